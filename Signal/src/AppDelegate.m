@@ -31,6 +31,7 @@
 #import <SignalMessaging/VersionMigrations.h>
 #import <SignalServiceKit/NSUserDefaults+OWS.h>
 #import <SignalServiceKit/OWSBatchMessageProcessor.h>
+#import <SignalServiceKit/OWSCompactSerializer.h>
 #import <SignalServiceKit/OWSDisappearingMessagesJob.h>
 #import <SignalServiceKit/OWSFailedAttachmentDownloadsJob.h>
 #import <SignalServiceKit/OWSFailedMessagesJob.h>
@@ -38,6 +39,7 @@
 #import <SignalServiceKit/OWSMessageSender.h>
 #import <SignalServiceKit/OWSOrphanedDataCleaner.h>
 #import <SignalServiceKit/OWSReadReceiptManager.h>
+#import <SignalServiceKit/OWSWriteCoalescer.h>
 #import <SignalServiceKit/TSAccountManager.h>
 #import <SignalServiceKit/TSDatabaseView.h>
 #import <SignalServiceKit/TSPreKeyManager.h>
@@ -54,6 +56,15 @@ static NSString *const kInitialViewControllerIdentifier = @"UserInitialViewContr
 static NSString *const kURLSchemeSGNLKey                = @"sgnl";
 static NSString *const kURLHostVerifyPrefix             = @"verify";
 
+#ifdef DEBUG
+// How long each window of incremental orphan cleanup may run.
+static const NSTimeInterval kOrphanCleanupLaunchTimeBudget = 2.f;
+static const NSTimeInterval kOrphanCleanupBackgroundTimeBudget = 10.f;
+#endif
+
+// How long each launch may spend re-encoding legacy rows in the compact format.
+static const NSTimeInterval kCompactSerializerMigrationTimeBudget = 2.f;
+
 @interface AppDelegate ()
 
 @property (nonatomic) UIWindow *screenProtectionWindow;
@@ -70,6 +81,21 @@ static NSString *const kURLHostVerifyPrefix             = @"verify";
 - (void)applicationDidEnterBackground:(UIApplication *)application {
     DDLogWarn(@"%@ applicationDidEnterBackground.", self.logTag);
 
+    if (self.isEnvironmentSetup) {
+        // Don't leave coalesced writes waiting while we're suspended.
+        [[TSStorageManager dbWriteCoalescer] flushAndWait];
+    }
+
+#ifdef DEBUG
+    if (self.isEnvironmentSetup) {
+        __block OWSBackgroundTask *backgroundTask = [OWSBackgroundTask backgroundTaskWithLabelStr:__PRETTY_FUNCTION__];
+        [OWSOrphanedDataCleaner cleanupIncrementallyWithTimeBudget:kOrphanCleanupBackgroundTimeBudget
+                                                        completion:^(OWSOrphanedDataCleanerReport *report) {
+                                                            backgroundTask = nil;
+                                                        }];
+    }
+#endif
+
     [DDLog flushLog];
 }
 
@@ -88,6 +114,10 @@ static NSString *const kURLHostVerifyPrefix             = @"verify";
 {
     DDLogWarn(@"%@ applicationWillTerminate.", self.logTag);
 
+    if (self.isEnvironmentSetup) {
+        [[TSStorageManager dbWriteCoalescer] flushAndWait];
+    }
+
     [DDLog flushLog];
 }
 
@@ -757,12 +787,15 @@ static NSString *const kURLHostVerifyPrefix             = @"verify";
     // run it in DEBUG builds for a few releases.
     //
     // TODO: Release to production once we have analytics.
-    // TODO: Orphan cleanup is somewhat expensive - not least in doing a bunch
-    //       of disk access.  We might want to only run it "once per version"
-    //       or something like that in production.
-    [OWSOrphanedDataCleaner auditAndCleanupAsync:nil];
+    //
+    // Orphan cleanup is incremental: each window advances a persisted pass
+    // by a few seconds' worth of work, so it never holds up launch.
+    [OWSOrphanedDataCleaner cleanupIncrementallyWithTimeBudget:kOrphanCleanupLaunchTimeBudget completion:nil];
 #endif
 
+    [OWSCompactSerializer migrateLegacyRowsIncrementallyWithTimeBudget:kCompactSerializerMigrationTimeBudget
+                                                            completion:nil];
+
     [OWSProfileManager.sharedManager fetchLocalUsersProfile];
     [[OWSReadReceiptManager sharedManager] prepareCachedValues];
 
@@ -823,6 +856,11 @@ static NSString *const kURLHostVerifyPrefix             = @"verify";
     }
 
     [AppUpdateNag.sharedInstance showAppUpgradeNagIfNecessary];
+
+    // Wait for the first screen to render.
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [OWSStorage runDeferredRegistrations];
+    });
 }
 
 @end
@@ -3,6 +3,7 @@
 //
 
 #import "ConversationViewCell.h"
+#import "ConversationViewItem.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -12,6 +13,17 @@ extern const CGFloat OWSMessageCellCornerRadius;
 
 + (NSString *)cellReuseIdentifier;
 
+// The size of a message's bubble(s), i.e. its cell size without the date header,
+// footer or failed send badge.  displayableText should be nil if the message
+// has no text.
+//
+// Unlike cellSizeForViewWidth:contentWidth:, this is safe to call off the main thread.
++ (CGSize)bodySizeForCellType:(OWSMessageCellType)cellType
+              displayableText:(nullable DisplayableText *)displayableText
+                    mediaSize:(CGSize)mediaSize
+                   isIncoming:(BOOL)isIncoming
+                 contentWidth:(int)contentWidth;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -295,11 +295,16 @@ const CGFloat OWSMessageCellCornerRadius = 17;
 }
 
 - (UIFont *)textMessageFont
+{
+    return [OWSMessageCell textMessageFontForDisplayableText:self.displayableText];
+}
+
++ (UIFont *)textMessageFontForDisplayableText:(DisplayableText *)displayableText
 {
     OWSAssert(DisplayableText.kMaxJumbomojiCount == 5);
 
     CGFloat basePointSize = [UIFont ows_dynamicTypeBodyFont].pointSize;
-    switch (self.displayableText.jumbomojiCount) {
+    switch (displayableText.jumbomojiCount) {
         case 0:
             break;
         case 1:
@@ -311,7 +316,7 @@ const CGFloat OWSMessageCellCornerRadius = 17;
         case 5:
             return [UIFont ows_regularFontWithSize:basePointSize + 6.f];
         default:
-            OWSFail(@"%@ Unexpected jumbomoji count: %zd", self.logTag, self.displayableText.jumbomojiCount);
+            OWSFail(@"%@ Unexpected jumbomoji count: %zd", self.logTag, displayableText.jumbomojiCount);
             break;
     }
 
@@ -319,11 +324,21 @@ const CGFloat OWSMessageCellCornerRadius = 17;
 }
 
 - (UIFont *)tapForMoreFont
+{
+    return [OWSMessageCell tapForMoreFont];
+}
+
++ (UIFont *)tapForMoreFont
 {
     return [UIFont ows_regularFontWithSize:12.f];
 }
 
 - (CGFloat)tapForMoreHeight
+{
+    return [OWSMessageCell tapForMoreHeight];
+}
+
++ (CGFloat)tapForMoreHeight
 {
     return (CGFloat)ceil([self tapForMoreFont].lineHeight * 1.25);
 }
@@ -523,6 +538,49 @@ const CGFloat OWSMessageCellCornerRadius = 17;
     return cellMedia;
 }
 
+// Still images and video frames are displayed using thumbnails, which are loaded
+// asynchronously so that decoding never happens on the main thread while scrolling.
+- (void)tryToLoadCellThumbnailIntoImageView:(UIImageView *)imageView
+{
+    OWSAssert(self.attachmentStream);
+    OWSAssert(imageView);
+
+    if (self.viewItem.didCellMediaFailToLoad) {
+        return;
+    }
+
+    TSAttachmentStream *attachmentStream = self.attachmentStream;
+    UIImage *_Nullable cachedThumbnail = [attachmentStream cachedThumbnailWithSize:OWSThumbnailSizeLarge];
+    if (cachedThumbnail) {
+        imageView.image = cachedThumbnail;
+        return;
+    }
+
+    ConversationViewItem *viewItem = self.viewItem;
+    [attachmentStream thumbnailWithSize:OWSThumbnailSizeLarge
+        success:^(UIImage *image) {
+            OWSAssertIsOnMainThread();
+
+            // The cell may have been reused or scrolled offscreen in the meantime.
+            if (self.viewItem != viewItem || !self.isCellVisible) {
+                return;
+            }
+            imageView.image = image;
+        }
+        failure:^{
+            OWSAssertIsOnMainThread();
+
+            DDLogError(@"%@ Failed to load cell thumbnail: %@", self.logTag, [attachmentStream mediaURL]);
+            viewItem.didCellMediaFailToLoad = YES;
+            if (self.viewItem != viewItem) {
+                return;
+            }
+            [imageView removeFromSuperview];
+            // TODO: We need to hide/remove the media view.
+            [self showAttachmentErrorView];
+        }];
+}
+
 // We want to lazy-load expensive view contents and eagerly unload if the
 // cell is no longer visible.
 - (void)ensureViewMediaState
@@ -542,12 +600,8 @@ const CGFloat OWSMessageCellCornerRadius = 17;
             if (self.stillImageView.image) {
                 return;
             }
-            self.stillImageView.image = [self tryToLoadCellMedia:^{
-                OWSAssert([self.attachmentStream isImage]);
-                return self.attachmentStream.image;
-            }
-                                                       mediaView:self.stillImageView
-                                                        cacheKey:self.attachmentStream.uniqueId];
+            OWSAssert([self.attachmentStream isImage]);
+            [self tryToLoadCellThumbnailIntoImageView:self.stillImageView];
             break;
         }
         case OWSMessageCellType_AnimatedImage: {
@@ -572,13 +626,8 @@ const CGFloat OWSMessageCellCornerRadius = 17;
             if (self.stillImageView.image) {
                 return;
             }
-            self.stillImageView.image = [self tryToLoadCellMedia:^{
-                OWSAssert([self.attachmentStream isVideo]);
-
-                return self.attachmentStream.image;
-            }
-                                                       mediaView:self.stillImageView
-                                                        cacheKey:self.attachmentStream.uniqueId];
+            OWSAssert([self.attachmentStream isVideo]);
+            [self tryToLoadCellThumbnailIntoImageView:self.stillImageView];
             break;
         }
         case OWSMessageCellType_TextMessage:
@@ -1010,30 +1059,61 @@ const CGFloat OWSMessageCellCornerRadius = 17;
         return CGSizeZero;
     }
 
-    BOOL isRTL = self.isRTL;
-    CGFloat leftMargin = isRTL ? self.textTrailingMargin : self.textLeadingMargin;
-    CGFloat rightMargin = isRTL ? self.textLeadingMargin : self.textTrailingMargin;
+    return [OWSMessageCell textBubbleSizeForDisplayableText:self.displayableText
+                                                 isIncoming:self.isIncoming
+                                               contentWidth:contentWidth];
+}
+
++ (CGSize)textBubbleSizeForDisplayableText:(DisplayableText *)displayableText
+                                isIncoming:(BOOL)isIncoming
+                              contentWidth:(int)contentWidth
+{
+    OWSAssert(displayableText);
+
+    // The margins are swapped for RTL, which doesn't affect their sum.
+    CGFloat hMargins = [self textLeadingMarginIsIncoming:isIncoming] + [self textTrailingMarginIsIncoming:isIncoming];
     CGFloat textVMargin = self.textVMargin;
 
     const int maxMessageWidth = [self maxMessageWidthForContentWidth:contentWidth];
-    const int maxTextWidth = (int)floor(maxMessageWidth - (leftMargin + rightMargin));
-
-    self.textView.text = self.displayableText.displayText;
-    // Honor dynamic type in the message bodies.
-    self.textView.font = [self textMessageFont];
-    CGSize textSize = [self.textView sizeThatFits:CGSizeMake(maxTextWidth, CGFLOAT_MAX)];
-    CGFloat tapForMoreHeight = (self.displayableText.isTextTruncated ? [self tapForMoreHeight] : 0.f);
-    CGSize textViewSize = CGSizeMake((CGFloat)ceil(textSize.width + leftMargin + rightMargin),
+    const int maxTextWidth = (int)floor(maxMessageWidth - hMargins);
+
+    // Lay out the text the way our (non-scrolling, zero-inset) UITextView would,
+    // but without a view so that this is safe off the main thread.
+    NSTextStorage *textStorage = [[NSTextStorage alloc]
+        initWithString:displayableText.displayText
+            attributes:@{
+                // Honor dynamic type in the message bodies.
+                NSFontAttributeName : [self textMessageFontForDisplayableText:displayableText],
+            }];
+    NSLayoutManager *layoutManager = [NSLayoutManager new];
+    NSTextContainer *textContainer = [[NSTextContainer alloc] initWithSize:CGSizeMake(maxTextWidth, CGFLOAT_MAX)];
+    [layoutManager addTextContainer:textContainer];
+    [textStorage addLayoutManager:layoutManager];
+    [layoutManager ensureLayoutForTextContainer:textContainer];
+    // Includes the text container's line fragment padding.
+    CGSize textSize = [layoutManager usedRectForTextContainer:textContainer].size;
+
+    CGFloat tapForMoreHeight = (displayableText.isTextTruncated ? [self tapForMoreHeight] : 0.f);
+    CGSize textViewSize = CGSizeMake((CGFloat)ceil(textSize.width + hMargins),
         (CGFloat)ceil(textSize.height + textVMargin * 2 + tapForMoreHeight));
 
     return textViewSize;
 }
 
 - (CGSize)mediaBubbleSizeForContentWidth:(int)contentWidth
+{
+    return [OWSMessageCell mediaBubbleSizeForCellType:self.cellType
+                                            mediaSize:self.viewItem.mediaSize
+                                         contentWidth:contentWidth];
+}
+
++ (CGSize)mediaBubbleSizeForCellType:(OWSMessageCellType)cellType
+                           mediaSize:(CGSize)mediaSize
+                        contentWidth:(int)contentWidth
 {
     const int maxMessageWidth = [self maxMessageWidthForContentWidth:contentWidth];
 
-    switch (self.cellType) {
+    switch (cellType) {
         case OWSMessageCellType_Unknown:
         case OWSMessageCellType_TextMessage:
         case OWSMessageCellType_OversizeTextMessage: {
@@ -1042,14 +1122,14 @@ const CGFloat OWSMessageCellCornerRadius = 17;
         case OWSMessageCellType_StillImage:
         case OWSMessageCellType_AnimatedImage:
         case OWSMessageCellType_Video: {
-            OWSAssert(self.mediaSize.width > 0);
-            OWSAssert(self.mediaSize.height > 0);
+            OWSAssert(mediaSize.width > 0);
+            OWSAssert(mediaSize.height > 0);
 
             // TODO: Adjust this behavior.
             // TODO: This behavior is a bit different than the old behavior defined
             //       in JSQMediaItem+OWS.h.  Let's discuss.
 
-            CGFloat contentAspectRatio = self.mediaSize.width / self.mediaSize.height;
+            CGFloat contentAspectRatio = mediaSize.width / mediaSize.height;
             // Clamp the aspect ratio so that very thin/wide content is presented
             // in a reasonable way.
             const CGFloat minAspectRatio = 0.25f;
@@ -1075,22 +1155,34 @@ const CGFloat OWSMessageCellCornerRadius = 17;
     }
 }
 
-- (int)maxMessageWidthForContentWidth:(int)contentWidth
++ (int)maxMessageWidthForContentWidth:(int)contentWidth
 {
     return (int)floor(contentWidth * 0.8f);
 }
 
++ (CGSize)bodySizeForCellType:(OWSMessageCellType)cellType
+              displayableText:(nullable DisplayableText *)displayableText
+                    mediaSize:(CGSize)mediaSize
+                   isIncoming:(BOOL)isIncoming
+                 contentWidth:(int)contentWidth
+{
+    CGSize mediaContentSize = [self mediaBubbleSizeForCellType:cellType mediaSize:mediaSize contentWidth:contentWidth];
+    CGSize textContentSize = (displayableText ? [self textBubbleSizeForDisplayableText:displayableText
+                                                                            isIncoming:isIncoming
+                                                                          contentWidth:contentWidth]
+                                              : CGSizeZero);
+
+    CGFloat cellContentWidth = fmax(mediaContentSize.width, textContentSize.width);
+    CGFloat cellContentHeight = mediaContentSize.height + textContentSize.height;
+    return CGSizeMake(cellContentWidth, cellContentHeight);
+}
+
 - (CGSize)cellSizeForViewWidth:(int)viewWidth contentWidth:(int)contentWidth
 {
     OWSAssert(self.viewItem);
     OWSAssert([self.viewItem.interaction isKindOfClass:[TSMessage class]]);
 
-    CGSize mediaContentSize = [self mediaBubbleSizeForContentWidth:contentWidth];
-    CGSize textContentSize = [self textBubbleSizeForContentWidth:contentWidth];
-
-    CGFloat cellContentWidth = fmax(mediaContentSize.width, textContentSize.width);
-    CGFloat cellContentHeight = mediaContentSize.height + textContentSize.height;
-    CGSize cellSize = CGSizeMake(cellContentWidth, cellContentHeight);
+    CGSize cellSize = [self.viewItem bodySizeForContentWidth:contentWidth];
 
     OWSAssert(cellSize.width > 0 && cellSize.height > 0);
 
@@ -1129,15 +1221,30 @@ const CGFloat OWSMessageCellCornerRadius = 17;
 
 - (CGFloat)textLeadingMargin
 {
-    return self.isIncoming ? 15 : 10;
+    return [OWSMessageCell textLeadingMarginIsIncoming:self.isIncoming];
+}
+
++ (CGFloat)textLeadingMarginIsIncoming:(BOOL)isIncoming
+{
+    return isIncoming ? 15 : 10;
 }
 
 - (CGFloat)textTrailingMargin
 {
-    return self.isIncoming ? 10 : 15;
+    return [OWSMessageCell textTrailingMarginIsIncoming:self.isIncoming];
+}
+
++ (CGFloat)textTrailingMarginIsIncoming:(BOOL)isIncoming
+{
+    return isIncoming ? 10 : 15;
 }
 
 - (CGFloat)textVMargin
+{
+    return [OWSMessageCell textVMargin];
+}
+
++ (CGFloat)textVMargin
 {
     return 10;
 }
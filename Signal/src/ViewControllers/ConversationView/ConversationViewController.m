@@ -82,6 +82,7 @@
 #import <SignalServiceKit/OWSMessageSender.h>
 #import <SignalServiceKit/OWSReadReceiptManager.h>
 #import <SignalServiceKit/OWSVerificationStateChangeMessage.h>
+#import <SignalServiceKit/OWSWriteCoalescer.h>
 #import <SignalServiceKit/SignalRecipient.h>
 #import <SignalServiceKit/TSAccountManager.h>
 #import <SignalServiceKit/TSGroupModel.h>
@@ -2843,14 +2844,17 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
     // We need to reload any modified interactions _before_ we call
     // reloadViewItems.
     BOOL hasDeletions = NO;
+    NSMutableArray<ConversationViewItem *> *updatedViewItems = [NSMutableArray new];
     for (YapDatabaseViewRowChange *rowChange in rowChanges) {
         switch (rowChange.type) {
             case YapDatabaseViewChangeUpdate: {
                 YapCollectionKey *collectionKey = rowChange.collectionKey;
                 OWSAssert(collectionKey.key.length > 0);
-                if (collectionKey.key) {
-                    ConversationViewItem *viewItem = self.viewItemCache[collectionKey.key];
-                    [self reloadInteractionForViewItem:viewItem];
+                ConversationViewItem *_Nullable viewItem
+                    = (collectionKey.key ? self.viewItemCache[collectionKey.key] : nil);
+                OWSAssert(viewItem);
+                if (viewItem) {
+                    [updatedViewItems addObject:viewItem];
                 }
                 break;
             }
@@ -2869,8 +2873,14 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
         }
     }
 
+    [self reloadInteractionsForViewItems:updatedViewItems];
+
     NSUInteger oldViewItemCount = self.viewItems.count;
-    NSMutableSet<NSNumber *> *rowsThatChangedSize = [[self reloadViewItems] mutableCopy];
+    NSSet<NSNumber *> *_Nullable changedRows = [self reloadViewItemsWithRowChanges:rowChanges];
+    if (!changedRows) {
+        changedRows = [self reloadViewItems];
+    }
+    NSMutableSet<NSNumber *> *rowsThatChangedSize = [changedRows mutableCopy];
 
     BOOL wasAtBottom = [self isScrolledToBottom];
     // We want sending messages to feel snappy.  So, if the only
@@ -3514,7 +3524,7 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
         __block TSThread *thread = _thread;
         __block NSString *currentDraft = [self.inputToolbar messageText];
 
-        [self.editingDatabaseConnection asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
             [thread setDraft:currentDraft transaction:transaction];
         }];
     }
@@ -3523,7 +3533,7 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
 - (void)clearDraft
 {
     __block TSThread *thread = _thread;
-    [self.editingDatabaseConnection asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+    [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
         [thread setDraft:@"" transaction:transaction];
     }];
 }
@@ -3860,6 +3870,11 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
     return (self.showLoadMoreHeader ? kLoadMoreHeaderHeight : 0.f);
 }
 
+- (void)prepareLayoutItemsForContentWidth:(int)contentWidth
+{
+    [ConversationViewItem ensureBodySizesForViewItems:self.viewItems contentWidth:contentWidth];
+}
+
 #pragma mark - ConversationInputToolbarDelegate
 
 - (void)sendButtonPressed
@@ -4144,116 +4159,275 @@ typedef NS_ENUM(NSInteger, MessagesRangeSizeMode) {
         }
     }];
 
-    NSMutableSet<NSNumber *> *rowsThatChangedSize = [NSMutableSet new];
+    NSSet<NSNumber *> *rowsThatChangedSize = [self updateDateAndStatusOfViewItems:viewItems rows:nil];
+
+    self.viewItems = viewItems;
+    self.viewItemCache = viewItemCache;
+
+    return rowsThatChangedSize;
+}
+
+// Applies row changes to the existing view items, so that only the inserted
+// interactions are read from the database and only the view items near the
+// changes have their date and status re-evaluated.
+//
+// Any updated interactions should already have been reloaded.
+//
+// Returns nil if the row changes can't be reconciled with the view items,
+// in which case they should be reloaded with reloadViewItems.
+- (nullable NSSet<NSNumber *> *)reloadViewItemsWithRowChanges:(NSArray<YapDatabaseViewRowChange *> *)rowChanges
+{
+    OWSAssertIsOnMainThread();
 
-    // Update the "shouldShowDate" property of the view items.
-    BOOL shouldShowDateOnNextViewItem = YES;
-    uint64_t previousViewItemTimestamp = 0;
-    for (ConversationViewItem *viewItem in viewItems) {
-        BOOL canShowDate = NO;
-        switch (viewItem.interaction.interactionType) {
-            case OWSInteractionType_Unknown:
-            case OWSInteractionType_UnreadIndicator:
-            case OWSInteractionType_Offer:
-                canShowDate = NO;
+    NSArray<ConversationViewItem *> *oldViewItems = self.viewItems;
+    for (ConversationViewItem *viewItem in oldViewItems) {
+        viewItem.previousRow = viewItem.row;
+    }
+
+    // As with UICollectionView batch updates, removals are specified in terms of the
+    // original rows and insertions in terms of the final rows.  Moves are both.
+    NSMutableIndexSet *removedRows = [NSMutableIndexSet new];
+    NSMutableArray<YapDatabaseViewRowChange *> *insertions = [NSMutableArray new];
+    NSMutableSet<NSString *> *updatedKeys = [NSMutableSet new];
+    for (YapDatabaseViewRowChange *rowChange in rowChanges) {
+        switch (rowChange.type) {
+            case YapDatabaseViewChangeDelete:
+            case YapDatabaseViewChangeMove: {
+                if (rowChange.originalIndex >= oldViewItems.count
+                    || ![oldViewItems[rowChange.originalIndex].interaction.uniqueId
+                           isEqualToString:rowChange.collectionKey.key]) {
+                    DDLogWarn(@"%@ Row change doesn't match view items.", self.logTag);
+                    return nil;
+                }
+                [removedRows addIndex:rowChange.originalIndex];
+                if (rowChange.type == YapDatabaseViewChangeMove) {
+                    [insertions addObject:rowChange];
+                }
+                break;
+            }
+            case YapDatabaseViewChangeInsert:
+                [insertions addObject:rowChange];
                 break;
-            case OWSInteractionType_IncomingMessage:
-            case OWSInteractionType_OutgoingMessage:
-            case OWSInteractionType_Error:
-            case OWSInteractionType_Info:
-            case OWSInteractionType_Call:
-                canShowDate = YES;
+            case YapDatabaseViewChangeUpdate:
+                if (rowChange.collectionKey.key) {
+                    [updatedKeys addObject:rowChange.collectionKey.key];
+                }
                 break;
         }
+    }
+    [insertions sortUsingComparator:^NSComparisonResult(YapDatabaseViewRowChange *left, YapDatabaseViewRowChange *right) {
+        return [@(left.finalIndex) compare:@(right.finalIndex)];
+    }];
 
-        BOOL shouldShowDate = NO;
-        if (!canShowDate) {
-            shouldShowDate = NO;
-            shouldShowDateOnNextViewItem = YES;
-        } else if (shouldShowDateOnNextViewItem) {
-            shouldShowDate = YES;
-            shouldShowDateOnNextViewItem = NO;
-        } else {
-            uint64_t viewItemTimestamp = viewItem.interaction.timestampForSorting;
-            OWSAssert(viewItemTimestamp > 0);
-            OWSAssert(previousViewItemTimestamp > 0);
-            uint64_t timeDifferenceMs = viewItemTimestamp - previousViewItemTimestamp;
-            static const uint64_t kShowTimeIntervalMs = 5 * kMinuteInMs;
-            if (timeDifferenceMs > kShowTimeIntervalMs) {
-                shouldShowDate = YES;
+    NSMutableArray<ConversationViewItem *> *viewItems = [oldViewItems mutableCopy];
+    [viewItems removeObjectsAtIndexes:removedRows];
+
+    __block BOOL isConsistent = YES;
+    BOOL isGroupThread = self.isGroupConversation;
+    [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        YapDatabaseViewTransaction *viewTransaction = [transaction ext:TSMessageDatabaseViewExtensionName];
+        OWSAssert(viewTransaction);
+        for (YapDatabaseViewRowChange *rowChange in insertions) {
+            if (rowChange.finalIndex > viewItems.count) {
+                isConsistent = NO;
+                return;
             }
-            shouldShowDateOnNextViewItem = NO;
-        }
 
-        // If this is an existing view item and it has changed size,
-        // note that so that we can reload this cell while doing
-        // incremental updates.
-        if (viewItem.shouldShowDate != shouldShowDate && viewItem.previousRow != NSNotFound) {
-            [rowsThatChangedSize addObject:@(viewItem.previousRow)];
+            ConversationViewItem *_Nullable viewItem;
+            if (rowChange.type == YapDatabaseViewChangeMove) {
+                viewItem = oldViewItems[rowChange.originalIndex];
+            } else {
+                TSInteraction *_Nullable interaction =
+                    [viewTransaction objectAtRow:rowChange.finalIndex inSection:0 withMappings:self.messageMappings];
+                if (!interaction || ![interaction.uniqueId isEqualToString:rowChange.collectionKey.key]) {
+                    isConsistent = NO;
+                    return;
+                }
+                viewItem = self.viewItemCache[interaction.uniqueId];
+                if (viewItem) {
+                    viewItem.previousRow = viewItem.row;
+                } else {
+                    viewItem = [[ConversationViewItem alloc] initWithInteraction:interaction
+                                                                   isGroupThread:isGroupThread
+                                                                     transaction:transaction];
+                }
+            }
+            [viewItems insertObject:viewItem atIndex:rowChange.finalIndex];
         }
-        viewItem.shouldShowDate = shouldShowDate;
+    }];
+    if (!isConsistent || viewItems.count != [self.messageMappings numberOfItemsInSection:0]) {
+        DDLogWarn(@"%@ Row changes don't match view items.", self.logTag);
+        return nil;
+    }
 
-        previousViewItemTimestamp = viewItem.interaction.timestampForSorting;
+    NSMutableDictionary<NSString *, ConversationViewItem *> *viewItemCache = [NSMutableDictionary new];
+    for (NSUInteger row = 0; row < viewItems.count; row++) {
+        ConversationViewItem *viewItem = viewItems[row];
+        viewItem.row = (NSInteger)row;
+        viewItemCache[viewItem.interaction.uniqueId] = viewItem;
+    }
+
+    // A view item's date depends on the view item before it and its status depends
+    // on the view item after it, so we only need to re-evaluate the view items which
+    // are new, updated, or have new neighbors, and their neighbors.
+    NSMutableIndexSet *rowsToUpdate = [NSMutableIndexSet new];
+    NSInteger lastOldRow = (NSInteger)oldViewItems.count - 1;
+    for (NSUInteger row = 0; row < viewItems.count; row++) {
+        ConversationViewItem *viewItem = viewItems[row];
+        NSInteger previousRow = viewItem.previousRow;
+
+        BOOL hasChanged;
+        if (previousRow == NSNotFound || [updatedKeys containsObject:viewItem.interaction.uniqueId]) {
+            hasChanged = YES;
+        } else {
+            BOOL hasNewPrecedingViewItem;
+            if (row > 0) {
+                NSInteger precedingRow = viewItems[row - 1].previousRow;
+                hasNewPrecedingViewItem = precedingRow == NSNotFound || precedingRow + 1 != previousRow;
+            } else {
+                hasNewPrecedingViewItem = previousRow != 0;
+            }
+            BOOL hasNewFollowingViewItem;
+            if (row + 1 < viewItems.count) {
+                hasNewFollowingViewItem = viewItems[row + 1].previousRow != previousRow + 1;
+            } else {
+                hasNewFollowingViewItem = previousRow != lastOldRow;
+            }
+            hasChanged = hasNewPrecedingViewItem || hasNewFollowingViewItem;
+        }
+        if (hasChanged) {
+            if (row > 0) {
+                [rowsToUpdate addIndex:row - 1];
+            }
+            [rowsToUpdate addIndex:row];
+            if (row + 1 < viewItems.count) {
+                [rowsToUpdate addIndex:row + 1];
+            }
+        }
     }
 
-    // Update the "shouldShowDate" property of the view items.
-    OWSInteractionType lastInteractionType = OWSInteractionType_Unknown;
-    MessageRecipientStatus lastRecipientStatus = MessageRecipientStatusUploading;
-    for (ConversationViewItem *viewItem in viewItems.reverseObjectEnumerator) {
-        BOOL shouldHideRecipientStatus = NO;
-        OWSInteractionType interactionType = viewItem.interaction.interactionType;
+    NSSet<NSNumber *> *rowsThatChangedSize = [self updateDateAndStatusOfViewItems:viewItems rows:rowsToUpdate];
 
-        if (interactionType == OWSInteractionType_OutgoingMessage) {
-            TSOutgoingMessage *outgoingMessage = (TSOutgoingMessage *)viewItem.interaction;
-            MessageRecipientStatus recipientStatus =
-                [MessageRecipientStatusUtils recipientStatusWithOutgoingMessage:outgoingMessage];
+    self.viewItems = viewItems;
+    self.viewItemCache = viewItemCache;
 
-            if (outgoingMessage.messageState == TSOutgoingMessageStateUnsent) {
-                // always sow "failed to send" status
-                shouldHideRecipientStatus = NO;
-            } else {
-                shouldHideRecipientStatus
-                    = (interactionType == lastInteractionType && recipientStatus == lastRecipientStatus);
-            }
+    return rowsThatChangedSize;
+}
 
-            lastRecipientStatus = recipientStatus;
-        }
-        lastInteractionType = interactionType;
+// Updates the "shouldShowDate" and "shouldHideRecipientStatus" properties of the
+// view items in the given rows, or of all view items if rows is nil.
+//
+// Returns the previous rows of the existing view items which may have changed size.
+- (NSSet<NSNumber *> *)updateDateAndStatusOfViewItems:(NSArray<ConversationViewItem *> *)viewItems
+                                                 rows:(nullable NSIndexSet *)rows
+{
+    if (!rows) {
+        rows = [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, viewItems.count)];
+    }
+
+    NSMutableSet<NSNumber *> *rowsThatChangedSize = [NSMutableSet new];
+    [rows enumerateIndexesUsingBlock:^(NSUInteger row, BOOL *stop) {
+        ConversationViewItem *viewItem = viewItems[row];
+        ConversationViewItem *_Nullable previousViewItem = (row > 0 ? viewItems[row - 1] : nil);
+        ConversationViewItem *_Nullable nextViewItem = (row + 1 < viewItems.count ? viewItems[row + 1] : nil);
+
+        BOOL shouldShowDate = [self shouldShowDateForViewItem:viewItem previousViewItem:previousViewItem];
+        BOOL shouldHideRecipientStatus =
+            [self shouldHideRecipientStatusForViewItem:viewItem nextViewItem:nextViewItem];
 
         // If this is an existing view item and it has changed size,
         // note that so that we can reload this cell while doing
         // incremental updates.
-        if (viewItem.shouldHideRecipientStatus != shouldHideRecipientStatus && viewItem.previousRow != NSNotFound) {
+        if ((viewItem.shouldShowDate != shouldShowDate
+                || viewItem.shouldHideRecipientStatus != shouldHideRecipientStatus)
+            && viewItem.previousRow != NSNotFound) {
             [rowsThatChangedSize addObject:@(viewItem.previousRow)];
         }
+        viewItem.shouldShowDate = shouldShowDate;
         viewItem.shouldHideRecipientStatus = shouldHideRecipientStatus;
+    }];
+
+    return [rowsThatChangedSize copy];
+}
+
+- (BOOL)canShowDateForViewItem:(ConversationViewItem *)viewItem
+{
+    switch (viewItem.interaction.interactionType) {
+        case OWSInteractionType_Unknown:
+        case OWSInteractionType_UnreadIndicator:
+        case OWSInteractionType_Offer:
+            return NO;
+        case OWSInteractionType_IncomingMessage:
+        case OWSInteractionType_OutgoingMessage:
+        case OWSInteractionType_Error:
+        case OWSInteractionType_Info:
+        case OWSInteractionType_Call:
+            return YES;
     }
+}
 
-    self.viewItems = viewItems;
-    self.viewItemCache = viewItemCache;
+- (BOOL)shouldShowDateForViewItem:(ConversationViewItem *)viewItem
+                 previousViewItem:(nullable ConversationViewItem *)previousViewItem
+{
+    if (![self canShowDateForViewItem:viewItem]) {
+        return NO;
+    }
+    if (!previousViewItem || ![self canShowDateForViewItem:previousViewItem]) {
+        return YES;
+    }
 
-    return [rowsThatChangedSize copy];
+    uint64_t viewItemTimestamp = viewItem.interaction.timestampForSorting;
+    uint64_t previousViewItemTimestamp = previousViewItem.interaction.timestampForSorting;
+    OWSAssert(viewItemTimestamp > 0);
+    OWSAssert(previousViewItemTimestamp > 0);
+    uint64_t timeDifferenceMs = viewItemTimestamp - previousViewItemTimestamp;
+    static const uint64_t kShowTimeIntervalMs = 5 * kMinuteInMs;
+    return timeDifferenceMs > kShowTimeIntervalMs;
 }
 
-// Whenever an interaction is modified, we need to reload it from the DB
-// and update the corresponding view item.
-- (void)reloadInteractionForViewItem:(ConversationViewItem *)viewItem
+- (BOOL)shouldHideRecipientStatusForViewItem:(ConversationViewItem *)viewItem
+                                nextViewItem:(nullable ConversationViewItem *)nextViewItem
+{
+    if (viewItem.interaction.interactionType != OWSInteractionType_OutgoingMessage) {
+        return NO;
+    }
+
+    TSOutgoingMessage *outgoingMessage = (TSOutgoingMessage *)viewItem.interaction;
+    if (outgoingMessage.messageState == TSOutgoingMessageStateUnsent) {
+        // always sow "failed to send" status
+        return NO;
+    }
+    if (nextViewItem.interaction.interactionType != OWSInteractionType_OutgoingMessage) {
+        return NO;
+    }
+
+    TSOutgoingMessage *nextOutgoingMessage = (TSOutgoingMessage *)nextViewItem.interaction;
+    return ([MessageRecipientStatusUtils recipientStatusWithOutgoingMessage:outgoingMessage] ==
+        [MessageRecipientStatusUtils recipientStatusWithOutgoingMessage:nextOutgoingMessage]);
+}
+
+// Whenever interactions are modified, we need to reload them from the DB
+// and update the corresponding view items.
+//
+// Like the rest of the view item updates, this reads from the UI connection's
+// long-lived read transaction, so it sees the same snapshot as the mappings.
+- (void)reloadInteractionsForViewItems:(NSArray<ConversationViewItem *> *)viewItems
 {
     OWSAssertIsOnMainThread();
-    OWSAssert(viewItem);
 
-    // This should never happen, but don't crash in production if we have a bug.
-    if (!viewItem) {
+    if (viewItems.count < 1) {
         return;
     }
 
     [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
-        TSInteraction *_Nullable interaction =
-            [TSInteraction fetchObjectWithUniqueID:viewItem.interaction.uniqueId transaction:transaction];
-        if (!interaction) {
-            OWSFail(@"%@ could not reload interaction", self.logTag);
-        } else {
-            [viewItem replaceInteraction:interaction transaction:transaction];
+        for (ConversationViewItem *viewItem in viewItems) {
+            TSInteraction *_Nullable interaction =
+                [TSInteraction fetchObjectWithUniqueID:viewItem.interaction.uniqueId transaction:transaction];
+            if (!interaction) {
+                OWSFail(@"%@ could not reload interaction", self.logTag);
+            } else {
+                [viewItem replaceInteraction:interaction transaction:transaction];
+            }
         }
     }];
 }
@@ -67,6 +67,17 @@ NSString *NSStringForOWSMessageCellType(OWSMessageCellType cellType);
 
 - (void)clearCachedLayoutState;
 
+// The size of a message's bubble(s); see OWSMessageCell.
+//
+// Body sizes are cached by interaction, width and dynamic type size, and are
+// shared by all view items, so they survive clearCachedLayoutState and the
+// conversation view being dismissed.
+- (CGSize)bodySizeForContentWidth:(int)contentWidth;
+
+// Measures the bodies of any of these messages whose sizes aren't cached,
+// concurrently and off the main thread.  Returns once they've been measured.
++ (void)ensureBodySizesForViewItems:(NSArray<ConversationViewItem *> *)viewItems contentWidth:(int)contentWidth;
+
 #pragma mark - Audio Playback
 
 @property (nonatomic, weak) OWSAudioMessageView *lastAudioMessageView;
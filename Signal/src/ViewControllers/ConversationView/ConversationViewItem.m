@@ -146,6 +146,116 @@ NSString *NSStringForOWSMessageCellType(OWSMessageCellType cellType)
     return [self.cachedCellSize CGSizeValue];
 }
 
+#pragma mark - Body Sizes
+
++ (NSCache<NSString *, NSValue *> *)bodySizeCache
+{
+    static NSCache<NSString *, NSValue *> *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [NSCache new];
+        cache.countLimit = 2000;
+    });
+    return cache;
+}
+
+- (BOOL)hasBodySize
+{
+    switch (self.interaction.interactionType) {
+        case OWSInteractionType_IncomingMessage:
+        case OWSInteractionType_OutgoingMessage:
+            return YES;
+        case OWSInteractionType_Unknown:
+        case OWSInteractionType_Error:
+        case OWSInteractionType_Info:
+        case OWSInteractionType_Call:
+        case OWSInteractionType_UnreadIndicator:
+        case OWSInteractionType_Offer:
+            return NO;
+    }
+}
+
+- (NSString *)bodySizeCacheKeyForContentWidth:(int)contentWidth
+{
+    // The cell type and media size change when an attachment is downloaded.
+    return [NSString stringWithFormat:@"%@.%d.%@.%d.%f",
+                     self.interaction.uniqueId,
+                     (int)self.messageCellType,
+                     NSStringFromCGSize(self.mediaSize),
+                     contentWidth,
+                     [UIFont ows_dynamicTypeBodyFont].pointSize];
+}
+
+// Captures the view state needed to measure the body, so that the returned
+// block can be safely invoked off the main thread.
+- (CGSize (^)(void))bodySizeMeasurementForContentWidth:(int)contentWidth
+{
+    OWSAssertIsOnMainThread();
+
+    OWSMessageCellType cellType = self.messageCellType;
+    DisplayableText *_Nullable displayableText = (self.hasText ? self.displayableText : nil);
+    CGSize mediaSize = self.mediaSize;
+    BOOL isIncoming = self.interaction.interactionType == OWSInteractionType_IncomingMessage;
+    return ^{
+        return [OWSMessageCell bodySizeForCellType:cellType
+                                   displayableText:displayableText
+                                         mediaSize:mediaSize
+                                        isIncoming:isIncoming
+                                      contentWidth:contentWidth];
+    };
+}
+
+- (CGSize)bodySizeForContentWidth:(int)contentWidth
+{
+    OWSAssertIsOnMainThread();
+    OWSAssert(self.hasBodySize);
+
+    NSString *cacheKey = [self bodySizeCacheKeyForContentWidth:contentWidth];
+    NSValue *_Nullable bodySize = [ConversationViewItem.bodySizeCache objectForKey:cacheKey];
+    if (!bodySize) {
+        bodySize = [NSValue valueWithCGSize:[self bodySizeMeasurementForContentWidth:contentWidth]()];
+        [ConversationViewItem.bodySizeCache setObject:bodySize forKey:cacheKey];
+    }
+    return bodySize.CGSizeValue;
+}
+
++ (void)ensureBodySizesForViewItems:(NSArray<ConversationViewItem *> *)viewItems contentWidth:(int)contentWidth
+{
+    OWSAssertIsOnMainThread();
+
+    NSMutableArray<CGSize (^)(void)> *measurements = [NSMutableArray new];
+    NSMutableArray<NSString *> *cacheKeys = [NSMutableArray new];
+    for (ConversationViewItem *viewItem in viewItems) {
+        if (!viewItem.hasBodySize) {
+            continue;
+        }
+        NSString *cacheKey = [viewItem bodySizeCacheKeyForContentWidth:contentWidth];
+        if ([self.bodySizeCache objectForKey:cacheKey]) {
+            continue;
+        }
+        [measurements addObject:[viewItem bodySizeMeasurementForContentWidth:contentWidth]];
+        [cacheKeys addObject:cacheKey];
+    }
+    if (measurements.count < 1) {
+        return;
+    }
+
+    NSDate *startDate = [NSDate new];
+    // The view items' view state is gathered above, on the main thread; the
+    // workers only do the text layout.
+    NSCache<NSString *, NSValue *> *bodySizeCache = self.bodySizeCache;
+    dispatch_apply(measurements.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t i) {
+        CGSize bodySize = measurements[i]();
+        [bodySizeCache setObject:[NSValue valueWithCGSize:bodySize] forKey:cacheKeys[i]];
+    });
+    DDLogVerbose(@"%@ measured %zd message bodies in %.3fs.",
+        self.logTag,
+        measurements.count,
+        fabs([startDate timeIntervalSinceNow]));
+}
+
+#pragma mark -
+
 - (ConversationViewLayoutAlignment)layoutAlignment
 {
     switch (self.interaction.interactionType) {
@@ -28,6 +28,9 @@ typedef NS_ENUM(NSInteger, ConversationViewLayoutAlignment) {
 
 - (CGFloat)layoutHeaderHeight;
 
+// Invoked before the layout items are measured, so that they can be measured in bulk.
+- (void)prepareLayoutItemsForContentWidth:(int)contentWidth;
+
 @end
 
 #pragma mark -
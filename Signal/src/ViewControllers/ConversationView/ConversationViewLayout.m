@@ -91,6 +91,7 @@ NS_ASSUME_NONNULL_BEGIN
     const int contentWidth = (int)floor(viewWidth - 2 * hInset);
     self.contentWidth = contentWidth;
 
+    [self.delegate prepareLayoutItemsForContentWidth:contentWidth];
     NSArray<id<ConversationViewLayoutItem>> *layoutItems = self.delegate.layoutItems;
 
     CGFloat y = vInset + self.delegate.layoutHeaderHeight;
@@ -25,6 +25,7 @@
 #import <SignalServiceKit/NSDate+OWS.h>
 #import <SignalServiceKit/OWSBlockingManager.h>
 #import <SignalServiceKit/OWSMessageSender.h>
+#import <SignalServiceKit/OWSThreadInboxSummary.h>
 #import <SignalServiceKit/TSOutgoingMessage.h>
 #import <SignalServiceKit/Threading.h>
 #import <YapDatabase/YapDatabase.h>
@@ -41,6 +42,9 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
 @property (nonatomic) YapDatabaseConnection *editingDbConnection;
 @property (nonatomic) YapDatabaseConnection *uiDatabaseConnection;
 @property (nonatomic) YapDatabaseViewMappings *threadMappings;
+// Consistent with uiDatabaseConnection's long-lived read transaction, so that
+// cells can be configured without any database reads.
+@property (nonatomic) NSDictionary<NSString *, OWSThreadInboxSummary *> *inboxSummaries;
 @property (nonatomic) CellState viewingThreadsIn;
 @property (nonatomic) long inboxCount;
 @property (nonatomic) UISegmentedControl *segmentedControl;
@@ -110,6 +114,7 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
     _messageSender = [Environment current].messageSender;
     _blockingManager = [OWSBlockingManager sharedManager];
     _blockedPhoneNumberSet = [NSSet setWithArray:[_blockingManager blockedPhoneNumbers]];
+    _inboxSummaries = @{};
 
     // Ensure ExperienceUpgradeFinder has been initialized.
     [ExperienceUpgradeFinder sharedManager];
@@ -476,6 +481,7 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
         [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
             [self.threadMappings updateWithTransaction:transaction];
         }];
+        [self reloadInboxSummaries];
     }
 
     [[self tableView] reloadData];
@@ -599,8 +605,12 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
     OWSAssert(cell);
 
     TSThread *thread = [self threadForIndexPath:indexPath];
+    OWSThreadInboxSummary *_Nullable inboxSummary = (thread.uniqueId ? self.inboxSummaries[thread.uniqueId] : nil);
 
-    [cell configureWithThread:thread contactsManager:self.contactsManager blockedPhoneNumberSet:_blockedPhoneNumberSet];
+    [cell configureWithThread:thread
+                 inboxSummary:inboxSummary
+              contactsManager:self.contactsManager
+        blockedPhoneNumberSet:_blockedPhoneNumberSet];
 
     if ((unsigned long)indexPath.row == [self.threadMappings numberOfItemsInSection:0] - 1) {
         cell.separatorInset = UIEdgeInsetsMake(0.f, cell.bounds.size.width, 0.f, 0.f);
@@ -953,6 +963,9 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
         [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
             [self.self.threadMappings updateWithTransaction:transaction];
         }];
+        if ([self updateInboxSummariesWithNotifications:notifications rowChanges:@[]]) {
+            [self.tableView reloadData];
+        }
         return;
     }
 
@@ -974,7 +987,13 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
     [self updateInboxCountLabel];
     [self checkIfEmptyView];
 
+    // Update the summaries before any rows are reloaded.
+    BOOL didUpdateInboxSummaries = [self updateInboxSummariesWithNotifications:notifications rowChanges:rowChanges];
+
     if ([sectionChanges count] == 0 && [rowChanges count] == 0) {
+        if (didUpdateInboxSummaries) {
+            [self.tableView reloadData];
+        }
         return;
     }
 
@@ -1030,6 +1049,90 @@ typedef NS_ENUM(NSInteger, CellState) { kArchiveState, kInboxState };
     [self.tableView endUpdates];
 }
 
+#pragma mark - Inbox Summaries
+
+- (void)reloadInboxSummaries
+{
+    OWSAssertIsOnMainThread();
+
+    [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        NSMutableArray<NSString *> *threadIds = [NSMutableArray new];
+        [[transaction ext:TSThreadDatabaseViewExtensionName]
+            enumerateKeysInGroup:self.currentGrouping
+                      usingBlock:^(NSString *collection, NSString *key, NSUInteger index, BOOL *stop) {
+                          [threadIds addObject:key];
+                      }];
+        self.inboxSummaries = [OWSThreadInboxSummary summariesForThreadIds:threadIds transaction:transaction];
+    }];
+}
+
+// Returns YES IFF any summaries changed.
+- (BOOL)updateInboxSummariesWithNotifications:(NSArray *)notifications
+                                   rowChanges:(NSArray<YapDatabaseViewRowChange *> *)rowChanges
+{
+    OWSAssertIsOnMainThread();
+
+    NSString *collection = [OWSThreadInboxSummary collection];
+    if (![self.uiDatabaseConnection hasChangeForCollection:collection inNotifications:notifications]) {
+        return NO;
+    }
+
+    // Summaries are keyed by thread id.  Consider every changed summary, not just those
+    // of the threads we already have, so that we pick up summaries which are written
+    // after a thread is first displayed, e.g. by a migration.
+    NSMutableSet<NSString *> *_Nullable threadIds = [self changedKeysInCollection:collection
+                                                                  notifications:notifications];
+    if (!threadIds) {
+        [self reloadInboxSummaries];
+        return YES;
+    }
+    for (YapDatabaseViewRowChange *rowChange in rowChanges) {
+        if (rowChange.type == YapDatabaseViewChangeInsert && !self.inboxSummaries[rowChange.collectionKey.key]) {
+            [threadIds addObject:rowChange.collectionKey.key];
+        }
+    }
+    if (threadIds.count < 1) {
+        return NO;
+    }
+
+    NSMutableDictionary<NSString *, OWSThreadInboxSummary *> *inboxSummaries = [self.inboxSummaries mutableCopy];
+    [inboxSummaries removeObjectsForKeys:threadIds.allObjects];
+    [self.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [inboxSummaries addEntriesFromDictionary:[OWSThreadInboxSummary summariesForThreadIds:threadIds.allObjects
+                                                                                   transaction:transaction]];
+    }];
+    self.inboxSummaries = [inboxSummaries copy];
+
+    return YES;
+}
+
+// Returns the keys in the collection which were modified or removed by the
+// transactions of the given notifications, or nil if they can't be determined,
+// e.g. if the database was modified by another process.
+- (nullable NSMutableSet<NSString *> *)changedKeysInCollection:(NSString *)collection
+                                                 notifications:(NSArray<NSNotification *> *)notifications
+{
+    NSMutableSet<NSString *> *keys = [NSMutableSet new];
+    for (NSNotification *notification in notifications) {
+        NSDictionary *changeset = notification.userInfo;
+        if ([changeset[YapDatabaseModifiedExternallyKey] boolValue] ||
+            [changeset[YapDatabaseAllKeysRemovedKey] boolValue] ||
+            [changeset[YapDatabaseRemovedCollectionsKey] containsObject:collection]) {
+            return nil;
+        }
+        for (NSString *changesKey in
+            @[ YapDatabaseObjectChangesKey, YapDatabaseMetadataChangesKey, YapDatabaseRemovedKeysKey ]) {
+            id<NSFastEnumeration> _Nullable collectionKeys = changeset[changesKey];
+            for (YapCollectionKey *collectionKey in collectionKeys) {
+                if ([collectionKey.collection isEqualToString:collection]) {
+                    [keys addObject:collectionKey.key];
+                }
+            }
+        }
+    }
+    return keys;
+}
+
 - (void)checkIfEmptyView
 {
     [_tableView setHidden:NO];
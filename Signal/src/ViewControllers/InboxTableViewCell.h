@@ -4,8 +4,9 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
-@class TSThread;
 @class OWSContactsManager;
+@class OWSThreadInboxSummary;
+@class TSThread;
 
 @interface InboxTableViewCell : UITableViewCell
 
@@ -13,7 +14,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 + (NSString *)cellReuseIdentifier;
 
+// If present, inboxSummary is used to configure the cell without any database reads.
 - (void)configureWithThread:(TSThread *)thread
+               inboxSummary:(nullable OWSThreadInboxSummary *)inboxSummary
             contactsManager:(OWSContactsManager *)contactsManager
       blockedPhoneNumberSet:(NSSet<NSString *> *)blockedPhoneNumberSet;
 
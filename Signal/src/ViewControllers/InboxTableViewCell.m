@@ -9,6 +9,7 @@
 #import <SignalMessaging/OWSFormat.h>
 #import <SignalMessaging/OWSUserProfile.h>
 #import <SignalServiceKit/OWSMessageManager.h>
+#import <SignalServiceKit/OWSThreadInboxSummary.h>
 #import <SignalServiceKit/TSContactThread.h>
 #import <SignalServiceKit/TSGroupThread.h>
 #import <SignalServiceKit/TSThread.h>
@@ -152,6 +153,7 @@ const NSUInteger kAvatarViewDiameter = 52;
 }
 
 - (void)configureWithThread:(TSThread *)thread
+               inboxSummary:(nullable OWSThreadInboxSummary *)inboxSummary
             contactsManager:(OWSContactsManager *)contactsManager
       blockedPhoneNumberSet:(NSSet<NSString *> *)blockedPhoneNumberSet
 {
@@ -162,6 +164,20 @@ const NSUInteger kAvatarViewDiameter = 52;
 
     self.thread = thread;
     self.contactsManager = contactsManager;
+
+    BOOL hasUnreadMessages;
+    NSString *lastMessageLabel;
+    NSUInteger unreadCount;
+    if (inboxSummary) {
+        hasUnreadMessages = inboxSummary.hasUnreadMessages;
+        lastMessageLabel = inboxSummary.snippet;
+        unreadCount = inboxSummary.unreadCount;
+    } else {
+        // The summary may not have been built yet; see OWS107BuildThreadInboxSummaries.
+        hasUnreadMessages = thread.hasUnreadMessages;
+        lastMessageLabel = thread.lastMessageLabel;
+        unreadCount = [[OWSMessageManager sharedManager] unreadMessagesInThread:thread];
+    }
     
     BOOL isBlocked = NO;
     if (!thread.isGroupThread) {
@@ -184,28 +200,27 @@ const NSUInteger kAvatarViewDiameter = 52;
                                                  initWithString:@"\ue067  "
                                                  attributes:@{
                                                               NSFontAttributeName : [UIFont ows_elegantIconsFont:9.f],
-                                                              NSForegroundColorAttributeName : (thread.hasUnreadMessages
+                                                              NSForegroundColorAttributeName : (hasUnreadMessages
                                                                                                 ? [UIColor colorWithWhite:0.1f alpha:1.f]
                                                                                                 : [UIColor lightGrayColor]),
                                                               }]];
         }
-        NSString *displayableText = [DisplayableText displayableText:thread.lastMessageLabel];
+        NSString *displayableText = [DisplayableText displayableText:lastMessageLabel];
         if (displayableText) {
             [snippetText appendAttributedString:[[NSAttributedString alloc]
                                                     initWithString:displayableText
                                                         attributes:@{
-                                                            NSFontAttributeName : (thread.hasUnreadMessages
+                                                            NSFontAttributeName : (hasUnreadMessages
                                                                     ? [UIFont ows_mediumFontWithSize:12]
                                                                     : [UIFont ows_regularFontWithSize:12]),
                                                             NSForegroundColorAttributeName :
-                                                                (thread.hasUnreadMessages ? [UIColor ows_blackColor]
+                                                                (hasUnreadMessages ? [UIColor ows_blackColor]
                                                                                           : [UIColor lightGrayColor]),
                                                         }]];
         }
     }
 
     NSAttributedString *attributedDate = [self dateAttributedString:thread.lastMessageDate];
-    NSUInteger unreadCount = [[OWSMessageManager sharedManager] unreadMessagesInThread:thread];
 
 
     [[NSNotificationCenter defaultCenter] addObserver:self
@@ -220,7 +235,7 @@ const NSUInteger kAvatarViewDiameter = 52;
 
     self.separatorInset = UIEdgeInsetsMake(0, self.avatarSize * 1.5f, 0, 0);
 
-    _timeLabel.textColor = thread.hasUnreadMessages ? [UIColor ows_materialBlueColor] : [UIColor ows_darkGrayColor];
+    _timeLabel.textColor = hasUnreadMessages ? [UIColor ows_materialBlueColor] : [UIColor ows_darkGrayColor];
 
     if (unreadCount > 0) {
         self.unreadBadge.hidden = NO;
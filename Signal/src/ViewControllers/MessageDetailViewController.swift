@@ -578,7 +578,10 @@ class MessageDetailViewController: OWSViewController, UIScrollViewDelegate, Medi
             Logger.error("\(TAG) Attachment missing data source.")
             return
         }
-        let data = dataSource.data()
+        guard let data = dataSource.mappedData() else {
+            Logger.error("\(TAG) Could not read attachment data.")
+            return
+        }
         UIPasteboard.general.setData(data, forPasteboardType: utiType)
     }
 
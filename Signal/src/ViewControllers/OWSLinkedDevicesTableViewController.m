@@ -70,6 +70,11 @@ int const OWSLinkedDevicesTableViewControllerSectionAddDevice = 1;
                                              selector:@selector(yapDatabaseModifiedExternally:)
                                                  name:YapDatabaseModifiedExternallyNotification
                                                object:nil];
+    // The secondary devices view is registered after launch, so it may not exist yet.
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(storageDeferredRegistrationsComplete:)
+                                                 name:StorageDeferredRegistrationsCompleteNotification
+                                               object:nil];
 
     self.refreshControl = [UIRefreshControl new];
     [self.refreshControl addTarget:self action:@selector(refreshDevices) forControlEvents:UIControlEventValueChanged];
@@ -207,6 +212,21 @@ int const OWSLinkedDevicesTableViewControllerSectionAddDevice = 1;
     // External database modifications can't be converted into incremental updates,
     // so rebuild everything.  This is expensive and usually isn't necessary, but
     // there's no alternative.
+    [self resetMappings];
+}
+
+- (void)storageDeferredRegistrationsComplete:(NSNotification *)notification
+{
+    OWSAssertIsOnMainThread();
+
+    // Our mappings were empty if they were built before the view was registered.
+    [self resetMappings];
+}
+
+- (void)resetMappings
+{
+    OWSAssertIsOnMainThread();
+
     [self.dbConnection beginLongLivedReadTransaction];
     [self.dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
         [self.deviceMappings updateWithTransaction:transaction];
@@ -31,8 +31,8 @@ typedef NS_ENUM(NSUInteger, OWSBackupState) {
 // large backups, to prevent the app from being killed on launch.
 // Therefore, we break up backup import/restoration into two parts:
 //
-// * Preparation (which includes the costly decryption/unzip of the
-//   backup file)
+// * Preparation (which includes the costly decryption/decompression of
+//   the backup file, streamed directly into a staging directory)
 // * Completion (file moves, NSUserDefaults writes, keychain writes).
 //
 // To protect data during backup and restore, we:
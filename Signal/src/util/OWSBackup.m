@@ -6,8 +6,8 @@
 #import "NSUserDefaults+OWS.h"
 #import "Signal-Swift.h"
 #import "zlib.h"
+#import <CommonCrypto/CommonKeyDerivation.h>
 #import <SAMKeychain/SAMKeychain.h>
-#import <SSZipArchive/SSZipArchive.h>
 #import <SignalMessaging/SignalMessaging-Swift.h>
 #import <SignalServiceKit/Cryptography.h>
 #import <SignalServiceKit/OWSFileSystem.h>
@@ -42,9 +42,656 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
 
 @end
 
+#pragma mark - Archive
+
+// A backup archive is a short header followed by a sequence of frames.
+//
+// Each frame is compressed and sealed with AES-GCM independently, so that
+// frames can be compressed and encrypted (or decrypted and decompressed)
+// in parallel while the archive is written (or read) in a single streaming
+// pass, without staging copies of the backed up files on disk.
+//
+// Frames carry a sequence number so that they can't be reordered, and the
+// archive ends with an explicit "end" frame so that truncation is detected.
+static const char kOWSBackupArchiveMagic[] = "SignalBackup";
+static const uint8_t kOWSBackupArchiveVersion = 1;
+// The amount of file data in each data frame.
+static const NSUInteger kOWSBackupArchiveChunkSize = 512 * 1024;
+// Bounds how much data is buffered for each parallel batch of frames.
+static const NSUInteger kOWSBackupArchiveMaxBatchBytes = 8 * 1024 * 1024;
+static const NSUInteger kOWSBackupArchiveMaxBatchFrames = 256;
+static const NSUInteger kOWSBackupArchiveSaltLength = 16;
+static const uint32_t kOWSBackupArchiveKeyDerivationRounds = 100000;
+// AES-GCM initialization vector and authentication tag.
+static const NSUInteger kOWSBackupArchiveSealOverhead = 12 + 16;
+// Sequence number, frame type, compression flag and uncompressed length.
+static const NSUInteger kOWSBackupArchiveMaxFrameHeaderLength = 8 + 1 + 1 + 4;
+
+typedef NS_ENUM(uint8_t, OWSBackupArchiveKeyMode) {
+    // The archive key is stored in the header, i.e. the backup has no password.
+    OWSBackupArchiveKeyMode_Embedded = 0,
+    // The archive key is derived from the backup password.
+    OWSBackupArchiveKeyMode_Password = 1,
+};
+
+typedef NS_ENUM(uint8_t, OWSBackupArchiveFrameType) {
+    // The payload is the UTF-8 relative path of the entry.
+    OWSBackupArchiveFrameType_EntryBegin = 1,
+    // The payload is the next chunk of the entry's contents.
+    OWSBackupArchiveFrameType_EntryData = 2,
+    OWSBackupArchiveFrameType_EntryEnd = 3,
+    OWSBackupArchiveFrameType_ArchiveEnd = 4,
+};
+
+static BOOL OWSBackupWriteBytes(NSOutputStream *stream, const void *bytes, NSUInteger length)
+{
+    NSUInteger offset = 0;
+    while (offset < length) {
+        NSInteger bytesWritten = [stream write:(const uint8_t *)bytes + offset maxLength:length - offset];
+        if (bytesWritten <= 0) {
+            return NO;
+        }
+        offset += (NSUInteger)bytesWritten;
+    }
+    return YES;
+}
+
+// Returns the number of bytes read, which is less than length only at the
+// end of the stream or on error.
+static NSUInteger OWSBackupReadBytes(NSInputStream *stream, void *bytes, NSUInteger length)
+{
+    NSUInteger offset = 0;
+    while (offset < length) {
+        NSInteger bytesRead = [stream read:(uint8_t *)bytes + offset maxLength:length - offset];
+        if (bytesRead <= 0) {
+            break;
+        }
+        offset += (NSUInteger)bytesRead;
+    }
+    return offset;
+}
+
+static OWSAES256Key *_Nullable OWSBackupArchiveKeyForPassword(NSString *password, NSData *salt, uint32_t rounds)
+{
+    NSData *passwordData = [password dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *keyData = [NSMutableData dataWithLength:kAES256_KeyByteLength];
+    int result = CCKeyDerivationPBKDF(kCCPBKDF2,
+        passwordData.bytes,
+        passwordData.length,
+        salt.bytes,
+        salt.length,
+        kCCPRFHmacAlgSHA256,
+        rounds,
+        keyData.mutableBytes,
+        keyData.length);
+    if (result != kCCSuccess) {
+        OWSCFail(@"Could not derive backup key: %d", result);
+        return nil;
+    }
+    return [OWSAES256Key keyWithData:keyData];
+}
+
+#pragma mark -
+
+@interface OWSBackupArchiveFrame : NSObject
+
+@property (nonatomic) uint64_t sequenceNumber;
+@property (nonatomic) OWSBackupArchiveFrameType frameType;
+@property (nonatomic) NSData *payload;
+
+@property (nonatomic, nullable) NSData *sealedData;
+
+@end
+
+#pragma mark -
+
+@implementation OWSBackupArchiveFrame
+
+// Compresses (data frames only) and encrypts the payload into sealedData.
+- (BOOL)sealWithKey:(OWSAES256Key *)key
+{
+    NSMutableData *plaintext = [NSMutableData dataWithCapacity:kOWSBackupArchiveMaxFrameHeaderLength + self.payload.length];
+    uint64_t sequenceNumber = OSSwapHostToLittleInt64(self.sequenceNumber);
+    [plaintext appendBytes:&sequenceNumber length:sizeof(sequenceNumber)];
+    uint8_t frameType = self.frameType;
+    [plaintext appendBytes:&frameType length:sizeof(frameType)];
+
+    if (self.frameType == OWSBackupArchiveFrameType_EntryData) {
+        uLongf compressedLength = compressBound(self.payload.length);
+        NSMutableData *compressedData = [NSMutableData dataWithLength:compressedLength];
+        int result = compress2(compressedData.mutableBytes,
+            &compressedLength,
+            self.payload.bytes,
+            self.payload.length,
+            Z_DEFAULT_COMPRESSION);
+        // Media is usually already compressed; in that case we store it as is.
+        uint8_t isCompressed = (result == Z_OK && compressedLength < self.payload.length);
+        [plaintext appendBytes:&isCompressed length:sizeof(isCompressed)];
+        uint32_t uncompressedLength = OSSwapHostToLittleInt32((uint32_t)self.payload.length);
+        [plaintext appendBytes:&uncompressedLength length:sizeof(uncompressedLength)];
+        if (isCompressed) {
+            [plaintext appendBytes:compressedData.bytes length:compressedLength];
+        } else {
+            [plaintext appendData:self.payload];
+        }
+    } else {
+        [plaintext appendData:self.payload];
+    }
+
+    self.sealedData = [Cryptography encryptAESGCMWithData:plaintext key:key];
+    return self.sealedData != nil;
+}
+
+// Decrypts and decompresses sealedData.
+- (BOOL)openWithKey:(OWSAES256Key *)key
+{
+    NSData *_Nullable sealedData = self.sealedData;
+    if (sealedData.length <= kOWSBackupArchiveSealOverhead) {
+        return NO;
+    }
+    NSData *_Nullable plaintext = [Cryptography decryptAESGCMWithData:sealedData key:key];
+    if (plaintext.length < sizeof(uint64_t) + sizeof(uint8_t)) {
+        return NO;
+    }
+    const uint8_t *bytes = plaintext.bytes;
+    uint64_t sequenceNumber;
+    memcpy(&sequenceNumber, bytes, sizeof(sequenceNumber));
+    self.sequenceNumber = OSSwapLittleToHostInt64(sequenceNumber);
+    self.frameType = (OWSBackupArchiveFrameType)bytes[sizeof(sequenceNumber)];
+
+    NSUInteger offset = sizeof(uint64_t) + sizeof(uint8_t);
+    if (self.frameType != OWSBackupArchiveFrameType_EntryData) {
+        self.payload = [plaintext subdataWithRange:NSMakeRange(offset, plaintext.length - offset)];
+        return YES;
+    }
+
+    if (plaintext.length < offset + sizeof(uint8_t) + sizeof(uint32_t)) {
+        return NO;
+    }
+    BOOL isCompressed = bytes[offset] != 0;
+    offset += sizeof(uint8_t);
+    uint32_t uncompressedLength;
+    memcpy(&uncompressedLength, bytes + offset, sizeof(uncompressedLength));
+    uncompressedLength = OSSwapLittleToHostInt32(uncompressedLength);
+    offset += sizeof(uint32_t);
+    if (uncompressedLength > kOWSBackupArchiveChunkSize) {
+        return NO;
+    }
+
+    NSData *body = [plaintext subdataWithRange:NSMakeRange(offset, plaintext.length - offset)];
+    if (!isCompressed) {
+        self.payload = body;
+        return body.length == uncompressedLength;
+    }
+    NSMutableData *payload = [NSMutableData dataWithLength:uncompressedLength];
+    uLongf payloadLength = uncompressedLength;
+    int result = uncompress(payload.mutableBytes, &payloadLength, body.bytes, body.length);
+    if (result != Z_OK || payloadLength != uncompressedLength) {
+        return NO;
+    }
+    self.payload = payload;
+    return YES;
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSBackupArchiveWriter : NSObject
+
+// Invoked on the writing thread with the number of bytes of entry data written so far.
+@property (nonatomic, nullable) void (^progressBlock)(unsigned long long bytesProcessed);
+@property (nonatomic, nullable) BOOL (^isCancelledBlock)(void);
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (nullable instancetype)initWithFilePath:(NSString *)filePath password:(nullable NSString *)password;
+
+- (BOOL)writeEntryWithData:(NSData *)data path:(NSString *)path;
+
+// Skips (and returns YES for) a file which no longer exists.
+- (BOOL)writeEntryWithFileAtPath:(NSString *)filePath path:(NSString *)path;
+
+- (BOOL)finish;
+
+@end
+
+#pragma mark -
+
+@interface OWSBackupArchiveWriter ()
+
+@property (nonatomic, readonly) NSOutputStream *outputStream;
+@property (nonatomic, readonly) OWSAES256Key *key;
+
+@property (nonatomic, readonly) NSMutableArray<OWSBackupArchiveFrame *> *pendingFrames;
+@property (nonatomic) NSUInteger pendingBytes;
+@property (nonatomic) uint64_t nextSequenceNumber;
+@property (nonatomic) unsigned long long bytesProcessed;
+
+@end
+
+#pragma mark -
+
+@implementation OWSBackupArchiveWriter
+
+- (nullable instancetype)initWithFilePath:(NSString *)filePath password:(nullable NSString *)password
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _pendingFrames = [NSMutableArray new];
+
+    _outputStream = [NSOutputStream outputStreamToFileAtPath:filePath append:NO];
+    [_outputStream open];
+    if (_outputStream.streamStatus != NSStreamStatusOpen) {
+        OWSFail(@"%@ Could not open archive: %@", self.logTag, _outputStream.streamError);
+        return nil;
+    }
+
+    NSMutableData *header = [NSMutableData new];
+    [header appendBytes:kOWSBackupArchiveMagic length:strlen(kOWSBackupArchiveMagic)];
+    [header appendBytes:&kOWSBackupArchiveVersion length:sizeof(kOWSBackupArchiveVersion)];
+    if (password.length > 0) {
+        NSData *salt = [Cryptography generateRandomBytes:kOWSBackupArchiveSaltLength];
+        OWSAES256Key *_Nullable key
+            = OWSBackupArchiveKeyForPassword(password, salt, kOWSBackupArchiveKeyDerivationRounds);
+        if (!key) {
+            return nil;
+        }
+        _key = key;
+
+        uint8_t keyMode = OWSBackupArchiveKeyMode_Password;
+        [header appendBytes:&keyMode length:sizeof(keyMode)];
+        [header appendData:salt];
+        uint32_t rounds = OSSwapHostToLittleInt32(kOWSBackupArchiveKeyDerivationRounds);
+        [header appendBytes:&rounds length:sizeof(rounds)];
+    } else {
+        _key = [OWSAES256Key generateRandomKey];
+
+        uint8_t keyMode = OWSBackupArchiveKeyMode_Embedded;
+        [header appendBytes:&keyMode length:sizeof(keyMode)];
+        [header appendData:_key.keyData];
+    }
+    if (!OWSBackupWriteBytes(_outputStream, header.bytes, header.length)) {
+        OWSFail(@"%@ Could not write archive header: %@", self.logTag, _outputStream.streamError);
+        return nil;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_outputStream close];
+}
+
+- (BOOL)writeEntryWithData:(NSData *)data path:(NSString *)path
+{
+    OWSAssert(data);
+    OWSAssert(path.length > 0);
+
+    if (![self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryBegin
+                            payload:[path dataUsingEncoding:NSUTF8StringEncoding]]) {
+        return NO;
+    }
+    for (NSUInteger offset = 0; offset < data.length; offset += kOWSBackupArchiveChunkSize) {
+        NSRange range = NSMakeRange(offset, MIN(kOWSBackupArchiveChunkSize, data.length - offset));
+        if (![self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryData payload:[data subdataWithRange:range]]) {
+            return NO;
+        }
+    }
+    return [self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryEnd payload:[NSData new]];
+}
+
+- (BOOL)writeEntryWithFileAtPath:(NSString *)filePath path:(NSString *)path
+{
+    OWSAssert(filePath.length > 0);
+    OWSAssert(path.length > 0);
+
+    NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:filePath];
+    [inputStream open];
+    if (inputStream.streamStatus != NSStreamStatusOpen) {
+        if (![[NSFileManager defaultManager] fileExistsAtPath:filePath]) {
+            // e.g. an attachment which was deleted after we listed the files.
+            DDLogWarn(@"%@ Skipping file which no longer exists: %@", self.logTag, filePath);
+            return YES;
+        }
+        OWSFail(@"%@ Could not open file: %@, %@", self.logTag, filePath, inputStream.streamError);
+        return NO;
+    }
+
+    BOOL success = [self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryBegin
+                                      payload:[path dataUsingEncoding:NSUTF8StringEncoding]];
+    while (success) {
+        NSMutableData *chunk = [NSMutableData dataWithLength:kOWSBackupArchiveChunkSize];
+        NSUInteger chunkLength = OWSBackupReadBytes(inputStream, chunk.mutableBytes, chunk.length);
+        if (inputStream.streamStatus == NSStreamStatusError) {
+            OWSFail(@"%@ Could not read file: %@, %@", self.logTag, filePath, inputStream.streamError);
+            success = NO;
+            break;
+        }
+        if (chunkLength == 0) {
+            break;
+        }
+        chunk.length = chunkLength;
+        success = [self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryData payload:chunk];
+        if (chunkLength < kOWSBackupArchiveChunkSize) {
+            break;
+        }
+    }
+    [inputStream close];
+
+    return success && [self enqueueFrameWithType:OWSBackupArchiveFrameType_EntryEnd payload:[NSData new]];
+}
+
+- (BOOL)finish
+{
+    if (![self enqueueFrameWithType:OWSBackupArchiveFrameType_ArchiveEnd payload:[NSData new]]) {
+        return NO;
+    }
+    if (![self flush]) {
+        return NO;
+    }
+    [self.outputStream close];
+    return YES;
+}
+
+- (BOOL)enqueueFrameWithType:(OWSBackupArchiveFrameType)frameType payload:(NSData *)payload
+{
+    OWSBackupArchiveFrame *frame = [OWSBackupArchiveFrame new];
+    frame.sequenceNumber = self.nextSequenceNumber++;
+    frame.frameType = frameType;
+    frame.payload = payload;
+    [self.pendingFrames addObject:frame];
+    self.pendingBytes += payload.length;
+
+    if (self.pendingBytes < kOWSBackupArchiveMaxBatchBytes && self.pendingFrames.count < kOWSBackupArchiveMaxBatchFrames) {
+        return YES;
+    }
+    return [self flush];
+}
+
+// Seals the pending frames in parallel, then writes them in order.
+- (BOOL)flush
+{
+    if (self.isCancelledBlock && self.isCancelledBlock()) {
+        return NO;
+    }
+
+    NSArray<OWSBackupArchiveFrame *> *frames = [self.pendingFrames copy];
+    [self.pendingFrames removeAllObjects];
+    self.pendingBytes = 0;
+
+    OWSAES256Key *key = self.key;
+    dispatch_apply(frames.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        [frames[index] sealWithKey:key];
+    });
+
+    for (OWSBackupArchiveFrame *frame in frames) {
+        NSData *_Nullable sealedData = frame.sealedData;
+        if (!sealedData) {
+            OWSFail(@"%@ Could not seal frame.", self.logTag);
+            return NO;
+        }
+        uint32_t sealedLength = OSSwapHostToLittleInt32((uint32_t)sealedData.length);
+        if (!OWSBackupWriteBytes(self.outputStream, &sealedLength, sizeof(sealedLength))
+            || !OWSBackupWriteBytes(self.outputStream, sealedData.bytes, sealedData.length)) {
+            OWSFail(@"%@ Could not write frame: %@", self.logTag, self.outputStream.streamError);
+            return NO;
+        }
+        if (frame.frameType == OWSBackupArchiveFrameType_EntryData) {
+            self.bytesProcessed += frame.payload.length;
+        }
+    }
+
+    if (self.progressBlock) {
+        self.progressBlock(self.bytesProcessed);
+    }
+    return YES;
+}
+
+@end
+
+#pragma mark -
+
+// Returns the stream to write an entry's contents to, or nil to abort.
+typedef NSOutputStream *_Nullable (^OWSBackupArchiveEntryBlock)(NSString *path);
+
+@interface OWSBackupArchiveReader : NSObject
+
+// Invoked on the reading thread with the number of bytes of the archive read so far.
+@property (nonatomic, nullable) void (^progressBlock)(unsigned long long bytesProcessed);
+@property (nonatomic, nullable) BOOL (^isCancelledBlock)(void);
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (nullable instancetype)initWithFilePath:(NSString *)filePath password:(nullable NSString *)password;
+
+- (BOOL)extractEntriesWithBlock:(OWSBackupArchiveEntryBlock)entryBlock;
+
+@end
+
+#pragma mark -
+
+@interface OWSBackupArchiveReader ()
+
+@property (nonatomic, readonly) NSInputStream *inputStream;
+@property (nonatomic, readonly) OWSAES256Key *key;
+
+@property (nonatomic) unsigned long long bytesProcessed;
+
+@end
+
+#pragma mark -
+
+@implementation OWSBackupArchiveReader
+
+- (nullable instancetype)initWithFilePath:(NSString *)filePath password:(nullable NSString *)password
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _inputStream = [NSInputStream inputStreamWithFileAtPath:filePath];
+    [_inputStream open];
+    if (_inputStream.streamStatus != NSStreamStatusOpen) {
+        OWSFail(@"%@ Could not open archive: %@", self.logTag, _inputStream.streamError);
+        return nil;
+    }
+
+    size_t magicLength = strlen(kOWSBackupArchiveMagic);
+    NSMutableData *magic = [NSMutableData dataWithLength:magicLength];
+    uint8_t version;
+    uint8_t keyMode;
+    if (OWSBackupReadBytes(_inputStream, magic.mutableBytes, magicLength) != magicLength
+        || memcmp(magic.bytes, kOWSBackupArchiveMagic, magicLength) != 0
+        || OWSBackupReadBytes(_inputStream, &version, sizeof(version)) != sizeof(version)
+        || version != kOWSBackupArchiveVersion
+        || OWSBackupReadBytes(_inputStream, &keyMode, sizeof(keyMode)) != sizeof(keyMode)) {
+        DDLogError(@"%@ Not a supported backup archive.", self.logTag);
+        return nil;
+    }
+    self.bytesProcessed = magicLength + sizeof(version) + sizeof(keyMode);
+
+    switch (keyMode) {
+        case OWSBackupArchiveKeyMode_Embedded: {
+            NSMutableData *keyData = [NSMutableData dataWithLength:kAES256_KeyByteLength];
+            if (OWSBackupReadBytes(_inputStream, keyData.mutableBytes, keyData.length) != keyData.length) {
+                DDLogError(@"%@ Could not read archive key.", self.logTag);
+                return nil;
+            }
+            _key = [OWSAES256Key keyWithData:keyData];
+            self.bytesProcessed += keyData.length;
+            break;
+        }
+        case OWSBackupArchiveKeyMode_Password: {
+            NSMutableData *salt = [NSMutableData dataWithLength:kOWSBackupArchiveSaltLength];
+            uint32_t rounds;
+            if (OWSBackupReadBytes(_inputStream, salt.mutableBytes, salt.length) != salt.length
+                || OWSBackupReadBytes(_inputStream, &rounds, sizeof(rounds)) != sizeof(rounds)) {
+                DDLogError(@"%@ Could not read archive salt.", self.logTag);
+                return nil;
+            }
+            rounds = OSSwapLittleToHostInt32(rounds);
+            if (password.length < 1 || rounds < 1 || rounds > 100 * kOWSBackupArchiveKeyDerivationRounds) {
+                DDLogError(@"%@ Missing password or invalid key derivation parameters.", self.logTag);
+                return nil;
+            }
+            _key = OWSBackupArchiveKeyForPassword(password, salt, rounds);
+            self.bytesProcessed += salt.length + sizeof(rounds);
+            break;
+        }
+        default:
+            DDLogError(@"%@ Unknown archive key mode: %d", self.logTag, (int)keyMode);
+            return nil;
+    }
+    if (!_key) {
+        return nil;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_inputStream close];
+}
+
+- (BOOL)isValidEntryPath:(NSString *)path
+{
+    if (path.length < 1 || path.isAbsolutePath) {
+        return NO;
+    }
+    for (NSString *component in path.pathComponents) {
+        if ([component isEqualToString:@".."]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+// Reads the next batch of sealed frames.  Returns nil on error.
+- (nullable NSArray<OWSBackupArchiveFrame *> *)readFrameBatch
+{
+    // A data frame can't grow by more than zlib's worst case.
+    const NSUInteger kMaxSealedFrameLength
+        = compressBound(kOWSBackupArchiveChunkSize) + kOWSBackupArchiveMaxFrameHeaderLength + kOWSBackupArchiveSealOverhead;
+
+    NSMutableArray<OWSBackupArchiveFrame *> *frames = [NSMutableArray new];
+    NSUInteger batchBytes = 0;
+    while (batchBytes < kOWSBackupArchiveMaxBatchBytes && frames.count < kOWSBackupArchiveMaxBatchFrames) {
+        uint32_t sealedLength;
+        NSUInteger bytesRead = OWSBackupReadBytes(self.inputStream, &sealedLength, sizeof(sealedLength));
+        if (bytesRead == 0 && self.inputStream.streamStatus != NSStreamStatusError) {
+            // End of archive.
+            break;
+        }
+        sealedLength = OSSwapLittleToHostInt32(sealedLength);
+        if (bytesRead != sizeof(sealedLength) || sealedLength > kMaxSealedFrameLength) {
+            DDLogError(@"%@ Invalid frame length.", self.logTag);
+            return nil;
+        }
+        NSMutableData *sealedData = [NSMutableData dataWithLength:sealedLength];
+        if (OWSBackupReadBytes(self.inputStream, sealedData.mutableBytes, sealedLength) != sealedLength) {
+            DDLogError(@"%@ Could not read frame: %@", self.logTag, self.inputStream.streamError);
+            return nil;
+        }
+
+        OWSBackupArchiveFrame *frame = [OWSBackupArchiveFrame new];
+        frame.sealedData = sealedData;
+        [frames addObject:frame];
+        batchBytes += sizeof(sealedLength) + sealedLength;
+    }
+    self.bytesProcessed += batchBytes;
+    return frames;
+}
+
+- (BOOL)extractEntriesWithBlock:(OWSBackupArchiveEntryBlock)entryBlock
+{
+    uint64_t nextSequenceNumber = 0;
+    NSOutputStream *_Nullable entryStream = nil;
+    BOOL isComplete = NO;
+    while (!isComplete) {
+        if (self.isCancelledBlock && self.isCancelledBlock()) {
+            [entryStream close];
+            return NO;
+        }
+
+        NSArray<OWSBackupArchiveFrame *> *_Nullable frames = [self readFrameBatch];
+        if (frames.count < 1) {
+            DDLogError(@"%@ Archive is truncated.", self.logTag);
+            [entryStream close];
+            return NO;
+        }
+
+        // Open the frames in parallel, then handle them in order.
+        OWSAES256Key *key = self.key;
+        __block BOOL didOpenAllFrames = YES;
+        dispatch_apply(frames.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+            if (![frames[index] openWithKey:key]) {
+                // Every failed frame writes the same value.
+                didOpenAllFrames = NO;
+            }
+        });
+        if (!didOpenAllFrames) {
+            // This is the expected failure if the password is wrong.
+            DDLogError(@"%@ Could not open frames.", self.logTag);
+            [entryStream close];
+            return NO;
+        }
+
+        for (OWSBackupArchiveFrame *frame in frames) {
+            BOOL isValidFrame = !isComplete && frame.sequenceNumber == nextSequenceNumber++;
+            switch (frame.frameType) {
+                case OWSBackupArchiveFrameType_EntryBegin: {
+                    NSString *_Nullable path = [[NSString alloc] initWithData:frame.payload encoding:NSUTF8StringEncoding];
+                    isValidFrame = isValidFrame && !entryStream && path && [self isValidEntryPath:path];
+                    if (isValidFrame) {
+                        entryStream = entryBlock(path);
+                        [entryStream open];
+                        isValidFrame = entryStream.streamStatus == NSStreamStatusOpen;
+                    }
+                    break;
+                }
+                case OWSBackupArchiveFrameType_EntryData:
+                    isValidFrame = isValidFrame && entryStream
+                        && OWSBackupWriteBytes(entryStream, frame.payload.bytes, frame.payload.length);
+                    break;
+                case OWSBackupArchiveFrameType_EntryEnd:
+                    isValidFrame = isValidFrame && entryStream;
+                    [entryStream close];
+                    entryStream = nil;
+                    break;
+                case OWSBackupArchiveFrameType_ArchiveEnd:
+                    isValidFrame = isValidFrame && !entryStream;
+                    isComplete = YES;
+                    break;
+                default:
+                    isValidFrame = NO;
+                    break;
+            }
+            if (!isValidFrame) {
+                DDLogError(@"%@ Unexpected frame: %llu, %d", self.logTag, frame.sequenceNumber, (int)frame.frameType);
+                [entryStream close];
+                return NO;
+            }
+        }
+
+        if (self.progressBlock) {
+            self.progressBlock(self.bytesProcessed);
+        }
+    }
+    return YES;
+}
+
+@end
+
 #pragma mark -
 
-@interface OWSBackup () <SSZipArchiveDelegate>
+@interface OWSBackup ()
 
 @property (nonatomic) OWSBackupState backupState;
 
@@ -164,7 +811,7 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     OWSAssertIsOnMainThread();
 
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        [self exportToFilesAndZip];
+        [self exportToArchive];
 
         dispatch_async(dispatch_get_main_queue(), ^{
             [self complete];
@@ -172,7 +819,7 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     });
 }
 
-- (void)exportToFilesAndZip
+- (void)exportToArchive
 {
     DDLogInfo(@"%@ %s.", self.logTag, __PRETTY_FUNCTION__);
 
@@ -182,7 +829,6 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     NSString *temporaryDirectory = NSTemporaryDirectory();
     NSString *rootDirName = [OWSBackup_DirNamePrefix stringByAppendingString:[NSUUID UUID].UUIDString];
     NSString *rootDirPath = [temporaryDirectory stringByAppendingPathComponent:rootDirName];
-    NSString *backupDirPath = [rootDirPath stringByAppendingPathComponent:@"Contents"];
 
     NSDateFormatter *dateFormatter = [NSDateFormatter new];
     [dateFormatter setLocale:[NSLocale currentLocale]];
@@ -195,30 +841,42 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
                   backupDateTime];
     NSString *backupZipPath =
         [rootDirPath stringByAppendingPathComponent:[backupName stringByAppendingString:OWSBackup_FileExtension]];
-    self.backupDirPath = backupDirPath;
+    self.backupDirPath = rootDirPath;
     self.backupZipPath = backupZipPath;
     DDLogInfo(@"%@ rootDirPath: %@", self.logTag, rootDirPath);
-    DDLogInfo(@"%@ backupDirPath: %@", self.logTag, backupDirPath);
     DDLogInfo(@"%@ backupZipPath: %@", self.logTag, backupZipPath);
 
     [OWSFileSystem ensureDirectoryExists:rootDirPath];
     [OWSFileSystem protectFileOrFolderAtPath:rootDirPath];
-    [OWSFileSystem ensureDirectoryExists:backupDirPath];
 
     if (self.isCancelledOrFailed) {
         return;
     }
 
+    OWSBackupArchiveWriter *_Nullable archiveWriter =
+        [[OWSBackupArchiveWriter alloc] initWithFilePath:backupZipPath password:self.backupPassword];
+    if (!archiveWriter) {
+        return [self fail];
+    }
+    // The files (and their total size) are listed below, while we hold the database lock.
+    __block unsigned long long totalFileSize = 0;
+    archiveWriter.progressBlock = ^(unsigned long long bytesProcessed) {
+        if (totalFileSize > 0) {
+            self.backupProgress = MIN(1.f, bytesProcessed / (CGFloat)totalFileSize);
+        }
+    };
+    archiveWriter.isCancelledBlock = ^{
+        return self.isCancelledOrFailed;
+    };
+
     OWSAES256Key *encryptionKey = [OWSAES256Key generateRandomKey];
     self.encryptionKey = encryptionKey;
 
     NSData *databasePassword = [TSStorageManager sharedManager].databasePassword;
 
-    // TODO: We don't want this to reside unencrypted on disk even temporarily.
-    // We need to encrypt this with a key that we hide in the keychain.
     if (![self writeData:databasePassword
                  fileName:OWSBackup_DatabasePasswordFilename
-            backupDirPath:backupDirPath
+            archiveWriter:archiveWriter
             encryptionKey:encryptionKey]) {
         return [self fail];
     }
@@ -227,7 +885,7 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     }
     if (![self writeUserDefaults:NSUserDefaults.standardUserDefaults
                         fileName:OWSBackup_StandardUserDefaultsFilename
-                   backupDirPath:backupDirPath
+                   archiveWriter:archiveWriter
                    encryptionKey:encryptionKey]) {
         return [self fail];
     }
@@ -236,54 +894,101 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     }
     if (![self writeUserDefaults:NSUserDefaults.appUserDefaults
                         fileName:OWSBackup_AppUserDefaultsFilename
-                   backupDirPath:backupDirPath
+                   archiveWriter:archiveWriter
                    encryptionKey:encryptionKey]) {
         return [self fail];
     }
     if (self.isCancelledOrFailed) {
         return;
     }
-    // Use a read/write transaction to acquire a file lock on the database files.
+
+    // Files are streamed straight from their current location into the archive.
+    //
+    // Use a read/write transaction to acquire a file lock on the database files,
+    // and list the files while we hold it, so that the listing is consistent with
+    // the database.  Only the database files need to be consistent with each other,
+    // so only they are written while we hold the lock.
     //
     // TODO: If we use multiple database files, lock them too.
+    NSMutableArray<NSString *> *srcFilePaths = [NSMutableArray new];
+    NSMutableArray<NSString *> *entryPaths = [NSMutableArray new];
+    NSMutableIndexSet *databaseFileIndices = [NSMutableIndexSet new];
     [TSStorageManager.sharedManager.newDatabaseConnection
         readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-            if (![self copyDirectory:OWSFileSystem.appDocumentDirectoryPath
-                          dstDirName:OWSBackup_AppDocumentDirName
-                       backupDirPath:backupDirPath]) {
+            if (![self findFilesInDirectory:OWSFileSystem.appDocumentDirectoryPath
+                                 dstDirName:OWSBackup_AppDocumentDirName
+                               srcFilePaths:srcFilePaths
+                                 entryPaths:entryPaths]) {
                 [self fail];
                 return;
             }
-            if (self.isCancelledOrFailed) {
-                return;
-            }
-            if (![self copyDirectory:OWSFileSystem.appSharedDataDirectoryPath
-                          dstDirName:OWSBackup_AppSharedDataDirName
-                       backupDirPath:backupDirPath]) {
+            if (![self findFilesInDirectory:OWSFileSystem.appSharedDataDirectoryPath
+                                 dstDirName:OWSBackup_AppSharedDataDirName
+                               srcFilePaths:srcFilePaths
+                                 entryPaths:entryPaths]) {
                 [self fail];
                 return;
             }
+            for (NSString *srcFilePath in srcFilePaths) {
+                totalFileSize += [[NSFileManager defaultManager] attributesOfItemAtPath:srcFilePath error:nil].fileSize;
+            }
+            DDLogInfo(@"%@ Backing up %zd files, %llu bytes.", self.logTag, srcFilePaths.count, totalFileSize);
+
+            NSString *databaseFilePath = TSStorageManager.databaseFilePath;
+            [srcFilePaths enumerateObjectsUsingBlock:^(NSString *srcFilePath, NSUInteger index, BOOL *stop) {
+                if ([srcFilePath.stringByStandardizingPath hasPrefix:databaseFilePath.stringByStandardizingPath]) {
+                    [databaseFileIndices addIndex:index];
+                }
+            }];
+            OWSAssert(databaseFileIndices.count > 0);
+
+            [databaseFileIndices enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+                if (![archiveWriter writeEntryWithFileAtPath:srcFilePaths[index] path:entryPaths[index]]) {
+                    [self fail];
+                    *stop = YES;
+                }
+            }];
         }];
     if (self.isCancelledOrFailed) {
         return;
     }
-    if (![self zipDirectory:backupDirPath dstFilePath:backupZipPath encryptionKey:encryptionKey]) {
+    for (NSUInteger index = 0; index < srcFilePaths.count; index++) {
+        if ([databaseFileIndices containsIndex:index]) {
+            continue;
+        }
+        if (![archiveWriter writeEntryWithFileAtPath:srcFilePaths[index] path:entryPaths[index]]) {
+            return [self fail];
+        }
+    }
+
+    // Write the encryption key directly into the archive so that it never
+    // resides in plaintext on disk.
+    if (![archiveWriter writeEntryWithData:encryptionKey.keyData path:OWSBackup_EncryptionKeyFilename]) {
+        return [self fail];
+    }
+    if (![archiveWriter finish]) {
         return [self fail];
     }
 
     [OWSFileSystem protectFileOrFolderAtPath:backupZipPath];
 
-    [OWSFileSystem deleteFileIfExists:self.backupDirPath];
+    NSError *error;
+    NSNumber *fileSize = [[NSFileManager defaultManager] attributesOfItemAtPath:backupZipPath error:&error][NSFileSize];
+    if (error) {
+        OWSFail(@"%@ failed to get archive file size: %@", self.logTag, error);
+        return [self fail];
+    }
+    DDLogInfo(@"%@ Archive file size: %@", self.logTag, fileSize);
 }
 
 - (BOOL)writeData:(NSData *)data
          fileName:(NSString *)fileName
-    backupDirPath:(NSString *)backupDirPath
+    archiveWriter:(OWSBackupArchiveWriter *)archiveWriter
     encryptionKey:(OWSAES256Key *)encryptionKey
 {
     OWSAssert(data);
     OWSAssert(fileName.length > 0);
-    OWSAssert(backupDirPath.length > 0);
+    OWSAssert(archiveWriter);
     OWSAssert(encryptionKey);
 
     NSData *_Nullable encryptedData = [Cryptography encryptAESGCMWithData:data key:encryptionKey];
@@ -292,33 +997,29 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
         return NO;
     }
 
-    NSString *filePath = [backupDirPath stringByAppendingPathComponent:fileName];
+    DDLogInfo(@"%@ writeData: %@", self.logTag, fileName);
 
-    DDLogInfo(@"%@ writeData: %@", self.logTag, filePath);
-
-    NSError *error;
-    BOOL success = [encryptedData writeToFile:filePath options:NSDataWritingAtomic error:&error];
-    if (!success || error) {
-        OWSFail(@"%@ failed to write user defaults: %@", self.logTag, error);
+    if (![archiveWriter writeEntryWithData:encryptedData path:fileName]) {
+        OWSFail(@"%@ failed to write data: %@", self.logTag, fileName);
         return NO;
     }
     return YES;
 }
 
-- (BOOL)copyDirectory:(NSString *)srcDirPath dstDirName:(NSString *)dstDirName backupDirPath:(NSString *)backupDirPath
+// Finds the files to back up in srcDirPath, and the paths of their archive entries.
+- (BOOL)findFilesInDirectory:(NSString *)srcDirPath
+                  dstDirName:(NSString *)dstDirName
+                srcFilePaths:(NSMutableArray<NSString *> *)srcFilePaths
+                  entryPaths:(NSMutableArray<NSString *> *)entryPaths
 {
     OWSAssert(srcDirPath.length > 0);
     OWSAssert(dstDirName.length > 0);
-    OWSAssert(backupDirPath.length > 0);
 
-    NSString *dstDirPath = [backupDirPath stringByAppendingPathComponent:dstDirName];
+    DDLogInfo(@"%@ findFilesInDirectory: %@ -> %@", self.logTag, srcDirPath, dstDirName);
 
-    DDLogInfo(@"%@ copyDirectory: %@ -> %@", self.logTag, srcDirPath, dstDirPath);
-
-    // We "manually" copy the "root" items in the src directory.
-    // Can't just use [NSFileManager copyItemAtPath:...] because the shared data container
+    // We "manually" list the "root" items in the src directory.
+    // Can't just list it recursively because the shared data container
     // contains files that the app is not allowed to access.
-    [OWSFileSystem ensureDirectoryExists:dstDirPath];
     NSError *error = nil;
     NSArray<NSString *> *fileNames = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:srcDirPath error:&error];
     if (error) {
@@ -327,15 +1028,24 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     }
     for (NSString *fileName in fileNames) {
         NSString *srcFilePath = [srcDirPath stringByAppendingPathComponent:fileName];
-        NSString *dstFilePath = [dstDirPath stringByAppendingPathComponent:fileName];
         if ([fileName hasPrefix:@"."]) {
             DDLogInfo(@"%@ ignoring: %@", self.logTag, srcFilePath);
             continue;
         }
-        BOOL success = [[NSFileManager defaultManager] copyItemAtPath:srcFilePath toPath:dstFilePath error:&error];
-        if (!success || error) {
-            OWSFail(@"%@ failed to copy directory item: %@, %@", self.logTag, srcFilePath, error);
-            return NO;
+        BOOL isDirectory;
+        [[NSFileManager defaultManager] fileExistsAtPath:srcFilePath isDirectory:&isDirectory];
+        NSArray<NSString *> *_Nullable itemFilePaths = @[ srcFilePath ];
+        if (isDirectory) {
+            itemFilePaths = [OWSFileSystem allFilesInDirectoryRecursive:srcFilePath error:&error];
+            if (!itemFilePaths || error) {
+                OWSFail(@"%@ failed to list directory item: %@, %@", self.logTag, srcFilePath, error);
+                return NO;
+            }
+        }
+        for (NSString *itemFilePath in itemFilePaths) {
+            NSString *relativePath = [self relativePathforPath:itemFilePath basePath:srcDirPath];
+            [srcFilePaths addObject:itemFilePath];
+            [entryPaths addObject:[dstDirName stringByAppendingPathComponent:relativePath]];
         }
     }
 
@@ -344,12 +1054,12 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
 
 - (BOOL)writeUserDefaults:(NSUserDefaults *)userDefaults
                  fileName:(NSString *)fileName
-            backupDirPath:(NSString *)backupDirPath
+            archiveWriter:(OWSBackupArchiveWriter *)archiveWriter
             encryptionKey:(OWSAES256Key *)encryptionKey
 {
     OWSAssert(userDefaults);
     OWSAssert(fileName.length > 0);
-    OWSAssert(backupDirPath.length > 0);
+    OWSAssert(archiveWriter);
     OWSAssert(encryptionKey);
 
     DDLogInfo(@"%@ writeUserDefaults: %@", self.logTag, fileName);
@@ -365,74 +1075,7 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
         return NO;
     }
 
-    return [self writeData:data fileName:fileName backupDirPath:backupDirPath encryptionKey:encryptionKey];
-}
-
-- (BOOL)zipDirectory:(NSString *)srcDirPath
-         dstFilePath:(NSString *)dstFilePath
-       encryptionKey:(OWSAES256Key *)encryptionKey
-{
-    OWSAssert(srcDirPath.length > 0);
-    OWSAssert(dstFilePath.length > 0);
-    OWSAssert(encryptionKey);
-
-    DDLogInfo(@"%@ %s.", self.logTag, __PRETTY_FUNCTION__);
-
-    srcDirPath = [srcDirPath stringByStandardizingPath];
-    OWSAssert(srcDirPath.length > 0);
-
-    NSError *error;
-    NSArray<NSString *> *_Nullable srcFilePaths = [OWSFileSystem allFilesInDirectoryRecursive:srcDirPath error:&error];
-    if (!srcFilePaths || error) {
-        OWSFail(@"%@ failed to find files to zip: %@", self.logTag, error);
-        return NO;
-    }
-
-    // Don't use the SSZipArchive convenience methods so that we can add the
-    // encryption key directly as data.
-    SSZipArchive *zipArchive = [[SSZipArchive alloc] initWithPath:dstFilePath];
-    if (![zipArchive open]) {
-        OWSFail(@"%@ failed to open zip file.", self.logTag);
-        return NO;
-    }
-    for (NSString *srcFilePath in srcFilePaths) {
-        NSString *relativePath = [self relativePathforPath:srcFilePath basePath:srcDirPath];
-        BOOL success = [zipArchive writeFileAtPath:srcFilePath
-                                      withFileName:relativePath
-                                  compressionLevel:Z_DEFAULT_COMPRESSION
-                                          password:self.backupPassword
-                                               AES:self.backupPassword != nil];
-        if (!success) {
-            OWSFail(@"%@ failed to write file to zip file.", self.logTag);
-            return NO;
-        }
-    }
-    // Write the encryption key directly into the zip so that it never
-    // resides in plaintext on disk.
-    BOOL success = [zipArchive writeData:encryptionKey.keyData
-                                filename:OWSBackup_EncryptionKeyFilename
-                        compressionLevel:Z_DEFAULT_COMPRESSION
-                                password:self.backupPassword
-                                     AES:self.backupPassword != nil];
-    if (!success) {
-        OWSFail(@"%@ failed to write file to zip file.", self.logTag);
-        return NO;
-    }
-
-
-    if (![zipArchive close]) {
-        OWSFail(@"%@ failed to close zip file.", self.logTag);
-        return NO;
-    }
-
-    NSNumber *fileSize = [[NSFileManager defaultManager] attributesOfItemAtPath:dstFilePath error:&error][NSFileSize];
-    if (error) {
-        OWSFail(@"%@ failed to get zip file size: %@", self.logTag, error);
-        return NO;
-    }
-    DDLogInfo(@"%@ Zip file size: %@", self.logTag, fileSize);
-
-    return YES;
+    return [self writeData:data fileName:fileName archiveWriter:archiveWriter encryptionKey:encryptionKey];
 }
 
 #pragma mark - Import Backup, Part 1
@@ -482,34 +1125,20 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     NSString *rootDirName = [OWSBackup_DirNamePrefix stringByAppendingString:[NSUUID UUID].UUIDString];
     NSString *rootDirPath = [documentDirectoryPath stringByAppendingPathComponent:rootDirName];
     NSString *backupDirPath = [rootDirPath stringByAppendingPathComponent:@"Contents"];
-    NSString *backupZipPath = [rootDirPath stringByAppendingPathComponent:srcZipPath.lastPathComponent];
     self.backupDirPath = backupDirPath;
-    self.backupZipPath = backupZipPath;
+    self.backupZipPath = srcZipPath;
     DDLogInfo(@"%@ rootDirPath: %@", self.logTag, rootDirPath);
     DDLogInfo(@"%@ backupDirPath: %@", self.logTag, backupDirPath);
-    DDLogInfo(@"%@ backupZipPath: %@", self.logTag, backupZipPath);
+    DDLogInfo(@"%@ backupZipPath: %@", self.logTag, srcZipPath);
 
     [OWSFileSystem ensureDirectoryExists:rootDirPath];
     [OWSFileSystem protectFileOrFolderAtPath:rootDirPath];
     [OWSFileSystem ensureDirectoryExists:backupDirPath];
 
-    NSError *error = nil;
-    BOOL success = [[NSFileManager defaultManager] copyItemAtPath:srcZipPath toPath:backupZipPath error:&error];
-    if (!success || error) {
-        OWSFail(@"%@ failed to copy backup zip: %@, %@", self.logTag, srcZipPath, error);
-        return [self fail];
-    }
-
     if (self.isCancelledOrFailed) {
         return;
     }
-    if (![self unzipFilePath]) {
-        return [self fail];
-    }
-    if (self.isCancelledOrFailed) {
-        return;
-    }
-    if (![self extractEncryptionKey]) {
+    if (![self extractArchive]) {
         return [self fail];
     }
     if (self.isCancelledOrFailed) {
@@ -526,16 +1155,49 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     }
 }
 
-- (BOOL)extractEncryptionKey
+// Streams the archive's entries directly into the backup directory,
+// from which they are moved into place by completeImportBackupIfPossible.
+- (BOOL)extractArchive
 {
+    OWSAssert(self.backupZipPath.length > 0);
+    OWSAssert(self.backupDirPath.length > 0);
+
     DDLogInfo(@"%@ %s.", self.logTag, __PRETTY_FUNCTION__);
 
-    NSString *encryptionKeyFilePath =
-        [self.backupDirPath stringByAppendingPathComponent:OWSBackup_EncryptionKeyFilename];
-    if (![[NSFileManager defaultManager] fileExistsAtPath:encryptionKeyFilePath]) {
+    OWSBackupArchiveReader *_Nullable archiveReader =
+        [[OWSBackupArchiveReader alloc] initWithFilePath:self.backupZipPath password:self.backupPassword];
+    if (!archiveReader) {
         return NO;
     }
-    NSData *_Nullable encryptionKeyData = [NSData dataWithContentsOfFile:encryptionKeyFilePath];
+    unsigned long long archiveFileSize =
+        [[NSFileManager defaultManager] attributesOfItemAtPath:self.backupZipPath error:nil].fileSize;
+    archiveReader.progressBlock = ^(unsigned long long bytesProcessed) {
+        self.backupProgress = (archiveFileSize > 0 ? MIN(1.f, bytesProcessed / (CGFloat)archiveFileSize) : 1.f);
+    };
+    archiveReader.isCancelledBlock = ^{
+        return self.isCancelledOrFailed;
+    };
+
+    NSString *backupDirPath = self.backupDirPath;
+    __block NSOutputStream *_Nullable encryptionKeyStream = nil;
+    BOOL success = [archiveReader extractEntriesWithBlock:^NSOutputStream *_Nullable(NSString *path) {
+        if ([path isEqualToString:OWSBackup_EncryptionKeyFilename]) {
+            // Never write the encryption key to disk.
+            encryptionKeyStream = [NSOutputStream outputStreamToMemory];
+            return encryptionKeyStream;
+        }
+        NSString *filePath = [backupDirPath stringByAppendingPathComponent:path];
+        if (![OWSFileSystem ensureDirectoryExists:filePath.stringByDeletingLastPathComponent]) {
+            return nil;
+        }
+        return [NSOutputStream outputStreamToFileAtPath:filePath append:NO];
+    }];
+    if (!success) {
+        DDLogError(@"%@ failed to extract archive.", self.logTag);
+        return NO;
+    }
+
+    NSData *_Nullable encryptionKeyData = [encryptionKeyStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
     if (!encryptionKeyData) {
         return NO;
     }
@@ -545,49 +1207,6 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     }
     self.encryptionKey = encryptionKey;
 
-    NSError *error = nil;
-    BOOL success = [[NSFileManager defaultManager] removeItemAtPath:encryptionKeyFilePath error:&error];
-    if (!success || error) {
-        OWSFail(@"%@ could not delete encryption key file: %@", self.logTag, error);
-        return NO;
-    }
-    return YES;
-}
-
-- (BOOL)unzipFilePath
-{
-    OWSAssert(self.backupZipPath.length > 0);
-    OWSAssert(self.backupDirPath.length > 0);
-
-    DDLogInfo(@"%@ %s.", self.logTag, __PRETTY_FUNCTION__);
-
-    // Don't use the SSZipArchive convenience methods so that we can add the
-    // encryption key directly as data.
-
-    // TODO: Should we use preserveAttributes?
-    NSError *error = nil;
-    BOOL success = [SSZipArchive unzipFileAtPath:self.backupZipPath
-        toDestination:self.backupDirPath
-        preserveAttributes:YES
-        overwrite:YES
-        nestedZipLevel:0
-        password:self.backupPassword
-        error:&error
-        delegate:self
-        progressHandler:^(NSString *entry, unz_file_info zipInfo, long entryNumber, long total) {
-            DDLogInfo(@"%@ progressHandler: %ld %ld", self.logTag, entryNumber, total);
-
-            CGFloat progress = entryNumber / (CGFloat)total;
-            self.backupProgress = progress;
-        }
-        completionHandler:^(NSString *path, BOOL succeeded, NSError *_Nullable completionError) {
-            DDLogInfo(@"%@ completionHandler: %d %@", self.logTag, succeeded, completionError);
-        }];
-    if (!success || error) {
-        OWSFail(@"%@ failed to unzip file: %@.", self.logTag, error);
-        return NO;
-    }
-
     return YES;
 }
 
@@ -953,16 +1572,6 @@ NSString *const Keychain_ImportBackupKey = @"ImportBackupKey";
     });
 }
 
-#pragma mark - SSZipArchiveDelegate
-
-- (void)zipArchiveProgressEvent:(unsigned long long)loaded total:(unsigned long long)total
-{
-    DDLogInfo(@"%@ zipArchiveProgressEvent: %llu %llu", self.logTag, loaded, total);
-
-    CGFloat progress = loaded / (CGFloat)total;
-    self.backupProgress = progress;
-}
-
 @end
 
 NS_ASSUME_NONNULL_END
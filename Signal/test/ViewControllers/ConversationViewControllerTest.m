@@ -0,0 +1,136 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "ConversationViewController.h"
+#import "ConversationViewItem.h"
+#import <SignalServiceKit/TSContactThread.h>
+#import <SignalServiceKit/TSDatabaseView.h>
+#import <SignalServiceKit/TSOutgoingMessage.h>
+#import <SignalServiceKit/TSStorageManager.h>
+#import <XCTest/XCTest.h>
+#import <YapDatabase/YapDatabaseView.h>
+
+static const NSUInteger kLoadedMessageCount = 500;
+
+@interface ConversationViewController (Testing)
+
+@property (nonatomic) YapDatabaseConnection *uiDatabaseConnection;
+@property (nonatomic) YapDatabaseViewMappings *messageMappings;
+@property (nonatomic) NSArray<ConversationViewItem *> *viewItems;
+
+- (NSSet<NSNumber *> *)reloadViewItems;
+- (nullable NSSet<NSNumber *> *)reloadViewItemsWithRowChanges:(NSArray<YapDatabaseViewRowChange *> *)rowChanges;
+
+@end
+
+#pragma mark -
+
+@interface ConversationViewControllerTest : XCTestCase
+
+@property (nonatomic) TSContactThread *thread;
+@property (nonatomic) ConversationViewController *viewController;
+@property (nonatomic) uint64_t lastTimestamp;
+
+@end
+
+#pragma mark -
+
+@implementation ConversationViewControllerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [[TSStorageManager sharedManager] purgeCollection:[TSInteraction collection]];
+    YapDatabaseConnection *dbConnection = [TSStorageManager sharedManager].newDatabaseConnection;
+    [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        self.thread = [TSContactThread getOrCreateThreadWithContactId:@"+13213214321" transaction:transaction];
+        for (NSUInteger i = 0; i < kLoadedMessageCount; i++) {
+            [[self newMessage] saveWithTransaction:transaction];
+        }
+    }];
+
+    self.viewController = [ConversationViewController new];
+    [self.viewController configureForThread:self.thread keyboardOnViewAppearing:NO callOnViewAppearing:NO];
+
+    // Load every message rather than a single page.
+    YapDatabaseViewRangeOptions *rangeOptions =
+        [YapDatabaseViewRangeOptions flexibleRangeWithLength:kLoadedMessageCount offset:0 from:YapDatabaseViewEnd];
+    [self.viewController.messageMappings setRangeOptions:rangeOptions forGroup:self.thread.uniqueId];
+    [self.viewController.uiDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [self.viewController.messageMappings updateWithTransaction:transaction];
+    }];
+    [self.viewController reloadViewItems];
+    XCTAssertEqual(kLoadedMessageCount, self.viewController.viewItems.count);
+}
+
+- (TSOutgoingMessage *)newMessage
+{
+    self.lastTimestamp++;
+    return [[TSOutgoingMessage alloc] initWithTimestamp:self.lastTimestamp inThread:self.thread messageBody:@"Test"];
+}
+
+// Sends a message, then advances the view controller's read transaction and
+// returns the resulting row changes.
+- (NSArray<YapDatabaseViewRowChange *> *)rowChangesForNewMessage
+{
+    [[self newMessage] save];
+
+    NSArray<NSNotification *> *notifications = [self.viewController.uiDatabaseConnection beginLongLivedReadTransaction];
+    NSArray<YapDatabaseViewSectionChange *> *sectionChanges = nil;
+    NSArray<YapDatabaseViewRowChange *> *rowChanges = nil;
+    [[self.viewController.uiDatabaseConnection ext:TSMessageDatabaseViewExtensionName]
+        getSectionChanges:&sectionChanges
+               rowChanges:&rowChanges
+         forNotifications:notifications
+             withMappings:self.viewController.messageMappings];
+    return rowChanges ?: @[];
+}
+
+- (NSArray<NSString *> *)viewItemInteractionIds
+{
+    NSMutableArray<NSString *> *result = [NSMutableArray new];
+    for (ConversationViewItem *viewItem in self.viewController.viewItems) {
+        [result addObject:viewItem.interaction.uniqueId];
+    }
+    return result;
+}
+
+- (void)testIncrementalReloadMatchesFullReload
+{
+    NSArray<YapDatabaseViewRowChange *> *rowChanges = [self rowChangesForNewMessage];
+    XCTAssertGreaterThan(rowChanges.count, 0);
+
+    XCTAssertNotNil([self.viewController reloadViewItemsWithRowChanges:rowChanges]);
+    NSArray<NSString *> *incrementalInteractionIds = [self viewItemInteractionIds];
+
+    [self.viewController reloadViewItems];
+    XCTAssertEqualObjects(incrementalInteractionIds, [self viewItemInteractionIds]);
+}
+
+- (void)testPerformanceIncrementalReload
+{
+    [self measureMetrics:[[self class] defaultPerformanceMetrics]
+        automaticallyStartMeasuring:NO
+                           forBlock:^{
+                               NSArray<YapDatabaseViewRowChange *> *rowChanges = [self rowChangesForNewMessage];
+                               [self startMeasuring];
+                               [self.viewController reloadViewItemsWithRowChanges:rowChanges];
+                               [self stopMeasuring];
+                           }];
+}
+
+- (void)testPerformanceFullReload
+{
+    [self measureMetrics:[[self class] defaultPerformanceMetrics]
+        automaticallyStartMeasuring:NO
+                           forBlock:^{
+                               [self rowChangesForNewMessage];
+                               [self startMeasuring];
+                               [self.viewController reloadViewItems];
+                               [self stopMeasuring];
+                           }];
+}
+
+@end
@@ -3,14 +3,71 @@
 //
 
 #import "TestUtil.h"
+#import <SignalMessaging/Environment.h>
 #import <SignalMessaging/OWSContactsManager.h>
+#import <SignalServiceKit/SignalRecipient.h>
 #import <XCTest/XCTest.h>
+#import <YapDatabase/YapDatabaseConnection.h>
+
+@interface OWSContactsManager (Testing)
+
+@property (nonatomic) NSUInteger signalRecipientScanCount;
+
+- (dispatch_queue_t)serialQueue;
+- (void)buildSignalAccountsAndClearStaleCache:(BOOL)shouldClearStaleCache;
+
+@end
+
+#pragma mark -
 
 @interface OWSContactsManagerTest : XCTestCase
 
+@property (nonatomic) OWSContactsManager *contactsManager;
+
 @end
 
+#pragma mark -
 
 @implementation OWSContactsManagerTest
 
+- (void)setUp
+{
+    [super setUp];
+
+    self.contactsManager = [Environment current].contactsManager;
+}
+
+// Returns the number of SignalRecipient scans after waiting for any pending builds.
+- (NSUInteger)signalRecipientScanCount
+{
+    __block NSUInteger result;
+    dispatch_sync(self.contactsManager.serialQueue, ^{
+        result = self.contactsManager.signalRecipientScanCount;
+    });
+    return result;
+}
+
+- (void)testUnchangedBuildDoesNoWork
+{
+    // Make sure that there is a previous build to compare against.
+    [self.contactsManager buildSignalAccountsAndClearStaleCache:NO];
+    NSUInteger scanCount = [self signalRecipientScanCount];
+
+    [self.contactsManager buildSignalAccountsAndClearStaleCache:NO];
+    XCTAssertEqual(scanCount, [self signalRecipientScanCount]);
+}
+
+- (void)testBuildAfterRegistrationScansRecipients
+{
+    [self.contactsManager buildSignalAccountsAndClearStaleCache:NO];
+    NSUInteger scanCount = [self signalRecipientScanCount];
+
+    [self expectationForNotification:YapDatabaseModifiedNotification object:nil handler:nil];
+    [[[SignalRecipient alloc] initWithTextSecureIdentifier:@"+13213214321" relay:nil] save];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    [self.contactsManager buildSignalAccountsAndClearStaleCache:NO];
+    XCTAssertGreaterThan([self signalRecipientScanCount], scanCount);
+}
+
 @end
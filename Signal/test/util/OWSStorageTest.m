@@ -0,0 +1,81 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import <SignalServiceKit/OWSStorage+Subclass.h>
+#import <SignalServiceKit/TSDatabaseView.h>
+#import <SignalServiceKit/TSStorageManager.h>
+#import <XCTest/XCTest.h>
+#import <YapDatabase/YapDatabaseAutoView.h>
+
+static NSString *const OWSStorageTestViewExtensionName = @"OWSStorageTestViewExtensionName";
+
+@interface OWSStorageTest : XCTestCase
+
+@end
+
+#pragma mark -
+
+@implementation OWSStorageTest
+
+- (void)testDeferredRegistrationsRunAfterFirstPaint
+{
+    // Registrations may still be in progress when the tests start.
+    if (![OWSStorage isStorageReady]) {
+        [self expectationForNotification:StorageIsReadyNotification
+                                  object:nil
+                                 handler:^BOOL(NSNotification *notification) {
+                                     XCTAssertTrue([TSStorageManager sharedManager].areAsyncRegistrationsComplete);
+                                     XCTAssertFalse([OWSStorage areDeferredRegistrationsComplete]);
+                                     return YES;
+                                 }];
+        [self waitForExpectationsWithTimeout:10.0 handler:nil];
+    }
+    XCTAssertTrue([TSStorageManager sharedManager].areAsyncRegistrationsComplete);
+
+    if (![OWSStorage areDeferredRegistrationsComplete]) {
+        [self expectationForNotification:StorageDeferredRegistrationsCompleteNotification object:nil handler:nil];
+        [self waitForExpectationsWithTimeout:10.0 handler:nil];
+    }
+    XCTAssertTrue([OWSStorage isStorageReady]);
+
+    // The deferred registrations are only started once the first screen is presented.
+    XCTAssertNotNil([UIApplication sharedApplication].delegate.window.rootViewController);
+    XCTAssertNotNil(
+        [[TSStorageManager sharedManager] registeredExtension:TSSecondaryDevicesDatabaseViewExtensionName]);
+}
+
+- (void)testRegistrationCompletionBlocksPrecedeFlushCompletion
+{
+    YapDatabaseViewGrouping *grouping = [YapDatabaseViewGrouping
+        withKeyBlock:^NSString *_Nullable(YapDatabaseReadTransaction *transaction, NSString *collection, NSString *key) {
+            return nil;
+        }];
+    YapDatabaseViewSorting *sorting = [YapDatabaseViewSorting
+        withKeyBlock:^NSComparisonResult(YapDatabaseReadTransaction *transaction,
+            NSString *group,
+            NSString *collection1,
+            NSString *key1,
+            NSString *collection2,
+            NSString *key2) {
+            return NSOrderedSame;
+        }];
+    YapDatabaseAutoView *view =
+        [[YapDatabaseAutoView alloc] initWithGrouping:grouping sorting:sorting versionTag:@"1" options:nil];
+
+    __block BOOL didCompleteRegistration = NO;
+    [[TSStorageManager sharedManager] asyncRegisterExtension:view
+                                                    withName:OWSStorageTestViewExtensionName
+                                             completionBlock:^(BOOL ready) {
+                                                 didCompleteRegistration = YES;
+                                             }];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"flushed"];
+    [[TSStorageManager sharedManager] flushRegistrationsWithCompletion:^{
+        XCTAssertTrue(didCompleteRegistration);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+}
+
+@end
@@ -76,4 +76,73 @@ class SearcherTest: XCTestCase {
         XCTAssert(searcher.matches(item: stinkingLizaveta, query:"Liza 323"))
         XCTAssertFalse(searcher.matches(item: regularLizaveta, query:"Liza 323"))
     }
+
+    // MARK: - SearchIndex
+
+    func testIndexMatchesSearcher() {
+        let characters = ["smerdyakov": smerdyakov, "stinkingLizaveta": stinkingLizaveta, "regularLizaveta": regularLizaveta]
+        let index = SearchIndex<String>()
+        for (key, character) in characters {
+            index.update(key: key, indexingString: indexer(character))
+        }
+
+        let queries = ["Pavel", "pavel", "asdf", "", "  ", "Pity", "pavel pavel", "pavelpavel", "Lizaveta",
+                       "Stinking Lizaveta", "Lizaveta St", "  Lizaveta St ", "323", "1-323-555-5555",
+                       "13235555555", "+1-323", "Liza +1-323", "Liza", "Liza 323", "a", "ve", "5555"]
+        for query in queries {
+            let expected = Set(characters.keys.filter { searcher.matches(item: characters[$0]!, query: query) })
+            XCTAssertEqual(index.search(query: query), expected, "query: \(query)")
+        }
+    }
+
+    func testIndexUpdates() {
+        let index = SearchIndex<String>()
+        index.update(key: "liza", indexingString: indexer(regularLizaveta))
+        XCTAssertEqual(index.search(query: "Lizaveta"), ["liza"])
+        XCTAssertEqual(index.search(query: "Stinking"), [])
+
+        index.update(key: "liza", indexingString: indexer(stinkingLizaveta))
+        XCTAssertEqual(index.search(query: "Stinking"), ["liza"])
+        XCTAssertEqual(index.search(query: "415"), [])
+
+        index.remove(key: "liza")
+        XCTAssertFalse(index.contains(key: "liza"))
+        XCTAssertEqual(index.search(query: "Lizaveta"), [])
+    }
+
+    // MARK: - Performance
+
+    let benchmarkQueries = ["liza", "pavel smerd", "555", "zzz", "e", "ivanovich"]
+
+    var benchmarkCharacters: [TestCharacter] {
+        let firstNames = ["Pavel", "Dmitri", "Ivan", "Alexei", "Grushenka", "Katerina", "Lizaveta", "Fyodor"]
+        let lastNames = ["Karamazov", "Smerdyakov", "Svetlov", "Verkhovtseva", "Khokhlakova", "Rakitin"]
+        return (0..<3000).map { i in
+            let name = "\(firstNames[i % firstNames.count]) \(firstNames[(i / 7) % firstNames.count])ovich \(lastNames[i % lastNames.count]) \(i)"
+            return TestCharacter(name: name, description: "", phoneNumber: "+1415555\(1000 + i)")
+        }
+    }
+
+    func testPerformanceLinearScan() {
+        let characters = benchmarkCharacters
+        let searcher = self.searcher
+        measure {
+            for query in self.benchmarkQueries {
+                _ = characters.filter { searcher.matches(item: $0, query: query) }
+            }
+        }
+    }
+
+    func testPerformanceIndex() {
+        let characters = benchmarkCharacters
+        let index = SearchIndex<Int>()
+        for (i, character) in characters.enumerated() {
+            index.update(key: i, indexingString: indexer(character))
+        }
+        measure {
+            for query in self.benchmarkQueries {
+                _ = index.search(query: query)
+            }
+        }
+    }
 }
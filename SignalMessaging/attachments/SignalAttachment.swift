@@ -113,9 +113,11 @@ public class SignalAttachment: NSObject {
     @objc
     public var captionText: String?
 
+    // Memory-mapped where possible; prefer dataLength or dataUrl when
+    // the contents aren't needed.
     @objc
     public var data: Data {
-        return dataSource.data()
+        return dataSource.mappedData() ?? Data()
     }
 
     @objc
@@ -225,7 +227,8 @@ public class SignalAttachment: NSObject {
         if let cachedImage = cachedImage {
             return cachedImage
         }
-        guard let image = UIImage(data:dataSource.data()) else {
+        guard let data = dataSource.mappedData(),
+            let image = UIImage(data:data) else {
             return nil
         }
         cachedImage = image
@@ -579,7 +582,8 @@ public class SignalAttachment: NSObject {
             Logger.verbose("\(TAG) Sending raw \(attachment.mimeType) to retain any animation")
             return attachment
         } else {
-            guard let image = UIImage(data:dataSource.data()) else {
+            guard let data = dataSource.mappedData(),
+                let image = UIImage(data:data) else {
                 attachment.error = .couldNotParseImage
                 return attachment
             }
@@ -36,6 +36,26 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
 @property (nonatomic, readonly) YapDatabaseConnection *dbReadConnection;
 @property (nonatomic, readonly) YapDatabaseConnection *dbWriteConnection;
 
+// The following state should only be accessed on the serialQueue.
+//
+// Signal accounts are rebuilt incrementally, for only the contacts which have
+// changed (or have had a phone number registered) since the last build.
+@property (nonatomic) NSArray<Contact *> *buildContacts;
+@property (nonatomic) NSDictionary<NSString *, Contact *> *buildContactIdMap;
+@property (nonatomic) NSDictionary<NSString *, Contact *> *buildPhoneNumberMap;
+@property (nonatomic, readonly) NSMutableSet<NSString *> *pendingChangedContactIds;
+@property (nonatomic) BOOL needsFullSignalAccountBuild;
+// Incremented whenever SignalRecipients may have been added or removed, so that
+// builds only need to scan the SignalRecipient collection if it has changed.
+@property (nonatomic) NSUInteger signalRecipientsVersion;
+@property (nonatomic) NSUInteger signalRecipientScanCount;
+// The state of the last build.
+@property (nonatomic) NSSet<NSString *> *builtRecipientIds;
+@property (nonatomic) NSUInteger builtSignalRecipientsVersion;
+@property (nonatomic) ABPersonSortOrdering builtSortOrdering;
+@property (nonatomic, readonly) NSMutableArray<SignalAccount *> *builtSignalAccounts;
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, SignalAccount *> *builtSignalAccountMap;
+
 @end
 
 @implementation OWSContactsManager
@@ -57,6 +77,15 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
     _allContactsMap = @{};
     _signalAccountMap = @{};
     _signalAccounts = @[];
+    _buildContacts = @[];
+    _buildContactIdMap = @{};
+    _buildPhoneNumberMap = @{};
+    _pendingChangedContactIds = [NSMutableSet new];
+    _needsFullSignalAccountBuild = YES;
+    _signalRecipientsVersion = 1;
+    _builtRecipientIds = [NSSet new];
+    _builtSignalAccounts = [NSMutableArray new];
+    _builtSignalAccountMap = [NSMutableDictionary new];
     _systemContactsFetcher = [SystemContactsFetcher new];
     _systemContactsFetcher.delegate = self;
 
@@ -136,19 +165,22 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
 
 - (void)systemContactsFetcher:(SystemContactsFetcher *)systemsContactsFetcher
               updatedContacts:(NSArray<Contact *> *)contacts
+            changedContactIds:(nullable NSSet<NSString *> *)changedContactIds
                 isUserRequested:(BOOL)isUserRequested
 {
-    [self updateWithContacts:contacts shouldClearStaleCache:isUserRequested];
+    [self updateWithContacts:contacts changedContactIds:changedContactIds shouldClearStaleCache:isUserRequested];
 }
 
 #pragma mark - Intersection
 
-- (void)intersectContactsWithCompletion:(void (^)(NSError *_Nullable error))completionBlock
+- (void)intersectContactsWithForceFullIntersection:(BOOL)forceFullIntersection
+                                        completion:(void (^)(NSError *_Nullable error))completionBlock
 {
-    [self intersectContactsWithRetryDelay:1 completion:completionBlock];
+    [self intersectContactsWithRetryDelay:1 forceFullIntersection:forceFullIntersection completion:completionBlock];
 }
 
 - (void)intersectContactsWithRetryDelay:(double)retryDelaySeconds
+                  forceFullIntersection:(BOOL)forceFullIntersection
                              completion:(void (^)(NSError *_Nullable error))completionBlock
 {
     void (^success)(void) = ^{
@@ -170,10 +202,13 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
         // TODO: Abort if another contact intersection succeeds in the meantime.
         dispatch_after(
             dispatch_time(DISPATCH_TIME_NOW, (int64_t)(retryDelaySeconds * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-                [self intersectContactsWithRetryDelay:retryDelaySeconds * 2 completion:completionBlock];
+                [self intersectContactsWithRetryDelay:retryDelaySeconds * 2
+                                forceFullIntersection:forceFullIntersection
+                                           completion:completionBlock];
             });
     };
     [[ContactsUpdater sharedUpdater] updateSignalContactIntersectionWithABContacts:self.allContacts
+                                                             forceFullIntersection:forceFullIntersection
                                                                            success:success
                                                                            failure:failure];
 }
@@ -184,6 +219,39 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
                                              selector:@selector(otherUsersProfileWillChange:)
                                                  name:kNSNotificationName_OtherUsersProfileWillChange
                                                object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(yapDatabaseModified:)
+                                                 name:YapDatabaseModifiedNotification
+                                               object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(yapDatabaseModifiedExternally:)
+                                                 name:YapDatabaseModifiedExternallyNotification
+                                               object:nil];
+}
+
+- (void)yapDatabaseModified:(NSNotification *)notification
+{
+    if ([self.dbReadConnection hasChangeForCollection:[SignalRecipient collection] inNotifications:@[ notification ]]) {
+        [self signalRecipientsDidChange];
+    }
+}
+
+- (void)yapDatabaseModifiedExternally:(NSNotification *)notification
+{
+    [self signalRecipientsDidChange];
+}
+
+- (void)signalRecipientsDidChange
+{
+    dispatch_async(self.serialQueue, ^{
+        self.signalRecipientsVersion++;
+
+        // Pick up any newly registered contacts.  We don't do this until the
+        // first build, which needs the system contacts.
+        if (self.builtSignalRecipientsVersion > 0) {
+            [self buildSignalAccountsAndClearStaleCache:NO];
+        }
+    });
 }
 
 - (void)otherUsersProfileWillChange:(NSNotification *)notification
@@ -196,10 +264,13 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
     [self.avatarCache removeAllImagesForKey:recipientId];
 }
 
-- (void)updateWithContacts:(NSArray<Contact *> *)contacts shouldClearStaleCache:(BOOL)shouldClearStaleCache
+- (void)updateWithContacts:(NSArray<Contact *> *)contacts
+         changedContactIds:(nullable NSSet<NSString *> *)changedContactIds
+     shouldClearStaleCache:(BOOL)shouldClearStaleCache
 {
     dispatch_async(self.serialQueue, ^{
         NSMutableDictionary<NSString *, Contact *> *allContactsMap = [NSMutableDictionary new];
+        NSMutableDictionary<NSString *, Contact *> *contactIdMap = [NSMutableDictionary new];
         for (Contact *contact in contacts) {
             for (PhoneNumber *phoneNumber in contact.parsedPhoneNumbers) {
                 NSString *phoneNumberE164 = phoneNumber.toE164;
@@ -207,6 +278,16 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
                     allContactsMap[phoneNumberE164] = contact;
                 }
             }
+            contactIdMap[contact.uniqueId] = contact;
+        }
+
+        self.buildContacts = contacts;
+        self.buildContactIdMap = [contactIdMap copy];
+        self.buildPhoneNumberMap = [allContactsMap copy];
+        if (changedContactIds) {
+            [self.pendingChangedContactIds unionSet:changedContactIds];
+        } else {
+            self.needsFullSignalAccountBuild = YES;
         }
 
         dispatch_async(dispatch_get_main_queue(), ^{
@@ -215,9 +296,10 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
 
             [self.avatarCache removeAllImages];
 
-            [self intersectContactsWithCompletion:^(NSError *_Nullable error) {
-                [self buildSignalAccountsAndClearStaleCache:shouldClearStaleCache];
-            }];
+            [self intersectContactsWithForceFullIntersection:shouldClearStaleCache
+                                                  completion:^(NSError *_Nullable error) {
+                                                      [self buildSignalAccountsAndClearStaleCache:shouldClearStaleCache];
+                                                  }];
         });
     });
 }
@@ -225,118 +307,273 @@ NSString *const OWSContactsManagerSignalAccountsDidChangeNotification
 - (void)buildSignalAccountsAndClearStaleCache:(BOOL)shouldClearStaleCache;
 {
     dispatch_async(self.serialQueue, ^{
-        NSMutableArray<SignalAccount *> *signalAccounts = [NSMutableArray new];
-        NSArray<Contact *> *contacts = self.allContacts;
-
-        // We use a transaction only to load the SignalRecipients for each contact,
-        // in order to avoid database deadlock.
-        NSMutableDictionary<NSString *, NSArray<SignalRecipient *> *> *contactIdToSignalRecipientsMap =
-            [NSMutableDictionary new];
-        [self.dbReadConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
-            for (Contact *contact in contacts) {
-                NSArray<SignalRecipient *> *signalRecipients = [contact signalRecipientsWithTransaction:transaction];
-                contactIdToSignalRecipientsMap[contact.uniqueId] = signalRecipients;
+        NSDate *startDate = [NSDate new];
+
+        BOOL isIncremental = (!shouldClearStaleCache && !self.needsFullSignalAccountBuild
+            && self.builtSortOrdering == ABPersonGetSortOrdering());
+        NSSet<NSString *> *changedContactIds = [self.pendingChangedContactIds copy];
+        NSUInteger signalRecipientsVersion = self.signalRecipientsVersion;
+        BOOL haveSignalRecipientsChanged
+            = (!isIncremental || signalRecipientsVersion != self.builtSignalRecipientsVersion);
+        if (!haveSignalRecipientsChanged && changedContactIds.count < 1) {
+            DDLogDebug(@"%@ SignalAccounts unchanged.", self.logTag);
+            return;
+        }
+        [self.pendingChangedContactIds removeAllObjects];
+        self.needsFullSignalAccountBuild = NO;
+
+        __block NSSet<NSString *> *recipientIds = self.builtRecipientIds;
+        if (haveSignalRecipientsChanged) {
+            [self.dbReadConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+                recipientIds = [NSSet setWithArray:[transaction allKeysInCollection:[SignalRecipient collection]]];
+            }];
+            self.signalRecipientScanCount++;
+        }
+
+        if (isIncremental) {
+            [self updateSignalAccountsForContactIds:changedContactIds recipientIds:recipientIds];
+        } else {
+            [self rebuildSignalAccountsWithRecipientIds:recipientIds shouldClearStaleCache:shouldClearStaleCache];
+        }
+        self.builtRecipientIds = recipientIds;
+        self.builtSignalRecipientsVersion = signalRecipientsVersion;
+        self.builtSortOrdering = ABPersonGetSortOrdering();
+
+        DDLogInfo(@"%@ %@ %lu signal accounts from %lu contacts in %.3fs.",
+            self.logTag,
+            (isIncremental ? @"updated" : @"rebuilt"),
+            (unsigned long)self.builtSignalAccounts.count,
+            (unsigned long)(isIncremental ? changedContactIds.count : self.buildContacts.count),
+            fabs([startDate timeIntervalSinceNow]));
+    });
+}
+
+// Should only be called on the serialQueue.
+- (void)rebuildSignalAccountsWithRecipientIds:(NSSet<NSString *> *)recipientIds
+                        shouldClearStaleCache:(BOOL)shouldClearStaleCache
+{
+    NSMutableArray<SignalAccount *> *signalAccounts = [NSMutableArray new];
+    NSMutableSet<NSString *> *seenRecipientIds = [NSMutableSet new];
+    for (Contact *contact in self.buildContacts) {
+        NSArray<NSString *> *contactRecipientIds = [self recipientIdsForContact:contact recipientIds:recipientIds];
+        for (NSString *recipientId in contactRecipientIds) {
+            if ([seenRecipientIds containsObject:recipientId]) {
+                DDLogDebug(@"Ignoring duplicate contact: %@, %@", recipientId, contact.fullName);
+                continue;
             }
-        }];
+            [seenRecipientIds addObject:recipientId];
 
-        NSMutableSet<NSString *> *seenRecipientIds = [NSMutableSet new];
-        for (Contact *contact in contacts) {
-            NSArray<SignalRecipient *> *signalRecipients = contactIdToSignalRecipientsMap[contact.uniqueId];
-            for (SignalRecipient *signalRecipient in [signalRecipients sortedArrayUsingSelector:@selector(compare:)]) {
-                if ([seenRecipientIds containsObject:signalRecipient.recipientId]) {
-                    DDLogDebug(@"Ignoring duplicate contact: %@, %@", signalRecipient.recipientId, contact.fullName);
-                    continue;
-                }
-                [seenRecipientIds addObject:signalRecipient.recipientId];
-
-                SignalAccount *signalAccount = [[SignalAccount alloc] initWithSignalRecipient:signalRecipient];
-                signalAccount.contact = contact;
-                if (signalRecipients.count > 1) {
-                    signalAccount.hasMultipleAccountContact = YES;
-                    signalAccount.multipleAccountLabelText =
-                        [[self class] accountLabelForContact:contact recipientId:signalRecipient.recipientId];
+            [signalAccounts addObject:[self signalAccountForContact:contact
+                                                        recipientId:recipientId
+                                                 isMultipleAccounts:contactRecipientIds.count > 1]];
+        }
+    }
+
+    NSMutableDictionary<NSString *, SignalAccount *> *oldSignalAccounts = [NSMutableDictionary new];
+    [self.dbReadConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
+        [SignalAccount
+            enumerateCollectionObjectsWithTransaction:transaction
+                                           usingBlock:^(id _Nonnull object, BOOL *_Nonnull stop) {
+                                               OWSAssert([object isKindOfClass:[SignalAccount class]]);
+                                               SignalAccount *oldSignalAccount = (SignalAccount *)object;
+
+                                               oldSignalAccounts[oldSignalAccount.uniqueId] = oldSignalAccount;
+                                           }];
+    }];
+
+    NSMutableArray *accountsToSave = [NSMutableArray new];
+    for (SignalAccount *signalAccount in signalAccounts) {
+        SignalAccount *_Nullable oldSignalAccount = oldSignalAccounts[signalAccount.uniqueId];
+
+        // keep track of which accounts are still relevant, so we can clean up orphans
+        [oldSignalAccounts removeObjectForKey:signalAccount.uniqueId];
+
+        if (oldSignalAccount == nil) {
+            // new Signal Account
+            [accountsToSave addObject:signalAccount];
+            continue;
+        }
+
+        if ([oldSignalAccount isEqual:signalAccount]) {
+            // Same value, no need to save.
+            continue;
+        }
+
+        // value changed, save account
+        [accountsToSave addObject:signalAccount];
+    }
+
+    // Update cached SignalAccounts on disk
+    [self.dbWriteConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
+        DDLogInfo(@"%@ Saving %lu SignalAccounts", self.logTag, (unsigned long)accountsToSave.count);
+        for (SignalAccount *signalAccount in accountsToSave) {
+            DDLogVerbose(@"%@ Saving SignalAccount: %@", self.logTag, signalAccount);
+            [signalAccount saveWithTransaction:transaction];
+        }
+
+        if (shouldClearStaleCache) {
+            DDLogInfo(@"%@ Removing %lu old SignalAccounts.", self.logTag, (unsigned long)oldSignalAccounts.count);
+            for (SignalAccount *signalAccount in oldSignalAccounts.allValues) {
+                DDLogVerbose(@"%@ Removing old SignalAccount: %@", self.logTag, signalAccount);
+                [signalAccount removeWithTransaction:transaction];
+            }
+        } else {
+            // In theory we want to remove SignalAccounts if the user deletes the corresponding system contact.
+            // However, as of iOS11.2 CNContactStore occasionally gives us only a subset of the system contacts.
+            // Because of that, it's not safe to clear orphaned accounts.
+            // Because we still want to give users a way to clear their stale accounts, if they pull-to-refresh
+            // their contacts we'll clear the cached ones.
+            // RADAR: https://bugreport.apple.com/web/?problemID=36082946
+            if (oldSignalAccounts.allValues.count > 0) {
+                DDLogWarn(
+                    @"%@ NOT Removing %lu old SignalAccounts.", self.logTag, (unsigned long)oldSignalAccounts.count);
+                for (SignalAccount *signalAccount in oldSignalAccounts.allValues) {
+                    DDLogVerbose(
+                        @"%@ Ensuring old SignalAccount is not inadvertently lost: %@", self.logTag, signalAccount);
+                    [signalAccounts addObject:signalAccount];
                 }
-                [signalAccounts addObject:signalAccount];
             }
         }
+    }];
 
-        NSMutableDictionary<NSString *, SignalAccount *> *oldSignalAccounts = [NSMutableDictionary new];
-        [self.dbReadConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
-            [SignalAccount
-                enumerateCollectionObjectsWithTransaction:transaction
-                                               usingBlock:^(id _Nonnull object, BOOL *_Nonnull stop) {
-                                                   OWSAssert([object isKindOfClass:[SignalAccount class]]);
-                                                   SignalAccount *oldSignalAccount = (SignalAccount *)object;
-
-                                                   oldSignalAccounts[oldSignalAccount.uniqueId] = oldSignalAccount;
-                                               }];
-        }];
+    // The incremental updates rely on this order.
+    [signalAccounts sortUsingComparator:self.signalAccountComparator];
 
-        NSMutableArray *accountsToSave = [NSMutableArray new];
-        for (SignalAccount *signalAccount in signalAccounts) {
-            SignalAccount *_Nullable oldSignalAccount = oldSignalAccounts[signalAccount.uniqueId];
+    [self.builtSignalAccounts setArray:signalAccounts];
+    [self.builtSignalAccountMap removeAllObjects];
+    for (SignalAccount *signalAccount in signalAccounts) {
+        self.builtSignalAccountMap[signalAccount.recipientId] = signalAccount;
+    }
 
-            // keep track of which accounts are still relevant, so we can clean up orphans
-            [oldSignalAccounts removeObjectForKey:signalAccount.uniqueId];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self updateSignalAccounts:signalAccounts];
+    });
+}
 
-            if (oldSignalAccount == nil) {
-                // new Signal Account
-                [accountsToSave addObject:signalAccount];
+// Should only be called on the serialQueue.
+//
+// Only contacts which have changed, or which have a phone number that has been
+// registered since the last build, are visited.  As with a full build that
+// doesn't clear the stale cache, accounts are never removed.
+- (void)updateSignalAccountsForContactIds:(NSSet<NSString *> *)changedContactIds
+                             recipientIds:(NSSet<NSString *> *)recipientIds
+{
+    NSMutableSet<NSString *> *contactIds = [changedContactIds mutableCopy];
+    for (NSString *recipientId in recipientIds) {
+        if ([self.builtRecipientIds containsObject:recipientId]) {
+            continue;
+        }
+        Contact *_Nullable contact = self.buildPhoneNumberMap[recipientId];
+        if (contact) {
+            [contactIds addObject:contact.uniqueId];
+        }
+    }
+
+    NSMutableArray<SignalAccount *> *accountsToSave = [NSMutableArray new];
+    for (NSString *contactId in contactIds) {
+        Contact *_Nullable contact = self.buildContactIdMap[contactId];
+        if (!contact) {
+            // Deleted contact.
+            continue;
+        }
+
+        NSArray<NSString *> *contactRecipientIds = [self recipientIdsForContact:contact recipientIds:recipientIds];
+        for (NSString *recipientId in contactRecipientIds) {
+            SignalAccount *_Nullable oldSignalAccount = self.builtSignalAccountMap[recipientId];
+            NSString *_Nullable oldContactId = oldSignalAccount.contact.uniqueId;
+            if (oldContactId && ![oldContactId isEqualToString:contactId] && ![contactIds containsObject:oldContactId]
+                && self.buildContactIdMap[oldContactId]) {
+                DDLogDebug(@"Ignoring duplicate contact: %@, %@", recipientId, contact.fullName);
                 continue;
             }
 
+            SignalAccount *signalAccount = [self signalAccountForContact:contact
+                                                             recipientId:recipientId
+                                                      isMultipleAccounts:contactRecipientIds.count > 1];
             if ([oldSignalAccount isEqual:signalAccount]) {
-                // Same value, no need to save.
                 continue;
             }
 
-            // value changed, save account
+            if (oldSignalAccount) {
+                [self removeBuiltSignalAccount:oldSignalAccount];
+            }
+            [self insertBuiltSignalAccount:signalAccount];
             [accountsToSave addObject:signalAccount];
         }
+    }
 
-        // Update cached SignalAccounts on disk
-        [self.dbWriteConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-            DDLogInfo(@"%@ Saving %lu SignalAccounts", self.logTag, (unsigned long)accountsToSave.count);
-            for (SignalAccount *signalAccount in accountsToSave) {
-                DDLogVerbose(@"%@ Saving SignalAccount: %@", self.logTag, signalAccount);
-                [signalAccount saveWithTransaction:transaction];
-            }
+    if (accountsToSave.count < 1) {
+        DDLogDebug(@"%@ SignalAccounts unchanged.", self.logTag);
+        return;
+    }
 
-            if (shouldClearStaleCache) {
-                DDLogInfo(@"%@ Removing %lu old SignalAccounts.", self.logTag, (unsigned long)oldSignalAccounts.count);
-                for (SignalAccount *signalAccount in oldSignalAccounts.allValues) {
-                    DDLogVerbose(@"%@ Removing old SignalAccount: %@", self.logTag, signalAccount);
-                    [signalAccount removeWithTransaction:transaction];
-                }
-            } else {
-                // In theory we want to remove SignalAccounts if the user deletes the corresponding system contact.
-                // However, as of iOS11.2 CNContactStore occasionally gives us only a subset of the system contacts.
-                // Because of that, it's not safe to clear orphaned accounts.
-                // Because we still want to give users a way to clear their stale accounts, if they pull-to-refresh
-                // their contacts we'll clear the cached ones.
-                // RADAR: https://bugreport.apple.com/web/?problemID=36082946
-                if (oldSignalAccounts.allValues.count > 0) {
-                    DDLogWarn(@"%@ NOT Removing %lu old SignalAccounts.",
-                        self.logTag,
-                        (unsigned long)oldSignalAccounts.count);
-                    for (SignalAccount *signalAccount in oldSignalAccounts.allValues) {
-                        DDLogVerbose(
-                            @"%@ Ensuring old SignalAccount is not inadvertently lost: %@", self.logTag, signalAccount);
-                        [signalAccounts addObject:signalAccount];
-                    }
-
-                    // re-sort signal accounts since we've appended some orphans
-                    [signalAccounts sortUsingComparator:self.signalAccountComparator];
-                }
-            }
-        }];
+    [self.dbWriteConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
+        DDLogInfo(@"%@ Saving %lu SignalAccounts", self.logTag, (unsigned long)accountsToSave.count);
+        for (SignalAccount *signalAccount in accountsToSave) {
+            DDLogVerbose(@"%@ Saving SignalAccount: %@", self.logTag, signalAccount);
+            [signalAccount saveWithTransaction:transaction];
+        }
+    }];
 
-        dispatch_async(dispatch_get_main_queue(), ^{
-            [self updateSignalAccounts:signalAccounts];
-        });
+    NSArray<SignalAccount *> *signalAccounts = [self.builtSignalAccounts copy];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self updateSignalAccounts:signalAccounts];
     });
 }
 
+// Should only be called on the serialQueue.
+- (void)insertBuiltSignalAccount:(SignalAccount *)signalAccount
+{
+    NSUInteger index = [self.builtSignalAccounts indexOfObject:signalAccount
+                                                 inSortedRange:NSMakeRange(0, self.builtSignalAccounts.count)
+                                                       options:NSBinarySearchingInsertionIndex
+                                               usingComparator:self.signalAccountComparator];
+    [self.builtSignalAccounts insertObject:signalAccount atIndex:index];
+    self.builtSignalAccountMap[signalAccount.recipientId] = signalAccount;
+}
+
+// Should only be called on the serialQueue.
+- (void)removeBuiltSignalAccount:(SignalAccount *)signalAccount
+{
+    NSUInteger index = [self.builtSignalAccounts indexOfObject:signalAccount
+                                                 inSortedRange:NSMakeRange(0, self.builtSignalAccounts.count)
+                                                       options:NSBinarySearchingFirstEqual
+                                               usingComparator:self.signalAccountComparator];
+    if (index == NSNotFound || self.builtSignalAccounts[index] != signalAccount) {
+        OWSFail(@"%@ Missing SignalAccount: %@", self.logTag, signalAccount.recipientId);
+        [self.builtSignalAccounts removeObjectIdenticalTo:signalAccount];
+    } else {
+        [self.builtSignalAccounts removeObjectAtIndex:index];
+    }
+    [self.builtSignalAccountMap removeObjectForKey:signalAccount.recipientId];
+}
+
+// Returns the contact's registered phone numbers, in a stable order.
+- (NSArray<NSString *> *)recipientIdsForContact:(Contact *)contact recipientIds:(NSSet<NSString *> *)recipientIds
+{
+    NSMutableArray<NSString *> *result = [NSMutableArray new];
+    for (PhoneNumber *phoneNumber in [contact.parsedPhoneNumbers sortedArrayUsingSelector:@selector(compare:)]) {
+        NSString *recipientId = phoneNumber.toE164;
+        if ([recipientIds containsObject:recipientId] && ![result containsObject:recipientId]) {
+            [result addObject:recipientId];
+        }
+    }
+    return result;
+}
+
+- (SignalAccount *)signalAccountForContact:(Contact *)contact
+                               recipientId:(NSString *)recipientId
+                        isMultipleAccounts:(BOOL)isMultipleAccounts
+{
+    SignalAccount *signalAccount = [[SignalAccount alloc] initWithRecipientId:recipientId];
+    signalAccount.contact = contact;
+    if (isMultipleAccounts) {
+        signalAccount.hasMultipleAccountContact = YES;
+        signalAccount.multipleAccountLabelText = [[self class] accountLabelForContact:contact recipientId:recipientId];
+    }
+    return signalAccount;
+}
+
 - (void)updateSignalAccounts:(NSArray<SignalAccount *> *)signalAccounts
 {
     OWSAssertIsOnMainThread();
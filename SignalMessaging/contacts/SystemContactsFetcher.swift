@@ -100,6 +100,15 @@ class ContactsFrameworkContactStoreAdaptee: ContactStoreAdaptee {
             return .error(error)
         }
 
+        // Parse each distinct phone number in the address book once, up front;
+        // building the contacts then hits the phone number cache.
+        let parseStartTime = Date()
+        let phoneNumberTexts = systemContacts.flatMap { systemContact in
+            systemContact.phoneNumbers.map { $0.value.stringValue }
+        }
+        let phoneNumbersForText = PhoneNumber.tryParsePhoneNumbers(fromUserSpecifiedTexts: phoneNumberTexts, clientPhoneNumber: TSAccountManager.localNumber())
+        Logger.info("\(self.TAG) parsed \(phoneNumberTexts.count) phone numbers (\(phoneNumbersForText.count) distinct) in \(Date().timeIntervalSince(parseStartTime))s.")
+
         let contacts = systemContacts.map { Contact(systemContact: $0) }
         return .success(contacts)
     }
@@ -317,7 +326,9 @@ class ContactStoreAdapter: ContactStoreAdaptee {
 }
 
 @objc public protocol SystemContactsFetcherDelegate: class {
-    func systemContactsFetcher(_ systemContactsFetcher: SystemContactsFetcher, updatedContacts contacts: [Contact], isUserRequested: Bool)
+    // changedContactIds are the unique ids of the contacts which have been added, changed or
+    // removed since the delegate was last notified, or nil if they aren't known.
+    func systemContactsFetcher(_ systemContactsFetcher: SystemContactsFetcher, updatedContacts contacts: [Contact], changedContactIds: Set<String>?, isUserRequested: Bool)
 }
 
 @objc
@@ -325,6 +336,8 @@ public class SystemContactsFetcher: NSObject {
 
     private let TAG = "[SystemContactsFetcher]"
     var lastContactUpdateHash: Int?
+    // The hash of each contact, keyed by contact id, when the delegate was last notified.
+    var lastContactHashes: [String: Int]?
     var lastDelegateNotificationDate: Date?
     let contactStoreAdapter: ContactStoreAdapter
 
@@ -489,6 +502,10 @@ public class SystemContactsFetcher: NSObject {
 
             Logger.info("\(self.TAG) fetched \(contacts.count) contacts.")
             let contactsHash  = HashableArray(contacts).hashValue
+            var contactHashes = [String: Int]()
+            for contact in contacts {
+                contactHashes[contact.uniqueId] = contact.hashValue
+            }
 
             DispatchQueue.main.async {
                 var shouldNotifyDelegate = false
@@ -526,10 +543,24 @@ public class SystemContactsFetcher: NSObject {
                     return
                 }
 
+                var changedContactIds: Set<String>?
+                if let lastContactHashes = self.lastContactHashes {
+                    var contactIds = Set<String>()
+                    for (contactId, contactHash) in contactHashes where lastContactHashes[contactId] != contactHash {
+                        contactIds.insert(contactId)
+                    }
+                    for contactId in lastContactHashes.keys where contactHashes[contactId] == nil {
+                        contactIds.insert(contactId)
+                    }
+                    changedContactIds = contactIds
+                    Logger.info("\(self.TAG) \(contactIds.count) contacts changed.")
+                }
+
                 self.lastDelegateNotificationDate = Date()
                 self.lastContactUpdateHash = contactsHash
+                self.lastContactHashes = contactHashes
 
-                self.delegate?.systemContactsFetcher(self, updatedContacts: contacts, isUserRequested: isUserRequested)
+                self.delegate?.systemContactsFetcher(self, updatedContacts: contacts, changedContactIds: changedContactIds, isUserRequested: isUserRequested)
                 completion(nil)
             }
         }
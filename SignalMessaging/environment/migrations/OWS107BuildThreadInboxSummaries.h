@@ -0,0 +1,13 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSDatabaseMigration.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OWS107BuildThreadInboxSummaries : OWSDatabaseMigration
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,31 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWS107BuildThreadInboxSummaries.h"
+#import <SignalServiceKit/OWSThreadInboxSummary.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Increment a similar constant for every future DBMigration
+static NSString *const OWS107BuildThreadInboxSummariesMigrationId = @"107";
+
+// Inbox summaries are maintained as interactions are saved and removed, but
+// existing threads need a summary built for them once.
+@implementation OWS107BuildThreadInboxSummaries
+
++ (NSString *)migrationId
+{
+    return OWS107BuildThreadInboxSummariesMigrationId;
+}
+
+- (void)runUpWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(transaction);
+
+    [OWSThreadInboxSummary ensureSummariesWithTransaction:transaction];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -8,6 +8,7 @@
 #import "OWS103EnableVideoCalling.h"
 #import "OWS104CreateRecipientIdentities.h"
 #import "OWS105AttachmentFilePaths.h"
+#import "OWS107BuildThreadInboxSummaries.h"
 #import "OWSDatabaseMigration.h"
 #import <SignalMessaging/SignalMessaging-Swift.h>
 #import <SignalServiceKit/AppContext.h>
@@ -38,7 +39,8 @@ NS_ASSUME_NONNULL_BEGIN
         [[OWS103EnableVideoCalling alloc] initWithStorageManager:storageManager],
         // OWS104CreateRecipientIdentities is run separately. See runSafeBlockingMigrations.
         [[OWS105AttachmentFilePaths alloc] initWithStorageManager:storageManager],
-        [[OWS106EnsureProfileComplete alloc] initWithStorageManager:storageManager]
+        [[OWS106EnsureProfileComplete alloc] initWithStorageManager:storageManager],
+        [[OWS107BuildThreadInboxSummaries alloc] initWithStorageManager:storageManager]
     ];
 }
 
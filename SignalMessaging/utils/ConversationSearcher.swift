@@ -12,20 +12,43 @@ public class ConversationSearcher: NSObject {
     public static let shared: ConversationSearcher = ConversationSearcher()
     override private init() {
         super.init()
+
+        NotificationCenter.default.addObserver(self,
+                                               selector: #selector(signalAccountsDidChange),
+                                               name: NSNotification.Name(rawValue: OWSContactsManagerSignalAccountsDidChangeNotification),
+                                               object: nil)
+        NotificationCenter.default.addObserver(self,
+                                               selector: #selector(otherUsersProfileDidChange),
+                                               name: NSNotification.Name(rawValue: kNSNotificationName_OtherUsersProfileDidChange),
+                                               object: nil)
+    }
+
+    deinit {
+        NotificationCenter.default.removeObserver(self)
     }
 
     @objc(filterThreads:withSearchText:)
     public func filterThreads(_ threads: [TSThread], searchText: String) -> [TSThread] {
+        AssertIsOnMainThread()
+
         guard searchText.trimmingCharacters(in: .whitespacesAndNewlines).count > 0 else {
             return threads
         }
 
+        let groupThreads = threads.flatMap { $0 as? TSGroupThread }
+        let matchingGroupThreadIds = searchGroupThreads(groupThreads, searchText: searchText)
+        let recipientIds = threads.flatMap { ($0 as? TSContactThread)?.contactIdentifier() }
+        let matchingRecipientIds = searchRecipients(recipientIds, searchText: searchText)
+
         return threads.filter { thread in
             switch thread {
             case let groupThread as TSGroupThread:
-                return self.groupThreadSearcher.matches(item: groupThread, query: searchText)
+                guard let groupThreadId = groupThread.uniqueId else {
+                    return false
+                }
+                return matchingGroupThreadIds.contains(groupThreadId)
             case let contactThread as TSContactThread:
-                return self.contactThreadSearcher.matches(item: contactThread, query: searchText)
+                return matchingRecipientIds.contains(contactThread.contactIdentifier())
             default:
                 owsFail("Unexpected thread type: \(thread)")
                 return false
@@ -35,48 +58,134 @@ public class ConversationSearcher: NSObject {
 
     @objc(filterGroupThreads:withSearchText:)
     public func filterGroupThreads(_ groupThreads: [TSGroupThread], searchText: String) -> [TSGroupThread] {
+        AssertIsOnMainThread()
+
         guard searchText.trimmingCharacters(in: .whitespacesAndNewlines).count > 0 else {
             return groupThreads
         }
 
+        let matchingGroupThreadIds = searchGroupThreads(groupThreads, searchText: searchText)
         return groupThreads.filter { groupThread in
-            return self.groupThreadSearcher.matches(item: groupThread, query: searchText)
+            guard let groupThreadId = groupThread.uniqueId else {
+                return false
+            }
+            return matchingGroupThreadIds.contains(groupThreadId)
         }
     }
 
     @objc(filterSignalAccounts:withSearchText:)
     public func filterSignalAccounts(_ signalAccounts: [SignalAccount], searchText: String) -> [SignalAccount] {
+        AssertIsOnMainThread()
+
         guard searchText.trimmingCharacters(in: .whitespacesAndNewlines).count > 0 else {
             return signalAccounts
         }
 
+        let matchingRecipientIds = searchRecipients(signalAccounts.map { $0.recipientId }, searchText: searchText)
         return signalAccounts.filter { signalAccount in
-            self.signalAccountSearcher.matches(item: signalAccount, query: searchText)
+            return matchingRecipientIds.contains(signalAccount.recipientId)
         }
     }
 
-    // MARK: - Helpers
+    // MARK: - Index
+
+    // Contact threads and signal accounts are both indexed by their recipient's
+    // names, so they share an index keyed by recipient id.
+    //
+    // These indexes are only updated with the items that are searched, and
+    // should only be accessed on the main thread.
+    private let recipientIndex = SearchIndex<String>()
+    private let groupThreadIndex = SearchIndex<String>()
+
+    // Group threads are re-indexed whenever their name or members change.
+    private var groupThreadFingerprints: [String: String] = [:]
+    private var groupThreadIdsByRecipientId: [String: Set<String>] = [:]
 
-    // MARK: Searchers
-    private lazy var groupThreadSearcher: Searcher<TSGroupThread> = Searcher { (groupThread: TSGroupThread) in
-        let groupName = groupThread.groupModel.groupName
-        let memberStrings = groupThread.groupModel.groupMemberIds.map { recipientId in
+    private var indexQueryCount: UInt = 0
+    private var indexQueryDuration: TimeInterval = 0
+
+    private func searchRecipients(_ recipientIds: [String], searchText: String) -> Set<String> {
+        let startTime = CFAbsoluteTimeGetCurrent()
+        for recipientId in recipientIds where !recipientIndex.contains(key: recipientId) {
+            recipientIndex.update(key: recipientId, indexingString: indexingString(recipientId: recipientId))
+        }
+        let result = recipientIndex.search(query: searchText)
+        didQueryIndex(startTime: startTime)
+        return result
+    }
+
+    private func searchGroupThreads(_ groupThreads: [TSGroupThread], searchText: String) -> Set<String> {
+        let startTime = CFAbsoluteTimeGetCurrent()
+        for groupThread in groupThreads {
+            updateIndex(groupThread: groupThread)
+        }
+        let result = groupThreadIndex.search(query: searchText)
+        didQueryIndex(startTime: startTime)
+        return result
+    }
+
+    private func updateIndex(groupThread: TSGroupThread) {
+        guard let groupThreadId = groupThread.uniqueId else {
+            owsFail("\(self.logTag) group thread is missing its id.")
+            return
+        }
+        let groupName = groupThread.groupModel.groupName ?? ""
+        let memberIds = groupThread.groupModel.groupMemberIds
+        let fingerprint = "\(groupName)\n\(memberIds.joined(separator: " "))"
+        guard groupThreadFingerprints[groupThreadId] != fingerprint || !groupThreadIndex.contains(key: groupThreadId) else {
+            return
+        }
+
+        groupThreadFingerprints[groupThreadId] = fingerprint
+        for recipientId in memberIds {
+            var groupThreadIds = groupThreadIdsByRecipientId[recipientId] ?? []
+            groupThreadIds.insert(groupThreadId)
+            groupThreadIdsByRecipientId[recipientId] = groupThreadIds
+        }
+
+        let memberStrings = memberIds.map { recipientId in
             self.indexingString(recipientId: recipientId)
-            }.joined(separator: " ")
+        }.joined(separator: " ")
+        groupThreadIndex.update(key: groupThreadId, indexingString: "\(memberStrings) \(groupName)")
+    }
 
-        return "\(memberStrings) \(groupName ?? "")"
+    private func didQueryIndex(startTime: CFAbsoluteTime) {
+        indexQueryCount += 1
+        indexQueryDuration += CFAbsoluteTimeGetCurrent() - startTime
+        if indexQueryCount % 100 == 0 {
+            Logger.info("\(self.logTag) \(indexQueryCount) queries, average: \(indexQueryDuration / Double(indexQueryCount))s, recipients: \(recipientIndex.count), groups: \(groupThreadIndex.count)")
+        }
     }
 
-    private lazy var contactThreadSearcher: Searcher<TSContactThread> = Searcher { (contactThread: TSContactThread) in
-        let recipientId = contactThread.contactIdentifier()
-        return self.indexingString(recipientId: recipientId)
+    // MARK: - Notifications
+
+    @objc
+    private func signalAccountsDidChange(notification: Notification) {
+        AssertIsOnMainThread()
+
+        // Any contact's name may have changed.
+        recipientIndex.removeAll()
+        groupThreadIndex.removeAll()
+        groupThreadFingerprints.removeAll()
+        groupThreadIdsByRecipientId.removeAll()
     }
 
-    private lazy var signalAccountSearcher: Searcher<SignalAccount> = Searcher { (signalAccount: SignalAccount) in
-        let recipientId = signalAccount.recipientId
-        return self.indexingString(recipientId: recipientId)
+    @objc
+    private func otherUsersProfileDidChange(notification: Notification) {
+        AssertIsOnMainThread()
+
+        guard let recipientId = notification.userInfo?[kNSNotificationKey_ProfileRecipientId] as? String else {
+            return
+        }
+
+        recipientIndex.remove(key: recipientId)
+        for groupThreadId in groupThreadIdsByRecipientId[recipientId] ?? [] {
+            groupThreadIndex.remove(key: groupThreadId)
+        }
     }
 
+    // MARK: - Helpers
+
     private var contactsManager: OWSContactsManager {
         return Environment.current().contactsManager
     }
@@ -29,14 +29,14 @@ public class Searcher<T> {
     }
 
     public func matches(item: T, query: String) -> Bool {
-        let itemString = normalize(string: indexer(item))
+        let itemString = Searcher.normalize(string: indexer(item))
 
-        return stem(string: query).map { queryStem in
+        return Searcher.stem(string: query).map { queryStem in
             return itemString.contains(queryStem)
         }.reduce(true) { $0 && $1 }
     }
 
-    private func stem(string: String) -> [String] {
+    fileprivate class func stem(string: String) -> [String] {
         var normalized = normalize(string: string)
 
         // Remove any phone number formatting from the search terms
@@ -49,7 +49,130 @@ public class Searcher<T> {
         return normalized.components(separatedBy: .whitespacesAndNewlines)
     }
 
-    private func normalize(string: String) -> String {
+    fileprivate class func normalize(string: String) -> String {
         return string.lowercased().trimmingCharacters(in: .whitespacesAndNewlines)
     }
 }
+
+// An index of items' (normalized) indexing strings, which answers the same
+// queries as Searcher without scanning every item.
+//
+// Every substring of up to three characters (an "n-gram") of every item is
+// indexed.  A query stem of up to three characters is answered with a single
+// lookup.  Longer stems are answered by intersecting the items which contain
+// each of the stem's trigrams and then confirming those few candidates.
+//
+// Items are identified by key, and should be updated when their indexing
+// strings change.
+public class SearchIndex<Key: Hashable> {
+
+    private let maxGramLength = 3
+
+    private var itemStrings: [Key: String] = [:]
+    private var gramKeys: [String: Set<Key>] = [:]
+
+    public init() {}
+
+    public var count: Int {
+        return itemStrings.count
+    }
+
+    public func contains(key: Key) -> Bool {
+        return itemStrings[key] != nil
+    }
+
+    public func update(key: Key, indexingString: String) {
+        let itemString = Searcher<Key>.normalize(string: indexingString)
+        if itemStrings[key] == itemString {
+            return
+        }
+
+        remove(key: key)
+        itemStrings[key] = itemString
+        for gram in grams(string: itemString) {
+            var keys = gramKeys[gram] ?? []
+            keys.insert(key)
+            gramKeys[gram] = keys
+        }
+    }
+
+    public func remove(key: Key) {
+        guard let itemString = itemStrings.removeValue(forKey: key) else {
+            return
+        }
+        for gram in grams(string: itemString) {
+            guard var keys = gramKeys[gram] else {
+                continue
+            }
+            keys.remove(key)
+            gramKeys[gram] = keys.isEmpty ? nil : keys
+        }
+    }
+
+    public func removeAll() {
+        itemStrings.removeAll()
+        gramKeys.removeAll()
+    }
+
+    // Returns the keys of the items which match every stem of the query.
+    public func search(query: String) -> Set<Key> {
+        var result: Set<Key>?
+        for queryStem in Searcher<Key>.stem(string: query) {
+            let stemKeys = keys(matchingStem: queryStem)
+            result = result?.intersection(stemKeys) ?? stemKeys
+            if result!.isEmpty {
+                break
+            }
+        }
+        return result ?? []
+    }
+
+    private func keys(matchingStem queryStem: String) -> Set<Key> {
+        // Consistent with Searcher; nothing contains the empty string.
+        guard queryStem.count > 0 else {
+            return []
+        }
+        guard queryStem.count > maxGramLength else {
+            return gramKeys[queryStem] ?? []
+        }
+
+        // Start with the rarest trigram.
+        let trigramKeys = grams(string: queryStem, length: maxGramLength).map { gramKeys[$0] ?? [] }.sorted {
+            $0.count < $1.count
+        }
+        var candidates = trigramKeys.first ?? []
+        for keys in trigramKeys.dropFirst() {
+            if candidates.isEmpty {
+                break
+            }
+            candidates.formIntersection(keys)
+        }
+
+        return candidates.filter { key in
+            guard let itemString = itemStrings[key] else {
+                return false
+            }
+            return itemString.contains(queryStem)
+        }
+    }
+
+    private func grams(string: String) -> Set<String> {
+        var result = Set<String>()
+        for length in 1...maxGramLength {
+            result.formUnion(grams(string: string, length: length))
+        }
+        return result
+    }
+
+    private func grams(string: String, length: Int) -> Set<String> {
+        let characters = Array(string)
+        guard characters.count >= length else {
+            return []
+        }
+        var result = Set<String>()
+        for start in 0...(characters.count - length) {
+            result.insert(String(characters[start..<(start + length)]))
+        }
+        return result
+    }
+}
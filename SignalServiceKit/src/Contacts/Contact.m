@@ -176,12 +176,13 @@ NS_ASSUME_NONNULL_BEGIN
 {
     OWSAssert(self.phoneNumberNameMap);
 
+    NSDictionary<NSString *, NSArray<PhoneNumber *> *> *phoneNumbersForText =
+        [PhoneNumber tryParsePhoneNumbersFromUserSpecifiedTexts:userTextPhoneNumbers
+                                              clientPhoneNumber:[TSAccountManager localNumber]];
     NSMutableDictionary<NSString *, PhoneNumber *> *parsedPhoneNumberMap = [NSMutableDictionary new];
     NSMutableArray<PhoneNumber *> *parsedPhoneNumbers = [NSMutableArray new];
     for (NSString *phoneNumberString in userTextPhoneNumbers) {
-        for (PhoneNumber *phoneNumber in
-            [PhoneNumber tryParsePhoneNumbersFromsUserSpecifiedText:phoneNumberString
-                                                  clientPhoneNumber:[TSAccountManager localNumber]]) {
+        for (PhoneNumber *phoneNumber in phoneNumbersForText[phoneNumberString]) {
             [parsedPhoneNumbers addObject:phoneNumber];
             parsedPhoneNumberMap[phoneNumber.toE164] = phoneNumber;
             NSString *phoneNumberName = phoneNumberNameMap[phoneNumberString];
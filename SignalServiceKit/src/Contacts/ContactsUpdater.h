@@ -7,11 +7,14 @@
 NS_ASSUME_NONNULL_BEGIN
 
 @class Contact;
+@class TSNetworkManager;
 
 @interface ContactsUpdater : NSObject
 
 + (instancetype)sharedUpdater;
 
+- (instancetype)initWithNetworkManager:(TSNetworkManager *)networkManager NS_DESIGNATED_INITIALIZER;
+
 - (nullable SignalRecipient *)synchronousLookup:(NSString *)identifier error:(NSError **)error;
 
 // This asynchronously tries to verify whether or not a contact id
@@ -37,6 +40,15 @@ NS_ASSUME_NONNULL_BEGIN
                                               success:(void (^)(void))success
                                               failure:(void (^)(NSError *error))failure;
 
+// Phone numbers which were intersected by the last successful intersection
+// aren't sent again, unless a full intersection is due or forceFullIntersection
+// is set.  Only a full intersection removes recipients which are no longer
+// registered.
+- (void)updateSignalContactIntersectionWithABContacts:(NSArray<Contact *> *)abContacts
+                                forceFullIntersection:(BOOL)forceFullIntersection
+                                              success:(void (^)(void))success
+                                              failure:(void (^)(NSError *error))failure;
+
 @end
 
 NS_ASSUME_NONNULL_END
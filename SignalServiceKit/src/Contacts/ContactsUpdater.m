@@ -5,6 +5,7 @@
 #import "ContactsUpdater.h"
 #import "Contact.h"
 #import "Cryptography.h"
+#import "NSDate+OWS.h"
 #import "OWSError.h"
 #import "PhoneNumber.h"
 #import "TSContactsIntersectionRequest.h"
@@ -14,6 +15,28 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+NSString *const kContactsUpdaterCollection = @"kContactsUpdaterCollection";
+NSString *const kContactsUpdaterLastFullIntersectionDateKey = @"kContactsUpdaterLastFullIntersectionDateKey";
+NSString *const kContactsUpdaterIntersectedPhoneNumbersKey = @"kContactsUpdaterIntersectedPhoneNumbersKey";
+
+static const NSTimeInterval kFullIntersectionInterval = kDayInterval;
+// Large address books are split into several concurrent requests.
+static const NSUInteger kMaxHashesPerIntersectionRequest = 2048;
+// Bounds the size (and duration) of any one transaction.
+static const NSUInteger kMaxRecipientsPerTransaction = 250;
+
+@interface ContactsUpdater ()
+
+@property (nonatomic, readonly) TSNetworkManager *networkManager;
+@property (nonatomic, readonly) YapDatabaseConnection *dbConnection;
+
+// Maps phone numbers to their hashes.
+@property (nonatomic, readonly) NSCache<NSString *, NSString *> *hashCache;
+
+@end
+
+#pragma mark -
+
 @implementation ContactsUpdater
 
 + (instancetype)sharedUpdater {
@@ -25,14 +48,24 @@ NS_ASSUME_NONNULL_BEGIN
     return sharedInstance;
 }
 
-
 - (instancetype)init
+{
+    return [self initWithNetworkManager:[TSNetworkManager sharedManager]];
+}
+
+- (instancetype)initWithNetworkManager:(TSNetworkManager *)networkManager
 {
     self = [super init];
     if (!self) {
         return self;
     }
 
+    OWSAssert(networkManager);
+
+    _networkManager = networkManager;
+    _dbConnection = [TSStorageManager sharedManager].newDatabaseConnection;
+    _hashCache = [NSCache new];
+
     OWSSingletonAssert();
 
     return self;
@@ -114,112 +147,228 @@ NS_ASSUME_NONNULL_BEGIN
                                               success:(void (^)(void))success
                                               failure:(void (^)(NSError *error))failure
 {
-    NSMutableSet<NSString *> *abPhoneNumbers = [NSMutableSet set];
+    [self updateSignalContactIntersectionWithABContacts:abContacts
+                                  forceFullIntersection:NO
+                                                success:success
+                                                failure:failure];
+}
 
-    for (Contact *contact in abContacts) {
-        for (PhoneNumber *phoneNumber in contact.parsedPhoneNumbers) {
-            [abPhoneNumbers addObject:phoneNumber.toE164];
+- (void)updateSignalContactIntersectionWithABContacts:(NSArray<Contact *> *)abContacts
+                                forceFullIntersection:(BOOL)forceFullIntersection
+                                              success:(void (^)(void))success
+                                              failure:(void (^)(NSError *error))failure
+{
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSMutableSet<NSString *> *abPhoneNumbers = [NSMutableSet set];
+        for (Contact *contact in abContacts) {
+            for (PhoneNumber *phoneNumber in contact.parsedPhoneNumbers) {
+                [abPhoneNumbers addObject:phoneNumber.toE164];
+            }
         }
-    }
 
-    NSMutableSet *recipientIds = [NSMutableSet set];
-    [TSStorageManager.dbReadConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
-        NSArray *allRecipientKeys = [transaction allKeysInCollection:[SignalRecipient collection]];
-        [recipientIds addObjectsFromArray:allRecipientKeys];
-    }];
+        __block NSDate *_Nullable lastFullIntersectionDate;
+        __block NSSet<NSString *> *_Nullable intersectedPhoneNumbers;
+        NSMutableSet<NSString *> *recipientIds = [NSMutableSet set];
+        [self.dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+            lastFullIntersectionDate = [transaction objectForKey:kContactsUpdaterLastFullIntersectionDateKey
+                                                    inCollection:kContactsUpdaterCollection];
+            intersectedPhoneNumbers = [transaction objectForKey:kContactsUpdaterIntersectedPhoneNumbersKey
+                                                   inCollection:kContactsUpdaterCollection];
+        }];
 
-    NSMutableSet<NSString *> *allContacts = [[abPhoneNumbers setByAddingObjectsFromSet:recipientIds] mutableCopy];
+        BOOL isFullIntersection = (forceFullIntersection || !lastFullIntersectionDate || !intersectedPhoneNumbers
+            || fabs([lastFullIntersectionDate timeIntervalSinceNow]) > kFullIntersectionInterval);
+
+        NSMutableSet<NSString *> *phoneNumbersToIntersect;
+        if (isFullIntersection) {
+            [self.dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+                [recipientIds addObjectsFromArray:[transaction allKeysInCollection:[SignalRecipient collection]]];
+            }];
+            phoneNumbersToIntersect = [[abPhoneNumbers setByAddingObjectsFromSet:recipientIds] mutableCopy];
+        } else {
+            phoneNumbersToIntersect = [abPhoneNumbers mutableCopy];
+            [phoneNumbersToIntersect minusSet:intersectedPhoneNumbers];
+        }
 
-    [self contactIntersectionWithSet:allContacts
-                             success:^(NSSet<NSString *> *matchedIds) {
-                                 [recipientIds minusSet:matchedIds];
+        DDLogInfo(@"%@ %@ intersection of %lu phone numbers (%lu contact phone numbers).",
+            self.logTag,
+            (isFullIntersection ? @"full" : @"incremental"),
+            (unsigned long)phoneNumbersToIntersect.count,
+            (unsigned long)abPhoneNumbers.count);
 
-                                 // Cleaning up unregistered identifiers
-                                 [TSStorageManager.dbReadWriteConnection
-                                     readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
-                                         for (NSString *identifier in recipientIds) {
-                                             SignalRecipient *recipient =
-                                                 [SignalRecipient fetchObjectWithUniqueID:identifier
-                                                                              transaction:transaction];
+        if (phoneNumbersToIntersect.count < 1) {
+            success();
+            return;
+        }
 
-                                             [recipient removeWithTransaction:transaction];
+        [self contactIntersectionWithSet:phoneNumbersToIntersect
+                                 success:^(NSSet<NSString *> *matchedIds) {
+                                     if (isFullIntersection) {
+                                         // Cleaning up unregistered identifiers
+                                         [recipientIds minusSet:matchedIds];
+                                         [self removeRecipientIds:recipientIds.allObjects];
+                                     }
+
+                                     [self.dbConnection readWriteWithBlock:^(
+                                         YapDatabaseReadWriteTransaction *transaction) {
+                                         NSSet<NSString *> *newIntersectedPhoneNumbers = phoneNumbersToIntersect;
+                                         if (isFullIntersection) {
+                                             [transaction setObject:[NSDate new]
+                                                             forKey:kContactsUpdaterLastFullIntersectionDateKey
+                                                       inCollection:kContactsUpdaterCollection];
+                                         } else {
+                                             newIntersectedPhoneNumbers =
+                                                 [intersectedPhoneNumbers setByAddingObjectsFromSet:phoneNumbersToIntersect];
                                          }
+                                         [transaction setObject:newIntersectedPhoneNumbers
+                                                         forKey:kContactsUpdaterIntersectedPhoneNumbersKey
+                                                   inCollection:kContactsUpdaterCollection];
                                      }];
 
-                                 DDLogInfo(@"%@ successfully intersected contacts.", self.logTag);
-                                 success();
-                             }
-                             failure:failure];
+                                     DDLogInfo(@"%@ successfully intersected contacts.", self.logTag);
+                                     success();
+                                 }
+                                 failure:failure];
+    });
+}
+
+- (void)removeRecipientIds:(NSArray<NSString *> *)recipientIds
+{
+    for (NSUInteger start = 0; start < recipientIds.count; start += kMaxRecipientsPerTransaction) {
+        NSArray<NSString *> *batch = [recipientIds
+            subarrayWithRange:NSMakeRange(start, MIN(kMaxRecipientsPerTransaction, recipientIds.count - start))];
+        [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            for (NSString *identifier in batch) {
+                SignalRecipient *recipient =
+                    [SignalRecipient fetchObjectWithUniqueID:identifier transaction:transaction];
+
+                [recipient removeWithTransaction:transaction];
+            }
+        }];
+    }
+}
+
+- (NSString *)hashForPhoneNumber:(NSString *)phoneNumber
+{
+    NSString *_Nullable hash = [self.hashCache objectForKey:phoneNumber];
+    if (!hash) {
+        hash = [Cryptography truncatedSHA1Base64EncodedWithoutPadding:phoneNumber];
+        [self.hashCache setObject:hash forKey:phoneNumber];
+    }
+    return hash;
 }
 
 - (void)contactIntersectionWithSet:(NSSet<NSString *> *)idSet
                            success:(void (^)(NSSet<NSString *> *matchedIds))success
                            failure:(void (^)(NSError *error))failure {
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-      NSMutableDictionary *phoneNumbersByHashes = [NSMutableDictionary dictionary];
-      for (NSString *identifier in idSet) {
-          [phoneNumbersByHashes setObject:identifier
-                                   forKey:[Cryptography truncatedSHA1Base64EncodedWithoutPadding:identifier]];
-      }
-      NSArray *hashes = [phoneNumbersByHashes allKeys];
-
-      TSRequest *request = [[TSContactsIntersectionRequest alloc] initWithHashesArray:hashes];
-      [[TSNetworkManager sharedManager] makeRequest:request
-          success:^(NSURLSessionDataTask *tsTask, id responseDict) {
-              NSMutableDictionary *attributesForIdentifier = [NSMutableDictionary dictionary];
-              NSArray *contactsArray = [(NSDictionary *)responseDict objectForKey:@"contacts"];
-
-              // Map attributes to phone numbers
-              if (contactsArray) {
-                  for (NSDictionary *dict in contactsArray) {
-                      NSString *hash = [dict objectForKey:@"token"];
-                      NSString *identifier = [phoneNumbersByHashes objectForKey:hash];
-
-                      if (!identifier) {
-                          DDLogWarn(@"%@ An interesecting hash wasn't found in the mapping.", self.logTag);
-                          break;
-                      }
-
-                      [attributesForIdentifier setObject:dict forKey:identifier];
-                  }
-              }
-
-              // Insert or update contact attributes
-              [TSStorageManager.dbReadWriteConnection
-                  readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
-                      for (NSString *identifier in attributesForIdentifier) {
-                          SignalRecipient *recipient = [SignalRecipient recipientWithTextSecureIdentifier:identifier
-                                                                                          withTransaction:transaction];
-                          if (!recipient) {
-                              recipient = [[SignalRecipient alloc] initWithTextSecureIdentifier:identifier relay:nil];
-                          }
-
-                          NSDictionary *attributes = [attributesForIdentifier objectForKey:identifier];
-
-                          recipient.relay = attributes[@"relay"];
-
-                          [recipient saveWithTransaction:transaction];
-                      }
-                  }];
-
-              success([NSSet setWithArray:attributesForIdentifier.allKeys]);
-          }
-          failure:^(NSURLSessionDataTask *task, NSError *error) {
-              if (!IsNSErrorNetworkFailure(error)) {
-                  OWSProdError([OWSAnalyticsEvents contactsErrorContactsIntersectionFailed]);
-              }
-
-              NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
-              if (response.statusCode == 413) {
-                  failure(OWSErrorWithCodeDescription(
-                      OWSErrorCodeContactsUpdaterRateLimit, @"Contacts Intersection Rate Limit"));
-              } else {
-                  failure(error);
-              }
-          }];
+        NSMutableDictionary<NSString *, NSString *> *phoneNumbersByHashes = [NSMutableDictionary dictionary];
+        for (NSString *identifier in idSet) {
+            [phoneNumbersByHashes setObject:identifier forKey:[self hashForPhoneNumber:identifier]];
+        }
+        NSArray<NSString *> *hashes = [phoneNumbersByHashes allKeys];
+
+        // The following state should only be accessed while synchronized on it.
+        NSMutableDictionary<NSString *, NSDictionary *> *attributesForIdentifier = [NSMutableDictionary dictionary];
+        __block NSError *_Nullable firstError;
+
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger start = 0; start < hashes.count; start += kMaxHashesPerIntersectionRequest) {
+            NSArray<NSString *> *chunk = [hashes
+                subarrayWithRange:NSMakeRange(start, MIN(kMaxHashesPerIntersectionRequest, hashes.count - start))];
+
+            dispatch_group_enter(group);
+            TSRequest *request = [[TSContactsIntersectionRequest alloc] initWithHashesArray:chunk];
+            [self.networkManager makeRequest:request
+                success:^(NSURLSessionDataTask *tsTask, id responseDict) {
+                    NSArray *contactsArray = [(NSDictionary *)responseDict objectForKey:@"contacts"];
+
+                    // Map attributes to phone numbers
+                    @synchronized(attributesForIdentifier)
+                    {
+                        for (NSDictionary *dict in contactsArray) {
+                            NSString *hash = [dict objectForKey:@"token"];
+                            NSString *identifier = [phoneNumbersByHashes objectForKey:hash];
+
+                            if (!identifier) {
+                                DDLogWarn(@"%@ An interesecting hash wasn't found in the mapping.", self.logTag);
+                                break;
+                            }
+
+                            [attributesForIdentifier setObject:dict forKey:identifier];
+                        }
+                    }
+                    dispatch_group_leave(group);
+                }
+                failure:^(NSURLSessionDataTask *task, NSError *error) {
+                    if (!IsNSErrorNetworkFailure(error)) {
+                        OWSProdError([OWSAnalyticsEvents contactsErrorContactsIntersectionFailed]);
+                    }
+
+                    NSError *intersectionError = error;
+                    NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
+                    if (response.statusCode == 413) {
+                        intersectionError = OWSErrorWithCodeDescription(
+                            OWSErrorCodeContactsUpdaterRateLimit, @"Contacts Intersection Rate Limit");
+                    }
+                    @synchronized(attributesForIdentifier)
+                    {
+                        if (!firstError) {
+                            firstError = intersectionError;
+                        }
+                    }
+                    dispatch_group_leave(group);
+                }];
+        }
+
+        dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            if (firstError) {
+                failure(firstError);
+                return;
+            }
+
+            [self saveRecipientsWithAttributes:attributesForIdentifier];
+
+            success([NSSet setWithArray:attributesForIdentifier.allKeys]);
+        });
     });
 }
 
+// Insert or update contact attributes
+- (void)saveRecipientsWithAttributes:(NSDictionary<NSString *, NSDictionary *> *)attributesForIdentifier
+{
+    NSArray<NSString *> *identifiers = attributesForIdentifier.allKeys;
+    __block NSUInteger savedCount = 0;
+    for (NSUInteger start = 0; start < identifiers.count; start += kMaxRecipientsPerTransaction) {
+        NSArray<NSString *> *batch = [identifiers
+            subarrayWithRange:NSMakeRange(start, MIN(kMaxRecipientsPerTransaction, identifiers.count - start))];
+        [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            for (NSString *identifier in batch) {
+                NSDictionary *attributes = [attributesForIdentifier objectForKey:identifier];
+                NSString *_Nullable relay = attributes[@"relay"];
+
+                SignalRecipient *recipient =
+                    [SignalRecipient recipientWithTextSecureIdentifier:identifier withTransaction:transaction];
+                if (!recipient) {
+                    recipient = [[SignalRecipient alloc] initWithTextSecureIdentifier:identifier relay:nil];
+                } else if (recipient.relay == relay || [recipient.relay isEqual:relay]) {
+                    // Unchanged, no need to save.
+                    continue;
+                }
+
+                recipient.relay = relay;
+
+                [recipient saveWithTransaction:transaction];
+                savedCount++;
+            }
+        }];
+    }
+    DDLogInfo(@"%@ saved %lu of %lu intersected recipients.",
+        self.logTag,
+        (unsigned long)savedCount,
+        (unsigned long)identifiers.count);
+}
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -26,6 +26,17 @@
 + (NSArray<PhoneNumber *> *)tryParsePhoneNumbersFromsUserSpecifiedText:(NSString *)text
                                                      clientPhoneNumber:(NSString *)clientPhoneNumber;
 
+// Equivalent to tryParsePhoneNumbersFromsUserSpecifiedText:clientPhoneNumber: for
+// each of the texts, but parses each distinct text only once.
+//
+// Results are cached, so parsing a large address book up front makes subsequent
+// parses of the same numbers (e.g. by Contact) cheap.
++ (NSDictionary<NSString *, NSArray<PhoneNumber *> *> *)tryParsePhoneNumbersFromUserSpecifiedTexts:
+                                                            (NSArray<NSString *> *)texts
+                                                                                 clientPhoneNumber:
+                                                                                     (NSString *)clientPhoneNumber
+    NS_SWIFT_NAME(tryParsePhoneNumbers(fromUserSpecifiedTexts:clientPhoneNumber:));
+
 + (NSString *)removeFormattingCharacters:(NSString *)inputString;
 + (NSString *)bestEffortFormatPartialUserSpecifiedTextToLookLikeAPhoneNumber:(NSString *)input;
 + (NSString *)bestEffortFormatPartialUserSpecifiedTextToLookLikeAPhoneNumber:(NSString *)input
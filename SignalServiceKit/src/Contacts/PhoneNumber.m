@@ -13,6 +13,9 @@
 static NSString *const RPDefaultsKeyPhoneNumberString    = @"RPDefaultsKeyPhoneNumberString";
 static NSString *const RPDefaultsKeyPhoneNumberCanonical = @"RPDefaultsKeyPhoneNumberCanonical";
 
+// Large enough to hold every distinct number in a large address book.
+static const NSUInteger kMaxCachedPhoneNumberTexts = 32 * 1024;
+
 @interface PhoneNumber ()
 
 @property (nonatomic, readonly) NBPhoneNumber *phoneNumber;
@@ -36,10 +39,35 @@ static NSString *const RPDefaultsKeyPhoneNumberCanonical = @"RPDefaultsKeyPhoneN
     return self;
 }
 
+// Maps (text, region) to a PhoneNumber, or to NSNull if the text can't be parsed.
++ (NSCache<NSString *, id> *)phoneNumberCache
+{
+    static NSCache *cache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [NSCache new];
+        cache.countLimit = kMaxCachedPhoneNumberTexts;
+    });
+    return cache;
+}
+
 + (PhoneNumber *)phoneNumberFromText:(NSString *)text andRegion:(NSString *)regionCode {
     OWSAssert(text != nil);
     OWSAssert(regionCode != nil);
 
+    NSString *cacheKey = [NSString stringWithFormat:@"%@\n%@", text, regionCode];
+    id cachedResult = [self.phoneNumberCache objectForKey:cacheKey];
+    if (cachedResult) {
+        return ([cachedResult isKindOfClass:[PhoneNumber class]] ? cachedResult : nil);
+    }
+
+    PhoneNumber *result = [self parsePhoneNumberFromText:text andRegion:regionCode];
+    [self.phoneNumberCache setObject:(result ?: [NSNull null]) forKey:cacheKey];
+    return result;
+}
+
++ (PhoneNumber *)parsePhoneNumberFromText:(NSString *)text andRegion:(NSString *)regionCode
+{
     PhoneNumberUtil *phoneUtil = [PhoneNumberUtil sharedUtil];
 
     NSError *parseError   = nil;
@@ -187,8 +215,50 @@ static NSString *const RPDefaultsKeyPhoneNumberCanonical = @"RPDefaultsKeyPhoneN
     return result;
 }
 
+// Maps (text, client phone number, default region) to an array of PhoneNumbers.
++ (NSCache<NSString *, NSArray<PhoneNumber *> *> *)userSpecifiedTextCache
+{
+    static NSCache *cache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [NSCache new];
+        cache.countLimit = kMaxCachedPhoneNumberTexts;
+    });
+    return cache;
+}
+
++ (NSDictionary<NSString *, NSArray<PhoneNumber *> *> *)tryParsePhoneNumbersFromUserSpecifiedTexts:
+                                                            (NSArray<NSString *> *)texts
+                                                                                 clientPhoneNumber:
+                                                                                     (NSString *)clientPhoneNumber
+{
+    NSMutableDictionary<NSString *, NSArray<PhoneNumber *> *> *result = [NSMutableDictionary new];
+    for (NSString *text in texts) {
+        if (result[text]) {
+            continue;
+        }
+        result[text] = [self tryParsePhoneNumbersFromsUserSpecifiedText:text clientPhoneNumber:clientPhoneNumber];
+    }
+    return [result copy];
+}
+
 + (NSArray<PhoneNumber *> *)tryParsePhoneNumbersFromsUserSpecifiedText:(NSString *)text
                                                      clientPhoneNumber:(NSString *)clientPhoneNumber
+{
+    OWSAssert(text != nil);
+
+    NSString *cacheKey =
+        [NSString stringWithFormat:@"%@\n%@\n%@", text, clientPhoneNumber ?: @"", [self defaultCountryCode]];
+    NSArray<PhoneNumber *> *result = [self.userSpecifiedTextCache objectForKey:cacheKey];
+    if (!result) {
+        result = [self parsePhoneNumbersFromUserSpecifiedText:text clientPhoneNumber:clientPhoneNumber] ?: @[];
+        [self.userSpecifiedTextCache setObject:result forKey:cacheKey];
+    }
+    return result;
+}
+
++ (NSArray<PhoneNumber *> *)parsePhoneNumbersFromUserSpecifiedText:(NSString *)text
+                                                          clientPhoneNumber:(NSString *)clientPhoneNumber
 {
     NSMutableArray<PhoneNumber *> *result =
         [[self tryParsePhoneNumbersFromNormalizedText:text clientPhoneNumber:clientPhoneNumber] mutableCopy];
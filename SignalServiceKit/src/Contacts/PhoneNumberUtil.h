@@ -30,9 +30,15 @@
 
 + (instancetype)sharedUtil;
 
+// Thread-safe.  Results, including failures, are cached by (numberToParse, defaultRegion).
 - (NBPhoneNumber *)parse:(NSString *)numberToParse defaultRegion:(NSString *)defaultRegion error:(NSError **)error;
 - (NSString *)format:(NBPhoneNumber *)phoneNumber
         numberFormat:(NBEPhoneNumberFormat)numberFormat
                error:(NSError **)error;
 
+#pragma mark - Metrics
+
+@property (atomic, readonly) NSUInteger parseCacheHitCount;
+@property (atomic, readonly) NSUInteger parseCacheMissCount;
+
 @end
@@ -7,10 +7,19 @@
 #import "FunctionalUtil.h"
 #import <libPhoneNumber_iOS/NBPhoneNumber.h>
 
+// Large enough to hold every distinct number in a large address book,
+// parsed against a handful of regions.
+static const NSUInteger kMaxCachedParses = 64 * 1024;
+
 @interface PhoneNumberUtil ()
 
 @property (nonatomic, readonly) NSMutableDictionary *countryCodesFromCallingCodeCache;
-@property (nonatomic, readonly) NSCache *parsedPhoneNumberCache;
+// Values are either an NBPhoneNumber or the NSError with which parsing failed.
+@property (nonatomic, readonly) NSCache<NSString *, id> *parsedPhoneNumberCache;
+
+// The following state should only be accessed while synchronized on self.
+@property (atomic) NSUInteger parseCacheHitCount;
+@property (atomic) NSUInteger parseCacheMissCount;
 
 @end
 
@@ -34,6 +43,7 @@
         _nbPhoneNumberUtil = [[NBPhoneNumberUtil alloc] init];
         _countryCodesFromCallingCodeCache = [NSMutableDictionary new];
         _parsedPhoneNumberCache = [NSCache new];
+        _parsedPhoneNumberCache.countLimit = kMaxCachedParses;
 
         OWSSingletonAssert();
     }
@@ -45,30 +55,56 @@
                     defaultRegion:(NSString *)defaultRegion
                             error:(NSError **)error
 {
-    NSString *hashKey = [NSString stringWithFormat:@"numberToParse:%@defaultRegion:%@", numberToParse, defaultRegion];
-
-    NBPhoneNumber *result = [self.parsedPhoneNumberCache objectForKey:hashKey];
-
-    if (!result) {
-        result = [self.nbPhoneNumberUtil parse:numberToParse defaultRegion:defaultRegion error:error];
-        if (error && *error) {
-            OWSAssert(!result);
+    NSString *cacheKey = [NSString stringWithFormat:@"%@\n%@", numberToParse, defaultRegion];
+
+    id _Nullable cachedResult = [self.parsedPhoneNumberCache objectForKey:cacheKey];
+    [self didLookupParseCacheWithHit:cachedResult != nil];
+    if (cachedResult) {
+        if ([cachedResult isKindOfClass:[NSError class]]) {
+            if (error) {
+                *error = cachedResult;
+            }
             return nil;
         }
+        return cachedResult;
+    }
+
+    NSError *parseError;
+    NBPhoneNumber *_Nullable result =
+        [self.nbPhoneNumberUtil parse:numberToParse defaultRegion:defaultRegion error:&parseError];
+    if (parseError) {
+        OWSAssert(!result);
+        [self.parsedPhoneNumberCache setObject:parseError forKey:cacheKey];
+        if (error) {
+            *error = parseError;
+        }
+        return nil;
+    }
 
-        OWSAssert(result);
+    OWSAssert(result);
+    if (result) {
+        [self.parsedPhoneNumberCache setObject:result forKey:cacheKey];
+    }
+    return result;
+}
 
-        if (result) {
-            [self.parsedPhoneNumberCache setObject:result forKey:hashKey];
+- (void)didLookupParseCacheWithHit:(BOOL)isHit
+{
+    @synchronized(self)
+    {
+        if (isHit) {
+            self.parseCacheHitCount++;
         } else {
-            [self.parsedPhoneNumberCache setObject:[NSNull null] forKey:hashKey];
+            self.parseCacheMissCount++;
         }
-    }
 
-    if ([result class] == [NSNull class]) {
-        return nil;
-    } else {
-        return result;
+        NSUInteger lookupCount = self.parseCacheHitCount + self.parseCacheMissCount;
+        if (lookupCount % 10000 == 0) {
+            DDLogInfo(@"%@ %lu parses, cache hit rate: %.2f",
+                self.logTag,
+                (unsigned long)lookupCount,
+                self.parseCacheHitCount / (double)lookupCount);
+        }
     }
 }
 
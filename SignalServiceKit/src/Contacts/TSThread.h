@@ -100,6 +100,29 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)updateWithLastMessage:(TSInteraction *)lastMessage transaction:(YapDatabaseReadWriteTransaction *)transaction;
 
+#pragma mark Coalesced Updates
+
+/**
+ *  Saving or removing an interaction updates its thread (and the thread's inbox summary).
+ *  Within block, those updates are deferred and coalesced so that each affected thread
+ *  is written at most once, when block returns, rather than once per interaction.
+ *
+ *  Use when saving or removing many interactions in one transaction.  May be nested;
+ *  the updates are performed when the outermost block returns.
+ *
+ *  @param transaction Database transaction; all interaction saves and removals within
+ *                     block should use it.
+ */
++ (void)performWithCoalescedThreadUpdatesWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
+                                                   block:(void (^)(void))block;
+
+// These are invoked by TSInteraction.  Outside of
+// performWithCoalescedThreadUpdatesWithTransaction:block:, the thread is updated immediately.
++ (void)interactionWasSaved:(TSInteraction *)interaction transaction:(YapDatabaseReadWriteTransaction *)transaction;
++ (void)touchThreadWithId:(NSString *)threadId
+        updateInboxSummary:(BOOL)updateInboxSummary
+               transaction:(YapDatabaseReadWriteTransaction *)transaction;
+
 #pragma mark Archival
 
 /**
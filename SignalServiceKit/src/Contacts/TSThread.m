@@ -4,6 +4,7 @@
 
 #import "TSThread.h"
 #import "OWSReadTracking.h"
+#import "OWSThreadInboxSummary.h"
 #import "TSDatabaseView.h"
 #import "TSIncomingMessage.h"
 #import "TSInfoMessage.h"
@@ -12,9 +13,68 @@
 #import "TSOutgoingMessage.h"
 #import "TSStorageManager.h"
 #import <YapDatabase/YapDatabase.h>
+#import <objc/runtime.h>
 
 NS_ASSUME_NONNULL_BEGIN
 
+static void *kTransaction_PendingThreadUpdates = &kTransaction_PendingThreadUpdates;
+
+@interface OWSPendingThreadUpdate : NSObject
+
+// The latest saved interaction which should appear in the inbox, if any.
+@property (nonatomic, nullable) TSInteraction *lastMessage;
+@property (nonatomic) BOOL needsTouch;
+@property (nonatomic) BOOL needsInboxSummaryUpdate;
+
+@end
+
+@implementation OWSPendingThreadUpdate
+
+@end
+
+#pragma mark -
+
+// The thread updates deferred within a transaction, keyed by thread id.
+@interface OWSPendingThreadUpdates : NSObject
+
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, OWSPendingThreadUpdate *> *updates;
+@property (nonatomic) NSUInteger nestingDepth;
+@property (nonatomic) NSUInteger interactionCount;
+
+@end
+
+@implementation OWSPendingThreadUpdates
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _updates = [NSMutableDictionary new];
+
+    return self;
+}
+
+- (OWSPendingThreadUpdate *)updateForThreadId:(NSString *)threadId
+{
+    OWSAssert(threadId.length > 0);
+
+    self.interactionCount++;
+
+    OWSPendingThreadUpdate *_Nullable update = self.updates[threadId];
+    if (!update) {
+        update = [OWSPendingThreadUpdate new];
+        self.updates[threadId] = update;
+    }
+    return update;
+}
+
+@end
+
+#pragma mark -
+
 @interface TSThread ()
 
 @property (nonatomic) NSDate *creationDate;
@@ -69,6 +129,8 @@ NS_ASSUME_NONNULL_BEGIN
     for (NSString *interactionId in interactionIds) {
         [transaction removeObjectForKey:interactionId inCollection:[[TSInteraction class] collection]];
     }
+
+    [OWSThreadInboxSummary removeSummaryForThreadId:self.uniqueId transaction:transaction];
 }
 
 #pragma mark To be subclassed.
@@ -235,9 +297,15 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)markAllAsReadWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
 {
-    for (id<OWSReadTracking> message in [self unseenMessagesWithTransaction:transaction]) {
-        [message markAsReadWithTransaction:transaction sendReadReceipt:YES updateExpiration:YES];
-    }
+    [TSThread performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                         block:^{
+                                                             for (id<OWSReadTracking> message in
+                                                                 [self unseenMessagesWithTransaction:transaction]) {
+                                                                 [message markAsReadWithTransaction:transaction
+                                                                                    sendReadReceipt:YES
+                                                                                   updateExpiration:YES];
+                                                             }
+                                                         }];
 
     // Just to be defensive, we'll also check for unread messages.
     OWSAssert([self unseenMessagesWithTransaction:transaction].count < 1);
@@ -321,8 +389,18 @@ NS_ASSUME_NONNULL_BEGIN
     OWSAssert(lastMessage);
     OWSAssert(transaction);
 
+    if ([self applyLastMessage:lastMessage]) {
+        [self saveWithTransaction:transaction];
+    }
+}
+
+// Returns YES IFF the thread needs to be saved.
+- (BOOL)applyLastMessage:(TSInteraction *)lastMessage
+{
+    OWSAssert(lastMessage);
+
     if (![self.class shouldInteractionAppearInInbox:lastMessage]) {
-        return;
+        return NO;
     }
 
     self.hasEverHadMessage = YES;
@@ -330,9 +408,120 @@ NS_ASSUME_NONNULL_BEGIN
     NSDate *lastMessageDate = [lastMessage dateForSorting];
     if (!_lastMessageDate || [lastMessageDate timeIntervalSinceDate:self.lastMessageDate] > 0) {
         _lastMessageDate = lastMessageDate;
+        return YES;
+    }
+    return NO;
+}
 
-        [self saveWithTransaction:transaction];
+#pragma mark Coalesced Updates
+
++ (nullable OWSPendingThreadUpdates *)pendingThreadUpdatesForTransaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    return objc_getAssociatedObject(transaction, kTransaction_PendingThreadUpdates);
+}
+
++ (void)performWithCoalescedThreadUpdatesWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
+                                                   block:(void (^)(void))block
+{
+    OWSAssert(transaction);
+    OWSAssert(block);
+
+    OWSPendingThreadUpdates *_Nullable pendingUpdates = [self pendingThreadUpdatesForTransaction:transaction];
+    if (!pendingUpdates) {
+        pendingUpdates = [OWSPendingThreadUpdates new];
+        objc_setAssociatedObject(
+            transaction, kTransaction_PendingThreadUpdates, pendingUpdates, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+
+    pendingUpdates.nestingDepth++;
+    block();
+    pendingUpdates.nestingDepth--;
+
+    if (pendingUpdates.nestingDepth > 0) {
+        return;
     }
+
+    objc_setAssociatedObject(transaction, kTransaction_PendingThreadUpdates, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    [self performPendingThreadUpdates:pendingUpdates transaction:transaction];
+}
+
++ (void)performPendingThreadUpdates:(OWSPendingThreadUpdates *)pendingUpdates
+                        transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(pendingUpdates);
+    OWSAssert(transaction);
+
+    NSUInteger threadWriteCount = 0;
+    for (NSString *threadId in pendingUpdates.updates) {
+        OWSPendingThreadUpdate *update = pendingUpdates.updates[threadId];
+
+        BOOL didSave = NO;
+        if (update.lastMessage) {
+            TSThread *_Nullable thread = [TSThread fetchObjectWithUniqueID:threadId transaction:transaction];
+            if ([thread applyLastMessage:update.lastMessage]) {
+                [thread saveWithTransaction:transaction];
+                didSave = YES;
+                threadWriteCount++;
+            }
+        }
+        // Saving the thread notifies observers, so it doesn't need to be touched as well.
+        if (update.needsTouch && !didSave) {
+            [transaction touchObjectForKey:threadId inCollection:[TSThread collection]];
+            threadWriteCount++;
+        }
+        if (update.needsInboxSummaryUpdate) {
+            [OWSThreadInboxSummary updateSummaryForThreadId:threadId transaction:transaction];
+        }
+    }
+
+    DDLogDebug(@"%@ coalesced %lu interaction updates into %lu thread writes.",
+        self.logTag,
+        (unsigned long)pendingUpdates.interactionCount,
+        (unsigned long)threadWriteCount);
+}
+
++ (void)interactionWasSaved:(TSInteraction *)interaction transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(interaction);
+    OWSAssert(transaction);
+
+    OWSPendingThreadUpdates *_Nullable pendingUpdates = [self pendingThreadUpdatesForTransaction:transaction];
+    if (!pendingUpdates) {
+        TSThread *_Nullable thread =
+            [TSThread fetchObjectWithUniqueID:interaction.uniqueThreadId transaction:transaction];
+        [thread updateWithLastMessage:interaction transaction:transaction];
+        [OWSThreadInboxSummary updateSummaryForThreadId:interaction.uniqueThreadId transaction:transaction];
+        return;
+    }
+
+    OWSPendingThreadUpdate *update = [pendingUpdates updateForThreadId:interaction.uniqueThreadId];
+    update.needsInboxSummaryUpdate = YES;
+    if ([self shouldInteractionAppearInInbox:interaction]
+        && (!update.lastMessage ||
+               [interaction.dateForSorting timeIntervalSinceDate:update.lastMessage.dateForSorting] > 0)) {
+        update.lastMessage = interaction;
+    }
+}
+
++ (void)touchThreadWithId:(NSString *)threadId
+        updateInboxSummary:(BOOL)updateInboxSummary
+               transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(threadId.length > 0);
+    OWSAssert(transaction);
+
+    OWSPendingThreadUpdates *_Nullable pendingUpdates = [self pendingThreadUpdatesForTransaction:transaction];
+    if (!pendingUpdates) {
+        [transaction touchObjectForKey:threadId inCollection:[TSThread collection]];
+        if (updateInboxSummary) {
+            [OWSThreadInboxSummary updateSummaryForThreadId:threadId transaction:transaction];
+        }
+        return;
+    }
+
+    OWSPendingThreadUpdate *update = [pendingUpdates updateForThreadId:threadId];
+    update.needsTouch = YES;
+    update.needsInboxSummaryUpdate = update.needsInboxSummaryUpdate || updateInboxSummary;
 }
 
 #pragma mark Archival
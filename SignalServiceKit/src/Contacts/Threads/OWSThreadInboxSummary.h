@@ -0,0 +1,47 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "TSYapDatabaseObject.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+// A denormalized summary of a thread's interactions, keyed by thread id, so that
+// the inbox can configure its cells without querying the thread's interactions.
+//
+// Summaries are updated within the same transaction as the interaction
+// saves and removals which affect them, so they're always consistent with the
+// database views from which they're derived.
+//
+// Thread state (e.g. mute, last message date) and blocking state are not
+// included; they're already available in memory.
+@interface OWSThreadInboxSummary : TSYapDatabaseObject
+
+// The preview text of the latest interaction which should appear in the inbox.
+@property (nonatomic, readonly) NSString *snippet;
+
+// The number of unread messages in the thread.
+@property (nonatomic, readonly) NSUInteger unreadCount;
+
+// YES IFF the latest interaction in the thread is an unread incoming message.
+@property (nonatomic, readonly) BOOL hasUnreadMessages;
+
+- (instancetype)initWithUniqueId:(NSString *_Nullable)uniqueId NS_UNAVAILABLE;
+
+// Recomputes the summary of a thread from the database views and saves it,
+// if it has changed.
++ (void)updateSummaryForThreadId:(NSString *)threadId transaction:(YapDatabaseReadWriteTransaction *)transaction;
+
++ (void)removeSummaryForThreadId:(NSString *)threadId transaction:(YapDatabaseReadWriteTransaction *)transaction;
+
+// Builds summaries for any threads that don't have one.
++ (void)ensureSummariesWithTransaction:(YapDatabaseReadWriteTransaction *)transaction;
+
+// Returns the summaries for the given threads, keyed by thread id.  Threads without
+// a summary are omitted.
++ (NSDictionary<NSString *, OWSThreadInboxSummary *> *)summariesForThreadIds:(NSArray<NSString *> *)threadIds
+                                                                  transaction:(YapDatabaseReadTransaction *)transaction;
+
+@end
+
+NS_ASSUME_NONNULL_END
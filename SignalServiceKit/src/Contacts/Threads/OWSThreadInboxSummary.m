@@ -0,0 +1,154 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSThreadInboxSummary.h"
+#import "TSDatabaseView.h"
+#import "TSIncomingMessage.h"
+#import "TSInteraction.h"
+#import "TSThread.h"
+#import <YapDatabase/YapDatabase.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@implementation OWSThreadInboxSummary
+
+- (instancetype)initWithThreadId:(NSString *)threadId
+                         snippet:(NSString *)snippet
+                     unreadCount:(NSUInteger)unreadCount
+               hasUnreadMessages:(BOOL)hasUnreadMessages
+{
+    OWSAssert(threadId.length > 0);
+    OWSAssert(snippet);
+
+    self = [super initWithUniqueId:threadId];
+    if (!self) {
+        return self;
+    }
+
+    _snippet = snippet;
+    _unreadCount = unreadCount;
+    _hasUnreadMessages = hasUnreadMessages;
+
+    return self;
+}
+
+- (BOOL)isEqualToSummary:(OWSThreadInboxSummary *)other
+{
+    return (self.unreadCount == other.unreadCount && self.hasUnreadMessages == other.hasUnreadMessages &&
+        [self.snippet isEqualToString:other.snippet]);
+}
+
+#pragma mark -
+
++ (OWSThreadInboxSummary *)buildSummaryForThreadId:(NSString *)threadId
+                                       transaction:(YapDatabaseReadTransaction *)transaction
+{
+    OWSAssert(threadId.length > 0);
+    OWSAssert(transaction);
+
+    YapDatabaseViewTransaction *interactionsByThread = [transaction ext:TSMessageDatabaseViewExtensionName];
+    OWSAssert(interactionsByThread);
+
+    // Equivalent to -[TSThread hasUnreadMessages].
+    BOOL hasUnreadMessages = NO;
+    TSInteraction *_Nullable lastInteraction = [interactionsByThread lastObjectInGroup:threadId];
+    if ([lastInteraction isKindOfClass:[TSIncomingMessage class]]) {
+        hasUnreadMessages = ![(TSIncomingMessage *)lastInteraction wasRead];
+    }
+
+    // Equivalent to -[TSThread lastMessageLabel].
+    __block TSInteraction *_Nullable lastInboxInteraction = nil;
+    [interactionsByThread
+        enumerateRowsInGroup:threadId
+                 withOptions:NSEnumerationReverse
+                  usingBlock:^(
+                      NSString *collection, NSString *key, id object, id metadata, NSUInteger index, BOOL *stop) {
+                      OWSAssert([object isKindOfClass:[TSInteraction class]]);
+
+                      TSInteraction *interaction = (TSInteraction *)object;
+                      if ([TSThread shouldInteractionAppearInInbox:interaction]) {
+                          lastInboxInteraction = interaction;
+                          *stop = YES;
+                      }
+                  }];
+    NSString *_Nullable snippet = nil;
+    if ([lastInboxInteraction isKindOfClass:[TSMessage class]]) {
+        snippet = [(TSMessage *)lastInboxInteraction previewTextWithTransaction:transaction];
+    } else {
+        snippet = lastInboxInteraction.description;
+    }
+
+    NSUInteger unreadCount = [[transaction ext:TSUnreadDatabaseViewExtensionName] numberOfItemsInGroup:threadId];
+
+    return [[OWSThreadInboxSummary alloc] initWithThreadId:threadId
+                                                   snippet:(snippet ?: @"")
+                                               unreadCount:unreadCount
+                                         hasUnreadMessages:hasUnreadMessages];
+}
+
++ (void)updateSummaryForThreadId:(NSString *)threadId transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(threadId.length > 0);
+    OWSAssert(transaction);
+
+    if (![transaction hasObjectForKey:threadId inCollection:[TSThread collection]]) {
+        // e.g. an interaction is being removed after its thread.
+        [self removeSummaryForThreadId:threadId transaction:transaction];
+        return;
+    }
+
+    OWSThreadInboxSummary *summary = [self buildSummaryForThreadId:threadId transaction:transaction];
+    OWSThreadInboxSummary *_Nullable oldSummary =
+        [OWSThreadInboxSummary fetchObjectWithUniqueID:threadId transaction:transaction];
+    if (oldSummary && [oldSummary isEqualToSummary:summary]) {
+        // Avoid a redundant write, and the inbox update it would trigger.
+        return;
+    }
+    [summary saveWithTransaction:transaction];
+}
+
++ (void)removeSummaryForThreadId:(NSString *)threadId transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(threadId.length > 0);
+    OWSAssert(transaction);
+
+    [transaction removeObjectForKey:threadId inCollection:[OWSThreadInboxSummary collection]];
+}
+
++ (void)ensureSummariesWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(transaction);
+
+    NSUInteger builtCount = 0;
+    for (NSString *threadId in [transaction allKeysInCollection:[TSThread collection]]) {
+        if ([transaction hasObjectForKey:threadId inCollection:[OWSThreadInboxSummary collection]]) {
+            continue;
+        }
+        [[self buildSummaryForThreadId:threadId transaction:transaction] saveWithTransaction:transaction];
+        builtCount++;
+    }
+
+    DDLogInfo(@"%@ built %lu inbox summaries.", self.logTag, (unsigned long)builtCount);
+}
+
++ (NSDictionary<NSString *, OWSThreadInboxSummary *> *)summariesForThreadIds:(NSArray<NSString *> *)threadIds
+                                                                  transaction:(YapDatabaseReadTransaction *)transaction
+{
+    OWSAssert(threadIds);
+    OWSAssert(transaction);
+
+    NSMutableDictionary<NSString *, OWSThreadInboxSummary *> *summaries = [NSMutableDictionary new];
+    for (NSString *threadId in threadIds) {
+        OWSThreadInboxSummary *_Nullable summary =
+            [OWSThreadInboxSummary fetchObjectWithUniqueID:threadId transaction:transaction];
+        if (summary) {
+            summaries[threadId] = summary;
+        }
+    }
+    return [summaries copy];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
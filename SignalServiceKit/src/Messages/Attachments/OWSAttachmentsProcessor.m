@@ -9,6 +9,8 @@
 #import "NSNotificationCenter+OWS.h"
 #import "OWSBackgroundTask.h"
 #import "OWSError.h"
+#import "OWSFileSystem.h"
+#import "OWSSegmentedDownloader.h"
 #import "OWSSignalServiceProtos.pb.h"
 #import "TSAttachmentPointer.h"
 #import "TSAttachmentRequest.h"
@@ -205,21 +207,18 @@ static const CGFloat kAttachmentDownloadProgressTheta = 0.001f;
             dispatch_async([OWSDispatch attachmentsQueue], ^{
                 [self downloadFromLocation:location
                     pointer:attachment
-                    success:^(NSData *_Nonnull encryptedData) {
-                        [self decryptAttachmentData:encryptedData
+                    success:^(NSString *encryptedDataFilePath) {
+                        [self decryptAttachmentFile:encryptedDataFilePath
                                             pointer:attachment
                                             success:markAndHandleSuccess
                                             failure:markAndHandleFailure];
                     }
-                    failure:^(NSURLSessionDataTask *_Nullable task, NSError *_Nonnull error) {
+                    failure:^(NSError *error) {
                         if (attachment.serverId < 100) {
                             // This looks like the symptom of the "frequent 404
                             // downloading attachments with low server ids".
-                            NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)task.response;
-                            NSInteger statusCode = [httpResponse statusCode];
-                            OWSFail(@"%@ %d Failure with suspicious attachment id: %llu, %@",
+                            OWSFail(@"%@ Failure with suspicious attachment id: %llu, %@",
                                 self.logTag,
-                                (int)statusCode,
                                 (unsigned long long)attachment.serverId,
                                 error);
                         }
@@ -249,150 +248,80 @@ static const CGFloat kAttachmentDownloadProgressTheta = 0.001f;
         }];
 }
 
-- (void)decryptAttachmentData:(NSData *)cipherText
+- (void)decryptAttachmentFile:(NSString *)encryptedDataFilePath
                       pointer:(TSAttachmentPointer *)attachment
                       success:(void (^)(TSAttachmentStream *attachmentStream))successHandler
                       failure:(void (^)(NSError *error))failureHandler
 {
-    NSError *decryptError;
-    NSData *plaintext = [Cryptography decryptAttachment:cipherText
-                                                withKey:attachment.encryptionKey
-                                                 digest:attachment.digest
-                                           unpaddedSize:attachment.byteCount
-                                                  error:&decryptError];
-
-    if (decryptError) {
-        DDLogError(@"%@ failed to decrypt with error: %@", self.logTag, decryptError);
-        failureHandler(decryptError);
+    TSAttachmentStream *stream = [[TSAttachmentStream alloc] initWithPointer:attachment];
+    NSString *_Nullable filePath = stream.filePath;
+    if (!filePath) {
+        DDLogError(@"%@ Missing path for attachment.", self.logTag);
+        [OWSFileSystem deleteFileIfExists:encryptedDataFilePath];
+        failureHandler(OWSErrorMakeWriteAttachmentDataError());
         return;
     }
 
-    if (!plaintext) {
-        NSError *error = OWSErrorWithCodeDescription(OWSErrorCodeFailedToDecryptMessage, NSLocalizedString(@"ERROR_MESSAGE_INVALID_MESSAGE", @""));
+    // Decrypt straight into the attachment file in fixed-size chunks, so that we never
+    // hold the ciphertext or plaintext of large attachments in memory.
+    NSError *decryptError;
+    BOOL success = [Cryptography decryptAttachmentAtPath:encryptedDataFilePath
+                                                  toPath:filePath
+                                                 withKey:attachment.encryptionKey
+                                                  digest:attachment.digest
+                                            unpaddedSize:attachment.byteCount
+                                                   error:&decryptError];
+    [OWSFileSystem deleteFileIfExists:encryptedDataFilePath];
+
+    if (!success) {
+        DDLogError(@"%@ failed to decrypt with error: %@", self.logTag, decryptError);
+        NSError *error = decryptError
+            ?: OWSErrorWithCodeDescription(
+                   OWSErrorCodeFailedToDecryptMessage, NSLocalizedString(@"ERROR_MESSAGE_INVALID_MESSAGE", @""));
         failureHandler(error);
         return;
     }
 
-    TSAttachmentStream *stream = [[TSAttachmentStream alloc] initWithPointer:attachment];
-
-    NSError *writeError;
-    [stream writeData:plaintext error:&writeError];
-    if (writeError) {
-        DDLogError(@"%@ Failed writing attachment stream with error: %@", self.logTag, writeError);
-        failureHandler(writeError);
-        return;
-    }
-
     [stream save];
     successHandler(stream);
 }
 
 - (void)downloadFromLocation:(NSString *)location
                      pointer:(TSAttachmentPointer *)pointer
-                     success:(void (^)(NSData *encryptedData))successHandler
-                     failure:(void (^)(NSURLSessionDataTask *_Nullable task, NSError *_Nonnull error))failureHandler
+                     success:(void (^)(NSString *encryptedDataFilePath))successHandler
+                     failure:(void (^)(NSError *error))failureHandler
 {
-    AFHTTPSessionManager *manager = [AFHTTPSessionManager manager];
-    manager.requestSerializer     = [AFHTTPRequestSerializer serializer];
-    [manager.requestSerializer setValue:OWSMimeTypeApplicationOctetStream forHTTPHeaderField:@"Content-Type"];
-    manager.responseSerializer = [AFHTTPResponseSerializer serializer];
-    manager.completionQueue    = dispatch_get_main_queue();
+    NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:location]];
+    [request setValue:OWSMimeTypeApplicationOctetStream forHTTPHeaderField:@"Content-Type"];
 
-    // We want to avoid large downloads from a compromised or buggy service.
-    const long kMaxDownloadSize = 150 * 1024 * 1024;
-    // TODO stream this download rather than storing the entire blob.
-    __block NSURLSessionDataTask *task = nil;
-    __block BOOL hasCheckedContentLength = NO;
-    task = [manager GET:location
-        parameters:nil
-        progress:^(NSProgress *_Nonnull progress) {
-            OWSAssert(progress != nil);
-            
-            // Don't do anything until we've received at least one byte of data.
-            if (progress.completedUnitCount < 1) {
-                return;
-            }
-
-            void (^abortDownload)(void) = ^{
-                OWSFail(@"%@ Download aborted.", self.logTag);
-                [task cancel];
-            };
-
-            if (progress.totalUnitCount > kMaxDownloadSize || progress.completedUnitCount > kMaxDownloadSize) {
-                // A malicious service might send a misleading content length header,
-                // so....
-                //
-                // If the current downloaded bytes or the expected total byes
-                // exceed the max download size, abort the download.
-                DDLogError(@"%@ Attachment download exceed expected content length: %lld, %lld.",
-                    self.logTag,
-                    (long long)progress.totalUnitCount,
-                    (long long)progress.completedUnitCount);
-                abortDownload();
-                return;
-            }
+    // We download the ciphertext to a temporary file rather than holding the entire blob in memory.
+    //
+    // The path is stable for a given attachment so that an interrupted download can be resumed.
+    // The downloader rejects a second download of the same attachment while one is in flight.
+    NSString *encryptedFileName = [pointer.uniqueId stringByAppendingPathExtension:@"encrypted"];
+    NSString *encryptedDataFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:encryptedFileName];
+    NSString *resumeIdentifier = [NSString stringWithFormat:@"%llu", (unsigned long long)pointer.serverId];
 
-            [self fireProgressNotification:MAX(kAttachmentDownloadProgressTheta, progress.fractionCompleted)
+    // We want to avoid large downloads from a compromised or buggy service.
+    const unsigned long long kMaxDownloadSize = 150 * 1024 * 1024;
+    [[OWSSegmentedDownloader sharedDownloader] downloadWithRequest:request
+        toFilePath:encryptedDataFilePath
+        resumeIdentifier:resumeIdentifier
+        maxContentLength:kMaxDownloadSize
+        priority:OWSDownloadPriorityHigh
+        progress:^(CGFloat progress) {
+            [self fireProgressNotification:MAX(kAttachmentDownloadProgressTheta, progress)
                               attachmentId:pointer.uniqueId];
-
-            // We only need to check the content length header once.
-            if (hasCheckedContentLength) {
-                return;
-            }
-            
-            // Once we've received some bytes of the download, check the content length
-            // header for the download.
-            //
-            // If the task doesn't exist, or doesn't have a response, or is missing
-            // the expected headers, or has an invalid or oversize content length, etc.,
-            // abort the download.
-            NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)task.response;
-            if (![httpResponse isKindOfClass:[NSHTTPURLResponse class]]) {
-                DDLogError(@"%@ Attachment download has missing or invalid response.", self.logTag);
-                abortDownload();
-                return;
-            }
-            
-            NSDictionary *headers = [httpResponse allHeaderFields];
-            if (![headers isKindOfClass:[NSDictionary class]]) {
-                DDLogError(@"%@ Attachment download invalid headers.", self.logTag);
-                abortDownload();
-                return;
-            }
-            
-            
-            NSString *contentLength = headers[@"Content-Length"];
-            if (![contentLength isKindOfClass:[NSString class]]) {
-                DDLogError(@"%@ Attachment download missing or invalid content length.", self.logTag);
-                abortDownload();
-                return;
-            }
-            
-            
-            if (contentLength.longLongValue > kMaxDownloadSize) {
-                DDLogError(@"%@ Attachment download content length exceeds max download size.", self.logTag);
-                abortDownload();
-                return;
-            }
-            
-            // This response has a valid content length that is less
-            // than our max download size.  Proceed with the download.
-            hasCheckedContentLength = YES;
         }
-        success:^(NSURLSessionDataTask *_Nonnull task, id _Nullable responseObject) {
+        success:^(NSString *filePath) {
             dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-                if (![responseObject isKindOfClass:[NSData class]]) {
-                    DDLogError(@"%@ Failed retrieval of attachment. Response had unexpected format.", self.logTag);
-                    NSError *error = OWSErrorMakeUnableToProcessServerResponseError();
-                    return failureHandler(task, error);
-                }
-                successHandler((NSData *)responseObject);
+                successHandler(filePath);
             });
         }
-        failure:^(NSURLSessionDataTask *_Nullable task, NSError *_Nonnull error) {
+        failure:^(NSError *error) {
+            DDLogError(@"%@ Failed to retrieve attachment with error: %@", self.logTag, error);
             dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-                DDLogError(@"Failed to retrieve attachment with error: %@", error.description);
-                return failureHandler(task, error);
+                failureHandler(error);
             });
         }];
 }
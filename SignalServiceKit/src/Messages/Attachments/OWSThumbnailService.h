@@ -0,0 +1,54 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class TSAttachmentStream;
+
+// The max dimension, in pixels, of each thumbnail tier.
+typedef NS_ENUM(NSUInteger, OWSThumbnailSize) {
+    OWSThumbnailSizeSmall = 200,
+    OWSThumbnailSizeMedium = 450,
+    OWSThumbnailSizeLarge = 1024,
+};
+
+typedef void (^OWSThumbnailSuccess)(UIImage *image);
+typedef void (^OWSThumbnailFailure)(void);
+
+// Generates thumbnails for image and video attachments off the main thread,
+// persists them on disk and keeps recently used thumbnails in memory, so that
+// views don't need to decode full-size media while scrolling.
+@interface OWSThumbnailService : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
++ (instancetype)sharedService;
+
+// Returns the thumbnail if it is in the memory cache. Safe to call on the main thread.
+- (nullable UIImage *)cachedThumbnailForAttachment:(TSAttachmentStream *)attachment
+                                     thumbnailSize:(OWSThumbnailSize)thumbnailSize;
+
+// Loads the thumbnail from the memory cache, the disk cache or generates it,
+// in that order. Exactly one of success & failure will be called, on the main thread.
+- (void)thumbnailForAttachment:(TSAttachmentStream *)attachment
+                 thumbnailSize:(OWSThumbnailSize)thumbnailSize
+                       success:(OWSThumbnailSuccess)success
+                       failure:(OWSThumbnailFailure)failure;
+
+// Removes all thumbnails of this attachment from the memory and disk caches.
+- (void)removeThumbnailsForAttachmentId:(NSString *)attachmentId;
+
+- (void)removeAllThumbnails;
+
++ (NSString *)thumbnailsFolder;
+
+// Returns the id of the attachment a file in the thumbnails folder belongs to,
+// or nil if the file name is not that of a thumbnail.
++ (nullable NSString *)attachmentIdForThumbnailFileName:(NSString *)fileName;
+
+@end
+
+NS_ASSUME_NONNULL_END
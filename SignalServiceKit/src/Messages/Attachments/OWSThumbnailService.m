@@ -0,0 +1,370 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSThumbnailService.h"
+#import "NSData+Image.h"
+#import "OWSFileSystem.h"
+#import "TSAttachmentStream.h"
+#import "Threading.h"
+#import <AVFoundation/AVFoundation.h>
+#import <ImageIO/ImageIO.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Roughly enough for a screenful of large thumbnails plus neighbours.
+const NSUInteger kThumbnailMemoryCacheCostLimit = 32 * 1024 * 1024;
+
+@interface OWSThumbnailService ()
+
+@property (nonatomic, readonly) NSCache<NSString *, UIImage *> *memoryCache;
+
+// The following state should only be accessed while synchronized on self.
+//
+// Thumbnails which are being generated when they are removed must not be cached,
+// so we record the ids of removed attachments, and count calls to removeAllThumbnails.
+@property (nonatomic, readonly) NSMutableSet<NSString *> *removedAttachmentIds;
+@property (nonatomic) NSUInteger removeAllCount;
+
+@end
+
+#pragma mark -
+
+@implementation OWSThumbnailService
+
++ (instancetype)sharedService
+{
+    static OWSThumbnailService *sharedService = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedService = [[self alloc] initDefault];
+    });
+    return sharedService;
+}
+
+- (instancetype)initDefault
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _memoryCache = [NSCache new];
+    _memoryCache.totalCostLimit = kThumbnailMemoryCacheCostLimit;
+    _removedAttachmentIds = [NSMutableSet new];
+
+    OWSSingletonAssert();
+
+    return self;
+}
+
+- (dispatch_queue_t)serialQueue
+{
+    static dispatch_queue_t queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // Thumbnails are generated one at a time to bound peak memory usage.
+        queue = dispatch_queue_create("org.whispersystems.attachment.thumbnails", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
++ (NSString *)thumbnailsFolder
+{
+    static NSString *thumbnailsFolder = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // This must not live within the attachments folder, or the orphan data cleaner
+        // would treat thumbnails as orphaned attachment files.
+        thumbnailsFolder =
+            [[OWSFileSystem appSharedDataDirectoryPath] stringByAppendingPathComponent:@"AttachmentThumbnails"];
+
+        [OWSFileSystem ensureDirectoryExists:thumbnailsFolder];
+
+        [OWSFileSystem protectFileOrFolderAtPath:thumbnailsFolder];
+    });
+    return thumbnailsFolder;
+}
+
++ (NSArray<NSNumber *> *)allThumbnailSizes
+{
+    return @[
+        @(OWSThumbnailSizeSmall),
+        @(OWSThumbnailSizeMedium),
+        @(OWSThumbnailSizeLarge),
+    ];
+}
+
+- (NSString *)cacheKeyForAttachmentId:(NSString *)attachmentId thumbnailSize:(OWSThumbnailSize)thumbnailSize
+{
+    return [NSString stringWithFormat:@"%@-%lu", attachmentId, (unsigned long)thumbnailSize];
+}
+
+- (NSString *)thumbnailPathForAttachmentId:(NSString *)attachmentId thumbnailSize:(OWSThumbnailSize)thumbnailSize
+{
+    NSString *fileName =
+        [[self cacheKeyForAttachmentId:attachmentId thumbnailSize:thumbnailSize] stringByAppendingPathExtension:@"jpg"];
+    return [[[self class] thumbnailsFolder] stringByAppendingPathComponent:fileName];
+}
+
++ (nullable NSString *)attachmentIdForThumbnailFileName:(NSString *)fileName
+{
+    // Attachment ids may themselves contain dashes, so split on the last one.
+    NSString *cacheKey = [fileName stringByDeletingPathExtension];
+    NSRange range = [cacheKey rangeOfString:@"-" options:NSBackwardsSearch];
+    if (range.location == NSNotFound || range.location < 1) {
+        return nil;
+    }
+    return [cacheKey substringToIndex:range.location];
+}
+
+#pragma mark - Memory Cache
+
+- (nullable UIImage *)cachedThumbnailForAttachment:(TSAttachmentStream *)attachment
+                                     thumbnailSize:(OWSThumbnailSize)thumbnailSize
+{
+    OWSAssert(attachment);
+
+    return [self.memoryCache objectForKey:[self cacheKeyForAttachmentId:attachment.uniqueId
+                                                          thumbnailSize:thumbnailSize]];
+}
+
+// Returns NO if the thumbnails of the attachment have been removed since removeAllCount was read.
+- (BOOL)cacheThumbnail:(UIImage *)image
+              cacheKey:(NSString *)cacheKey
+          attachmentId:(NSString *)attachmentId
+        removeAllCount:(NSUInteger)removeAllCount
+{
+    OWSAssert(image);
+    OWSAssert(cacheKey.length > 0);
+    OWSAssert(attachmentId.length > 0);
+
+    @synchronized(self)
+    {
+        if ([self.removedAttachmentIds containsObject:attachmentId] || self.removeAllCount != removeAllCount) {
+            return NO;
+        }
+        NSUInteger cost = (NSUInteger)(image.size.width * image.scale * image.size.height * image.scale * 4);
+        [self.memoryCache setObject:image forKey:cacheKey cost:cost];
+        return YES;
+    }
+}
+
+#pragma mark - Loading
+
+- (void)thumbnailForAttachment:(TSAttachmentStream *)attachment
+                 thumbnailSize:(OWSThumbnailSize)thumbnailSize
+                       success:(OWSThumbnailSuccess)success
+                       failure:(OWSThumbnailFailure)failure
+{
+    OWSAssert(attachment);
+    OWSAssert(success);
+    OWSAssert(failure);
+
+    NSString *attachmentId = attachment.uniqueId;
+    NSString *cacheKey = [self cacheKeyForAttachmentId:attachmentId thumbnailSize:thumbnailSize];
+    UIImage *_Nullable cachedImage = [self.memoryCache objectForKey:cacheKey];
+    if (cachedImage) {
+        DispatchMainThreadSafe(^{
+            success(cachedImage);
+        });
+        return;
+    }
+
+    dispatch_async(self.serialQueue, ^{
+        // Repeated requests for the same thumbnail will have queued up behind the
+        // request that generated it.
+        UIImage *_Nullable image = [self.memoryCache objectForKey:cacheKey];
+        if (image) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                success(image);
+            });
+            return;
+        }
+
+        NSUInteger removeAllCount;
+        BOOL wasRemoved;
+        @synchronized(self)
+        {
+            removeAllCount = self.removeAllCount;
+            wasRemoved = [self.removedAttachmentIds containsObject:attachmentId];
+        }
+        if (wasRemoved) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                failure();
+            });
+            return;
+        }
+
+        image = [self loadOrGenerateThumbnailForAttachment:attachment thumbnailSize:thumbnailSize];
+        if (!image) {
+            DDLogError(@"%@ Could not load thumbnail for attachment: %@", self.logTag, attachmentId);
+            dispatch_async(dispatch_get_main_queue(), ^{
+                failure();
+            });
+            return;
+        }
+
+        if (![self cacheThumbnail:image cacheKey:cacheKey attachmentId:attachmentId removeAllCount:removeAllCount]) {
+            DDLogInfo(@"%@ Discarding thumbnail of removed attachment: %@", self.logTag, attachmentId);
+            // Any thumbnail we wrote to disk is removed by the removal, which is
+            // enqueued on the serial queue behind us.
+            dispatch_async(dispatch_get_main_queue(), ^{
+                failure();
+            });
+            return;
+        }
+        dispatch_async(dispatch_get_main_queue(), ^{
+            success(image);
+        });
+    });
+}
+
+- (nullable UIImage *)loadOrGenerateThumbnailForAttachment:(TSAttachmentStream *)attachment
+                                             thumbnailSize:(OWSThumbnailSize)thumbnailSize
+{
+    NSString *thumbnailPath = [self thumbnailPathForAttachmentId:attachment.uniqueId thumbnailSize:thumbnailSize];
+    if ([[NSFileManager defaultManager] fileExistsAtPath:thumbnailPath]) {
+        UIImage *_Nullable image = [self decodedImageAtPath:thumbnailPath maxPixelSize:0];
+        if (image) {
+            return image;
+        }
+        DDLogWarn(@"%@ Discarding unreadable thumbnail: %@", self.logTag, thumbnailPath);
+        [OWSFileSystem deleteFileIfExists:thumbnailPath];
+    }
+
+    NSString *_Nullable filePath = attachment.filePath;
+    if (!filePath) {
+        OWSFail(@"%@ Missing path for attachment.", self.logTag);
+        return nil;
+    }
+
+    UIImage *_Nullable image = nil;
+    if (attachment.isVideo) {
+        image = [self videoThumbnailAtPath:filePath maxPixelSize:thumbnailSize];
+    } else if (attachment.isImage || attachment.isAnimated) {
+        if (![NSData ows_isValidImageAtPath:filePath]) {
+            return nil;
+        }
+        image = [self decodedImageAtPath:filePath maxPixelSize:thumbnailSize];
+    } else {
+        OWSFail(@"%@ Can't generate thumbnail for content type: %@", self.logTag, attachment.contentType);
+        return nil;
+    }
+    if (!image) {
+        return nil;
+    }
+
+    NSData *_Nullable thumbnailData = UIImageJPEGRepresentation(image, 0.85f);
+    NSError *error;
+    if (!thumbnailData || ![thumbnailData writeToFile:thumbnailPath options:NSDataWritingAtomic error:&error]) {
+        // We can still use the thumbnail; we just won't be able to reuse it.
+        DDLogError(@"%@ Could not write thumbnail: %@", self.logTag, error);
+    }
+
+    return image;
+}
+
+// Uses ImageIO to decode (and if maxPixelSize is non-zero, downsample) the image without
+// ever decoding the full-size image. The resulting image is decoded immediately so that
+// this work doesn't happen on the main thread at render time.
+- (nullable UIImage *)decodedImageAtPath:(NSString *)filePath maxPixelSize:(NSUInteger)maxPixelSize
+{
+    NSURL *fileUrl = [NSURL fileURLWithPath:filePath];
+    NSDictionary *sourceOptions = @{
+        (NSString *)kCGImageSourceShouldCache : @(NO),
+    };
+    CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)fileUrl, (__bridge CFDictionaryRef)sourceOptions);
+    if (!source) {
+        DDLogError(@"%@ Could not load image: %@", self.logTag, fileUrl);
+        return nil;
+    }
+
+    NSMutableDictionary *thumbnailOptions = [@{
+        (NSString *)kCGImageSourceCreateThumbnailFromImageAlways : @(YES),
+        (NSString *)kCGImageSourceCreateThumbnailWithTransform : @(YES),
+        (NSString *)kCGImageSourceShouldCacheImmediately : @(YES),
+    } mutableCopy];
+    if (maxPixelSize > 0) {
+        thumbnailOptions[(NSString *)kCGImageSourceThumbnailMaxPixelSize] = @(maxPixelSize);
+    }
+    CGImageRef _Nullable imageRef
+        = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)thumbnailOptions);
+    CFRelease(source);
+    if (!imageRef) {
+        DDLogError(@"%@ Could not create thumbnail: %@", self.logTag, fileUrl);
+        return nil;
+    }
+
+    UIImage *image = [UIImage imageWithCGImage:imageRef];
+    CGImageRelease(imageRef);
+    return image;
+}
+
+- (nullable UIImage *)videoThumbnailAtPath:(NSString *)filePath maxPixelSize:(NSUInteger)maxPixelSize
+{
+    AVURLAsset *asset = [[AVURLAsset alloc] initWithURL:[NSURL fileURLWithPath:filePath] options:nil];
+    AVAssetImageGenerator *generator = [[AVAssetImageGenerator alloc] initWithAsset:asset];
+    generator.appliesPreferredTrackTransform = YES;
+    generator.maximumSize = CGSizeMake(maxPixelSize, maxPixelSize);
+    NSError *error;
+    CGImageRef _Nullable imageRef = [generator copyCGImageAtTime:CMTimeMake(1, 60) actualTime:NULL error:&error];
+    if (!imageRef) {
+        DDLogError(@"%@ Could not generate video thumbnail: %@", self.logTag, error);
+        return nil;
+    }
+
+    UIImage *image = [UIImage imageWithCGImage:imageRef];
+    CGImageRelease(imageRef);
+    return image;
+}
+
+#pragma mark - Invalidation
+
+- (void)removeThumbnailsForAttachmentId:(NSString *)attachmentId
+{
+    OWSAssert(attachmentId.length > 0);
+
+    @synchronized(self)
+    {
+        // Attachment ids are never reused, so we never need to forget them.
+        [self.removedAttachmentIds addObject:attachmentId];
+        for (NSNumber *thumbnailSize in [[self class] allThumbnailSizes]) {
+            OWSThumbnailSize size = (OWSThumbnailSize)thumbnailSize.unsignedIntegerValue;
+            [self.memoryCache removeObjectForKey:[self cacheKeyForAttachmentId:attachmentId thumbnailSize:size]];
+        }
+    }
+
+    dispatch_async(self.serialQueue, ^{
+        for (NSNumber *thumbnailSize in [[self class] allThumbnailSizes]) {
+            OWSThumbnailSize size = (OWSThumbnailSize)thumbnailSize.unsignedIntegerValue;
+            [OWSFileSystem deleteFileIfExists:[self thumbnailPathForAttachmentId:attachmentId thumbnailSize:size]];
+        }
+    });
+}
+
+- (void)removeAllThumbnails
+{
+    @synchronized(self)
+    {
+        self.removeAllCount++;
+        [self.memoryCache removeAllObjects];
+    }
+
+    dispatch_async(self.serialQueue, ^{
+        NSError *error;
+        NSArray<NSString *> *_Nullable fileNames =
+            [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[[self class] thumbnailsFolder] error:&error];
+        if (error) {
+            DDLogError(@"%@ Could not list thumbnails: %@", self.logTag, error);
+            return;
+        }
+        for (NSString *fileName in fileNames) {
+            [OWSFileSystem deleteFile:[[[self class] thumbnailsFolder] stringByAppendingPathComponent:fileName]];
+        }
+    });
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -6,6 +6,7 @@
 #import "TSAttachment.h"
 
 #if TARGET_OS_IPHONE
+#import "OWSThumbnailService.h"
 #import <UIKit/UIKit.h>
 
 #endif
@@ -35,7 +36,18 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readonly) NSDate *creationTimestamp;
 
 #if TARGET_OS_IPHONE
+// Decodes the full-size image (or video frame) synchronously.
+// Where a thumbnail will do, prefer the thumbnail methods below.
 - (nullable UIImage *)image;
+
+// Returns the thumbnail if it is already in memory.
+- (nullable UIImage *)cachedThumbnailWithSize:(OWSThumbnailSize)thumbnailSize;
+
+// Thumbnails are generated off the main thread once and then persisted.
+// success & failure are called on the main thread.
+- (void)thumbnailWithSize:(OWSThumbnailSize)thumbnailSize
+                  success:(OWSThumbnailSuccess)success
+                  failure:(OWSThumbnailFailure)failure;
 #endif
 
 - (BOOL)isAnimated;
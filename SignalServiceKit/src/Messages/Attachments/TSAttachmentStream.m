@@ -7,6 +7,7 @@
 #import "NSData+Image.h"
 #import "OWSFileSystem.h"
 #import "TSAttachmentPointer.h"
+#import "Threading.h"
 #import <AVFoundation/AVFoundation.h>
 #import <ImageIO/ImageIO.h>
 #import <YapDatabase/YapDatabase.h>
@@ -243,6 +244,8 @@ NS_ASSUME_NONNULL_BEGIN
     if (error) {
         DDLogError(@"%@ remove file errored with: %@", self.logTag, error);
     }
+
+    [[OWSThumbnailService sharedService] removeThumbnailsForAttachmentId:self.uniqueId];
 }
 
 - (void)removeWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
@@ -298,7 +301,35 @@ NS_ASSUME_NONNULL_BEGIN
     NSError *err                            = NULL;
     CMTime time                             = CMTimeMake(1, 60);
     CGImageRef imgRef                       = [generate copyCGImageAtTime:time actualTime:NULL error:&err];
-    return [[UIImage alloc] initWithCGImage:imgRef];
+    if (!imgRef) {
+        DDLogError(@"%@ Could not generate video thumbnail: %@", self.logTag, err);
+        return nil;
+    }
+    UIImage *image = [[UIImage alloc] initWithCGImage:imgRef];
+    CGImageRelease(imgRef);
+    return image;
+}
+
+- (nullable UIImage *)cachedThumbnailWithSize:(OWSThumbnailSize)thumbnailSize
+{
+    return [[OWSThumbnailService sharedService] cachedThumbnailForAttachment:self thumbnailSize:thumbnailSize];
+}
+
+- (void)thumbnailWithSize:(OWSThumbnailSize)thumbnailSize
+                  success:(OWSThumbnailSuccess)success
+                  failure:(OWSThumbnailFailure)failure
+{
+    if (![self isVideo] && ![self isImage] && ![self isAnimated]) {
+        DispatchMainThreadSafe(^{
+            failure();
+        });
+        return;
+    }
+
+    [[OWSThumbnailService sharedService] thumbnailForAttachment:self
+                                                  thumbnailSize:thumbnailSize
+                                                        success:success
+                                                        failure:failure];
 }
 
 + (void)deleteAttachments
@@ -321,6 +352,8 @@ NS_ASSUME_NONNULL_BEGIN
             OWSFail(@"failed to remove item at path: %@ with error: %@", url, error);
         }
     }
+
+    [[OWSThumbnailService sharedService] removeAllThumbnails];
 }
 
 - (CGSize)calculateImageSize
@@ -84,8 +84,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)touchThreadWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
 {
-    TSThread *thread = [TSThread fetchObjectWithUniqueID:self.uniqueThreadId transaction:transaction];
-    [thread touchWithTransaction:transaction];
+    [TSThread touchThreadWithId:self.uniqueThreadId updateInboxSummary:NO transaction:transaction];
 }
 
 #pragma mark Date operations
@@ -138,16 +137,14 @@ NS_ASSUME_NONNULL_BEGIN
 
     [super saveWithTransaction:transaction];
 
-    TSThread *fetchedThread = [TSThread fetchObjectWithUniqueID:self.uniqueThreadId transaction:transaction];
-
-    [fetchedThread updateWithLastMessage:self transaction:transaction];
+    [TSThread interactionWasSaved:self transaction:transaction];
 }
 
 - (void)removeWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
 {
     [super removeWithTransaction:transaction];
 
-    [self touchThreadWithTransaction:transaction];
+    [TSThread touchThreadWithId:self.uniqueThreadId updateInboxSummary:YES transaction:transaction];
 }
 
 - (BOOL)isDynamicInteraction
@@ -273,14 +273,6 @@ static const NSUInteger OWSMessageSchemaVersion = 4;
         TSAttachment *attachment = [TSAttachment fetchObjectWithUniqueID:attachmentId transaction:transaction];
         [attachment removeWithTransaction:transaction];
     };
-
-    // Updates inbox thread preview
-    [self touchThreadWithTransaction:transaction];
-}
-
-- (void)touchThreadWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
-{
-    [transaction touchObjectForKey:self.uniqueThreadId inCollection:[TSThread collection]];
 }
 
 - (BOOL)isExpiringMessage
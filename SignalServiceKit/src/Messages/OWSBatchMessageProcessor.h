@@ -7,6 +7,31 @@ NS_ASSUME_NONNULL_BEGIN
 @class OWSSignalServiceProtosEnvelope;
 @class OWSStorage;
 
+typedef NS_ENUM(NSUInteger, OWSMessageBatchSchedulingMode) {
+    // Grow or shrink the batch size and the inter-batch delay based on
+    // the backlog depth, the measured transaction time and whether or not
+    // the app is in the foreground.
+    OWSMessageBatchSchedulingModeAdaptive = 0,
+    // Always process batches of 32 jobs with a 0.5s delay between batches.
+    OWSMessageBatchSchedulingModeFixed,
+};
+
+// A snapshot of the processing queue's counters, useful for measuring drain throughput.
+@interface OWSMessageBatchProcessingStats : NSObject <NSCopying>
+
+@property (nonatomic, readonly) NSUInteger batchCount;
+@property (nonatomic, readonly) NSUInteger jobCount;
+@property (nonatomic, readonly) NSTimeInterval lastBatchDuration;
+@property (nonatomic, readonly) NSTimeInterval averageBatchDuration;
+@property (nonatomic, readonly) NSTimeInterval maxBatchDuration;
+@property (nonatomic, readonly) NSUInteger lastBatchSize;
+@property (nonatomic, readonly) NSUInteger lastBacklogDepth;
+@property (nonatomic, readonly) NSUInteger maxBacklogDepth;
+
+@end
+
+#pragma mark -
+
 // This class is used to write incoming (decrypted, unprocessed)
 // messages to a durable queue and then process them in batches,
 // in the order in which they were received.
@@ -18,6 +43,11 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)enqueueEnvelopeData:(NSData *)envelopeData plaintextData:(NSData *_Nullable)plaintextData;
 - (void)handleAnyUnprocessedEnvelopesAsync;
 
+// Defaults to OWSMessageBatchSchedulingModeAdaptive.
+@property (atomic) OWSMessageBatchSchedulingMode schedulingMode;
+
+- (OWSMessageBatchProcessingStats *)processingStats;
+
 @end
 
 NS_ASSUME_NONNULL_END
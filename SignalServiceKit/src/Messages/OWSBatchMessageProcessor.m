@@ -12,6 +12,7 @@
 #import "OWSStorage.h"
 #import "TSDatabaseView.h"
 #import "TSStorageManager.h"
+#import "TSThread.h"
 #import "TSYapDatabaseObject.h"
 #import "Threading.h"
 #import <YapDatabase/YapDatabaseAutoView.h>
@@ -225,6 +226,186 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
 
 @end
 
+#pragma mark - Scheduling
+
+@interface OWSMessageBatchProcessingStats ()
+
+@property (nonatomic) NSUInteger batchCount;
+@property (nonatomic) NSUInteger jobCount;
+@property (nonatomic) NSTimeInterval totalBatchDuration;
+@property (nonatomic) NSTimeInterval lastBatchDuration;
+@property (nonatomic) NSTimeInterval maxBatchDuration;
+@property (nonatomic) NSUInteger lastBatchSize;
+@property (nonatomic) NSUInteger lastBacklogDepth;
+@property (nonatomic) NSUInteger maxBacklogDepth;
+
+@end
+
+#pragma mark -
+
+@implementation OWSMessageBatchProcessingStats
+
+- (NSTimeInterval)averageBatchDuration
+{
+    return (self.batchCount > 0 ? self.totalBatchDuration / self.batchCount : 0);
+}
+
+- (id)copyWithZone:(nullable NSZone *)zone
+{
+    OWSMessageBatchProcessingStats *copy = [OWSMessageBatchProcessingStats new];
+    copy.batchCount = self.batchCount;
+    copy.jobCount = self.jobCount;
+    copy.totalBatchDuration = self.totalBatchDuration;
+    copy.lastBatchDuration = self.lastBatchDuration;
+    copy.maxBatchDuration = self.maxBatchDuration;
+    copy.lastBatchSize = self.lastBatchSize;
+    copy.lastBacklogDepth = self.lastBacklogDepth;
+    copy.maxBacklogDepth = self.maxBacklogDepth;
+    return copy;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"batches: %zd, jobs: %zd, last batch: %zd jobs in %.3fs, average batch: %.3fs, "
+                                      @"max batch: %.3fs, backlog: %zd, max backlog: %zd",
+                     self.batchCount,
+                     self.jobCount,
+                     self.lastBatchSize,
+                     self.lastBatchDuration,
+                     self.averageBatchDuration,
+                     self.maxBatchDuration,
+                     self.lastBacklogDepth,
+                     self.maxBacklogDepth];
+}
+
+@end
+
+#pragma mark -
+
+// The fixed policy.
+//
+// We want a value that is just high enough to yield perf benefits.
+const NSUInteger kFixedIncomingMessageBatchSize = 32;
+const NSTimeInterval kFixedIncomingMessageBatchDelaySeconds = 0.5f;
+
+// The bounds of the adaptive policy.
+const NSUInteger kMinIncomingMessageBatchSize = 8;
+const NSUInteger kMaxIncomingMessageBatchSize = 512;
+// In the foreground we don't want to hold the write transaction long enough
+// to stall writes from the UI, so we favor short batches and yield between them.
+const NSTimeInterval kForegroundTargetBatchDurationSeconds = 0.1f;
+// In the background we're racing the OS for execution time, so we favor throughput.
+const NSTimeInterval kBackgroundTargetBatchDurationSeconds = 0.5f;
+
+// Decides how many jobs to process in the next batch and how long to wait
+// between batches.
+//
+// This class is not thread-safe; it should only be used on the processing queue's
+// serial queue, with the exception of the mode, app state and stats accessors.
+@interface OWSMessageBatchScheduler : NSObject
+
+@property (atomic) OWSMessageBatchSchedulingMode mode;
+@property (atomic) BOOL isAppInBackground;
+
+// The number of jobs to process in the next batch.
+@property (nonatomic, readonly) NSUInteger nextBatchSize;
+
+// Returns the delay before the next batch should be processed.
+- (NSTimeInterval)didProcessBatchOfSize:(NSUInteger)batchSize
+                               duration:(NSTimeInterval)duration
+                           backlogDepth:(NSUInteger)backlogDepth;
+
+- (OWSMessageBatchProcessingStats *)stats;
+
+@end
+
+#pragma mark -
+
+@interface OWSMessageBatchScheduler ()
+
+@property (nonatomic) NSUInteger nextBatchSize;
+@property (nonatomic, readonly) OWSMessageBatchProcessingStats *mutableStats;
+
+@end
+
+#pragma mark -
+
+@implementation OWSMessageBatchScheduler
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _mode = OWSMessageBatchSchedulingModeAdaptive;
+    _nextBatchSize = kFixedIncomingMessageBatchSize;
+    _mutableStats = [OWSMessageBatchProcessingStats new];
+
+    return self;
+}
+
+- (OWSMessageBatchProcessingStats *)stats
+{
+    @synchronized(self)
+    {
+        return [self.mutableStats copy];
+    }
+}
+
+- (NSTimeInterval)didProcessBatchOfSize:(NSUInteger)batchSize
+                               duration:(NSTimeInterval)duration
+                           backlogDepth:(NSUInteger)backlogDepth
+{
+    @synchronized(self)
+    {
+        OWSMessageBatchProcessingStats *stats = self.mutableStats;
+        stats.batchCount++;
+        stats.jobCount += batchSize;
+        stats.totalBatchDuration += duration;
+        stats.lastBatchDuration = duration;
+        stats.maxBatchDuration = MAX(stats.maxBatchDuration, duration);
+        stats.lastBatchSize = batchSize;
+        stats.lastBacklogDepth = backlogDepth;
+        stats.maxBacklogDepth = MAX(stats.maxBacklogDepth, backlogDepth + batchSize);
+    }
+
+    if (self.mode == OWSMessageBatchSchedulingModeFixed) {
+        self.nextBatchSize = kFixedIncomingMessageBatchSize;
+        return kFixedIncomingMessageBatchDelaySeconds;
+    }
+
+    BOOL isAppInBackground = self.isAppInBackground;
+    NSTimeInterval targetBatchDuration
+        = (isAppInBackground ? kBackgroundTargetBatchDurationSeconds : kForegroundTargetBatchDurationSeconds);
+
+    // Grow the batch size while batches are comfortably fast and there's a backlog
+    // that can fill them; shrink it in proportion to how far we overshot the target.
+    if (duration > targetBatchDuration && batchSize > kMinIncomingMessageBatchSize) {
+        NSUInteger scaledBatchSize = (NSUInteger)floor(batchSize * targetBatchDuration / duration);
+        self.nextBatchSize = MAX(kMinIncomingMessageBatchSize, scaledBatchSize);
+    } else if (duration < targetBatchDuration * 0.5f && batchSize >= self.nextBatchSize
+        && backlogDepth > self.nextBatchSize) {
+        self.nextBatchSize = MIN(kMaxIncomingMessageBatchSize, self.nextBatchSize * 2);
+    }
+
+    if (backlogDepth >= self.nextBatchSize) {
+        // There's already a full batch waiting; waiting won't increase the batch size.
+        //
+        // In the background, drain as fast as possible. In the foreground, yield
+        // for as long as the last transaction took so that other writes can proceed.
+        return (isAppInBackground ? 0 : MIN(duration, kFixedIncomingMessageBatchDelaySeconds));
+    }
+
+    // Wait a bit in hopes of increasing the batch size. The smaller the backlog,
+    // the more we stand to gain by waiting.
+    double backlogFraction = (double)backlogDepth / (double)self.nextBatchSize;
+    return kFixedIncomingMessageBatchDelaySeconds * (1.0 - backlogFraction);
+}
+
+@end
+
 #pragma mark - Queue Processing
 
 @interface OWSMessageContentQueue : NSObject
@@ -232,6 +413,7 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
 @property (nonatomic, readonly) OWSMessageManager *messagesManager;
 @property (nonatomic, readonly) YapDatabaseConnection *dbReadWriteConnection;
 @property (nonatomic, readonly) OWSMessageContentJobFinder *finder;
+@property (nonatomic, readonly) OWSMessageBatchScheduler *scheduler;
 @property (nonatomic) BOOL isDrainingQueue;
 
 - (instancetype)initWithMessagesManager:(OWSMessageManager *)messagesManager
@@ -259,12 +441,21 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
     _messagesManager = messagesManager;
     _dbReadWriteConnection = [storageManager newDatabaseConnection];
     _finder = finder;
+    _scheduler = [OWSMessageBatchScheduler new];
     _isDrainingQueue = NO;
 
     [[NSNotificationCenter defaultCenter] addObserver:self
                                              selector:@selector(storageIsReady)
                                                  name:StorageIsReadyNotification
                                                object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(applicationDidEnterBackground:)
+                                                 name:OWSApplicationDidEnterBackgroundNotification
+                                               object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(applicationWillEnterForeground:)
+                                                 name:OWSApplicationWillEnterForegroundNotification
+                                               object:nil];
 
     return self;
 }
@@ -276,9 +467,23 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
 
 - (void)storageIsReady
 {
+    if ([NSThread isMainThread]) {
+        self.scheduler.isAppInBackground = CurrentAppContext().isInBackground;
+    }
+
     [self drainQueue];
 }
 
+- (void)applicationDidEnterBackground:(NSNotification *)notification
+{
+    self.scheduler.isAppInBackground = YES;
+}
+
+- (void)applicationWillEnterForeground:(NSNotification *)notification
+{
+    self.scheduler.isAppInBackground = NO;
+}
+
 #pragma mark - instance methods
 
 - (dispatch_queue_t)serialQueue
@@ -325,35 +530,49 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
 {
     AssertOnDispatchQueue(self.serialQueue);
 
-    // We want a value that is just high enough to yield perf benefits.
-    const NSUInteger kIncomingMessageBatchSize = 32;
-
-    NSArray<OWSMessageContentJob *> *jobs = [self.finder nextJobsForBatchSize:kIncomingMessageBatchSize];
+    NSArray<OWSMessageContentJob *> *jobs = [self.finder nextJobsForBatchSize:self.scheduler.nextBatchSize];
     OWSAssert(jobs);
     if (jobs.count < 1) {
         self.isDrainingQueue = NO;
-        DDLogVerbose(@"%@ Queue is drained", self.logTag);
+        DDLogVerbose(@"%@ Queue is drained; %@", self.logTag, self.scheduler.stats);
         return;
     }
 
     OWSBackgroundTask *backgroundTask = [OWSBackgroundTask backgroundTaskWithLabelStr:__PRETTY_FUNCTION__];
 
+    NSDate *startDate = [NSDate new];
+
     [self processJobs:jobs];
 
     [self.finder removeJobsWithIds:jobs.uniqueIds];
 
+    NSTimeInterval batchDuration = fabs([startDate timeIntervalSinceNow]);
+
     backgroundTask = nil;
 
-    DDLogVerbose(@"%@ completed %zd jobs. %zd jobs left.",
+    NSUInteger backlogDepth = [OWSMessageContentJob numberOfKeysInCollection];
+    NSTimeInterval delaySeconds =
+        [self.scheduler didProcessBatchOfSize:jobs.count duration:batchDuration backlogDepth:backlogDepth];
+
+    DDLogVerbose(@"%@ completed %zd jobs in %.3fs. %zd jobs left. Next batch: %zd jobs in %.3fs.",
         self.logTag,
         jobs.count,
-        [OWSMessageContentJob numberOfKeysInCollection]);
+        batchDuration,
+        backlogDepth,
+        self.scheduler.nextBatchSize,
+        delaySeconds);
+
+    if (delaySeconds <= 0) {
+        dispatch_async(self.serialQueue, ^{
+            [self drainQueueWorkStep];
+        });
+        return;
+    }
 
-    // Wait a bit in hopes of increasing the batch size.
     // This delay won't affect the first message to arrive when this queue is idle,
     // so by definition we're receiving more than one message and can benefit from
     // batching.
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5f * NSEC_PER_SEC)), self.serialQueue, ^{
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delaySeconds * NSEC_PER_SEC)), self.serialQueue, ^{
         [self drainQueueWorkStep];
     });
 }
@@ -363,11 +582,16 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
     AssertOnDispatchQueue(self.serialQueue);
 
     [self.dbReadWriteConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
-        for (OWSMessageContentJob *job in jobs) {
-            [self.messagesManager processEnvelope:job.envelopeProto
-                                    plaintextData:job.plaintextData
-                                      transaction:transaction];
-        }
+        // A batch often contains many messages for the same thread.
+        [TSThread performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                             block:^{
+                                                                 for (OWSMessageContentJob *job in jobs) {
+                                                                     [self.messagesManager
+                                                                         processEnvelope:job.envelopeProto
+                                                                           plaintextData:job.plaintextData
+                                                                             transaction:transaction];
+                                                                 }
+                                                             }];
     }];
 }
 
@@ -455,6 +679,21 @@ NSString *const OWSMessageContentJobFinderExtensionGroup = @"OWSMessageContentJo
     [self.processingQueue drainQueue];
 }
 
+- (OWSMessageBatchSchedulingMode)schedulingMode
+{
+    return self.processingQueue.scheduler.mode;
+}
+
+- (void)setSchedulingMode:(OWSMessageBatchSchedulingMode)schedulingMode
+{
+    self.processingQueue.scheduler.mode = schedulingMode;
+}
+
+- (OWSMessageBatchProcessingStats *)processingStats
+{
+    return self.processingQueue.scheduler.stats;
+}
+
 - (void)enqueueEnvelopeData:(NSData *)envelopeData plaintextData:(NSData *_Nullable)plaintextData
 {
     OWSAssert(envelopeData);
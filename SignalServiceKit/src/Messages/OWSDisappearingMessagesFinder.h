@@ -18,6 +18,14 @@ NS_ASSUME_NONNULL_BEGIN
                                              block:(void (^_Nonnull)(TSMessage *message))block
                                        transaction:(YapDatabaseReadTransaction *)transaction;
 
+/**
+ * @return
+ *   The ids of up to `limit` messages which expired at or before `now`, those which expired first first.
+ */
+- (NSArray<NSString *> *)fetchExpiredMessageIdsWithLimit:(NSUInteger)limit
+                                                     now:(uint64_t)now
+                                             transaction:(YapDatabaseReadTransaction *)transaction;
+
 /**
  * @return
  *   uint64_t millisecond timestamp wrapped in a number. Retrieve with `unsignedLongLongvalue`.
@@ -63,6 +63,34 @@ static NSString *const OWSDisappearingMessageFinderExpiresAtIndex = @"index_mess
     return [messageIds copy];
 }
 
+- (NSArray<NSString *> *)fetchExpiredMessageIdsWithLimit:(NSUInteger)limit
+                                                     now:(uint64_t)now
+                                             transaction:(YapDatabaseReadTransaction *)transaction
+{
+    OWSAssert(limit > 0);
+    OWSAssert(transaction);
+
+    NSMutableArray<NSString *> *messageIds = [NSMutableArray new];
+
+    // When (expiresAt == 0) the message SHOULD NOT expire. Careful ;)
+    NSString *formattedString = [NSString stringWithFormat:@"WHERE %@ > 0 AND %@ <= %lld ORDER BY %@ ASC",
+                                          OWSDisappearingMessageFinderExpiresAtColumn,
+                                          OWSDisappearingMessageFinderExpiresAtColumn,
+                                          now,
+                                          OWSDisappearingMessageFinderExpiresAtColumn];
+    YapDatabaseQuery *query = [YapDatabaseQuery queryWithFormat:formattedString];
+    [[transaction ext:OWSDisappearingMessageFinderExpiresAtIndex]
+        enumerateKeysMatchingQuery:query
+                        usingBlock:^void(NSString *collection, NSString *key, BOOL *stop) {
+                            [messageIds addObject:key];
+                            if (messageIds.count >= limit) {
+                                *stop = YES;
+                            }
+                        }];
+
+    return [messageIds copy];
+}
+
 - (nullable NSNumber *)nextExpirationTimestampWithTransaction:(YapDatabaseReadTransaction *)transaction
 {
     OWSAssert(transaction);
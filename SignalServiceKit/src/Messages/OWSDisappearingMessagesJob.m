@@ -13,8 +13,44 @@
 #import "TSIncomingMessage.h"
 #import "TSMessage.h"
 #import "TSStorageManager.h"
+#import "TSThread.h"
 
 NS_ASSUME_NONNULL_BEGIN
+
+// The max number of expired messages removed per write transaction, so that
+// a large backlog of expired messages doesn't hold the write lock for too long.
+const NSUInteger kMaxExpiredMessagesPerTransaction = 250;
+
+@interface OWSPendingMessageExpiration : NSObject
+
+@property (nonatomic, readonly) TSMessage *message;
+@property (nonatomic, readonly) uint64_t expirationStartedAt;
+
+@end
+
+#pragma mark -
+
+@implementation OWSPendingMessageExpiration
+
+- (instancetype)initWithMessage:(TSMessage *)message expirationStartedAt:(uint64_t)expirationStartedAt
+{
+    OWSAssert(message);
+
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _message = message;
+    _expirationStartedAt = expirationStartedAt;
+
+    return self;
+}
+
+@end
+
+#pragma mark -
+
 // Can we move to Signal-iOS?
 @interface OWSDisappearingMessagesJob ()
 
@@ -22,6 +58,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, readonly) OWSDisappearingMessagesFinder *disappearingMessagesFinder;
 
+// This property should only be accessed on the serialQueue.
+@property (nonatomic, readonly) NSMutableArray<OWSPendingMessageExpiration *> *pendingExpirations;
+
 // These three properties should only be accessed on the main thread.
 @property (nonatomic) BOOL hasStarted;
 @property (nonatomic, nullable) NSTimer *timer;
@@ -52,6 +91,7 @@ NS_ASSUME_NONNULL_BEGIN
 
     _databaseConnection = storageManager.newDatabaseConnection;
     _disappearingMessagesFinder = [OWSDisappearingMessagesFinder new];
+    _pendingExpirations = [NSMutableArray new];
 
     OWSSingletonAssert();
 
@@ -87,24 +127,70 @@ NS_ASSUME_NONNULL_BEGIN
 {
     uint64_t now = [NSDate ows_millisecondTimeStamp];
 
-    __block uint expirationCount = 0;
-    [self.databaseConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-        [self.disappearingMessagesFinder enumerateExpiredMessagesWithBlock:^(TSMessage *message) {
-            // sanity check
-            if (message.expiresAt > now) {
-                DDLogError(
-                    @"%@ Refusing to remove message which doesn't expire until: %lld", self.logTag, message.expiresAt);
-                return;
-            }
-
-            DDLogDebug(@"%@ Removing message which expired at: %lld", self.logTag, message.expiresAt);
-            [message removeWithTransaction:transaction];
-            expirationCount++;
+    // Remove expired messages (and their attachments) in bounded batches, one write
+    // transaction per batch, rather than one transaction for an unbounded backlog.
+    NSUInteger expirationCount = 0;
+    NSUInteger batchCount = 0;
+    while (YES) {
+        __block NSUInteger fetchCount = 0;
+        __block NSUInteger removalCount = 0;
+        [self.databaseConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
+            // Use the same `now` as removeExpiredMessagesWithIds:, so that we never
+            // fetch messages which it will refuse to remove.
+            NSArray<NSString *> *expiredMessageIds =
+                [self.disappearingMessagesFinder fetchExpiredMessageIdsWithLimit:kMaxExpiredMessagesPerTransaction
+                                                                             now:now
+                                                                     transaction:transaction];
+            fetchCount = expiredMessageIds.count;
+            // Each thread is updated once per batch, rather than once per expired message.
+            [TSThread performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                                 block:^{
+                                                                     removalCount = [self
+                                                                         removeExpiredMessagesWithIds:expiredMessageIds
+                                                                                                  now:now
+                                                                                          transaction:transaction];
+                                                                 }];
+        }];
+        expirationCount += removalCount;
+        batchCount++;
+
+        // If a batch removes nothing, the next batch would fetch the same messages.
+        if (fetchCount < kMaxExpiredMessagesPerTransaction || removalCount == 0) {
+            break;
         }
-                                                               transaction:transaction];
-    }];
+    }
+
+    DDLogDebug(@"%@ Removed %zd expired messages in %zd transactions", self.logTag, expirationCount, batchCount);
+}
 
-    DDLogDebug(@"%@ Removed %u expired messages", self.logTag, expirationCount);
+// Returns the number of messages removed.
+- (NSUInteger)removeExpiredMessagesWithIds:(NSArray<NSString *> *)expiredMessageIds
+                                       now:(uint64_t)now
+                               transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    __block NSUInteger removalCount = 0;
+    [transaction enumerateObjectsForKeys:expiredMessageIds
+                            inCollection:[TSMessage collection]
+                     unorderedUsingBlock:^(NSUInteger keyIndex, id _Nullable object, BOOL *stop) {
+                         if (![object isKindOfClass:[TSMessage class]]) {
+                             DDLogError(@"%@ unexpected object: %@", self.logTag, object);
+                             return;
+                         }
+                         TSMessage *message = (TSMessage *)object;
+
+                         // sanity check
+                         if (message.expiresAt > now) {
+                             DDLogError(@"%@ Refusing to remove message which doesn't expire until: %lld",
+                                 self.logTag,
+                                 message.expiresAt);
+                             return;
+                         }
+
+                         DDLogDebug(@"%@ Removing message which expired at: %lld", self.logTag, message.expiresAt);
+                         [message removeWithTransaction:transaction];
+                         removalCount++;
+                     }];
+    return removalCount;
 }
 
 // This method should only be called on the serialQueue.
@@ -114,6 +200,14 @@ NS_ASSUME_NONNULL_BEGIN
 
     [self run];
 
+    [self scheduleNextRun];
+}
+
+// Schedules the next run for exactly when the next message expires, or within maxDelaySeconds.
+//
+// This method should only be called on the serialQueue.
+- (void)scheduleNextRun
+{
     uint64_t now = [NSDate ows_millisecondTimeStamp];
     __block NSNumber *nextExpirationTimestampNumber;
     [self.databaseConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
@@ -121,8 +215,8 @@ NS_ASSUME_NONNULL_BEGIN
             [self.disappearingMessagesFinder nextExpirationTimestampWithTransaction:transaction];
     }];
     if (!nextExpirationTimestampNumber) {
-        // In theory we could kill the loop here. It should resume when the next expiring message is saved,
-        // But this is a safeguard for any race conditions that exist while running the job as a new message is saved.
+        // We'll be scheduled again when the expiration of the next expiring message starts,
+        // but fall back to polling in case that is missed.
         DDLogDebug(@"%@ No more expiring messages.", self.logTag);
         [self runLater];
         return;
@@ -162,22 +256,63 @@ NS_ASSUME_NONNULL_BEGIN
     });
 }
 
+// Expirations started in quick succession (e.g. when a batch of read receipts arrives)
+// are applied in a single write transaction.
+//
 // This method should only be called on the serialQueue.
 - (void)setExpirationForMessage:(TSMessage *)message expirationStartedAt:(uint64_t)expirationStartedAt
 {
+    [self.pendingExpirations
+        addObject:[[OWSPendingMessageExpiration alloc] initWithMessage:message expirationStartedAt:expirationStartedAt]];
+    if (self.pendingExpirations.count > 1) {
+        // A flush is already enqueued.
+        return;
+    }
+
+    // Any other expirations which are already enqueued on the serialQueue will be
+    // added before this flush runs.
+    dispatch_async(OWSDisappearingMessagesJob.serialQueue, ^{
+        [self flushPendingExpirations];
+    });
+}
+
+// This method should only be called on the serialQueue.
+- (void)flushPendingExpirations
+{
+    NSArray<OWSPendingMessageExpiration *> *pendingExpirations = [self.pendingExpirations copy];
+    [self.pendingExpirations removeAllObjects];
+    if (pendingExpirations.count < 1) {
+        return;
+    }
+
+    __block uint64_t earliestExpiresAt = 0;
     [self.databaseConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-        [self setExpirationForMessage:message expirationStartedAt:expirationStartedAt transaction:transaction];
+        for (OWSPendingMessageExpiration *pendingExpiration in pendingExpirations) {
+            uint64_t expiresAt = [self updateExpirationForMessage:pendingExpiration.message
+                                              expirationStartedAt:pendingExpiration.expirationStartedAt
+                                                      transaction:transaction];
+            if (expiresAt > 0 && (earliestExpiresAt == 0 || expiresAt < earliestExpiresAt)) {
+                earliestExpiresAt = expiresAt;
+            }
+        }
     }];
+    DDLogDebug(@"%@ Started expiration for %zd messages", self.logTag, pendingExpirations.count);
+
+    // Necessary that the async expiration run happens *after* the messages are saved with expiration configuration.
+    if (earliestExpiresAt > 0) {
+        [self runByDate:[NSDate ows_dateWithMillisecondsSince1970:earliestExpiresAt]];
+    }
 }
 
-- (void)setExpirationForMessage:(TSMessage *)message
-            expirationStartedAt:(uint64_t)expirationStartedAt
-                    transaction:(YapDatabaseReadWriteTransaction *_Nonnull)transaction
+// Returns the message's expiration timestamp or 0 if the message doesn't expire.
+- (uint64_t)updateExpirationForMessage:(TSMessage *)message
+                   expirationStartedAt:(uint64_t)expirationStartedAt
+                           transaction:(YapDatabaseReadWriteTransaction *_Nonnull)transaction
 {
     OWSAssert(transaction);
 
     if (!message.isExpiringMessage) {
-        return;
+        return 0;
     }
 
     int startedSecondsAgo = [NSDate new].timeIntervalSince1970 - expirationStartedAt / 1000.0;
@@ -188,8 +323,7 @@ NS_ASSUME_NONNULL_BEGIN
         [message updateWithExpireStartedAt:expirationStartedAt transaction:transaction];
     }
 
-    // Necessary that the async expiration run happens *after* the message is saved with expiration configuration.
-    [self runByDate:[NSDate ows_dateWithMillisecondsSince1970:message.expiresAt]];
+    return message.expiresAt;
 }
 
 + (void)setExpirationsForThread:(TSThread *)thread
@@ -203,6 +337,7 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)setExpirationsForThread:(TSThread *)thread
 {
     uint64_t now = [NSDate ows_millisecondTimeStamp];
+    __block NSUInteger messageCount = 0;
     [self.databaseConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
         [self.disappearingMessagesFinder
             enumerateUnstartedExpiringMessagesInThread:thread
@@ -213,12 +348,17 @@ NS_ASSUME_NONNULL_BEGIN
                                                          self.logTag);
                                                      // specify "now" in case D.M. have since been disabled, but we have
                                                      // existing unstarted expiring messages that still need to expire.
-                                                     [self setExpirationForMessage:message
-                                                               expirationStartedAt:now
-                                                                       transaction:transaction];
+                                                     [self updateExpirationForMessage:message
+                                                                  expirationStartedAt:now
+                                                                          transaction:transaction];
+                                                     messageCount++;
                                                  }
                                            transaction:transaction];
     }];
+
+    if (messageCount > 0) {
+        [self scheduleNextRun];
+    }
 }
 
 + (void)becomeConsistentWithConfigurationForMessage:(TSMessage *)message
@@ -302,6 +442,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (NSTimeInterval)maxDelaySeconds
 {
     // Don't run less often than once per N minutes.
+    //
+    // Runs are scheduled for exactly when the next message expires, but this is a
+    // safeguard in case an expiration started without rescheduling the job, e.g.
+    // due to a race with a run while a new expiring message is saved.
     return 5 * kMinuteInterval;
 }
 
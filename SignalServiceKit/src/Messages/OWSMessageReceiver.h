@@ -17,6 +17,8 @@ NS_ASSUME_NONNULL_BEGIN
 + (void)syncRegisterDatabaseExtension:(OWSStorage *)storage;
 
 - (void)handleReceivedEnvelope:(OWSSignalServiceProtosEnvelope *)envelope;
+// Persists the envelopes in a single transaction, in order.
+- (void)handleReceivedEnvelopes:(NSArray<OWSSignalServiceProtosEnvelope *> *)envelopes;
 - (void)handleAnyUnprocessedEnvelopesAsync;
 
 @end
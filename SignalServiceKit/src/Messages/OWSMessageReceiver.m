@@ -107,29 +107,42 @@ NSString *const OWSMessageDecryptJobFinderExtensionGroup = @"OWSMessageProcessin
     return self;
 }
 
-- (OWSMessageDecryptJob *_Nullable)nextJob
+- (NSArray<OWSMessageDecryptJob *> *)nextJobsForBatchSize:(NSUInteger)maxBatchSize
 {
-    __block OWSMessageDecryptJob *_Nullable job = nil;
+    NSMutableArray<OWSMessageDecryptJob *> *jobs = [NSMutableArray new];
     [self.dbConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
         YapDatabaseViewTransaction *viewTransaction = [transaction ext:OWSMessageDecryptJobFinderExtensionName];
         OWSAssert(viewTransaction != nil);
-        job = [viewTransaction firstObjectInGroup:OWSMessageDecryptJobFinderExtensionGroup];
+        [viewTransaction enumerateKeysAndObjectsInGroup:OWSMessageDecryptJobFinderExtensionGroup
+                                             usingBlock:^(NSString *_Nonnull collection,
+                                                 NSString *_Nonnull key,
+                                                 id _Nonnull object,
+                                                 NSUInteger index,
+                                                 BOOL *_Nonnull stop) {
+                                                 OWSMessageDecryptJob *job = object;
+                                                 [jobs addObject:job];
+                                                 if (jobs.count >= maxBatchSize) {
+                                                     *stop = YES;
+                                                 }
+                                             }];
     }];
 
-    return job;
+    return [jobs copy];
 }
 
-- (void)addJobForEnvelope:(OWSSignalServiceProtosEnvelope *)envelope
+- (void)addJobsForEnvelopes:(NSArray<OWSSignalServiceProtosEnvelope *> *)envelopes
 {
     [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-        [[[OWSMessageDecryptJob alloc] initWithEnvelope:envelope] saveWithTransaction:transaction];
+        for (OWSSignalServiceProtosEnvelope *envelope in envelopes) {
+            [[[OWSMessageDecryptJob alloc] initWithEnvelope:envelope] saveWithTransaction:transaction];
+        }
     }];
 }
 
-- (void)removeJobWithId:(NSString *)uniqueId
+- (void)removeJobsWithIds:(NSArray<NSString *> *)uniqueIds
 {
     [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
-        [transaction removeObjectForKey:uniqueId inCollection:[OWSMessageDecryptJob collection]];
+        [transaction removeObjectsForKeys:uniqueIds inCollection:[OWSMessageDecryptJob collection]];
     }];
 }
 
@@ -271,9 +284,9 @@ NSString *const OWSMessageDecryptJobFinderExtensionGroup = @"OWSMessageProcessin
     return queue;
 }
 
-- (void)enqueueEnvelopeForProcessing:(OWSSignalServiceProtosEnvelope *)envelope
+- (void)enqueueEnvelopesForProcessing:(NSArray<OWSSignalServiceProtosEnvelope *> *)envelopes
 {
-    [self.finder addJobForEnvelope:envelope];
+    [self.finder addJobsForEnvelopes:envelopes];
 }
 
 - (void)drainQueue
@@ -302,8 +315,14 @@ NSString *const OWSMessageDecryptJobFinderExtensionGroup = @"OWSMessageProcessin
 {
     AssertOnDispatchQueue(self.serialQueue);
 
-    OWSMessageDecryptJob *_Nullable job = [self.finder nextJob];
-    if (!job) {
+    // Fetching and removing the jobs in batches amortizes the transaction costs over
+    // many envelopes.  Each decrypted envelope is still persisted as soon as it has been
+    // decrypted; see processJobs:completion:.
+    const NSUInteger kIncomingMessageDecryptBatchSize = 16;
+
+    NSArray<OWSMessageDecryptJob *> *jobs = [self.finder nextJobsForBatchSize:kIncomingMessageDecryptBatchSize];
+    OWSAssert(jobs);
+    if (jobs.count < 1) {
         self.isDrainingQueue = NO;
         DDLogVerbose(@"%@ Queue is drained.", self.logTag);
         return;
@@ -311,40 +330,80 @@ NSString *const OWSMessageDecryptJobFinderExtensionGroup = @"OWSMessageProcessin
 
     __block OWSBackgroundTask *backgroundTask = [OWSBackgroundTask backgroundTaskWithLabelStr:__PRETTY_FUNCTION__];
 
-    [self processJob:job
-          completion:^(BOOL success) {
-              [self.finder removeJobWithId:job.uniqueId];
-              DDLogVerbose(@"%@ %@ job. %lu jobs left.",
-                  self.logTag,
-                  success ? @"decrypted" : @"failed to decrypt",
-                  (unsigned long)[OWSMessageDecryptJob numberOfKeysInCollection]);
-              [self drainQueueWorkStep];
-              backgroundTask = nil;
-          }];
+    [self processJobs:jobs
+           completion:^(NSUInteger successCount) {
+               AssertOnDispatchQueue(self.serialQueue);
+
+               [self.finder removeJobsWithIds:jobs.uniqueIds];
+
+               DDLogVerbose(@"%@ decrypted %zd of %zd jobs. %lu jobs left.",
+                   self.logTag,
+                   successCount,
+                   jobs.count,
+                   (unsigned long)[OWSMessageDecryptJob numberOfKeysInCollection]);
+               [self drainQueueWorkStep];
+               backgroundTask = nil;
+           }];
 }
 
-- (void)processJob:(OWSMessageDecryptJob *)job completion:(void (^)(BOOL))completion
+// Submits every job in the batch to the decrypter without waiting for the previous
+// one to complete, so that the blocking, DB-bound parts of decryption overlap.
+//
+// Per-sender ordering is preserved: the decrypter performs the session operations
+// on the serial session store queue, in the order in which they are submitted.
+//
+// We can't decrypt the same message twice, so we need to persist the decrypted
+// envelope data ASAP to prevent data loss.  Each envelope is persisted as soon as
+// it and every envelope before it in the batch have been decrypted, so that they
+// are processed in the order in which they were received.
+- (void)processJobs:(NSArray<OWSMessageDecryptJob *> *)jobs completion:(void (^)(NSUInteger successCount))completion
 {
     AssertOnDispatchQueue(self.serialQueue);
-    OWSAssert(job);
-
-    OWSSignalServiceProtosEnvelope *envelope = job.envelopeProto;
-    [self.messageDecrypter decryptEnvelope:envelope
-        successBlock:^(NSData *_Nullable plaintextData) {
+    OWSAssert(jobs.count > 0);
+
+    // The following state should only be accessed while synchronized on completedIndices.
+    NSMutableIndexSet *completedIndices = [NSMutableIndexSet new];
+    NSMutableIndexSet *successfulIndices = [NSMutableIndexSet new];
+    // Decrypted envelopes may have no plaintext, e.g. receipts.
+    NSMutableDictionary<NSNumber *, NSData *> *plaintextDataMap = [NSMutableDictionary new];
+    __block NSUInteger nextIndexToPersist = 0;
+
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger index = 0; index < jobs.count; index++) {
+        OWSMessageDecryptJob *job = jobs[index];
+
+        void (^didComplete)(BOOL, NSData *_Nullable) = ^(BOOL success, NSData *_Nullable plaintextData) {
+            @synchronized(completedIndices)
+            {
+                [completedIndices addIndex:index];
+                if (success) {
+                    [successfulIndices addIndex:index];
+                    plaintextDataMap[@(index)] = plaintextData;
+                }
+                for (; [completedIndices containsIndex:nextIndexToPersist]; nextIndexToPersist++) {
+                    if (![successfulIndices containsIndex:nextIndexToPersist]) {
+                        continue;
+                    }
+                    [self.batchMessageProcessor enqueueEnvelopeData:jobs[nextIndexToPersist].envelopeData
+                                                      plaintextData:plaintextDataMap[@(nextIndexToPersist)]];
+                }
+            }
+            dispatch_group_leave(group);
+        };
 
-            // We can't decrypt the same message twice, so we need to persist
-            // the decrypted envelope data ASAP to prevent data loss.
-            [self.batchMessageProcessor enqueueEnvelopeData:job.envelopeData plaintextData:plaintextData];
+        dispatch_group_enter(group);
+        [self.messageDecrypter decryptEnvelope:job.envelopeProto
+            successBlock:^(NSData *_Nullable plaintextData) {
+                didComplete(YES, plaintextData);
+            }
+            failureBlock:^{
+                didComplete(NO, nil);
+            }];
+    }
 
-            dispatch_async(self.serialQueue, ^{
-                completion(YES);
-            });
-        }
-        failureBlock:^{
-            dispatch_async(self.serialQueue, ^{
-                completion(NO);
-            });
-        }];
+    dispatch_group_notify(group, self.serialQueue, ^{
+        completion(successfulIndices.count);
+    });
 }
 
 #pragma mark Logging
@@ -436,21 +495,34 @@ NSString *const OWSMessageDecryptJobFinderExtensionGroup = @"OWSMessageProcessin
 
 - (void)handleReceivedEnvelope:(OWSSignalServiceProtosEnvelope *)envelope
 {
-    // Drop any too-large messages on the floor. Well behaving clients should never send them.
-    NSUInteger kMaxEnvelopeByteCount = 250 * 1024;
-    if (envelope.serializedSize > kMaxEnvelopeByteCount) {
-        OWSProdError([OWSAnalyticsEvents messageReceiverErrorOversizeMessage]);
-        return;
-    }
+    [self handleReceivedEnvelopes:@[ envelope ]];
+}
 
-    // Take note of any messages larger than we expect, but still process them.
-    // This likely indicates a misbehaving sending client.
-    NSUInteger kLargeEnvelopeWarningByteCount = 25 * 1024;
-    if (envelope.serializedSize > kLargeEnvelopeWarningByteCount) {
-        OWSProdError([OWSAnalyticsEvents messageReceiverErrorLargeMessage]);
+- (void)handleReceivedEnvelopes:(NSArray<OWSSignalServiceProtosEnvelope *> *)envelopes
+{
+    NSMutableArray<OWSSignalServiceProtosEnvelope *> *envelopesToProcess = [NSMutableArray new];
+    for (OWSSignalServiceProtosEnvelope *envelope in envelopes) {
+        // Drop any too-large messages on the floor. Well behaving clients should never send them.
+        NSUInteger kMaxEnvelopeByteCount = 250 * 1024;
+        if (envelope.serializedSize > kMaxEnvelopeByteCount) {
+            OWSProdError([OWSAnalyticsEvents messageReceiverErrorOversizeMessage]);
+            continue;
+        }
+
+        // Take note of any messages larger than we expect, but still process them.
+        // This likely indicates a misbehaving sending client.
+        NSUInteger kLargeEnvelopeWarningByteCount = 25 * 1024;
+        if (envelope.serializedSize > kLargeEnvelopeWarningByteCount) {
+            OWSProdError([OWSAnalyticsEvents messageReceiverErrorLargeMessage]);
+        }
+
+        [envelopesToProcess addObject:envelope];
+    }
+    if (envelopesToProcess.count < 1) {
+        return;
     }
 
-    [self.processingQueue enqueueEnvelopeForProcessing:envelope];
+    [self.processingQueue enqueueEnvelopesForProcessing:envelopesToProcess];
     [self.processingQueue drainQueue];
 }
 
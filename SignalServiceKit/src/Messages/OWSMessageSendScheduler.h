@@ -0,0 +1,48 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, OWSMessageSendPriority) {
+    // e.g. sync messages and receipts.
+    OWSMessageSendPriorityBackground,
+    // e.g. messages composed by the user.
+    OWSMessageSendPriorityInteractive,
+};
+
+// Runs message send operations with a bounded number in flight.
+//
+// * Operations are grouped into "lanes" (e.g. one per thread).  The operations
+//   of a lane are run one at a time, in the order in which they were added.
+// * When a slot frees up, the lane whose next operation has the highest priority
+//   (and then, was added earliest) goes next.  One slot is reserved for
+//   interactive operations so that they never wait behind a backlog of
+//   background operations.
+// * Lanes are discarded as soon as they are idle.
+@interface OWSMessageSendScheduler : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (instancetype)initWithMaxConcurrentOperationCount:(NSUInteger)maxConcurrentOperationCount NS_DESIGNATED_INITIALIZER;
+
+// The operation may be asynchronous; its lane is blocked until it finishes.
+//
+// The scheduler uses the operation's completionBlock, so callers shouldn't set it.
+- (void)addOperation:(NSOperation *)operation laneKey:(NSString *)laneKey priority:(OWSMessageSendPriority)priority;
+
+#pragma mark - Metrics
+
+// The number of operations which have been added but not yet started.
+@property (nonatomic, readonly) NSUInteger pendingOperationCount;
+@property (nonatomic, readonly) NSUInteger executingOperationCount;
+@property (nonatomic, readonly) NSUInteger laneCount;
+
+// The average time between an operation being added and it being started,
+// over the lifetime of the scheduler.
+- (NSTimeInterval)averageWaitTimeForPriority:(OWSMessageSendPriority)priority;
+- (NSTimeInterval)maxWaitTimeForPriority:(OWSMessageSendPriority)priority;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,281 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSMessageSendScheduler.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+static const NSUInteger kPriorityCount = OWSMessageSendPriorityInteractive + 1;
+
+@interface OWSScheduledSendOperation : NSObject
+
+@property (nonatomic, readonly) NSOperation *operation;
+@property (nonatomic, readonly) OWSMessageSendPriority priority;
+@property (nonatomic, readonly) NSDate *enqueueDate;
+
+@end
+
+#pragma mark -
+
+@implementation OWSScheduledSendOperation
+
+- (instancetype)initWithOperation:(NSOperation *)operation priority:(OWSMessageSendPriority)priority
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _operation = operation;
+    _priority = priority;
+    _enqueueDate = [NSDate new];
+
+    return self;
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSMessageSendLane : NSObject
+
+@property (nonatomic, readonly) NSMutableArray<OWSScheduledSendOperation *> *pendingOperations;
+@property (nonatomic) BOOL isExecuting;
+
+@end
+
+#pragma mark -
+
+@implementation OWSMessageSendLane
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _pendingOperations = [NSMutableArray new];
+
+    return self;
+}
+
+- (BOOL)isIdle
+{
+    return !self.isExecuting && self.pendingOperations.count < 1;
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSMessageSendScheduler ()
+
+@property (nonatomic, readonly) NSUInteger maxConcurrentOperationCount;
+@property (nonatomic, readonly) NSOperationQueue *operationQueue;
+
+// The following state should only be accessed while synchronized on self.
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, OWSMessageSendLane *> *lanes;
+@property (nonatomic) NSUInteger pendingOperationCount;
+@property (nonatomic) NSUInteger executingOperationCount;
+@property (nonatomic) NSUInteger startedOperationCount;
+
+@end
+
+#pragma mark -
+
+@implementation OWSMessageSendScheduler {
+    // Indexed by priority.  Should only be accessed while synchronized on self.
+    NSUInteger _startedCounts[kPriorityCount];
+    NSTimeInterval _totalWaitTimes[kPriorityCount];
+    NSTimeInterval _maxWaitTimes[kPriorityCount];
+}
+
+- (instancetype)initWithMaxConcurrentOperationCount:(NSUInteger)maxConcurrentOperationCount
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    OWSAssert(maxConcurrentOperationCount > 1);
+
+    _maxConcurrentOperationCount = maxConcurrentOperationCount;
+    _lanes = [NSMutableDictionary new];
+
+    // Concurrency is bounded by the scheduler, not the queue.
+    _operationQueue = [NSOperationQueue new];
+    _operationQueue.qualityOfService = NSOperationQualityOfServiceUserInitiated;
+    _operationQueue.name = self.logTag;
+
+    return self;
+}
+
+- (void)addOperation:(NSOperation *)operation laneKey:(NSString *)laneKey priority:(OWSMessageSendPriority)priority
+{
+    OWSAssert(operation);
+    OWSAssert(laneKey.length > 0);
+    OWSAssert(!operation.completionBlock);
+
+    @synchronized(self)
+    {
+        OWSMessageSendLane *lane = self.lanes[laneKey];
+        if (!lane) {
+            lane = [OWSMessageSendLane new];
+            self.lanes[laneKey] = lane;
+        }
+        [lane.pendingOperations
+            addObject:[[OWSScheduledSendOperation alloc] initWithOperation:operation priority:priority]];
+        self.pendingOperationCount++;
+
+        [self startOperations];
+    }
+}
+
+// Should only be called while synchronized on self.
+- (void)startOperations
+{
+    while (self.executingOperationCount < self.maxConcurrentOperationCount) {
+        NSString *_Nullable nextLaneKey = nil;
+        OWSScheduledSendOperation *_Nullable next = nil;
+        for (NSString *laneKey in self.lanes) {
+            OWSMessageSendLane *lane = self.lanes[laneKey];
+            if (lane.isExecuting || lane.pendingOperations.count < 1) {
+                continue;
+            }
+            OWSScheduledSendOperation *candidate = lane.pendingOperations.firstObject;
+            if (!next || candidate.priority > next.priority
+                || (candidate.priority == next.priority &&
+                       [candidate.enqueueDate compare:next.enqueueDate] == NSOrderedAscending)) {
+                next = candidate;
+                nextLaneKey = laneKey;
+            }
+        }
+        if (!next) {
+            return;
+        }
+
+        BOOL isLastSlot = self.executingOperationCount + 1 >= self.maxConcurrentOperationCount;
+        if (isLastSlot && next.priority < OWSMessageSendPriorityInteractive) {
+            // Reserved for interactive operations.
+            return;
+        }
+
+        OWSAssert(nextLaneKey);
+        [self startOperation:next laneKey:nextLaneKey];
+    }
+}
+
+// Should only be called while synchronized on self.
+- (void)startOperation:(OWSScheduledSendOperation *)scheduledOperation laneKey:(NSString *)laneKey
+{
+    OWSMessageSendLane *lane = self.lanes[laneKey];
+    OWSAssert(lane);
+    OWSAssert(lane.pendingOperations.firstObject == scheduledOperation);
+
+    [lane.pendingOperations removeObjectAtIndex:0];
+    lane.isExecuting = YES;
+    self.pendingOperationCount--;
+    self.executingOperationCount++;
+    [self didStartOperationWithPriority:scheduledOperation.priority
+                               waitTime:fabs([scheduledOperation.enqueueDate timeIntervalSinceNow])];
+
+    __weak typeof(self) weakSelf = self;
+    scheduledOperation.operation.completionBlock = ^{
+        [weakSelf operationDidFinishInLane:laneKey];
+    };
+    [self.operationQueue addOperation:scheduledOperation.operation];
+}
+
+- (void)operationDidFinishInLane:(NSString *)laneKey
+{
+    @synchronized(self)
+    {
+        OWSMessageSendLane *lane = self.lanes[laneKey];
+        OWSAssert(lane.isExecuting);
+
+        lane.isExecuting = NO;
+        self.executingOperationCount--;
+        if (lane.isIdle) {
+            [self.lanes removeObjectForKey:laneKey];
+        }
+
+        [self startOperations];
+    }
+}
+
+#pragma mark - Metrics
+
+// Should only be called while synchronized on self.
+- (void)didStartOperationWithPriority:(OWSMessageSendPriority)priority waitTime:(NSTimeInterval)waitTime
+{
+    OWSAssert(priority < kPriorityCount);
+
+    _startedCounts[priority]++;
+    _totalWaitTimes[priority] += waitTime;
+    _maxWaitTimes[priority] = MAX(_maxWaitTimes[priority], waitTime);
+    self.startedOperationCount++;
+
+    if (self.startedOperationCount % 100 == 0) {
+        DDLogInfo(@"%@ started %lu operations, pending: %lu, lanes: %lu, average wait: %.3fs interactive, %.3fs "
+                  @"background.",
+            self.logTag,
+            (unsigned long)self.startedOperationCount,
+            (unsigned long)self.pendingOperationCount,
+            (unsigned long)self.lanes.count,
+            [self averageWaitTimeForPriority:OWSMessageSendPriorityInteractive],
+            [self averageWaitTimeForPriority:OWSMessageSendPriorityBackground]);
+    }
+}
+
+- (NSUInteger)pendingOperationCount
+{
+    @synchronized(self)
+    {
+        return _pendingOperationCount;
+    }
+}
+
+- (NSUInteger)executingOperationCount
+{
+    @synchronized(self)
+    {
+        return _executingOperationCount;
+    }
+}
+
+- (NSUInteger)laneCount
+{
+    @synchronized(self)
+    {
+        return self.lanes.count;
+    }
+}
+
+- (NSTimeInterval)averageWaitTimeForPriority:(OWSMessageSendPriority)priority
+{
+    OWSAssert(priority < kPriorityCount);
+
+    @synchronized(self)
+    {
+        if (_startedCounts[priority] < 1) {
+            return 0;
+        }
+        return _totalWaitTimes[priority] / _startedCounts[priority];
+    }
+}
+
+- (NSTimeInterval)maxWaitTimeForPriority:(OWSMessageSendPriority)priority
+{
+    OWSAssert(priority < kPriorityCount);
+
+    @synchronized(self)
+    {
+        return _maxWaitTimes[priority];
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
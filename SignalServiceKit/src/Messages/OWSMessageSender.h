@@ -8,6 +8,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class ContactsUpdater;
 @class OWSBlockingManager;
+@class OWSMessageSendScheduler;
 @class OWSUploadingService;
 @class SignalRecipient;
 @class TSInvalidIdentityKeySendingErrorMessage;
@@ -61,6 +62,9 @@ NS_SWIFT_NAME(MessageSender)
 
 - (void)setBlockingManager:(OWSBlockingManager *)blockingManager;
 
+// Exposed for its metrics.
+@property (nonatomic, readonly) OWSMessageSendScheduler *sendScheduler;
+
 /**
  * Send and resend text messages or resend messages with existing attachments.
  * If you haven't yet created the attachment, see the ` enqueueAttachment:` variants.
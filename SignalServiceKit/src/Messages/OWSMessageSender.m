@@ -7,15 +7,18 @@
 #import "ContactsUpdater.h"
 #import "NSData+keyVersionByte.h"
 #import "NSData+messagePadding.h"
+#import "NSDate+OWS.h"
 #import "OWSBackgroundTask.h"
 #import "OWSBlockingManager.h"
 #import "OWSDevice.h"
 #import "OWSDisappearingMessagesJob.h"
 #import "OWSError.h"
 #import "OWSIdentityManager.h"
+#import "OWSMessageSendScheduler.h"
 #import "OWSMessageServiceParams.h"
 #import "OWSOutgoingSentMessageTranscript.h"
 #import "OWSOutgoingSyncMessage.h"
+#import "OWSReadReceiptsForSenderMessage.h"
 #import "OWSUploadingService.h"
 #import "PreKeyBundle+jsonDict.h"
 #import "SignalRecipient.h"
@@ -303,10 +306,117 @@ NSUInteger const OWSSendMessageOperationMaxRetries = 4;
 @end
 
 
+#pragma mark -
+
+// Accumulates where the time goes while sending a message.  The sends to
+// a group's recipients overlap, so the durations can add up to more than
+// the elapsed time.
+@interface OWSMessageSendTimings : NSObject
+
+@property (nonatomic, readonly) NSDate *startDate;
+@property (nonatomic, readonly) NSTimeInterval preKeyFetchDuration;
+@property (nonatomic, readonly) NSTimeInterval encryptionDuration;
+@property (nonatomic, readonly) NSTimeInterval networkDuration;
+
+@end
+
+#pragma mark -
+
+@implementation OWSMessageSendTimings
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _startDate = [NSDate new];
+
+    return self;
+}
+
+- (void)addPreKeyFetchDuration:(NSTimeInterval)duration
+{
+    @synchronized(self)
+    {
+        _preKeyFetchDuration += duration;
+    }
+}
+
+- (void)addEncryptionDuration:(NSTimeInterval)duration
+{
+    @synchronized(self)
+    {
+        _encryptionDuration += duration;
+    }
+}
+
+- (void)addNetworkDuration:(NSTimeInterval)duration
+{
+    @synchronized(self)
+    {
+        _networkDuration += duration;
+    }
+}
+
+- (NSString *)description
+{
+    @synchronized(self)
+    {
+        return [NSString stringWithFormat:@"total: %.3fs, prekey fetch: %.3fs, encryption: %.3fs, network: %.3fs",
+                         fabs([self.startDate timeIntervalSinceNow]),
+                         _preKeyFetchDuration,
+                         _encryptionDuration,
+                         _networkDuration];
+    }
+}
+
+@end
+
+#pragma mark -
+
+// The result of fetching a prekey bundle ahead of encryption.
+@interface OWSPrefetchedPreKeyBundle : NSObject
+
+@property (nonatomic, readonly, nullable) PreKeyBundle *bundle;
+@property (nonatomic, readonly, nullable) NSException *exception;
+@property (nonatomic, readonly) NSDate *fetchDate;
+
+@end
+
+#pragma mark -
+
+@implementation OWSPrefetchedPreKeyBundle
+
+- (instancetype)initWithBundle:(nullable PreKeyBundle *)bundle exception:(nullable NSException *)exception
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _bundle = bundle;
+    _exception = exception;
+    _fetchDate = [NSDate new];
+
+    return self;
+}
+
+@end
+
+#pragma mark -
+
 int const OWSMessageSenderRetryAttempts = 3;
 NSString *const OWSMessageSenderInvalidDeviceException = @"InvalidDeviceException";
 NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
 
+// Prefetched bundles which aren't used promptly are discarded.
+static const NSTimeInterval kPrefetchedPreKeyBundleMaxAge = 5 * kMinuteInterval;
+static const long kMaxConcurrentPreKeyRequests = 8;
+// Bounds the number of messages being sent at once, across all threads.
+static const NSUInteger kMaxConcurrentSends = 4;
+
 @interface OWSMessageSender ()
 
 @property (nonatomic, readonly) TSNetworkManager *networkManager;
@@ -316,7 +426,11 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
 @property (nonatomic, readonly) YapDatabaseConnection *dbConnection;
 @property (nonatomic, readonly) id<ContactsManagerProtocol> contactsManager;
 @property (nonatomic, readonly) ContactsUpdater *contactsUpdater;
-@property (atomic, readonly) NSMutableDictionary<NSString *, NSOperationQueue *> *sendingQueueMap;
+
+// Keyed by "<recipient id>.<device id>".  Should only be accessed while synchronized on the dictionary.
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, OWSPrefetchedPreKeyBundle *> *prefetchedPreKeyBundles;
+// Keyed by message timestamp.  Should only be accessed while synchronized on the dictionary.
+@property (nonatomic, readonly) NSMutableDictionary<NSNumber *, OWSMessageSendTimings *> *sendTimingsMap;
 
 @end
 
@@ -336,16 +450,28 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
     _storageManager = storageManager;
     _contactsManager = contactsManager;
     _contactsUpdater = contactsUpdater;
-    _sendingQueueMap = [NSMutableDictionary new];
+    _sendScheduler = [[OWSMessageSendScheduler alloc] initWithMaxConcurrentOperationCount:kMaxConcurrentSends];
+    _prefetchedPreKeyBundles = [NSMutableDictionary new];
+    _sendTimingsMap = [NSMutableDictionary new];
 
     _uploadingService = [[OWSUploadingService alloc] initWithNetworkManager:networkManager];
     _dbConnection = storageManager.newDatabaseConnection;
 
     OWSSingletonAssert();
 
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(identityStateDidChange:)
+                                                 name:kNSNotificationName_IdentityStateDidChange
+                                               object:nil];
+
     return self;
 }
 
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
 - (void)setBlockingManager:(OWSBlockingManager *)blockingManager
 {
     OWSAssert(blockingManager);
@@ -354,28 +480,25 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
     _blockingManager = blockingManager;
 }
 
-- (NSOperationQueue *)sendingQueueForMessage:(TSOutgoingMessage *)message
+- (NSString *)sendLaneKeyForMessage:(TSOutgoingMessage *)message
 {
     OWSAssert(message);
 
-    NSString *kDefaultQueueKey = @"kDefaultQueueKey";
-    NSString *queueKey = message.uniqueThreadId ?: kDefaultQueueKey;
-    OWSAssert(queueKey.length > 0);
-
-    @synchronized(self)
-    {
-        NSOperationQueue *sendingQueue = self.sendingQueueMap[queueKey];
-
-        if (!sendingQueue) {
-            sendingQueue = [NSOperationQueue new];
-            sendingQueue.qualityOfService = NSOperationQualityOfServiceUserInitiated;
-            sendingQueue.maxConcurrentOperationCount = 1;
+    NSString *kDefaultLaneKey = @"kDefaultLaneKey";
+    NSString *laneKey = message.uniqueThreadId ?: kDefaultLaneKey;
+    OWSAssert(laneKey.length > 0);
+    return laneKey;
+}
 
-            self.sendingQueueMap[queueKey] = sendingQueue;
-        }
+- (OWSMessageSendPriority)sendPriorityForMessage:(TSOutgoingMessage *)message
+{
+    OWSAssert(message);
 
-        return sendingQueue;
+    if ([message isKindOfClass:[OWSOutgoingSyncMessage class]] ||
+        [message isKindOfClass:[OWSReadReceiptsForSenderMessage class]]) {
+        return OWSMessageSendPriorityBackground;
     }
+    return OWSMessageSendPriorityInteractive;
 }
 
 - (void)enqueueMessage:(TSOutgoingMessage *)message
@@ -409,10 +532,9 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
                                                      success:successHandler
                                                      failure:failureHandler];
 
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            NSOperationQueue *sendingQueue = [self sendingQueueForMessage:message];
-            [sendingQueue addOperation:sendMessageOperation];
-        });
+        [self.sendScheduler addOperation:sendMessageOperation
+                                 laneKey:[self sendLaneKeyForMessage:message]
+                                priority:[self sendPriorityForMessage:message]];
     });
 }
 
@@ -556,9 +678,22 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
 }
 
 - (void)sendMessageToService:(TSOutgoingMessage *)message
-                     success:(void (^)(void))successHandler
-                     failure:(RetryableFailureHandler)failureHandler
+                     success:(void (^)(void))successHandlerParam
+                     failure:(RetryableFailureHandler)failureHandlerParam
 {
+    OWSMessageSendTimings *timings = [OWSMessageSendTimings new];
+    [self setSendTimings:timings forMessage:message];
+    void (^successHandler)(void) = ^{
+        [self setSendTimings:nil forMessage:message];
+        DDLogInfo(@"%@ sent message: %llu, %@", self.logTag, message.timestamp, timings);
+        successHandlerParam();
+    };
+    RetryableFailureHandler failureHandler = ^(NSError *error) {
+        [self setSendTimings:nil forMessage:message];
+        DDLogInfo(@"%@ failed to send message: %llu, %@", self.logTag, message.timestamp, timings);
+        failureHandlerParam(error);
+    };
+
     dispatch_async([OWSDispatch sendingQueue], ^{
         TSThread *thread = message.thread;
 
@@ -660,6 +795,26 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
     });
 }
 
+#pragma mark - Timings
+
+- (void)setSendTimings:(nullable OWSMessageSendTimings *)timings forMessage:(TSOutgoingMessage *)message
+{
+    @synchronized(self.sendTimingsMap)
+    {
+        self.sendTimingsMap[@(message.timestamp)] = timings;
+    }
+}
+
+- (nullable OWSMessageSendTimings *)sendTimingsForMessage:(TSOutgoingMessage *)message
+{
+    @synchronized(self.sendTimingsMap)
+    {
+        return self.sendTimingsMap[@(message.timestamp)];
+    }
+}
+
+#pragma mark -
+
 // For group sends, we're using chained futures to make the code more readable.
 - (TOCFuture *)sendMessageFuture:(TSOutgoingMessage *)message
                        recipient:(SignalRecipient *)recipient
@@ -692,8 +847,8 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
           failure:(RetryableFailureHandler)failureHandler
 {
     [self saveGroupMessage:message inThread:thread];
-    NSMutableArray<TOCFuture *> *futures = [NSMutableArray array];
 
+    NSMutableArray<SignalRecipient *> *sendRecipients = [NSMutableArray new];
     for (SignalRecipient *recipient in recipients) {
         NSString *recipientId = recipient.recipientId;
 
@@ -714,6 +869,32 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
         }
 
         // ...otherwise we send.
+        [sendRecipients addObject:recipient];
+    }
+
+    // Fetch any missing prekey bundles for all recipients up front and concurrently,
+    // rather than one at a time as each recipient's message is encrypted.
+    [self prefetchPreKeyBundlesForRecipients:sendRecipients
+                                     timings:[self sendTimingsForMessage:message]
+                                  completion:^{
+                                      [self sendToGroupRecipients:sendRecipients
+                                                          message:message
+                                                           thread:thread
+                                                          success:successHandler
+                                                          failure:failureHandler];
+                                  }];
+}
+
+- (void)sendToGroupRecipients:(NSArray<SignalRecipient *> *)recipients
+                      message:(TSOutgoingMessage *)message
+                       thread:(TSThread *)thread
+                      success:(void (^)(void))successHandler
+                      failure:(RetryableFailureHandler)failureHandler
+{
+    AssertIsOnSendingQueue();
+
+    NSMutableArray<TOCFuture *> *futures = [NSMutableArray array];
+    for (SignalRecipient *recipient in recipients) {
         [futures addObject:[self sendMessageFuture:message recipient:recipient thread:thread]];
     }
 
@@ -983,8 +1164,11 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
                                                                                   relay:recipient.relay
                                                                               timeStamp:message.timestamp];
 
+    OWSMessageSendTimings *_Nullable timings = [self sendTimingsForMessage:message];
+    NSDate *requestStartDate = [NSDate new];
     [self.networkManager makeRequest:request
         success:^(NSURLSessionDataTask *task, id responseObject) {
+            [timings addNetworkDuration:fabs([requestStartDate timeIntervalSinceNow])];
             dispatch_async([OWSDispatch sendingQueue], ^{
                 [recipient save];
                 [self handleMessageSentLocally:message];
@@ -992,6 +1176,7 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
             });
         }
         failure:^(NSURLSessionDataTask *task, NSError *error) {
+            [timings addNetworkDuration:fabs([requestStartDate timeIntervalSinceNow])];
             DDLogInfo(@"%@ sending to recipient: %@, failed with error: %@", self.logTag, recipient.uniqueId, error);
             [DDLog flushLog];
 
@@ -1222,13 +1407,200 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
         }];
 }
 
+#pragma mark - Prekeys
+
+- (NSString *)prefetchKeyForRecipientId:(NSString *)recipientId deviceId:(NSNumber *)deviceNumber
+{
+    return [NSString stringWithFormat:@"%@.%@", recipientId, deviceNumber];
+}
+
+// Fetches the prekey bundles of all of the recipients' devices with which we
+// don't yet have a session, several at a time.
+//
+// completion is invoked on the sending queue.
+- (void)prefetchPreKeyBundlesForRecipients:(NSArray<SignalRecipient *> *)recipients
+                                   timings:(nullable OWSMessageSendTimings *)timings
+                                completion:(dispatch_block_t)completion
+{
+    OWSAssert(completion);
+
+    NSMutableArray<SignalRecipient *> *recipientsToFetch = [NSMutableArray new];
+    NSMutableArray<NSNumber *> *devicesToFetch = [NSMutableArray new];
+    dispatch_sync([OWSDispatch sessionStoreQueue], ^{
+        for (SignalRecipient *recipient in recipients) {
+            for (NSNumber *deviceNumber in [recipient.devices copy]) {
+                if (![self.storageManager containsSession:recipient.uniqueId deviceId:[deviceNumber intValue]]) {
+                    [recipientsToFetch addObject:recipient];
+                    [devicesToFetch addObject:deviceNumber];
+                }
+            }
+        }
+    });
+
+    if (recipientsToFetch.count < 1) {
+        dispatch_async([OWSDispatch sendingQueue], completion);
+        return;
+    }
+
+    DDLogInfo(@"%@ prefetching %lu prekey bundles.", self.logTag, (unsigned long)recipientsToFetch.count);
+    NSDate *startDate = [NSDate new];
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_semaphore_t requestSlots = dispatch_semaphore_create(kMaxConcurrentPreKeyRequests);
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        for (NSUInteger i = 0; i < recipientsToFetch.count; i++) {
+            NSString *recipientId = recipientsToFetch[i].uniqueId;
+            NSNumber *deviceNumber = devicesToFetch[i];
+
+            dispatch_semaphore_wait(requestSlots, DISPATCH_TIME_FOREVER);
+            dispatch_group_enter(group);
+            [self fetchPreKeyBundleForRecipientId:recipientId
+                                         deviceId:deviceNumber
+                                       completion:^(PreKeyBundle *_Nullable bundle, NSException *_Nullable exception) {
+                                           OWSPrefetchedPreKeyBundle *result =
+                                               [[OWSPrefetchedPreKeyBundle alloc] initWithBundle:bundle
+                                                                                       exception:exception];
+                                           @synchronized(self.prefetchedPreKeyBundles)
+                                           {
+                                               [self evictExpiredPrefetchedPreKeyBundles];
+                                               self.prefetchedPreKeyBundles[[self
+                                                   prefetchKeyForRecipientId:recipientId
+                                                                    deviceId:deviceNumber]] = result;
+                                           }
+                                           dispatch_semaphore_signal(requestSlots);
+                                           dispatch_group_leave(group);
+                                       }];
+        }
+
+        dispatch_group_notify(group, [OWSDispatch sendingQueue], ^{
+            [timings addPreKeyFetchDuration:fabs([startDate timeIntervalSinceNow])];
+            completion();
+        });
+    });
+}
+
+// Should only be called while synchronized on prefetchedPreKeyBundles.
+- (void)evictExpiredPrefetchedPreKeyBundles
+{
+    NSMutableArray<NSString *> *expiredKeys = [NSMutableArray new];
+    [self.prefetchedPreKeyBundles
+        enumerateKeysAndObjectsUsingBlock:^(NSString *key, OWSPrefetchedPreKeyBundle *prefetched, BOOL *stop) {
+            if (fabs([prefetched.fetchDate timeIntervalSinceNow]) > kPrefetchedPreKeyBundleMaxAge) {
+                [expiredKeys addObject:key];
+            }
+        }];
+    [self.prefetchedPreKeyBundles removeObjectsForKeys:expiredKeys];
+}
+
+- (void)identityStateDidChange:(NSNotification *)notification
+{
+    // A prefetched bundle may carry an identity key which is no longer current.
+    @synchronized(self.prefetchedPreKeyBundles)
+    {
+        [self.prefetchedPreKeyBundles removeAllObjects];
+    }
+}
+
+- (nullable OWSPrefetchedPreKeyBundle *)takePrefetchedPreKeyBundleForRecipientId:(NSString *)recipientId
+                                                                        deviceId:(NSNumber *)deviceNumber
+{
+    NSString *key = [self prefetchKeyForRecipientId:recipientId deviceId:deviceNumber];
+    OWSPrefetchedPreKeyBundle *_Nullable result;
+    @synchronized(self.prefetchedPreKeyBundles)
+    {
+        result = self.prefetchedPreKeyBundles[key];
+        [self.prefetchedPreKeyBundles removeObjectForKey:key];
+    }
+    if (result && fabs([result.fetchDate timeIntervalSinceNow]) > kPrefetchedPreKeyBundleMaxAge) {
+        return nil;
+    }
+    return result;
+}
+
+- (void)fetchPreKeyBundleForRecipientId:(NSString *)recipientId
+                               deviceId:(NSNumber *)deviceNumber
+                             completion:(void (^)(PreKeyBundle *_Nullable bundle,
+                                            NSException *_Nullable exception))completion
+{
+    [self.networkManager makeRequest:[[TSRecipientPrekeyRequest alloc] initWithRecipient:recipientId
+                                                                                deviceId:[deviceNumber stringValue]]
+        success:^(NSURLSessionDataTask *task, id responseObject) {
+            PreKeyBundle *_Nullable bundle =
+                [PreKeyBundle preKeyBundleFromDictionary:responseObject forDeviceNumber:deviceNumber];
+            completion(bundle, nil);
+        }
+        failure:^(NSURLSessionDataTask *task, NSError *error) {
+            if (!IsNSErrorNetworkFailure(error)) {
+                OWSProdError([OWSAnalyticsEvents messageSenderErrorRecipientPrekeyRequestFailed]);
+            }
+            DDLogError(@"Server replied to PreKeyBundle request with error: %@", error);
+            NSException *_Nullable exception;
+            NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
+            if (response.statusCode == 404) {
+                // Can't throw exception from within callback as it's probabably a different thread.
+                exception = [NSException exceptionWithName:OWSMessageSenderInvalidDeviceException
+                                                    reason:@"Device not registered"
+                                                  userInfo:nil];
+            } else if (response.statusCode == 413) {
+                // Can't throw exception from within callback as it's probabably a different thread.
+                exception = [NSException exceptionWithName:OWSMessageSenderRateLimitedException
+                                                    reason:@"Too many prekey requests"
+                                                  userInfo:nil];
+            }
+            completion(nil, exception);
+        }];
+}
+
+// Uses a prefetched bundle if possible; otherwise blocks on a request.
+//
+// Should not be called on the session store queue.
+- (PreKeyBundle *)preKeyBundleForRecipientId:(NSString *)recipientId
+                                    deviceId:(NSNumber *)deviceNumber
+                                     timings:(nullable OWSMessageSendTimings *)timings
+{
+    __block PreKeyBundle *_Nullable bundle;
+    __block NSException *_Nullable exception;
+
+    OWSPrefetchedPreKeyBundle *_Nullable prefetched =
+        [self takePrefetchedPreKeyBundleForRecipientId:recipientId deviceId:deviceNumber];
+    if (prefetched) {
+        bundle = prefetched.bundle;
+        exception = prefetched.exception;
+    } else {
+        NSDate *startDate = [NSDate new];
+        dispatch_semaphore_t sema = dispatch_semaphore_create(0);
+        [self fetchPreKeyBundleForRecipientId:recipientId
+                                     deviceId:deviceNumber
+                                   completion:^(PreKeyBundle *_Nullable fetchedBundle,
+                                       NSException *_Nullable fetchException) {
+                                       bundle = fetchedBundle;
+                                       exception = fetchException;
+                                       dispatch_semaphore_signal(sema);
+                                   }];
+        dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+        [timings addPreKeyFetchDuration:fabs([startDate timeIntervalSinceNow])];
+    }
+
+    if (exception) {
+        @throw exception;
+    }
+    if (!bundle) {
+        @throw [NSException exceptionWithName:InvalidVersionException
+                                       reason:@"Can't get a prekey bundle from the server with required information"
+                                     userInfo:nil];
+    }
+    return bundle;
+}
+
+#pragma mark - Encryption
+
 - (NSArray<NSDictionary *> *)deviceMessages:(TSOutgoingMessage *)message
                                forRecipient:(SignalRecipient *)recipient
 {
     OWSAssert(message);
     OWSAssert(recipient);
 
-    NSMutableArray *messagesArray = [NSMutableArray arrayWithCapacity:recipient.devices.count];
+    OWSMessageSendTimings *_Nullable timings = [self sendTimingsForMessage:message];
+    NSString *recipientId = recipient.uniqueId;
 
     NSData *plainText = [message buildPlainTextData:recipient];
     DDLogDebug(@"%@ built message: %@ plainTextData.length: %lu",
@@ -1236,53 +1608,77 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
         [message class],
         (unsigned long)plainText.length);
 
-    for (NSNumber *deviceNumber in recipient.devices) {
-        @try {
-            __block NSDictionary *messageDict;
-            __block NSException *encryptionException;
-            // Mutating session state is not thread safe, so we operate on a serial queue, shared with decryption
-            // operations.
-            dispatch_sync([OWSDispatch sessionStoreQueue], ^{
-                @try {
-                    messageDict = [self encryptedMessageWithPlaintext:plainText
-                                                          toRecipient:recipient.uniqueId
-                                                             deviceId:deviceNumber
-                                                        keyingStorage:self.storageManager
-                                                             isSilent:message.isSilent];
-                } @catch (NSException *exception) {
-                    encryptionException = exception;
-                }
-            });
-
-            if (encryptionException) {
-                DDLogInfo(@"%@ Exception during encryption: %@", self.logTag, encryptionException);
-                @throw encryptionException;
+    // Find the devices which need a new session, so that we can fetch their prekey
+    // bundles without blocking the session store queue on network requests.
+    NSMutableArray<NSNumber *> *devicesWithoutSessions = [NSMutableArray new];
+    dispatch_sync([OWSDispatch sessionStoreQueue], ^{
+        for (NSNumber *deviceNumber in [recipient.devices copy]) {
+            if (![self.storageManager containsSession:recipientId deviceId:[deviceNumber intValue]]) {
+                [devicesWithoutSessions addObject:deviceNumber];
             }
+        }
+    });
 
-            if (messageDict) {
-                [messagesArray addObject:messageDict];
-            } else {
-                @throw [NSException exceptionWithName:InvalidMessageException
-                                               reason:@"Failed to encrypt message"
-                                             userInfo:nil];
-            }
+    NSMutableDictionary<NSNumber *, PreKeyBundle *> *preKeyBundles = [NSMutableDictionary new];
+    for (NSNumber *deviceNumber in devicesWithoutSessions) {
+        @try {
+            preKeyBundles[deviceNumber] =
+                [self preKeyBundleForRecipientId:recipientId deviceId:deviceNumber timings:timings];
         } @catch (NSException *exception) {
             if ([exception.name isEqualToString:OWSMessageSenderInvalidDeviceException]) {
                 [recipient removeDevices:[NSSet setWithObject:deviceNumber]];
             } else {
+                DDLogInfo(@"%@ Exception during prekey fetch: %@", self.logTag, exception);
                 @throw exception;
             }
         }
     }
 
+    NSMutableArray *messagesArray = [NSMutableArray arrayWithCapacity:recipient.devices.count];
+    __block NSException *_Nullable encryptionException;
+    NSDate *encryptionStartDate = [NSDate new];
+    // Mutating session state is not thread safe, so we operate on a serial queue, shared with decryption
+    // operations.  All of the recipient's devices are handled in a single hop.
+    dispatch_sync([OWSDispatch sessionStoreQueue], ^{
+        for (NSNumber *deviceNumber in [recipient.devices copy]) {
+            @try {
+                NSDictionary *_Nullable messageDict = [self encryptedMessageWithPlaintext:plainText
+                                                                              toRecipient:recipientId
+                                                                                 deviceId:deviceNumber
+                                                                            keyingStorage:self.storageManager
+                                                                                 isSilent:message.isSilent
+                                                                             preKeyBundle:preKeyBundles[deviceNumber]];
+                if (!messageDict) {
+                    @throw [NSException exceptionWithName:InvalidMessageException
+                                                   reason:@"Failed to encrypt message"
+                                                 userInfo:nil];
+                }
+                [messagesArray addObject:messageDict];
+            } @catch (NSException *exception) {
+                encryptionException = exception;
+                break;
+            }
+        }
+    });
+    [timings addEncryptionDuration:fabs([encryptionStartDate timeIntervalSinceNow])];
+
+    if (encryptionException) {
+        DDLogInfo(@"%@ Exception during encryption: %@", self.logTag, encryptionException);
+        @throw encryptionException;
+    }
+
     return [messagesArray copy];
 }
 
-- (NSDictionary *)encryptedMessageWithPlaintext:(NSData *)plainText
-                                    toRecipient:(NSString *)identifier
-                                       deviceId:(NSNumber *)deviceNumber
-                                  keyingStorage:(TSStorageManager *)storage
-                                       isSilent:(BOOL)isSilent
+// Should only be called on the session store queue.
+//
+// preKeyBundle is required if there is no session with the device.
+- (nullable NSDictionary *)encryptedMessageWithPlaintext:(NSData *)plainText
+                                             toRecipient:(NSString *)identifier
+                                                deviceId:(NSNumber *)deviceNumber
+                                           keyingStorage:(TSStorageManager *)storage
+                                                isSilent:(BOOL)isSilent
+                                            preKeyBundle:(nullable PreKeyBundle *)bundle
 {
     OWSAssert(plainText);
     OWSAssert(identifier.length > 0);
@@ -1290,39 +1686,6 @@ NSString *const OWSMessageSenderRateLimitedException = @"RateLimitedException";
     OWSAssert(storage);
 
     if (![storage containsSession:identifier deviceId:[deviceNumber intValue]]) {
-        __block dispatch_semaphore_t sema = dispatch_semaphore_create(0);
-        __block PreKeyBundle *_Nullable bundle;
-        __block NSException *_Nullable exception;
-        [self.networkManager makeRequest:[[TSRecipientPrekeyRequest alloc] initWithRecipient:identifier
-                                                                                    deviceId:[deviceNumber stringValue]]
-            success:^(NSURLSessionDataTask *task, id responseObject) {
-                bundle = [PreKeyBundle preKeyBundleFromDictionary:responseObject forDeviceNumber:deviceNumber];
-                dispatch_semaphore_signal(sema);
-            }
-            failure:^(NSURLSessionDataTask *task, NSError *error) {
-                if (!IsNSErrorNetworkFailure(error)) {
-                    OWSProdError([OWSAnalyticsEvents messageSenderErrorRecipientPrekeyRequestFailed]);
-                }
-                DDLogError(@"Server replied to PreKeyBundle request with error: %@", error);
-                NSHTTPURLResponse *response = (NSHTTPURLResponse *)task.response;
-                if (response.statusCode == 404) {
-                    // Can't throw exception from within callback as it's probabably a different thread.
-                    exception = [NSException exceptionWithName:OWSMessageSenderInvalidDeviceException
-                                                        reason:@"Device not registered"
-                                                      userInfo:nil];
-                } else if (response.statusCode == 413) {
-                    // Can't throw exception from within callback as it's probabably a different thread.
-                    exception = [NSException exceptionWithName:OWSMessageSenderRateLimitedException
-                                                        reason:@"Too many prekey requests"
-                                                      userInfo:nil];
-                }
-                dispatch_semaphore_signal(sema);
-            }];
-        dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
-        if (exception) {
-            @throw exception;
-        }
-
         if (!bundle) {
             @throw [NSException exceptionWithName:InvalidVersionException
                                            reason:@"Can't get a prekey bundle from the server with required information"
@@ -63,7 +63,8 @@ extern NSString *const kIncomingMessageMarkedAsReadNotification;
 //      are enabled).
 // * ...to inform the local user's other devices that this message was read.
 //
-// Both types of messages are deduplicated.
+// Both types of messages are deduplicated, batched and persisted until
+// they have been sent.
 //
 // This method can be called from any thread.
 - (void)messageWasReadLocally:(TSIncomingMessage *)message;
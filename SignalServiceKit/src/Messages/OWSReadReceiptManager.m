@@ -11,9 +11,11 @@
 #import "OWSSignalServiceProtos.pb.h"
 #import "OWSStorage.h"
 #import "OWSSyncConfigurationMessage.h"
+#import "OWSWriteCoalescer.h"
 #import "TSContactThread.h"
 #import "TSDatabaseView.h"
 #import "TSIncomingMessage.h"
+#import "TSNetworkManager.h"
 #import "TSStorageManager.h"
 #import "TextSecureKitEnv.h"
 #import "Threading.h"
@@ -112,6 +114,33 @@ NSString *const kIncomingMessageMarkedAsReadNotification = @"kIncomingMessageMar
 NSString *const OWSReadReceiptManagerCollection = @"OWSReadReceiptManagerCollection";
 NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsEnabled";
 
+// Outgoing read receipts are persisted until they have been sent, so that they
+// survive app exit.
+//
+// Map of "recipient id.message timestamp"-to-"message timestamp", so that
+// each receipt can be added or removed without rewriting the others.
+NSString *const OWSPendingReadReceiptsForSenderCollection = @"OWSPendingReadReceiptsForSenderCollection";
+// Map of "thread unique id"-to-"read receipt".
+NSString *const OWSPendingReadReceiptsForLinkedDevicesCollection
+    = @"OWSPendingReadReceiptsForLinkedDevicesCollection";
+
+// Pending receipts are flushed once they stop arriving for a moment, once the
+// oldest has waited long enough, or once there are enough of them; whichever
+// comes first.
+//
+// We want to wait long enough to effectively de-duplicate read receipts
+// without being so slow that we risk not sending them due to app exit.
+static const NSTimeInterval kReadReceiptFlushQuietInterval = 1.f;
+static const NSTimeInterval kReadReceiptMaxFlushDelay = 5.f;
+static const NSUInteger kReadReceiptFlushThreshold = 500;
+
+// Receipts which fail to send due to the network are retried after this delay,
+// so that we don't retry in a tight loop while offline.
+static const NSTimeInterval kReadReceiptNetworkRetryDelay = 30.f;
+
+// Bounds the size of any one receipt message.
+static const NSUInteger kMaxTimestampsPerReadReceiptMessage = 100;
+
 @interface OWSReadReceiptManager ()
 
 @property (nonatomic, readonly) OWSMessageSender *messageSender;
@@ -130,11 +159,18 @@ NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsE
 // Should only be accessed while synchronized on the OWSReadReceiptManager.
 @property (nonatomic, readonly) NSMutableDictionary<NSString *, NSMutableSet<NSNumber *> *> *toSenderReadReceiptMap;
 
-// Should only be accessed while synchronized on the OWSReadReceiptManager.
-@property (nonatomic) BOOL isProcessing;
+// The following state should only be accessed while synchronized on the OWSReadReceiptManager.
+@property (nonatomic) BOOL hasLoadedPendingReadReceipts;
+@property (nonatomic) BOOL isLoadingPendingReadReceipts;
+@property (nonatomic) BOOL isFlushScheduled;
+@property (nonatomic) NSUInteger pendingReadReceiptCount;
+@property (nonatomic, nullable) NSDate *firstPendingReadReceiptDate;
+@property (nonatomic, nullable) NSDate *lastPendingReadReceiptDate;
 
 @property (atomic) NSNumber *areReadReceiptsEnabledCached;
 
+@property (atomic) NSTimeInterval networkRetryDelaySeconds;
+
 @end
 
 #pragma mark -
@@ -173,6 +209,7 @@ NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsE
 
     _toLinkedDevicesReadReceiptMap = [NSMutableDictionary new];
     _toSenderReadReceiptMap = [NSMutableDictionary new];
+    _networkRetryDelaySeconds = kReadReceiptNetworkRetryDelay;
 
     OWSSingletonAssert();
 
@@ -197,110 +234,415 @@ NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsE
     [self scheduleProcessing];
 }
 
++ (NSString *)pendingReadReceiptKeyForSenderId:(NSString *)senderId timestamp:(uint64_t)timestamp
+{
+    OWSAssert(senderId.length > 0);
+
+    return [NSString stringWithFormat:@"%@.%llu", senderId, timestamp];
+}
+
++ (nullable NSString *)senderIdForPendingReadReceiptKey:(NSString *)key timestamp:(uint64_t)timestamp
+{
+    NSString *suffix = [NSString stringWithFormat:@".%llu", timestamp];
+    if (key.length <= suffix.length || ![key hasSuffix:suffix]) {
+        return nil;
+    }
+    return [key substringToIndex:key.length - suffix.length];
+}
+
 // Schedules a processing pass, unless one is already scheduled.
 - (void)scheduleProcessing
 {
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        if (![OWSStorage isStorageReady]) {
+            DDLogInfo(@"%@ Deferring read receipt processing; storage not yet ready.", self.logTag);
+            return;
+        }
+
+        [self loadPendingReadReceiptsIfNecessary];
+
         @synchronized(self)
         {
-            if (![OWSStorage isStorageReady]) {
-                DDLogInfo(@"%@ Deferring read receipt processing; storage not yet ready.", self.logTag);
+            // Don't flush until the persisted receipts have been merged, or we
+            // might send them twice.
+            if (!self.hasLoadedPendingReadReceipts) {
                 return;
             }
-            if (self.isProcessing) {
+            if (self.pendingReadReceiptCount < 1) {
                 return;
             }
 
-            self.isProcessing = YES;
-
-            [self process];
+            NSTimeInterval delaySeconds = [self delayUntilFlush];
+            if (delaySeconds <= 0) {
+                [self process];
+            } else if (!self.isFlushScheduled) {
+                [self scheduleFlushAfterDelay:delaySeconds];
+            }
         }
     });
 }
 
-- (void)process
+// Returns zero if the pending receipts should be flushed now, otherwise how
+// long to wait for more receipts to arrive.
+//
+// Should only be called while synchronized on self.
+- (NSTimeInterval)delayUntilFlush
+{
+    if (self.pendingReadReceiptCount >= kReadReceiptFlushThreshold) {
+        return 0;
+    }
+
+    NSTimeInterval quietInterval = fabs([self.lastPendingReadReceiptDate timeIntervalSinceNow]);
+    NSTimeInterval pendingInterval = fabs([self.firstPendingReadReceiptDate timeIntervalSinceNow]);
+    return MAX(0, MIN(kReadReceiptFlushQuietInterval - quietInterval, kReadReceiptMaxFlushDelay - pendingInterval));
+}
+
+// Should only be called while synchronized on self.
+- (void)scheduleFlushAfterDelay:(NSTimeInterval)delaySeconds
+{
+    OWSAssert(!self.isFlushScheduled);
+
+    self.isFlushScheduled = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delaySeconds * NSEC_PER_SEC)),
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^{
+            @synchronized(self)
+            {
+                self.isFlushScheduled = NO;
+                if (self.pendingReadReceiptCount < 1) {
+                    return;
+                }
+
+                NSTimeInterval delaySeconds = [self delayUntilFlush];
+                if (delaySeconds <= 0) {
+                    [self process];
+                } else {
+                    // Receipts are still arriving; wait for them to stop, within limits.
+                    [self scheduleFlushAfterDelay:delaySeconds];
+                }
+            }
+        });
+}
+
+// Reads the persisted receipts outside of the lock, then merges them under it.
+- (void)loadPendingReadReceiptsIfNecessary
 {
     @synchronized(self)
     {
-        DDLogVerbose(@"%@ Processing read receipts.", self.logTag);
+        if (self.hasLoadedPendingReadReceipts || self.isLoadingPendingReadReceipts) {
+            return;
+        }
+        self.isLoadingPendingReadReceipts = YES;
+    }
 
-        NSArray<OWSLinkedDeviceReadReceipt *> *readReceiptsForLinkedDevices =
-            [self.toLinkedDevicesReadReceiptMap allValues];
-        [self.toLinkedDevicesReadReceiptMap removeAllObjects];
-        if (readReceiptsForLinkedDevices.count > 0) {
-            OWSReadReceiptsForLinkedDevicesMessage *message =
-                [[OWSReadReceiptsForLinkedDevicesMessage alloc] initWithReadReceipts:readReceiptsForLinkedDevices];
-
-            [self.messageSender enqueueMessage:message
-                success:^{
-                    DDLogInfo(@"%@ Successfully sent %zd read receipt to linked devices.",
-                        self.logTag,
-                        readReceiptsForLinkedDevices.count);
+    NSMutableDictionary<NSString *, NSMutableSet<NSNumber *> *> *senderReadReceipts = [NSMutableDictionary new];
+    NSMutableDictionary<NSString *, OWSLinkedDeviceReadReceipt *> *linkedDeviceReadReceipts =
+        [NSMutableDictionary new];
+    [self.dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [transaction
+            enumerateKeysAndObjectsInCollection:OWSPendingReadReceiptsForSenderCollection
+                                     usingBlock:^(NSString *key, id object, BOOL *stop) {
+                                         if (![object isKindOfClass:[NSNumber class]]) {
+                                             OWSFail(@"%@ Unexpected pending read receipt: %@", self.logTag, object);
+                                             return;
+                                         }
+                                         uint64_t timestamp = ((NSNumber *)object).unsignedLongLongValue;
+                                         NSString *_Nullable recipientId =
+                                             [OWSReadReceiptManager senderIdForPendingReadReceiptKey:key
+                                                                                           timestamp:timestamp];
+                                         if (!recipientId) {
+                                             OWSFail(@"%@ Unexpected pending read receipt key: %@", self.logTag, key);
+                                             return;
+                                         }
+                                         NSMutableSet<NSNumber *> *_Nullable timestamps = senderReadReceipts[recipientId];
+                                         if (!timestamps) {
+                                             timestamps = [NSMutableSet new];
+                                             senderReadReceipts[recipientId] = timestamps;
+                                         }
+                                         [timestamps addObject:@(timestamp)];
+                                     }];
+        [transaction
+            enumerateKeysAndObjectsInCollection:OWSPendingReadReceiptsForLinkedDevicesCollection
+                                     usingBlock:^(NSString *threadUniqueId, id object, BOOL *stop) {
+                                         if (![object isKindOfClass:[OWSLinkedDeviceReadReceipt class]]) {
+                                             OWSFail(@"%@ Unexpected pending read receipt: %@", self.logTag, object);
+                                             return;
+                                         }
+                                         linkedDeviceReadReceipts[threadUniqueId] = (OWSLinkedDeviceReadReceipt *)object;
+                                     }];
+    }];
+
+    NSUInteger loadedCount = 0;
+    @synchronized(self)
+    {
+        // Receipts enqueued since the read are either already pending or newer,
+        // so the enqueue methods de-duplicate them.
+        for (NSString *recipientId in senderReadReceipts) {
+            for (NSNumber *timestamp in senderReadReceipts[recipientId]) {
+                if ([self enqueueReadReceiptForSenderId:recipientId timestamp:timestamp.unsignedLongLongValue]) {
+                    loadedCount++;
                 }
-                failure:^(NSError *error) {
-                    DDLogError(@"%@ Failed to send read receipt to linked devices with error: %@", self.logTag, error);
-                }];
+            }
+        }
+        for (NSString *threadUniqueId in linkedDeviceReadReceipts) {
+            if ([self enqueueReadReceiptForLinkedDevices:linkedDeviceReadReceipts[threadUniqueId]
+                                          threadUniqueId:threadUniqueId]) {
+                loadedCount++;
+            }
+        }
+
+        self.isLoadingPendingReadReceipts = NO;
+        self.hasLoadedPendingReadReceipts = YES;
+    }
+
+    if (loadedCount > 0) {
+        DDLogInfo(@"%@ Loaded %lu pending read receipts.", self.logTag, (unsigned long)loadedCount);
+    }
+}
+
+// Should only be called while synchronized on self.
+//
+// Returns YES IFF the receipt wasn't already pending.
+- (BOOL)enqueueReadReceiptForSenderId:(NSString *)senderId timestamp:(uint64_t)timestamp
+{
+    OWSAssert(senderId.length > 0);
+    OWSAssert(timestamp > 0);
+
+    NSMutableSet<NSNumber *> *_Nullable timestamps = self.toSenderReadReceiptMap[senderId];
+    if (!timestamps) {
+        timestamps = [NSMutableSet new];
+        self.toSenderReadReceiptMap[senderId] = timestamps;
+    }
+    if ([timestamps containsObject:@(timestamp)]) {
+        return NO;
+    }
+    [timestamps addObject:@(timestamp)];
+    [self didEnqueueReadReceipt];
+    return YES;
+}
+
+// Should only be called while synchronized on self.
+//
+// Returns YES IFF the receipt supersedes any pending receipt for the same thread.
+- (BOOL)enqueueReadReceiptForLinkedDevices:(OWSLinkedDeviceReadReceipt *)readReceipt
+                            threadUniqueId:(NSString *)threadUniqueId
+{
+    OWSAssert(readReceipt);
+    OWSAssert(threadUniqueId.length > 0);
+
+    OWSLinkedDeviceReadReceipt *_Nullable oldReadReceipt = self.toLinkedDevicesReadReceiptMap[threadUniqueId];
+    if (oldReadReceipt && oldReadReceipt.timestamp >= readReceipt.timestamp) {
+        // If there's an existing "linked device" read receipt for the same thread with
+        // a newer timestamp, discard this "linked device" read receipt.
+        return NO;
+    }
+    self.toLinkedDevicesReadReceiptMap[threadUniqueId] = readReceipt;
+    if (!oldReadReceipt) {
+        [self didEnqueueReadReceipt];
+    }
+    return YES;
+}
+
+// Should only be called while synchronized on self.
+- (void)didEnqueueReadReceipt
+{
+    NSDate *now = [NSDate new];
+    if (self.pendingReadReceiptCount < 1) {
+        self.firstPendingReadReceiptDate = now;
+    }
+    self.lastPendingReadReceiptDate = now;
+    self.pendingReadReceiptCount++;
+}
+
+// Should only be called while synchronized on self.
+- (void)process
+{
+    DDLogVerbose(@"%@ Processing read receipts.", self.logTag);
+
+    NSArray<NSString *> *threadUniqueIds = [self.toLinkedDevicesReadReceiptMap allKeys];
+    NSArray<OWSLinkedDeviceReadReceipt *> *readReceiptsForLinkedDevices =
+        [self.toLinkedDevicesReadReceiptMap objectsForKeys:threadUniqueIds notFoundMarker:[NSNull null]];
+    [self.toLinkedDevicesReadReceiptMap removeAllObjects];
+
+    NSDictionary<NSString *, NSMutableSet<NSNumber *> *> *toSenderReadReceiptMap = [self.toSenderReadReceiptMap copy];
+    [self.toSenderReadReceiptMap removeAllObjects];
+
+    DDLogInfo(@"%@ Flushing %lu read receipts: %lu for linked devices, %lu senders.",
+        self.logTag,
+        (unsigned long)self.pendingReadReceiptCount,
+        (unsigned long)readReceiptsForLinkedDevices.count,
+        (unsigned long)toSenderReadReceiptMap.count);
+
+    self.pendingReadReceiptCount = 0;
+    self.firstPendingReadReceiptDate = nil;
+    self.lastPendingReadReceiptDate = nil;
+
+    // Send outside of the lock.
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        if (readReceiptsForLinkedDevices.count > 0) {
+            [self sendReadReceiptsForLinkedDevices:readReceiptsForLinkedDevices threadUniqueIds:threadUniqueIds];
         }
 
-        NSDictionary<NSString *, NSMutableSet<NSNumber *> *> *toSenderReadReceiptMap =
-            [self.toSenderReadReceiptMap copy];
-        [self.toSenderReadReceiptMap removeAllObjects];
         if (toSenderReadReceiptMap.count > 0) {
-            for (NSString *recipientId in toSenderReadReceiptMap) {
-                NSSet<NSNumber *> *timestamps = toSenderReadReceiptMap[recipientId];
-                OWSAssert(timestamps.count > 0);
-
-                TSThread *thread = [TSContactThread getOrCreateThreadWithContactId:recipientId];
-                OWSReadReceiptsForSenderMessage *message =
-                    [[OWSReadReceiptsForSenderMessage alloc] initWithThread:thread
-                                                          messageTimestamps:timestamps.allObjects];
-
-                [self.messageSender enqueueMessage:message
-                    success:^{
-                        DDLogInfo(@"%@ Successfully sent %zd read receipts to sender.", self.logTag, timestamps.count);
-                    }
-                    failure:^(NSError *error) {
-                        DDLogError(@"%@ Failed to send read receipts to sender with error: %@", self.logTag, error);
+            if ([self areReadReceiptsEnabled]) {
+                [self sendReadReceiptsForSenders:toSenderReadReceiptMap];
+            } else {
+                DDLogInfo(@"%@ Discarding read receipts for senders; read receipts are disabled.", self.logTag);
+                [[TSStorageManager dbWriteCoalescer]
+                    asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+                        [transaction removeAllObjectsInCollection:OWSPendingReadReceiptsForSenderCollection];
                     }];
             }
-            [self.toSenderReadReceiptMap removeAllObjects];
         }
+    });
+}
 
-        BOOL didWork = (readReceiptsForLinkedDevices.count > 0 || toSenderReadReceiptMap.count > 0);
-
-        if (didWork) {
-            // Wait N seconds before processing read receipts again.
-            // This allows time for a batch to accumulate.
-            //
-            // We want a value high enough to allow us to effectively de-duplicate,
-            // read receipts without being so high that we risk not sending read
-            // receipts due to app exit.
-            const CGFloat kProcessingFrequencySeconds = 3.f;
-            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kProcessingFrequencySeconds * NSEC_PER_SEC)),
-                dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
-                ^{
-                    [self process];
-                });
-        } else {
-            self.isProcessing = NO;
+- (void)sendReadReceiptsForLinkedDevices:(NSArray<OWSLinkedDeviceReadReceipt *> *)readReceipts
+                         threadUniqueIds:(NSArray<NSString *> *)threadUniqueIds
+{
+    OWSAssert(readReceipts.count > 0);
+    OWSAssert(readReceipts.count == threadUniqueIds.count);
+
+    OWSReadReceiptsForLinkedDevicesMessage *message =
+        [[OWSReadReceiptsForLinkedDevicesMessage alloc] initWithReadReceipts:readReceipts];
+
+    void (^removePendingReadReceipts)(void) = ^{
+        [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            [readReceipts enumerateObjectsUsingBlock:^(
+                OWSLinkedDeviceReadReceipt *readReceipt, NSUInteger index, BOOL *stop) {
+                NSString *threadUniqueId = threadUniqueIds[index];
+                OWSLinkedDeviceReadReceipt *_Nullable pendingReadReceipt =
+                    [transaction objectForKey:threadUniqueId
+                                 inCollection:OWSPendingReadReceiptsForLinkedDevicesCollection];
+                // Don't remove a newer receipt that was enqueued in the meantime.
+                if (pendingReadReceipt && pendingReadReceipt.timestamp <= readReceipt.timestamp) {
+                    [transaction removeObjectForKey:threadUniqueId
+                                       inCollection:OWSPendingReadReceiptsForLinkedDevicesCollection];
+                }
+            }];
+        }];
+    };
+
+    [self.messageSender enqueueMessage:message
+        success:^{
+            DDLogInfo(@"%@ Successfully sent %zd read receipt to linked devices.", self.logTag, readReceipts.count);
+            removePendingReadReceipts();
+        }
+        failure:^(NSError *error) {
+            DDLogError(@"%@ Failed to send read receipt to linked devices with error: %@", self.logTag, error);
+            if (!IsNSErrorNetworkFailure(error)) {
+                removePendingReadReceipts();
+                return;
+            }
+            [self retryAfterNetworkFailureWithEnqueueBlock:^{
+                [readReceipts enumerateObjectsUsingBlock:^(
+                    OWSLinkedDeviceReadReceipt *readReceipt, NSUInteger index, BOOL *stop) {
+                    [self enqueueReadReceiptForLinkedDevices:readReceipt threadUniqueId:threadUniqueIds[index]];
+                }];
+            }];
+        }];
+}
+
+- (void)sendReadReceiptsForSenders:(NSDictionary<NSString *, NSSet<NSNumber *> *> *)toSenderReadReceiptMap
+{
+    OWSAssert(toSenderReadReceiptMap.count > 0);
+
+    // Fetch or create all of the threads in a single transaction.
+    NSMutableDictionary<NSString *, TSThread *> *threadMap = [NSMutableDictionary new];
+    [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        for (NSString *recipientId in toSenderReadReceiptMap) {
+            threadMap[recipientId] = [TSContactThread getOrCreateThreadWithContactId:recipientId
+                                                                         transaction:transaction];
+        }
+    }];
+
+    for (NSString *recipientId in toSenderReadReceiptMap) {
+        NSArray<NSNumber *> *timestamps =
+            [toSenderReadReceiptMap[recipientId].allObjects sortedArrayUsingSelector:@selector(compare:)];
+        OWSAssert(timestamps.count > 0);
+
+        TSThread *thread = threadMap[recipientId];
+        OWSAssert(thread);
+
+        for (NSUInteger location = 0; location < timestamps.count; location += kMaxTimestampsPerReadReceiptMessage) {
+            NSRange range = NSMakeRange(
+                location, MIN(kMaxTimestampsPerReadReceiptMessage, timestamps.count - location));
+            NSArray<NSNumber *> *batch = [timestamps subarrayWithRange:range];
+            [self sendReadReceiptsForSenderId:recipientId thread:thread timestamps:batch];
         }
     }
 }
 
+- (void)sendReadReceiptsForSenderId:(NSString *)recipientId
+                             thread:(TSThread *)thread
+                         timestamps:(NSArray<NSNumber *> *)timestamps
+{
+    OWSAssert(recipientId.length > 0);
+    OWSAssert(thread);
+    OWSAssert(timestamps.count > 0);
+
+    OWSReadReceiptsForSenderMessage *message =
+        [[OWSReadReceiptsForSenderMessage alloc] initWithThread:thread messageTimestamps:timestamps];
+
+    void (^removePendingReadReceipts)(void) = ^{
+        [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            NSMutableArray<NSString *> *keys = [NSMutableArray new];
+            for (NSNumber *timestamp in timestamps) {
+                [keys addObject:[OWSReadReceiptManager pendingReadReceiptKeyForSenderId:recipientId
+                                                                              timestamp:timestamp.unsignedLongLongValue]];
+            }
+            [transaction removeObjectsForKeys:keys inCollection:OWSPendingReadReceiptsForSenderCollection];
+        }];
+    };
+
+    // Read receipts are sent with background priority (see OWSMessageSender),
+    // so they never delay messages sent by the user.
+    [self.messageSender enqueueMessage:message
+        success:^{
+            DDLogInfo(@"%@ Successfully sent %zd read receipts to sender.", self.logTag, timestamps.count);
+            removePendingReadReceipts();
+        }
+        failure:^(NSError *error) {
+            DDLogError(@"%@ Failed to send read receipts to sender with error: %@", self.logTag, error);
+            if (!IsNSErrorNetworkFailure(error)) {
+                removePendingReadReceipts();
+                return;
+            }
+            [self retryAfterNetworkFailureWithEnqueueBlock:^{
+                for (NSNumber *timestamp in timestamps) {
+                    [self enqueueReadReceiptForSenderId:recipientId timestamp:timestamp.unsignedLongLongValue];
+                }
+            }];
+        }];
+}
+
+// Receipts which fail to send due to the network remain persisted, but they
+// were removed from the in-memory maps when they were flushed, so re-enqueue
+// them (by way of enqueueBlock) rather than waiting for the next launch.
+- (void)retryAfterNetworkFailureWithEnqueueBlock:(void (^)(void))enqueueBlock
+{
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.networkRetryDelaySeconds * NSEC_PER_SEC)),
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^{
+            @synchronized(self)
+            {
+                enqueueBlock();
+            }
+            [self scheduleProcessing];
+        });
+}
+
 #pragma mark - Mark as Read Locally
 
 - (void)markAsReadLocallyBeforeTimestamp:(uint64_t)timestamp thread:(TSThread *)thread
 {
     OWSAssert(thread);
 
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        [self.dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
-            [self markAsReadBeforeTimestamp:timestamp
-                                     thread:thread
-                                   wasLocal:YES
-                                transaction:transaction];
-        }];
-    });
+    // Scrolling through a conversation marks messages as read in quick
+    // succession, so coalesce these writes.
+    [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        [self markAsReadBeforeTimestamp:timestamp thread:thread wasLocal:YES transaction:transaction];
+    }];
 }
 
 - (void)messageWasReadLocally:(TSIncomingMessage *)message
@@ -314,27 +656,37 @@ NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsE
             NSString *messageAuthorId = message.messageAuthorId;
             OWSAssert(messageAuthorId.length > 0);
 
-            OWSLinkedDeviceReadReceipt *newReadReceipt =
-                [[OWSLinkedDeviceReadReceipt alloc] initWithSenderId:messageAuthorId timestamp:message.timestamp];
+            uint64_t timestamp = message.timestamp;
 
-            OWSLinkedDeviceReadReceipt *_Nullable oldReadReceipt = self.toLinkedDevicesReadReceiptMap[threadUniqueId];
-            if (oldReadReceipt && oldReadReceipt.timestamp > newReadReceipt.timestamp) {
-                // If there's an existing "linked device" read receipt for the same thread with
-                // a newer timestamp, discard this "linked device" read receipt.
+            OWSLinkedDeviceReadReceipt *newReadReceipt =
+                [[OWSLinkedDeviceReadReceipt alloc] initWithSenderId:messageAuthorId timestamp:timestamp];
+            BOOL shouldPersistForLinkedDevices =
+                [self enqueueReadReceiptForLinkedDevices:newReadReceipt threadUniqueId:threadUniqueId];
+            if (!shouldPersistForLinkedDevices) {
                 DDLogVerbose(@"%@ Ignoring redundant read receipt for linked devices.", self.logTag);
-            } else {
-                DDLogVerbose(@"%@ Enqueuing read receipt for linked devices.", self.logTag);
-                self.toLinkedDevicesReadReceiptMap[threadUniqueId] = newReadReceipt;
             }
 
+            BOOL shouldPersistForSender = NO;
             if ([self areReadReceiptsEnabled]) {
                 DDLogVerbose(@"%@ Enqueuing read receipt for sender.", self.logTag);
-                NSMutableSet<NSNumber *> *_Nullable timestamps = self.toSenderReadReceiptMap[messageAuthorId];
-                if (!timestamps) {
-                    timestamps = [NSMutableSet new];
-                    self.toSenderReadReceiptMap[messageAuthorId] = timestamps;
-                }
-                [timestamps addObject:@(message.timestamp)];
+                shouldPersistForSender = [self enqueueReadReceiptForSenderId:messageAuthorId timestamp:timestamp];
+            }
+
+            if (shouldPersistForLinkedDevices || shouldPersistForSender) {
+                [[TSStorageManager dbWriteCoalescer] asyncReadWriteWithBlock:^(
+                    YapDatabaseReadWriteTransaction *transaction) {
+                    if (shouldPersistForLinkedDevices) {
+                        [transaction setObject:newReadReceipt
+                                        forKey:threadUniqueId
+                                  inCollection:OWSPendingReadReceiptsForLinkedDevicesCollection];
+                    }
+                    if (shouldPersistForSender) {
+                        [transaction setObject:@(timestamp)
+                                        forKey:[OWSReadReceiptManager pendingReadReceiptKeyForSenderId:messageAuthorId
+                                                                                            timestamp:timestamp]
+                                  inCollection:OWSPendingReadReceiptsForSenderCollection];
+                    }
+                }];
             }
 
             [self scheduleProcessing];
@@ -541,15 +893,24 @@ NSString *const OWSReadReceiptManagerAreReadReceiptsEnabled = @"areReadReceiptsE
     } else {
         DDLogError(@"Marking %zd messages as read by linked device.", interactions.count);
     }
-    for (id<OWSReadTracking> possiblyRead in interactions) {
-        [possiblyRead markAsReadWithTransaction:transaction sendReadReceipt:wasLocal updateExpiration:YES];
-        
-        if ([possiblyRead isKindOfClass:[TSIncomingMessage class]]) {
-            TSIncomingMessage *incomingMessage = (TSIncomingMessage *)possiblyRead;
-            [[NSNotificationCenter defaultCenter] postNotificationNameAsync:kIncomingMessageMarkedAsReadNotification
-                                                                     object:incomingMessage];
-        }
-    }
+    [TSThread
+        performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                   block:^{
+                                                       for (id<OWSReadTracking> possiblyRead in interactions) {
+                                                           [possiblyRead markAsReadWithTransaction:transaction
+                                                                                   sendReadReceipt:wasLocal
+                                                                                  updateExpiration:YES];
+
+                                                           if ([possiblyRead isKindOfClass:[TSIncomingMessage class]]) {
+                                                               TSIncomingMessage *incomingMessage
+                                                                   = (TSIncomingMessage *)possiblyRead;
+                                                               [[NSNotificationCenter defaultCenter]
+                                                                   postNotificationNameAsync:
+                                                                       kIncomingMessageMarkedAsReadNotification
+                                                                                      object:incomingMessage];
+                                                           }
+                                                       }
+                                                   }];
 }
 
 #pragma mark - Settings
@@ -7,6 +7,7 @@
 #import "MIMETypeUtil.h"
 #import "NSNotificationCenter+OWS.h"
 #import "OWSError.h"
+#import "OWSFileSystem.h"
 #import "OWSMessageSender.h"
 #import "TSAttachmentStream.h"
 #import "TSNetworkManager.h"
@@ -82,34 +83,53 @@ static const CGFloat kAttachmentUploadProgressTheta = 0.001f;
                 UInt64 serverId = ((NSDecimalNumber *)[responseDict objectForKey:@"id"]).unsignedLongLongValue;
                 NSString *location = [responseDict objectForKey:@"location"];
 
-                NSError *error;
-                NSData *attachmentData = [attachmentStream readDataFromFileWithError:&error];
-                if (error) {
-                    DDLogError(@"%@ Failed to read attachment data with error:%@", self.logTag, error);
-                    [error setIsRetryable:YES];
+                NSString *_Nullable attachmentFilePath = attachmentStream.filePath;
+                if (!attachmentFilePath) {
+                    DDLogError(@"%@ Missing path for attachment.", self.logTag);
+                    NSError *error = OWSErrorMakeWriteAttachmentDataError();
+                    [error setIsRetryable:NO];
                     return failureHandlerWrapper(error);
                 }
 
+                // Encrypt to a temporary file in fixed-size chunks, so that we never hold
+                // the plaintext or ciphertext of large attachments in memory.
+                NSString *encryptedFileName = [[NSUUID UUID].UUIDString stringByAppendingPathExtension:@"encrypted"];
+                NSString *encryptedFilePath = [NSTemporaryDirectory() stringByAppendingPathComponent:encryptedFileName];
+
+                NSError *error;
                 NSData *encryptionKey;
                 NSData *digest;
-                NSData *encryptedAttachmentData =
-                    [Cryptography encryptAttachmentData:attachmentData outKey:&encryptionKey outDigest:&digest];
+                if (![Cryptography encryptAttachmentAtPath:attachmentFilePath
+                                                    toPath:encryptedFilePath
+                                                    outKey:&encryptionKey
+                                                 outDigest:&digest
+                                                     error:&error]) {
+                    DDLogError(@"%@ Failed to encrypt attachment data with error:%@", self.logTag, error);
+                    [error setIsRetryable:YES];
+                    return failureHandlerWrapper(error);
+                }
 
                 attachmentStream.encryptionKey = encryptionKey;
                 attachmentStream.digest = digest;
 
-                [self uploadDataWithProgress:encryptedAttachmentData
-                                    location:location
-                                attachmentId:attachmentStream.uniqueId
-                                     success:^{
-                                         OWSAssertIsOnMainThread();
+                [self uploadFileWithProgress:encryptedFilePath
+                    location:location
+                    attachmentId:attachmentStream.uniqueId
+                    success:^{
+                        OWSAssertIsOnMainThread();
+
+                        [OWSFileSystem deleteFileIfExists:encryptedFilePath];
+
+                        DDLogInfo(@"%@ Uploaded attachment: %p.", self.logTag, attachmentStream);
+                        attachmentStream.serverId = serverId;
+                        attachmentStream.isUploaded = YES;
+                        [attachmentStream saveAsyncWithCompletionBlock:successHandlerWrapper];
+                    }
+                    failure:^(NSError *uploadError) {
+                        [OWSFileSystem deleteFileIfExists:encryptedFilePath];
 
-                                         DDLogInfo(@"%@ Uploaded attachment: %p.", self.logTag, attachmentStream);
-                                         attachmentStream.serverId = serverId;
-                                         attachmentStream.isUploaded = YES;
-                                         [attachmentStream saveAsyncWithCompletionBlock:successHandlerWrapper];
-                                     }
-                                     failure:failureHandlerWrapper];
+                        failureHandlerWrapper(uploadError);
+                    }];
 
             });
         }
@@ -121,7 +141,7 @@ static const CGFloat kAttachmentUploadProgressTheta = 0.001f;
 }
 
 
-- (void)uploadDataWithProgress:(NSData *)cipherText
+- (void)uploadFileWithProgress:(NSString *)cipherTextFilePath
                       location:(NSString *)location
                   attachmentId:(NSString *)attachmentId
                        success:(void (^)(void))successHandler
@@ -129,7 +149,6 @@ static const CGFloat kAttachmentUploadProgressTheta = 0.001f;
 {
     NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:location]];
     request.HTTPMethod = @"PUT";
-    request.HTTPBody = cipherText;
     [request setValue:OWSMimeTypeApplicationOctetStream forHTTPHeaderField:@"Content-Type"];
 
     AFURLSessionManager *manager = [[AFURLSessionManager alloc]
@@ -137,7 +156,7 @@ static const CGFloat kAttachmentUploadProgressTheta = 0.001f;
 
     NSURLSessionUploadTask *uploadTask;
     uploadTask = [manager uploadTaskWithRequest:request
-        fromData:cipherText
+        fromFile:[NSURL fileURLWithPath:cipherTextFilePath]
         progress:^(NSProgress *_Nonnull uploadProgress) {
             [self fireProgressNotification:MAX(kAttachmentUploadProgressTheta, uploadProgress.fractionCompleted)
                               attachmentId:attachmentId];
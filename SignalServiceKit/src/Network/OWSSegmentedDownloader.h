@@ -0,0 +1,72 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, OWSDownloadPriority) {
+    OWSDownloadPriorityLow,
+    OWSDownloadPriorityHigh,
+};
+
+// progress is in the range [0, 1].
+typedef void (^OWSDownloadProgressBlock)(CGFloat progress);
+typedef void (^OWSDownloadSuccessBlock)(NSString *filePath);
+typedef void (^OWSDownloadFailureBlock)(NSError *error);
+
+// Represents a download that has been enqueued with an OWSSegmentedDownloader.
+//
+// Should be cancelled if no longer necessary.
+@interface OWSSegmentedDownload : NSObject
+
+@property (nonatomic, readonly) NSURLRequest *request;
+@property (nonatomic, readonly) NSString *filePath;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+// None of the download's callbacks will be invoked after it is cancelled.
+- (void)cancel;
+
+@end
+
+#pragma mark -
+
+// Downloads files as a series of HTTP range requests ("segments"), each of which
+// is written directly to its place in the destination file.
+//
+// * The first segment request also discovers the content length, after which the
+//   remaining segments are requested concurrently.  If the server doesn't honor
+//   range requests, the file is downloaded with a single request.
+// * Segments of all downloads share a queue, ordered by priority, with a bounded
+//   number of requests in flight per host.
+// * Downloads with a resume identifier record their completed segments alongside
+//   the destination file.  If the same file is later downloaded with the same
+//   resume identifier, only the missing segments are requested.  Downloads that
+//   fail for any reason other than a network error discard their partial file.
+// * Only one download may write to a given file at a time; a second download of
+//   the same file path fails immediately, leaving the file untouched.
+@interface OWSSegmentedDownloader : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (instancetype)initWithSessionConfiguration:(NSURLSessionConfiguration *)configuration
+                maxConcurrentRequestsPerHost:(NSUInteger)maxConcurrentRequestsPerHost NS_DESIGNATED_INITIALIZER;
+
++ (instancetype)sharedDownloader;
+
+// All callbacks are invoked on the main thread.  Exactly one of success and
+// failure is invoked, unless the download is cancelled first.
+//
+// A maxContentLength of zero means that the content length isn't limited.
+- (OWSSegmentedDownload *)downloadWithRequest:(NSURLRequest *)request
+                                   toFilePath:(NSString *)filePath
+                             resumeIdentifier:(nullable NSString *)resumeIdentifier
+                             maxContentLength:(unsigned long long)maxContentLength
+                                     priority:(OWSDownloadPriority)priority
+                                     progress:(nullable OWSDownloadProgressBlock)progress
+                                      success:(OWSDownloadSuccessBlock)success
+                                      failure:(OWSDownloadFailureBlock)failure;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,869 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSSegmentedDownloader.h"
+#import "OWSError.h"
+#import "OWSFileSystem.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+static const unsigned long long kSegmentLength = 1024 * 1024;
+static const NSUInteger kMaxSegmentRetryCount = 2;
+static const CGFloat kMinProgressDelta = 0.01f;
+
+static NSString *const kResumeFileExtension = @"segments";
+static NSString *const kResumeStateIdentifierKey = @"resumeIdentifier";
+static NSString *const kResumeStateContentLengthKey = @"contentLength";
+static NSString *const kResumeStateSegmentLengthKey = @"segmentLength";
+static NSString *const kResumeStateValidatorKey = @"validator";
+static NSString *const kResumeStateCompletedSegmentsKey = @"completedSegments";
+
+typedef NS_ENUM(NSUInteger, OWSDownloadSegmentState) {
+    OWSDownloadSegmentStateWaiting,
+    OWSDownloadSegmentStateDownloading,
+    OWSDownloadSegmentStateComplete,
+};
+
+// Parses a header value like "bytes 0-1023/4096".
+static BOOL OWSParseContentRange(NSString *_Nullable value,
+    unsigned long long *rangeStart,
+    unsigned long long *rangeEnd,
+    unsigned long long *totalLength)
+{
+    if (value.length < 1) {
+        return NO;
+    }
+    NSScanner *scanner = [NSScanner scannerWithString:value];
+    scanner.charactersToBeSkipped = nil;
+    return ([scanner scanString:@"bytes " intoString:NULL] &&
+        [scanner scanUnsignedLongLong:rangeStart] && [scanner scanString:@"-" intoString:NULL] &&
+        [scanner scanUnsignedLongLong:rangeEnd] && [scanner scanString:@"/" intoString:NULL] &&
+        [scanner scanUnsignedLongLong:totalLength] && scanner.isAtEnd && *rangeStart <= *rangeEnd
+        && *rangeEnd < *totalLength);
+}
+
+@class OWSSegmentedDownloader;
+
+@interface OWSDownloadSegment : NSObject
+
+@property (nonatomic, readonly) NSUInteger index;
+@property (nonatomic, readonly) unsigned long long start;
+// Until the content length is known, this is the length that was requested.
+@property (nonatomic) unsigned long long length;
+@property (nonatomic) unsigned long long bytesReceived;
+@property (nonatomic) OWSDownloadSegmentState state;
+@property (nonatomic) NSUInteger retryCount;
+@property (nonatomic, nullable) NSURLSessionDataTask *task;
+@property (nonatomic, nullable, weak) OWSSegmentedDownload *download;
+
+@end
+
+#pragma mark -
+
+@implementation OWSDownloadSegment
+
+- (instancetype)initWithIndex:(NSUInteger)index
+                        start:(unsigned long long)start
+                       length:(unsigned long long)length
+                     download:(OWSSegmentedDownload *)download
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _index = index;
+    _start = start;
+    _length = length;
+    _download = download;
+
+    return self;
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSSegmentedDownload ()
+
+@property (nonatomic, weak) OWSSegmentedDownloader *downloader;
+@property (nonatomic, nullable) NSString *resumeIdentifier;
+@property (nonatomic) unsigned long long maxContentLength;
+@property (nonatomic) OWSDownloadPriority priority;
+@property (nonatomic, nullable) OWSDownloadProgressBlock progressBlock;
+@property (nonatomic, nullable) OWSDownloadSuccessBlock successBlock;
+@property (nonatomic, nullable) OWSDownloadFailureBlock failureBlock;
+
+// The following state should only be accessed on the downloader's serial queue.
+@property (nonatomic) BOOL isFinished;
+@property (nonatomic) int fileDescriptor;
+@property (nonatomic) BOOL hasContentLength;
+@property (nonatomic) unsigned long long contentLength;
+// YES if the server ignored our range request and sent the whole file.
+@property (nonatomic) BOOL isUnsegmented;
+// ETag or Last-Modified of the first response, used with If-Range.
+@property (nonatomic, nullable) NSString *validator;
+@property (nonatomic) NSMutableArray<OWSDownloadSegment *> *segments;
+@property (nonatomic) CGFloat lastReportedProgress;
+
+@end
+
+#pragma mark -
+
+@interface OWSSegmentedDownloader () <NSURLSessionDataDelegate>
+
+- (void)cancelDownload:(OWSSegmentedDownload *)download;
+
+@end
+
+#pragma mark -
+
+@implementation OWSSegmentedDownload
+
+- (instancetype)initWithRequest:(NSURLRequest *)request
+                       filePath:(NSString *)filePath
+                     downloader:(OWSSegmentedDownloader *)downloader
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _request = [request copy];
+    _filePath = filePath;
+    _downloader = downloader;
+    _fileDescriptor = -1;
+    _segments = [NSMutableArray new];
+
+    return self;
+}
+
+- (NSString *)resumeFilePath
+{
+    return [self.filePath stringByAppendingPathExtension:kResumeFileExtension];
+}
+
+- (NSString *)host
+{
+    return self.request.URL.host ?: @"";
+}
+
+- (void)cancel
+{
+    [self.downloader cancelDownload:self];
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSSegmentedDownloader ()
+
+@property (nonatomic, readonly) NSURLSession *session;
+@property (nonatomic, readonly) dispatch_queue_t serialQueue;
+@property (nonatomic, readonly) NSUInteger maxConcurrentRequestsPerHost;
+
+// The following state should only be accessed on the serial queue.
+@property (nonatomic, readonly) NSMutableArray<OWSSegmentedDownload *> *downloads;
+@property (nonatomic, readonly) NSMutableDictionary<NSNumber *, OWSDownloadSegment *> *segmentsByTaskIdentifier;
+
+@end
+
+#pragma mark -
+
+@implementation OWSSegmentedDownloader
+
++ (instancetype)sharedDownloader
+{
+    static OWSSegmentedDownloader *sharedDownloader = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+        configuration.URLCache = nil;
+        configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        sharedDownloader =
+            [[self alloc] initWithSessionConfiguration:configuration maxConcurrentRequestsPerHost:4];
+    });
+    return sharedDownloader;
+}
+
+- (instancetype)initWithSessionConfiguration:(NSURLSessionConfiguration *)configuration
+                maxConcurrentRequestsPerHost:(NSUInteger)maxConcurrentRequestsPerHost
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    OWSAssert(maxConcurrentRequestsPerHost > 0);
+
+    _maxConcurrentRequestsPerHost = maxConcurrentRequestsPerHost;
+    _serialQueue = dispatch_queue_create("org.whispersystems.segmentedDownloader", DISPATCH_QUEUE_SERIAL);
+    _downloads = [NSMutableArray new];
+    _segmentsByTaskIdentifier = [NSMutableDictionary new];
+
+    // Deliver all delegate callbacks on the serial queue so that no other
+    // synchronization is necessary.
+    NSOperationQueue *delegateQueue = [NSOperationQueue new];
+    delegateQueue.underlyingQueue = _serialQueue;
+    delegateQueue.maxConcurrentOperationCount = 1;
+
+    NSURLSessionConfiguration *sessionConfiguration = [configuration copy];
+    sessionConfiguration.HTTPMaximumConnectionsPerHost = (NSInteger)maxConcurrentRequestsPerHost;
+    _session = [NSURLSession sessionWithConfiguration:sessionConfiguration delegate:self delegateQueue:delegateQueue];
+
+    return self;
+}
+
+#pragma mark - Public
+
+- (OWSSegmentedDownload *)downloadWithRequest:(NSURLRequest *)request
+                                   toFilePath:(NSString *)filePath
+                             resumeIdentifier:(nullable NSString *)resumeIdentifier
+                             maxContentLength:(unsigned long long)maxContentLength
+                                     priority:(OWSDownloadPriority)priority
+                                     progress:(nullable OWSDownloadProgressBlock)progress
+                                      success:(OWSDownloadSuccessBlock)success
+                                      failure:(OWSDownloadFailureBlock)failure
+{
+    OWSAssert(request.URL);
+    OWSAssert(filePath.length > 0);
+    OWSAssert(success);
+    OWSAssert(failure);
+
+    OWSSegmentedDownload *download =
+        [[OWSSegmentedDownload alloc] initWithRequest:request filePath:filePath downloader:self];
+    download.resumeIdentifier = resumeIdentifier;
+    download.maxContentLength = maxContentLength;
+    download.priority = priority;
+    download.progressBlock = progress;
+    download.successBlock = success;
+    download.failureBlock = failure;
+
+    dispatch_async(self.serialQueue, ^{
+        [self startDownload:download];
+    });
+
+    return download;
+}
+
+- (void)cancelDownload:(OWSSegmentedDownload *)download
+{
+    // Clear the callbacks synchronously so that none are invoked after
+    // cancel returns, even if they have already been dispatched.
+    @synchronized(download)
+    {
+        download.progressBlock = nil;
+        download.successBlock = nil;
+        download.failureBlock = nil;
+    }
+
+    dispatch_async(self.serialQueue, ^{
+        if (download.isFinished) {
+            return;
+        }
+        DDLogVerbose(@"%@ cancelled download: %@", self.logTag, download.request.URL);
+        [self finishDownload:download discardFile:download.resumeIdentifier == nil];
+        [self processQueue];
+    });
+}
+
+#pragma mark - Download Lifecycle
+
+- (void)startDownload:(OWSSegmentedDownload *)download
+{
+    if (download.isFinished) {
+        return;
+    }
+
+    for (OWSSegmentedDownload *otherDownload in self.downloads) {
+        if ([otherDownload.filePath isEqualToString:download.filePath]) {
+            // Don't let two downloads write to (or discard) the same file.
+            DDLogError(@"%@ file is already being downloaded: %@", self.logTag, download.filePath);
+            [self failDownload:download error:OWSErrorMakeWriteAttachmentDataError() discardFile:NO];
+            return;
+        }
+    }
+
+    if (![self restoreDownload:download]) {
+        [self resetDownload:download];
+    }
+
+    [OWSFileSystem ensureDirectoryExists:[download.filePath stringByDeletingLastPathComponent]];
+    download.fileDescriptor = open(download.filePath.fileSystemRepresentation, O_WRONLY | O_CREAT, 0600);
+    if (download.fileDescriptor < 0) {
+        DDLogError(@"%@ could not open file: %@, %d", self.logTag, download.filePath, errno);
+        [self failDownload:download error:OWSErrorMakeWriteAttachmentDataError()];
+        return;
+    }
+    if (!download.hasContentLength && ftruncate(download.fileDescriptor, 0) != 0) {
+        [self failDownload:download error:OWSErrorMakeWriteAttachmentDataError()];
+        return;
+    }
+
+    [self.downloads addObject:download];
+    [self processQueue];
+}
+
+// Discards any partial download and starts over with a "probe" segment
+// which also discovers the content length.
+- (void)resetDownload:(OWSSegmentedDownload *)download
+{
+    for (OWSDownloadSegment *segment in download.segments) {
+        [self discardSegment:segment];
+    }
+    [OWSFileSystem deleteFileIfExists:download.resumeFilePath];
+
+    download.hasContentLength = NO;
+    download.contentLength = 0;
+    download.isUnsegmented = NO;
+    download.validator = nil;
+    download.lastReportedProgress = 0;
+    download.segments = [@[ [[OWSDownloadSegment alloc] initWithIndex:0
+                                                                start:0
+                                                               length:kSegmentLength
+                                                             download:download] ] mutableCopy];
+
+    if (download.fileDescriptor >= 0 && ftruncate(download.fileDescriptor, 0) != 0) {
+        DDLogError(@"%@ could not truncate file: %@, %d", self.logTag, download.filePath, errno);
+    }
+}
+
+// Returns YES if the download has picked up the state of a previous,
+// interrupted download of the same file.
+- (BOOL)restoreDownload:(OWSSegmentedDownload *)download
+{
+    if (!download.resumeIdentifier) {
+        return NO;
+    }
+    NSDictionary *resumeState = [NSDictionary dictionaryWithContentsOfFile:download.resumeFilePath];
+    if (!resumeState) {
+        return NO;
+    }
+    NSNumber *_Nullable contentLength = resumeState[kResumeStateContentLengthKey];
+    NSNumber *_Nullable segmentLength = resumeState[kResumeStateSegmentLengthKey];
+    NSArray<NSNumber *> *_Nullable completedSegments = resumeState[kResumeStateCompletedSegmentsKey];
+    if (![resumeState[kResumeStateIdentifierKey] isEqual:download.resumeIdentifier] || !contentLength
+        || segmentLength.unsignedLongLongValue != kSegmentLength || ![completedSegments isKindOfClass:[NSArray class]]) {
+        return NO;
+    }
+    if (download.maxContentLength > 0 && contentLength.unsignedLongLongValue > download.maxContentLength) {
+        return NO;
+    }
+    NSDictionary *_Nullable attributes =
+        [[NSFileManager defaultManager] attributesOfItemAtPath:download.filePath error:nil];
+    if (!attributes || attributes.fileSize != contentLength.unsignedLongLongValue) {
+        return NO;
+    }
+
+    download.hasContentLength = YES;
+    download.contentLength = contentLength.unsignedLongLongValue;
+    download.validator = resumeState[kResumeStateValidatorKey];
+    [self createSegmentsForDownload:download];
+
+    NSSet<NSNumber *> *completedSegmentSet = [NSSet setWithArray:completedSegments];
+    for (OWSDownloadSegment *segment in download.segments) {
+        if ([completedSegmentSet containsObject:@(segment.index)]) {
+            segment.state = OWSDownloadSegmentStateComplete;
+            segment.bytesReceived = segment.length;
+        }
+    }
+
+    DDLogInfo(@"%@ resuming download with %lu/%lu segments complete: %@",
+        self.logTag,
+        (unsigned long)completedSegmentSet.count,
+        (unsigned long)download.segments.count,
+        download.request.URL);
+    return YES;
+}
+
+- (void)createSegmentsForDownload:(OWSSegmentedDownload *)download
+{
+    OWSAssert(download.hasContentLength);
+
+    OWSDownloadSegment *_Nullable probeSegment = download.segments.firstObject;
+    NSMutableArray<OWSDownloadSegment *> *segments = [NSMutableArray new];
+    NSUInteger index = 0;
+    for (unsigned long long start = 0; start < download.contentLength; start += kSegmentLength) {
+        unsigned long long length = MIN(kSegmentLength, download.contentLength - start);
+        if (index == 0 && probeSegment) {
+            // Keep the in-flight probe segment.
+            probeSegment.length = length;
+            [segments addObject:probeSegment];
+        } else {
+            [segments addObject:[[OWSDownloadSegment alloc] initWithIndex:index
+                                                                    start:start
+                                                                   length:length
+                                                                 download:download]];
+        }
+        index++;
+    }
+    download.segments = segments;
+}
+
+- (void)saveResumeStateForDownload:(OWSSegmentedDownload *)download
+{
+    if (!download.resumeIdentifier || !download.hasContentLength || download.isUnsegmented) {
+        return;
+    }
+
+    NSMutableArray<NSNumber *> *completedSegments = [NSMutableArray new];
+    for (OWSDownloadSegment *segment in download.segments) {
+        if (segment.state == OWSDownloadSegmentStateComplete) {
+            [completedSegments addObject:@(segment.index)];
+        }
+    }
+    NSMutableDictionary *resumeState = [@{
+        kResumeStateIdentifierKey : download.resumeIdentifier,
+        kResumeStateContentLengthKey : @(download.contentLength),
+        kResumeStateSegmentLengthKey : @(kSegmentLength),
+        kResumeStateCompletedSegmentsKey : completedSegments,
+    } mutableCopy];
+    if (download.validator) {
+        resumeState[kResumeStateValidatorKey] = download.validator;
+    }
+    if (![resumeState writeToFile:download.resumeFilePath atomically:YES]) {
+        DDLogWarn(@"%@ could not save resume state: %@", self.logTag, download.resumeFilePath);
+    }
+}
+
+- (void)discardSegment:(OWSDownloadSegment *)segment
+{
+    if (segment.task) {
+        [self.segmentsByTaskIdentifier removeObjectForKey:@(segment.task.taskIdentifier)];
+        [segment.task cancel];
+        segment.task = nil;
+    }
+    segment.download = nil;
+}
+
+- (void)finishDownload:(OWSSegmentedDownload *)download discardFile:(BOOL)discardFile
+{
+    OWSAssert(!download.isFinished);
+
+    download.isFinished = YES;
+    for (OWSDownloadSegment *segment in download.segments) {
+        [self discardSegment:segment];
+    }
+    if (download.fileDescriptor >= 0) {
+        close(download.fileDescriptor);
+        download.fileDescriptor = -1;
+    }
+    if (discardFile) {
+        [OWSFileSystem deleteFileIfExists:download.filePath];
+        [OWSFileSystem deleteFileIfExists:download.resumeFilePath];
+    }
+    [self.downloads removeObject:download];
+}
+
+- (void)succeedDownload:(OWSSegmentedDownload *)download
+{
+    DDLogVerbose(@"%@ download succeeded: %@", self.logTag, download.request.URL);
+
+    [self finishDownload:download discardFile:NO];
+    [OWSFileSystem deleteFileIfExists:download.resumeFilePath];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        OWSDownloadProgressBlock _Nullable progressBlock;
+        OWSDownloadSuccessBlock _Nullable successBlock;
+        @synchronized(download)
+        {
+            progressBlock = download.progressBlock;
+            successBlock = download.successBlock;
+            download.progressBlock = nil;
+            download.successBlock = nil;
+            download.failureBlock = nil;
+        }
+        if (progressBlock) {
+            progressBlock(1.f);
+        }
+        if (successBlock) {
+            successBlock(download.filePath);
+        }
+    });
+}
+
+- (void)failDownload:(OWSSegmentedDownload *)download error:(NSError *)error
+{
+    // Downloads that can be resumed keep their partial file and resume state,
+    // but only if they failed for a transient reason; invalid responses and
+    // local errors would most likely recur.
+    BOOL isRetryable = download.resumeIdentifier != nil && [error.domain isEqualToString:NSURLErrorDomain];
+    [self failDownload:download error:error discardFile:!isRetryable];
+}
+
+- (void)failDownload:(OWSSegmentedDownload *)download error:(NSError *)error discardFile:(BOOL)discardFile
+{
+    DDLogError(@"%@ download failed: %@, %@", self.logTag, download.request.URL, error);
+
+    [self finishDownload:download discardFile:discardFile];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        OWSDownloadFailureBlock _Nullable failureBlock;
+        @synchronized(download)
+        {
+            failureBlock = download.failureBlock;
+            download.progressBlock = nil;
+            download.successBlock = nil;
+            download.failureBlock = nil;
+        }
+        if (failureBlock) {
+            failureBlock(error);
+        }
+    });
+}
+
+- (void)reportProgressForDownload:(OWSSegmentedDownload *)download
+{
+    if (!download.hasContentLength || download.contentLength < 1) {
+        return;
+    }
+    unsigned long long bytesReceived = 0;
+    for (OWSDownloadSegment *segment in download.segments) {
+        bytesReceived += segment.bytesReceived;
+    }
+    CGFloat progress = (CGFloat)MIN(1.0, bytesReceived / (double)download.contentLength);
+    if (progress - download.lastReportedProgress < kMinProgressDelta) {
+        return;
+    }
+    download.lastReportedProgress = progress;
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        OWSDownloadProgressBlock _Nullable progressBlock;
+        @synchronized(download)
+        {
+            progressBlock = download.progressBlock;
+        }
+        if (progressBlock) {
+            progressBlock(progress);
+        }
+    });
+}
+
+#pragma mark - Scheduling
+
+- (NSUInteger)activeRequestCountForHost:(NSString *)host
+{
+    NSUInteger count = 0;
+    for (OWSDownloadSegment *segment in self.segmentsByTaskIdentifier.allValues) {
+        if ([segment.download.host isEqualToString:host]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Starts as many waiting segments as the per-host limits allow, high
+// priority downloads first, then in the order they were enqueued.
+- (void)processQueue
+{
+    NSMutableDictionary<NSString *, NSNumber *> *activeRequestCounts = [NSMutableDictionary new];
+    for (NSNumber *priority in @[ @(OWSDownloadPriorityHigh), @(OWSDownloadPriorityLow) ]) {
+        for (OWSSegmentedDownload *download in [self.downloads copy]) {
+            if (download.priority != priority.unsignedIntegerValue) {
+                continue;
+            }
+            NSString *host = download.host;
+            if (!activeRequestCounts[host]) {
+                activeRequestCounts[host] = @([self activeRequestCountForHost:host]);
+            }
+            for (OWSDownloadSegment *segment in download.segments) {
+                if (activeRequestCounts[host].unsignedIntegerValue >= self.maxConcurrentRequestsPerHost) {
+                    break;
+                }
+                if (segment.state != OWSDownloadSegmentStateWaiting) {
+                    continue;
+                }
+                [self startSegment:segment download:download];
+                activeRequestCounts[host] = @(activeRequestCounts[host].unsignedIntegerValue + 1);
+            }
+        }
+    }
+}
+
+- (void)startSegment:(OWSDownloadSegment *)segment download:(OWSSegmentedDownload *)download
+{
+    NSMutableURLRequest *request = [download.request mutableCopy];
+    if (!download.isUnsegmented) {
+        NSString *rangeHeaderValue =
+            [NSString stringWithFormat:@"bytes=%llu-%llu", segment.start, segment.start + segment.length - 1];
+        [request setValue:rangeHeaderValue forHTTPHeaderField:@"Range"];
+        if (download.validator) {
+            // If the content has changed, the server will send all of it.
+            [request setValue:download.validator forHTTPHeaderField:@"If-Range"];
+        }
+    }
+
+    NSURLSessionDataTask *task = [self.session dataTaskWithRequest:request];
+    segment.task = task;
+    segment.state = OWSDownloadSegmentStateDownloading;
+    segment.bytesReceived = 0;
+    self.segmentsByTaskIdentifier[@(task.taskIdentifier)] = segment;
+    [task resume];
+}
+
+#pragma mark - Responses
+
+// Returns NO if the download has failed or been restarted.
+- (BOOL)handleResponse:(NSURLResponse *)response
+               segment:(OWSDownloadSegment *)segment
+              download:(OWSSegmentedDownload *)download
+{
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        DDLogError(@"%@ unexpected response: %@", self.logTag, response);
+        [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+        return NO;
+    }
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+
+    if (httpResponse.statusCode == 206 && !download.isUnsegmented) {
+        unsigned long long rangeStart, rangeEnd, totalLength;
+        if (!OWSParseContentRange(
+                httpResponse.allHeaderFields[@"Content-Range"], &rangeStart, &rangeEnd, &totalLength)
+            || rangeStart != segment.start) {
+            DDLogError(@"%@ invalid content range: %@", self.logTag, httpResponse.allHeaderFields[@"Content-Range"]);
+            [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+            return NO;
+        }
+
+        if (!download.hasContentLength) {
+            if (download.maxContentLength > 0 && totalLength > download.maxContentLength) {
+                DDLogError(@"%@ content length exceeds limit: %llu", self.logTag, totalLength);
+                [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+                return NO;
+            }
+            if (ftruncate(download.fileDescriptor, (off_t)totalLength) != 0) {
+                DDLogError(@"%@ could not size file: %@, %d", self.logTag, download.filePath, errno);
+                [self failDownload:download error:OWSErrorMakeWriteAttachmentDataError()];
+                return NO;
+            }
+            download.hasContentLength = YES;
+            download.contentLength = totalLength;
+            download.validator = httpResponse.allHeaderFields[@"ETag"] ?: httpResponse.allHeaderFields[@"Last-Modified"];
+            [self createSegmentsForDownload:download];
+            [self saveResumeStateForDownload:download];
+            // Request the remaining segments alongside the probe segment.
+            [self processQueue];
+        } else if (totalLength != download.contentLength) {
+            DDLogWarn(@"%@ content length changed, restarting download: %@", self.logTag, download.request.URL);
+            [self resetDownload:download];
+            [self processQueue];
+            return NO;
+        }
+
+        if (rangeEnd - rangeStart + 1 != segment.length) {
+            DDLogError(@"%@ unexpected segment length: %llu != %llu",
+                self.logTag,
+                rangeEnd - rangeStart + 1,
+                segment.length);
+            [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+            return NO;
+        }
+        return YES;
+    }
+
+    if (httpResponse.statusCode == 200) {
+        if (download.isUnsegmented) {
+            // Retrying an unsegmented download.
+            return YES;
+        }
+        if (segment.index != 0 || download.hasContentLength) {
+            // The content has changed since we started; If-Range made the
+            // server send all of it.
+            DDLogWarn(@"%@ content changed, restarting download: %@", self.logTag, download.request.URL);
+            [self resetDownload:download];
+            [self processQueue];
+            return NO;
+        }
+
+        // The server doesn't support range requests; download the whole file
+        // with this request.
+        long long expectedContentLength = httpResponse.expectedContentLength;
+        if (download.maxContentLength > 0 && expectedContentLength > 0
+            && (unsigned long long)expectedContentLength > download.maxContentLength) {
+            DDLogError(@"%@ content length exceeds limit: %lld", self.logTag, expectedContentLength);
+            [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+            return NO;
+        }
+        download.isUnsegmented = YES;
+        download.hasContentLength = expectedContentLength > 0;
+        download.contentLength = (unsigned long long)MAX(0, expectedContentLength);
+        return YES;
+    }
+
+    DDLogError(@"%@ response has invalid status code: %d, %@",
+        self.logTag,
+        (int)httpResponse.statusCode,
+        download.request.URL);
+    [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+    return NO;
+}
+
+- (BOOL)writeData:(NSData *)data segment:(OWSDownloadSegment *)segment download:(OWSSegmentedDownload *)download
+{
+    unsigned long long segmentLimit = (download.isUnsegmented ? download.maxContentLength : segment.length);
+    if (segmentLimit > 0 && segment.bytesReceived + data.length > segmentLimit) {
+        DDLogError(@"%@ received more data than expected: %@", self.logTag, download.request.URL);
+        [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+        return NO;
+    }
+
+    __block unsigned long long offset = segment.start + segment.bytesReceived;
+    __block BOOL didWrite = YES;
+    int fileDescriptor = download.fileDescriptor;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        size_t remaining = byteRange.length;
+        const uint8_t *cursor = bytes;
+        while (remaining > 0) {
+            ssize_t written = pwrite(fileDescriptor, cursor, remaining, (off_t)offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                didWrite = NO;
+                *stop = YES;
+                return;
+            }
+            cursor += written;
+            remaining -= (size_t)written;
+            offset += (unsigned long long)written;
+        }
+    }];
+    if (!didWrite) {
+        DDLogError(@"%@ could not write to file: %@, %d", self.logTag, download.filePath, errno);
+        [self failDownload:download error:OWSErrorMakeWriteAttachmentDataError()];
+        return NO;
+    }
+
+    segment.bytesReceived += data.length;
+    return YES;
+}
+
+- (void)completeSegment:(OWSDownloadSegment *)segment
+               download:(OWSSegmentedDownload *)download
+              withError:(nullable NSError *)error
+{
+    if (error) {
+        if (segment.retryCount < kMaxSegmentRetryCount) {
+            DDLogWarn(@"%@ retrying segment %lu: %@", self.logTag, (unsigned long)segment.index, error);
+            segment.retryCount++;
+            segment.state = OWSDownloadSegmentStateWaiting;
+            segment.bytesReceived = 0;
+            [self processQueue];
+        } else {
+            [self failDownload:download error:error];
+            [self processQueue];
+        }
+        return;
+    }
+
+    if (download.isUnsegmented) {
+        if (download.hasContentLength && segment.bytesReceived != download.contentLength) {
+            DDLogError(@"%@ download is missing data: %@", self.logTag, download.request.URL);
+            [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+            [self processQueue];
+            return;
+        }
+        download.hasContentLength = YES;
+        download.contentLength = segment.bytesReceived;
+    } else if (segment.bytesReceived != segment.length) {
+        DDLogError(@"%@ segment %lu is missing data: %@",
+            self.logTag,
+            (unsigned long)segment.index,
+            download.request.URL);
+        [self failDownload:download error:OWSErrorMakeUnableToProcessServerResponseError()];
+        [self processQueue];
+        return;
+    }
+
+    segment.state = OWSDownloadSegmentStateComplete;
+
+    BOOL isComplete = YES;
+    for (OWSDownloadSegment *otherSegment in download.segments) {
+        if (otherSegment.state != OWSDownloadSegmentStateComplete) {
+            isComplete = NO;
+            break;
+        }
+    }
+    if (isComplete) {
+        [self succeedDownload:download];
+    } else {
+        [self saveResumeStateForDownload:download];
+    }
+    [self processQueue];
+}
+
+#pragma mark - NSURLSessionDataDelegate
+
+- (void)URLSession:(NSURLSession *)session
+              dataTask:(NSURLSessionDataTask *)dataTask
+    didReceiveResponse:(NSURLResponse *)response
+     completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler
+{
+    OWSDownloadSegment *_Nullable segment = self.segmentsByTaskIdentifier[@(dataTask.taskIdentifier)];
+    OWSSegmentedDownload *_Nullable download = segment.download;
+    if (!segment || !download || download.isFinished) {
+        completionHandler(NSURLSessionResponseCancel);
+        return;
+    }
+
+    if ([self handleResponse:response segment:segment download:download]) {
+        completionHandler(NSURLSessionResponseAllow);
+    } else {
+        completionHandler(NSURLSessionResponseCancel);
+        [self processQueue];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+    OWSDownloadSegment *_Nullable segment = self.segmentsByTaskIdentifier[@(dataTask.taskIdentifier)];
+    OWSSegmentedDownload *_Nullable download = segment.download;
+    if (!segment || !download || download.isFinished) {
+        [dataTask cancel];
+        return;
+    }
+
+    if ([self writeData:data segment:segment download:download]) {
+        [self reportProgressForDownload:download];
+    } else {
+        [self processQueue];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session
+              dataTask:(NSURLSessionDataTask *)dataTask
+     willCacheResponse:(NSCachedURLResponse *)proposedResponse
+     completionHandler:(void (^)(NSCachedURLResponse *_Nullable cachedResponse))completionHandler
+{
+    completionHandler(nil);
+}
+
+#pragma mark - NSURLSessionTaskDelegate
+
+- (void)URLSession:(NSURLSession *)session
+                    task:(NSURLSessionTask *)task
+    didCompleteWithError:(nullable NSError *)error
+{
+    OWSDownloadSegment *_Nullable segment = self.segmentsByTaskIdentifier[@(task.taskIdentifier)];
+    if (!segment) {
+        // Discarded segment.
+        return;
+    }
+    [self.segmentsByTaskIdentifier removeObjectForKey:@(task.taskIdentifier)];
+    segment.task = nil;
+
+    OWSSegmentedDownload *_Nullable download = segment.download;
+    if (!download || download.isFinished) {
+        return;
+    }
+
+    [self completeSegment:segment download:download withError:error];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
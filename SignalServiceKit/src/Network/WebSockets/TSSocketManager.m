@@ -10,6 +10,7 @@
 #import "OWSBackgroundTask.h"
 #import "OWSMessageManager.h"
 #import "OWSMessageReceiver.h"
+#import "OWSQueues.h"
 #import "OWSSignalService.h"
 #import "OWSSignalServiceProtos.pb.h"
 #import "OWSWebsocketSecurityPolicy.h"
@@ -31,6 +32,64 @@ static const CGFloat kBackgroundKeepSocketAliveDurationSeconds = 15.f;
 
 NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_SocketManagerStateDidChange";
 
+// Bounds the number of frames whose envelopes are persisted (and acknowledged) together.
+static const NSUInteger kMaxReceiveBatchSize = 64;
+
+#pragma mark -
+
+// The request frames received over a websocket since the last batch was
+// flushed, with their envelopes (once decrypted) in the same order.
+@interface OWSWebSocketReceiveBatch : NSObject
+
+@property (nonatomic, readonly) SRWebSocket *webSocket;
+@property (nonatomic, readonly) NSMutableArray<WebSocketRequestMessage *> *requests;
+// Should only be accessed while synchronized on the batch.
+@property (nonatomic, readonly) NSMutableDictionary<NSNumber *, OWSSignalServiceProtosEnvelope *> *envelopeMap;
+// Tracks the decryption of the batch's envelopes.
+@property (nonatomic, readonly) dispatch_group_t group;
+@property (nonatomic, readonly) OWSBackgroundTask *backgroundTask;
+
+@end
+
+#pragma mark -
+
+@implementation OWSWebSocketReceiveBatch
+
+- (instancetype)initWithWebSocket:(SRWebSocket *)webSocket
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _webSocket = webSocket;
+    _requests = [NSMutableArray new];
+    _envelopeMap = [NSMutableDictionary new];
+    _group = dispatch_group_create();
+    _backgroundTask = [OWSBackgroundTask backgroundTaskWithLabelStr:__PRETTY_FUNCTION__];
+
+    return self;
+}
+
+- (NSArray<OWSSignalServiceProtosEnvelope *> *)envelopes
+{
+    NSMutableArray<OWSSignalServiceProtosEnvelope *> *envelopes = [NSMutableArray new];
+    @synchronized(self)
+    {
+        for (NSUInteger i = 0; i < self.requests.count; i++) {
+            OWSSignalServiceProtosEnvelope *_Nullable envelope = self.envelopeMap[@(i)];
+            if (envelope) {
+                [envelopes addObject:envelope];
+            }
+        }
+    }
+    return [envelopes copy];
+}
+
+@end
+
+#pragma mark -
+
 // TSSocketManager's properties should only be accessed from the main thread.
 @interface TSSocketManager ()
 
@@ -82,6 +141,21 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
 
 @property (nonatomic) BOOL hasObservedNotifications;
 
+#pragma mark -
+
+// Websocket delegate callbacks are delivered on socketQueue so that incoming
+// frames are parsed off the main thread.  Other delegate callbacks hop to the
+// main thread.
+@property (nonatomic, readonly) dispatch_queue_t socketQueue;
+// Batches are persisted serially, in the order in which they were received.
+@property (nonatomic, readonly) dispatch_queue_t receiveBatchQueue;
+// Should only be accessed on socketQueue.
+@property (nonatomic, nullable) OWSWebSocketReceiveBatch *currentReceiveBatch;
+
+// Time spent on the main thread handling received frames.
+@property (nonatomic) NSTimeInterval mainThreadReceiveDuration;
+@property (nonatomic) NSUInteger receivedFrameCount;
+
 @end
 
 #pragma mark -
@@ -101,6 +175,8 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
     _signalService = [OWSSignalService sharedInstance];
     _messageReceiver = [OWSMessageReceiver sharedInstance];
     _state = SocketManagerStateClosed;
+    _socketQueue = dispatch_queue_create("org.whispersystems.websocket", DISPATCH_QUEUE_SERIAL);
+    _receiveBatchQueue = dispatch_queue_create("org.whispersystems.websocket.receive", DISPATCH_QUEUE_SERIAL);
 
     OWSSingletonAssert();
 
@@ -278,6 +354,7 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
             SRWebSocket *socket = [[SRWebSocket alloc] initWithURLRequest:request
                                                            securityPolicy:[OWSWebsocketSecurityPolicy sharedPolicy]];
             socket.delegate = self;
+            [socket setDelegateDispatchQueue:self.socketQueue];
             
             [self setWebsocket:socket];
 
@@ -328,33 +405,39 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
 #pragma mark - Delegate methods
 
 - (void)webSocketDidOpen:(SRWebSocket *)webSocket {
-    OWSAssertIsOnMainThread();
     OWSAssert(webSocket);
-    if (webSocket != self.websocket) {
-        // Ignore events from obsolete web sockets.
-        return;
-    }
 
-    self.state = SocketManagerStateOpen;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (webSocket != self.websocket) {
+            // Ignore events from obsolete web sockets.
+            return;
+        }
+
+        self.state = SocketManagerStateOpen;
+    });
 }
 
 - (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error {
-    OWSAssertIsOnMainThread();
     OWSAssert(webSocket);
-    if (webSocket != self.websocket) {
-        // Ignore events from obsolete web sockets.
-        return;
-    }
 
-    DDLogError(@"Websocket did fail with error: %@", error);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (webSocket != self.websocket) {
+            // Ignore events from obsolete web sockets.
+            return;
+        }
+
+        DDLogError(@"Websocket did fail with error: %@", error);
 
-    [self handleSocketFailure];
+        [self handleSocketFailure];
+    });
 }
 
 - (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(NSData *)data {
-    OWSAssertIsOnMainThread();
+    AssertOnDispatchQueue(self.socketQueue);
     OWSAssert(webSocket);
-    if (webSocket != self.websocket) {
+    // websocket may only be accessed on the main thread, but obsolete web sockets
+    // have had their delegate cleared.
+    if (webSocket.delegate != self) {
         // Ignore events from obsolete web sockets.
         return;
     }
@@ -362,7 +445,7 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
     WebSocketMessage *wsMessage = [WebSocketMessage parseFromData:data];
 
     if (wsMessage.type == WebSocketMessageTypeRequest) {
-        [self processWebSocketRequestMessage:wsMessage.request];
+        [self processWebSocketRequestMessage:wsMessage.request webSocket:webSocket];
     } else if (wsMessage.type == WebSocketMessageTypeResponse) {
         [self processWebSocketResponseMessage:wsMessage.response];
     } else {
@@ -370,50 +453,114 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
     }
 }
 
-- (void)processWebSocketRequestMessage:(WebSocketRequestMessage *)message {
-    OWSAssertIsOnMainThread();
+- (void)processWebSocketRequestMessage:(WebSocketRequestMessage *)message webSocket:(SRWebSocket *)webSocket
+{
+    AssertOnDispatchQueue(self.socketQueue);
 
     DDLogInfo(@"%@ Got message with verb: %@ and path: %@", self.logTag, message.verb, message.path);
 
-    // If we receive a message over the socket while the app is in the background,
-    // prolong how long the socket stays open.
-    [self requestSocketAliveForAtLeastSeconds:kBackgroundKeepSocketAliveDurationSeconds];
-
-    if ([message.path isEqualToString:@"/api/v1/message"] && [message.verb isEqualToString:@"PUT"]) {
-
-        __block OWSBackgroundTask *backgroundTask = [OWSBackgroundTask backgroundTaskWithLabelStr:__PRETTY_FUNCTION__];
+    OWSWebSocketReceiveBatch *_Nullable batch = self.currentReceiveBatch;
+    if (batch && batch.webSocket != webSocket) {
+        [self flushReceiveBatch];
+        batch = nil;
+    }
+    if (!batch) {
+        batch = [[OWSWebSocketReceiveBatch alloc] initWithWebSocket:webSocket];
+        self.currentReceiveBatch = batch;
+
+        // Any frames which have already been delivered to socketQueue will be
+        // handled before this block, and will join this batch.
+        dispatch_async(self.socketQueue, ^{
+            if (self.currentReceiveBatch == batch) {
+                [self flushReceiveBatch];
+            }
+        });
+    }
 
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+    NSUInteger index = batch.requests.count;
+    [batch.requests addObject:message];
 
+    if ([message.path isEqualToString:@"/api/v1/message"] && [message.verb isEqualToString:@"PUT"]) {
+        dispatch_group_async(batch.group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
             NSData *decryptedPayload =
                 [Cryptography decryptAppleMessagePayload:message.body withSignalingKey:TSAccountManager.signalingKey];
 
             if (!decryptedPayload) {
                 DDLogWarn(@"%@ Failed to decrypt incoming payload or bad HMAC", self.logTag);
-                [self sendWebSocketMessageAcknowledgement:message];
-                backgroundTask = nil;
                 return;
             }
 
             OWSSignalServiceProtosEnvelope *envelope = [OWSSignalServiceProtosEnvelope parseFromData:decryptedPayload];
-
-            [self.messageReceiver handleReceivedEnvelope:envelope];
-
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self sendWebSocketMessageAcknowledgement:message];
-                backgroundTask = nil;
-            });
+            @synchronized(batch)
+            {
+                batch.envelopeMap[@(index)] = envelope;
+            }
         });
     } else {
         DDLogWarn(@"%@ Unsupported WebSocket Request", self.logTag);
+    }
 
-        [self sendWebSocketMessageAcknowledgement:message];
+    if (batch.requests.count >= kMaxReceiveBatchSize) {
+        [self flushReceiveBatch];
     }
 }
 
-- (void)processWebSocketResponseMessage:(WebSocketResponseMessage *)message {
+// Persists the envelopes of the current batch and then acknowledges all of its frames.
+- (void)flushReceiveBatch
+{
+    AssertOnDispatchQueue(self.socketQueue);
+
+    OWSWebSocketReceiveBatch *_Nullable batch = self.currentReceiveBatch;
+    if (!batch) {
+        return;
+    }
+    self.currentReceiveBatch = nil;
+
+    dispatch_group_notify(batch.group, self.receiveBatchQueue, ^{
+        NSArray<OWSSignalServiceProtosEnvelope *> *envelopes = batch.envelopes;
+        if (envelopes.count > 0) {
+            [self.messageReceiver handleReceivedEnvelopes:envelopes];
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            NSDate *startDate = [NSDate new];
+
+            // If we receive a message over the socket while the app is in the background,
+            // prolong how long the socket stays open.
+            [self requestSocketAliveForAtLeastSeconds:kBackgroundKeepSocketAliveDurationSeconds];
+
+            for (WebSocketRequestMessage *request in batch.requests) {
+                // Frames received over an obsolete web socket will be redelivered by the service.
+                if (batch.webSocket != self.websocket) {
+                    break;
+                }
+                [self sendWebSocketMessageAcknowledgement:request];
+            }
+
+            [self didSpendMainThreadTime:fabs([startDate timeIntervalSinceNow])
+                     handlingFrameCount:batch.requests.count];
+        });
+    });
+}
+
+- (void)didSpendMainThreadTime:(NSTimeInterval)duration handlingFrameCount:(NSUInteger)frameCount
+{
     OWSAssertIsOnMainThread();
 
+    NSUInteger kLogInterval = 100;
+    BOOL shouldLog = (self.receivedFrameCount / kLogInterval) != ((self.receivedFrameCount + frameCount) / kLogInterval);
+    self.receivedFrameCount += frameCount;
+    self.mainThreadReceiveDuration += duration;
+    if (shouldLog) {
+        DDLogInfo(@"%@ received %lu frames, main thread time: %.3fs (%.3fms per frame).",
+            self.logTag,
+            (unsigned long)self.receivedFrameCount,
+            self.mainThreadReceiveDuration,
+            self.mainThreadReceiveDuration * 1000 / self.receivedFrameCount);
+    }
+}
+
+- (void)processWebSocketResponseMessage:(WebSocketResponseMessage *)message {
     DDLogWarn(@"Client should not receive WebSocket Respond messages");
 }
 
@@ -457,16 +604,18 @@ NSString *const kNSNotification_SocketManagerStateDidChange = @"kNSNotification_
  didCloseWithCode:(NSInteger)code
            reason:(NSString *)reason
          wasClean:(BOOL)wasClean {
-    OWSAssertIsOnMainThread();
     OWSAssert(webSocket);
-    if (webSocket != self.websocket) {
-        // Ignore events from obsolete web sockets.
-        return;
-    }
 
-    DDLogWarn(@"Websocket did close with code: %ld", (long)code);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (webSocket != self.websocket) {
+            // Ignore events from obsolete web sockets.
+            return;
+        }
+
+        DDLogWarn(@"Websocket did close with code: %ld", (long)code);
 
-    [self handleSocketFailure];
+        [self handleSocketFailure];
+    });
 }
 
 - (void)webSocketHeartBeat {
@@ -0,0 +1,54 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import <YapDatabase/YapDatabase.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// A compact binary encoding for the objects in our hottest collections
+// (messages, attachments and the incoming message jobs).
+//
+// * These objects are written with their (keyed) NSCoding implementations, so
+//   existing initWithCoder: migrations keep working, but fields are stored
+//   as tagged values rather than as an NSKeyedArchiver property list, which
+//   is several times larger and slower to encode and decode.
+// * Compact rows start with a header which can never begin a keyed archive,
+//   so rows written before this format existed are still decoded with the
+//   keyed unarchiver.  They are re-encoded whenever they are next saved, and
+//   in the background by migrateLegacyRowsIncrementallyWithTimeBudget:.
+// * Any other object is written as a keyed archive, as before.  So is any value
+//   within a compact row that isn't a property list type or NSDate.
+@interface OWSCompactSerializer : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+// The current version of the compact format.
++ (uint8_t)formatVersion;
+
++ (BOOL)isCompactData:(NSData *)data;
+
++ (BOOL)shouldUseCompactFormatForObject:(id)object;
+
+// Returns nil if the object can't be encoded in the compact format.
++ (nullable NSData *)compactDataForObject:(id)object;
+
+// Returns nil if the object's class no longer exists.  Throws if the data is malformed.
++ (nullable id)objectWithCompactData:(NSData *)data;
+
++ (YapDatabaseSerializer)serializer;
+
+// Decodes compact rows and passes any other row to legacyDeserializer.
++ (YapDatabaseDeserializer)deserializerWithLegacyDeserializer:(YapDatabaseDeserializer)legacyDeserializer;
+
+// Re-encodes rows of the hot collections which are still keyed archives, in
+// bounded batches, for roughly timeBudget seconds.  Progress is persisted,
+// so the work can be spread across launches.
+//
+// completion, if present, will be invoked on the main thread.
++ (void)migrateLegacyRowsIncrementallyWithTimeBudget:(NSTimeInterval)timeBudget
+                                          completion:(nullable void (^)(BOOL isComplete))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,932 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSCompactSerializer.h"
+#import "TSAttachmentPointer.h"
+#import "TSAttachmentStream.h"
+#import "TSIncomingMessage.h"
+#import "TSOutgoingMessage.h"
+#import "TSStorageManager.h"
+#import <SQLCipher/sqlite3.h>
+#import <objc/runtime.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Keyed archives are binary property lists, which always begin with "bplist".
+static const uint8_t kCompactHeaderMagic[] = { 0x00, 'O', 'W', 'S' };
+static const uint8_t kCompactFormatVersion = 1;
+
+static const NSUInteger kMigrationBatchSize = 100;
+
+static NSString *const OWSCompactSerializerCollection = @"OWSCompactSerializerCollection";
+static NSString *const OWSCompactSerializerMigrationCursorKey = @"migrationCursor";
+static NSString *const kMigrationCursorKeyCollectionIndex = @"collectionIndex";
+static NSString *const kMigrationCursorKeyKey = @"key";
+
+// Set on hot objects which were decoded from keyed archives.
+static char kLegacyDataAssociatedObjectKey;
+
+typedef NS_ENUM(uint8_t, OWSCompactTag) {
+    OWSCompactTagNil = 'z',
+    OWSCompactTagNull = 'n',
+    OWSCompactTagTrue = 'T',
+    OWSCompactTagFalse = 'F',
+    OWSCompactTagInteger = 'i',
+    OWSCompactTagUnsignedInteger = 'u',
+    OWSCompactTagDouble = 'd',
+    OWSCompactTagString = 's',
+    OWSCompactTagData = 'b',
+    OWSCompactTagDate = 't',
+    OWSCompactTagArray = 'a',
+    OWSCompactTagMutableArray = 'A',
+    OWSCompactTagSet = 'e',
+    OWSCompactTagMutableSet = 'E',
+    OWSCompactTagDictionary = 'm',
+    OWSCompactTagMutableDictionary = 'M',
+    OWSCompactTagObject = 'o',
+    OWSCompactTagKeyedArchive = 'k',
+};
+
+static void OWSRaiseMalformedData(NSString *reason)
+{
+    [NSException raise:NSInternalInconsistencyException format:@"Malformed compact data: %@", reason];
+}
+
+#pragma mark -
+
+@interface OWSCompactWriter : NSObject
+
+@property (nonatomic, readonly) NSMutableData *data;
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactWriter
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _data = [NSMutableData new];
+
+    return self;
+}
+
+- (void)writeByte:(uint8_t)value
+{
+    [self.data appendBytes:&value length:1];
+}
+
+- (void)writeVarint:(uint64_t)value
+{
+    uint8_t buffer[10];
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            byte |= 0x80;
+        }
+        buffer[length++] = byte;
+    } while (value != 0);
+    [self.data appendBytes:buffer length:length];
+}
+
+- (void)writeDouble:(double)value
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = CFSwapInt64HostToLittle(bits);
+    [self.data appendBytes:&bits length:sizeof(bits)];
+}
+
+- (void)writeBytes:(const void *)bytes length:(NSUInteger)length
+{
+    [self writeVarint:length];
+    [self.data appendBytes:bytes length:length];
+}
+
+- (void)writeString:(NSString *)value
+{
+    NSData *utf8 = [value dataUsingEncoding:NSUTF8StringEncoding];
+    [self writeBytes:utf8.bytes length:utf8.length];
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSCompactReader : NSObject
+
+@property (nonatomic, readonly) NSData *data;
+@property (nonatomic) NSUInteger offset;
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactReader
+
+- (instancetype)initWithData:(NSData *)data offset:(NSUInteger)offset
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _data = data;
+    _offset = offset;
+
+    return self;
+}
+
+- (const uint8_t *)consumeLength:(NSUInteger)length
+{
+    if (length > self.data.length - self.offset) {
+        OWSRaiseMalformedData(@"Unexpected end of data.");
+    }
+    const uint8_t *bytes = (const uint8_t *)self.data.bytes + self.offset;
+    self.offset += length;
+    return bytes;
+}
+
+- (uint8_t)readByte
+{
+    return *[self consumeLength:1];
+}
+
+- (uint64_t)readVarint
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = [self readByte];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    OWSRaiseMalformedData(@"Varint is too long.");
+    return 0;
+}
+
+- (NSUInteger)readCount
+{
+    uint64_t count = [self readVarint];
+    // Every element takes at least one byte.
+    if (count > self.data.length - self.offset) {
+        OWSRaiseMalformedData(@"Count exceeds remaining data.");
+    }
+    return (NSUInteger)count;
+}
+
+- (double)readDouble
+{
+    uint64_t bits;
+    memcpy(&bits, [self consumeLength:sizeof(bits)], sizeof(bits));
+    bits = CFSwapInt64LittleToHost(bits);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+- (NSData *)readData
+{
+    NSUInteger length = [self readCount];
+    return [NSData dataWithBytes:[self consumeLength:length] length:length];
+}
+
+- (NSString *)readString
+{
+    NSUInteger length = [self readCount];
+    NSString *_Nullable value =
+        [[NSString alloc] initWithBytes:[self consumeLength:length] length:length encoding:NSUTF8StringEncoding];
+    if (!value) {
+        OWSRaiseMalformedData(@"Invalid UTF-8.");
+    }
+    return value;
+}
+
+@end
+
+#pragma mark -
+
+// Records the fields passed to an object's encodeWithCoder:.
+@interface OWSCompactArchiver : NSCoder
+
+@property (nonatomic, readonly) NSMutableArray<NSString *> *keys;
+@property (nonatomic, readonly) NSMutableArray *values;
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactArchiver
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _keys = [NSMutableArray new];
+    _values = [NSMutableArray new];
+
+    return self;
+}
+
+- (BOOL)allowsKeyedCoding
+{
+    return YES;
+}
+
+- (BOOL)requiresSecureCoding
+{
+    return NO;
+}
+
+- (void)encodeObject:(nullable id)object forKey:(NSString *)key
+{
+    OWSAssert(key);
+
+    [self.keys addObject:key];
+    [self.values addObject:object ?: [OWSCompactArchiver nilValue]];
+}
+
+- (void)encodeConditionalObject:(nullable id)object forKey:(NSString *)key
+{
+    // Like NSKeyedArchiver, we only encode conditional objects which are
+    // encoded unconditionally elsewhere, which is never the case for a row.
+    [self encodeObject:nil forKey:key];
+}
+
+- (void)encodeBool:(BOOL)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeInt:(int)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeInt32:(int32_t)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeInt64:(int64_t)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeInteger:(NSInteger)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeFloat:(float)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
+- (void)encodeDouble:(double)value forKey:(NSString *)key
+{
+    [self encodeObject:@(value) forKey:key];
+}
+
++ (id)nilValue
+{
+    static id nilValue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        nilValue = [NSObject new];
+    });
+    return nilValue;
+}
+
+@end
+
+#pragma mark -
+
+// Presents the fields of a compact object to its initWithCoder:.
+@interface OWSCompactUnarchiver : NSCoder
+
+@property (nonatomic, readonly) NSDictionary<NSString *, id> *fields;
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactUnarchiver
+
+- (instancetype)initWithFields:(NSDictionary<NSString *, id> *)fields
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _fields = fields;
+
+    return self;
+}
+
+- (BOOL)allowsKeyedCoding
+{
+    return YES;
+}
+
+- (BOOL)requiresSecureCoding
+{
+    return NO;
+}
+
+- (BOOL)containsValueForKey:(NSString *)key
+{
+    return self.fields[key] != nil;
+}
+
+- (nullable id)decodeObjectForKey:(NSString *)key
+{
+    id _Nullable value = self.fields[key];
+    if (value == [OWSCompactArchiver nilValue]) {
+        return nil;
+    }
+    return value;
+}
+
+- (nullable id)decodeObjectOfClass:(Class)aClass forKey:(NSString *)key
+{
+    id _Nullable value = [self decodeObjectForKey:key];
+    if (value && ![value isKindOfClass:aClass]) {
+        DDLogError(@"%@ Unexpected class: %@ for key: %@", self.logTag, [value class], key);
+        return nil;
+    }
+    return value;
+}
+
+- (nullable id)decodeObjectOfClasses:(nullable NSSet<Class> *)classes forKey:(NSString *)key
+{
+    return [self decodeObjectForKey:key];
+}
+
+- (nullable NSNumber *)numberForKey:(NSString *)key
+{
+    id _Nullable value = [self decodeObjectForKey:key];
+    return ([value isKindOfClass:[NSNumber class]] ? value : nil);
+}
+
+- (BOOL)decodeBoolForKey:(NSString *)key
+{
+    return [self numberForKey:key].boolValue;
+}
+
+- (int)decodeIntForKey:(NSString *)key
+{
+    return [self numberForKey:key].intValue;
+}
+
+- (int32_t)decodeInt32ForKey:(NSString *)key
+{
+    return [self numberForKey:key].intValue;
+}
+
+- (int64_t)decodeInt64ForKey:(NSString *)key
+{
+    return [self numberForKey:key].longLongValue;
+}
+
+- (NSInteger)decodeIntegerForKey:(NSString *)key
+{
+    return [self numberForKey:key].integerValue;
+}
+
+- (float)decodeFloatForKey:(NSString *)key
+{
+    return [self numberForKey:key].floatValue;
+}
+
+- (double)decodeDoubleForKey:(NSString *)key
+{
+    return [self numberForKey:key].doubleValue;
+}
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactSerializer
+
++ (uint8_t)formatVersion
+{
+    return kCompactFormatVersion;
+}
+
++ (NSArray<Class> *)compactClasses
+{
+    static NSArray<Class> *compactClasses;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray<Class> *classes = [@[
+            [TSIncomingMessage class],
+            [TSOutgoingMessage class],
+            [TSAttachmentPointer class],
+            [TSAttachmentStream class],
+        ] mutableCopy];
+        // These job classes are private to their processors.
+        for (NSString *className in @[ @"OWSMessageDecryptJob", @"OWSMessageContentJob" ]) {
+            Class _Nullable jobClass = NSClassFromString(className);
+            OWSAssert(jobClass);
+            if (jobClass) {
+                [classes addObject:jobClass];
+            }
+        }
+        compactClasses = [classes copy];
+    });
+    return compactClasses;
+}
+
+// The collections which hold the compact classes and outlive a launch.
++ (NSArray<NSString *> *)migratedCollections
+{
+    return @[ [TSInteraction collection], [TSAttachment collection] ];
+}
+
++ (BOOL)shouldUseCompactFormatForObject:(id)object
+{
+    for (Class compactClass in self.compactClasses) {
+        if ([object isKindOfClass:compactClass]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
++ (BOOL)isCompactData:(NSData *)data
+{
+    if (data.length < sizeof(kCompactHeaderMagic) + 1) {
+        return NO;
+    }
+    return memcmp(data.bytes, kCompactHeaderMagic, sizeof(kCompactHeaderMagic)) == 0;
+}
+
+#pragma mark - Encoding
+
++ (nullable NSData *)compactDataForObject:(id)object
+{
+    OWSAssert(object);
+
+    OWSCompactWriter *writer = [OWSCompactWriter new];
+    [writer.data appendBytes:kCompactHeaderMagic length:sizeof(kCompactHeaderMagic)];
+    [writer writeByte:kCompactFormatVersion];
+
+    @try {
+        [self writeObject:object writer:writer];
+    } @catch (NSException *exception) {
+        // e.g. the class uses a part of NSCoder we don't implement.
+        DDLogError(@"%@ Could not encode %@ in compact format: %@", self.logTag, [object class], exception);
+        return nil;
+    }
+    return writer.data;
+}
+
++ (void)writeObject:(id<NSCoding>)object writer:(OWSCompactWriter *)writer
+{
+    OWSCompactArchiver *archiver = [OWSCompactArchiver new];
+    [object encodeWithCoder:archiver];
+
+    [writer writeByte:OWSCompactTagObject];
+    [writer writeString:NSStringFromClass([(NSObject *)object classForCoder])];
+    [writer writeVarint:archiver.keys.count];
+    for (NSUInteger i = 0; i < archiver.keys.count; i++) {
+        [writer writeString:archiver.keys[i]];
+        id value = archiver.values[i];
+        if (value == [OWSCompactArchiver nilValue]) {
+            [writer writeByte:OWSCompactTagNil];
+        } else {
+            [self writeValue:value writer:writer];
+        }
+    }
+}
+
++ (void)writeValue:(id)value writer:(OWSCompactWriter *)writer
+{
+    // Checked in rough order of frequency.
+    if ([value isKindOfClass:[NSString class]]) {
+        [writer writeByte:OWSCompactTagString];
+        [writer writeString:value];
+    } else if ([value isKindOfClass:[NSNumber class]]) {
+        [self writeNumber:value writer:writer];
+    } else if ([value isKindOfClass:[NSData class]]) {
+        NSData *data = value;
+        [writer writeByte:OWSCompactTagData];
+        [writer writeBytes:data.bytes length:data.length];
+    } else if ([value isKindOfClass:[NSDate class]]) {
+        [writer writeByte:OWSCompactTagDate];
+        [writer writeDouble:[(NSDate *)value timeIntervalSinceReferenceDate]];
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        NSArray *array = value;
+        BOOL isMutable = [array classForCoder] == [NSMutableArray class];
+        [writer writeByte:(isMutable ? OWSCompactTagMutableArray : OWSCompactTagArray)];
+        [writer writeVarint:array.count];
+        for (id element in array) {
+            [self writeValue:element writer:writer];
+        }
+    } else if ([value isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dictionary = value;
+        BOOL isMutable = [dictionary classForCoder] == [NSMutableDictionary class];
+        [writer writeByte:(isMutable ? OWSCompactTagMutableDictionary : OWSCompactTagDictionary)];
+        [writer writeVarint:dictionary.count];
+        [dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id element, BOOL *stop) {
+            [self writeValue:key writer:writer];
+            [self writeValue:element writer:writer];
+        }];
+    } else if ([value isKindOfClass:[NSSet class]] && ![value isKindOfClass:[NSOrderedSet class]]) {
+        NSSet *set = value;
+        BOOL isMutable = [set classForCoder] == [NSMutableSet class];
+        [writer writeByte:(isMutable ? OWSCompactTagMutableSet : OWSCompactTagSet)];
+        [writer writeVarint:set.count];
+        for (id element in set) {
+            [self writeValue:element writer:writer];
+        }
+    } else if ([value isKindOfClass:[NSNull class]]) {
+        [writer writeByte:OWSCompactTagNull];
+    } else {
+        NSData *archive = [NSKeyedArchiver archivedDataWithRootObject:value];
+        [writer writeByte:OWSCompactTagKeyedArchive];
+        [writer writeBytes:archive.bytes length:archive.length];
+    }
+}
+
++ (void)writeNumber:(NSNumber *)number writer:(OWSCompactWriter *)writer
+{
+    if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+        [writer writeByte:(number.boolValue ? OWSCompactTagTrue : OWSCompactTagFalse)];
+        return;
+    }
+
+    char type = number.objCType[0];
+    if (type == 'f' || type == 'd') {
+        [writer writeByte:OWSCompactTagDouble];
+        [writer writeDouble:number.doubleValue];
+    } else if (type == 'Q' && number.unsignedLongLongValue > INT64_MAX) {
+        [writer writeByte:OWSCompactTagUnsignedInteger];
+        [writer writeVarint:number.unsignedLongLongValue];
+    } else {
+        // Zigzag encoding keeps small negative values small.
+        int64_t value = number.longLongValue;
+        [writer writeByte:OWSCompactTagInteger];
+        [writer writeVarint:((uint64_t)value << 1) ^ (uint64_t)(value >> 63)];
+    }
+}
+
+#pragma mark - Decoding
+
++ (nullable id)objectWithCompactData:(NSData *)data
+{
+    if (![self isCompactData:data]) {
+        OWSRaiseMalformedData(@"Missing header.");
+    }
+
+    OWSCompactReader *reader = [[OWSCompactReader alloc] initWithData:data offset:sizeof(kCompactHeaderMagic)];
+    uint8_t version = [reader readByte];
+    if (version != kCompactFormatVersion) {
+        OWSRaiseMalformedData([NSString stringWithFormat:@"Unknown version: %d", (int)version]);
+    }
+    if ([reader readByte] != OWSCompactTagObject) {
+        OWSRaiseMalformedData(@"Root is not an object.");
+    }
+    id _Nullable object = [self readObjectWithReader:reader];
+    if (reader.offset != data.length) {
+        OWSRaiseMalformedData(@"Trailing data.");
+    }
+    return object;
+}
+
++ (nullable id)readObjectWithReader:(OWSCompactReader *)reader
+{
+    NSString *className = [reader readString];
+    NSUInteger fieldCount = [reader readCount];
+    NSMutableDictionary<NSString *, id> *fields = [[NSMutableDictionary alloc] initWithCapacity:fieldCount];
+    for (NSUInteger i = 0; i < fieldCount; i++) {
+        NSString *key = [reader readString];
+        uint8_t tag = [reader readByte];
+        fields[key] = (tag == OWSCompactTagNil ? [OWSCompactArchiver nilValue] : [self readValueWithTag:tag
+                                                                                                  reader:reader]);
+    }
+
+    Class _Nullable objectClass = NSClassFromString(className);
+    if (!objectClass) {
+        // Matches the handling of unknown classes in keyed archives.
+        DDLogError(@"%@ Could not decode object: %@", self.logTag, className);
+        OWSProdError([OWSAnalyticsEvents storageErrorCouldNotDecodeClass]);
+        return nil;
+    }
+
+    OWSCompactUnarchiver *unarchiver = [[OWSCompactUnarchiver alloc] initWithFields:fields];
+    id _Nullable object = [[objectClass alloc] initWithCoder:unarchiver];
+    return [object awakeAfterUsingCoder:unarchiver];
+}
+
++ (id)readValueWithReader:(OWSCompactReader *)reader
+{
+    return [self readValueWithTag:[reader readByte] reader:reader];
+}
+
++ (id)readValueWithTag:(uint8_t)tag reader:(OWSCompactReader *)reader
+{
+    switch ((OWSCompactTag)tag) {
+        case OWSCompactTagString:
+            return [reader readString];
+        case OWSCompactTagTrue:
+            return @(YES);
+        case OWSCompactTagFalse:
+            return @(NO);
+        case OWSCompactTagInteger: {
+            uint64_t zigzag = [reader readVarint];
+            return @((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1));
+        }
+        case OWSCompactTagUnsignedInteger:
+            return @([reader readVarint]);
+        case OWSCompactTagDouble:
+            return @([reader readDouble]);
+        case OWSCompactTagData:
+            return [reader readData];
+        case OWSCompactTagDate:
+            return [NSDate dateWithTimeIntervalSinceReferenceDate:[reader readDouble]];
+        case OWSCompactTagArray:
+        case OWSCompactTagMutableArray: {
+            NSUInteger count = [reader readCount];
+            NSMutableArray *array = [[NSMutableArray alloc] initWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                [array addObject:[self readValueWithReader:reader]];
+            }
+            return (tag == OWSCompactTagMutableArray ? array : [array copy]);
+        }
+        case OWSCompactTagSet:
+        case OWSCompactTagMutableSet: {
+            NSUInteger count = [reader readCount];
+            NSMutableSet *set = [[NSMutableSet alloc] initWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                [set addObject:[self readValueWithReader:reader]];
+            }
+            return (tag == OWSCompactTagMutableSet ? set : [set copy]);
+        }
+        case OWSCompactTagDictionary:
+        case OWSCompactTagMutableDictionary: {
+            NSUInteger count = [reader readCount];
+            NSMutableDictionary *dictionary = [[NSMutableDictionary alloc] initWithCapacity:count];
+            for (NSUInteger i = 0; i < count; i++) {
+                id<NSCopying> key = [self readValueWithReader:reader];
+                dictionary[key] = [self readValueWithReader:reader];
+            }
+            return (tag == OWSCompactTagMutableDictionary ? dictionary : [dictionary copy]);
+        }
+        case OWSCompactTagNull:
+            return [NSNull null];
+        case OWSCompactTagKeyedArchive: {
+            id _Nullable value = [NSKeyedUnarchiver unarchiveObjectWithData:[reader readData]];
+            return value ?: [NSNull null];
+        }
+        case OWSCompactTagNil:
+        case OWSCompactTagObject:
+            break;
+    }
+    OWSRaiseMalformedData([NSString stringWithFormat:@"Unexpected tag: %d", (int)tag]);
+    return [NSNull null];
+}
+
+#pragma mark - YapDatabase
+
++ (YapDatabaseSerializer)serializer
+{
+    return ^NSData *(NSString __unused *collection, NSString __unused *key, id object) {
+        if ([self shouldUseCompactFormatForObject:object]) {
+            NSData *_Nullable data = [self compactDataForObject:object];
+            if (data) {
+                objc_setAssociatedObject(object, &kLegacyDataAssociatedObjectKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+                return data;
+            }
+        }
+        // YapDatabase's default serializer.
+        return [NSKeyedArchiver archivedDataWithRootObject:object];
+    };
+}
+
++ (YapDatabaseDeserializer)deserializerWithLegacyDeserializer:(YapDatabaseDeserializer)legacyDeserializer
+{
+    OWSAssert(legacyDeserializer);
+
+    return ^id(NSString *collection, NSString *key, NSData *data) {
+        if (![self isCompactData:data]) {
+            id _Nullable object = legacyDeserializer(collection, key, data);
+            if (object && [self shouldUseCompactFormatForObject:object]) {
+                objc_setAssociatedObject(
+                    object, &kLegacyDataAssociatedObjectKey, @(YES), OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            }
+            return object;
+        }
+
+        @try {
+            return [self objectWithCompactData:data];
+        } @catch (NSException *exception) {
+            // Sync log in case we bail.
+            OWSProdError([OWSAnalyticsEvents storageErrorDeserialization]);
+            @throw exception;
+        }
+    };
+}
+
++ (BOOL)wasDecodedFromLegacyData:(id)object
+{
+    return [objc_getAssociatedObject(object, &kLegacyDataAssociatedObjectKey) boolValue];
+}
+
+#pragma mark - Migration
+
++ (dispatch_queue_t)serialQueue
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("org.whispersystems.signal.compactSerializerMigration", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return queue;
+}
+
++ (void)migrateLegacyRowsIncrementallyWithTimeBudget:(NSTimeInterval)timeBudget
+                                          completion:(nullable void (^)(BOOL isComplete))completion
+{
+    dispatch_async(self.serialQueue, ^{
+        YapDatabaseConnection *dbConnection = [TSStorageManager sharedManager].newDatabaseConnection;
+        NSArray<NSString *> *collections = self.migratedCollections;
+
+        __block NSDictionary *_Nullable cursor;
+        [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+            cursor = [self migrationCursorWithTransaction:transaction];
+        }];
+        NSUInteger collectionIndex = [cursor[kMigrationCursorKeyCollectionIndex] unsignedIntegerValue];
+        NSString *_Nullable lastKey = cursor[kMigrationCursorKeyKey];
+
+        NSDate *windowStartDate = [NSDate new];
+        NSUInteger scannedCount = 0;
+        NSUInteger migratedCount = 0;
+        // The sorted keys of the current collection, and the offset of the next batch within them.
+        //
+        // We only take one snapshot per collection per pass; rows inserted after the
+        // snapshot is taken are written in the compact format, so they can be skipped.
+        NSArray<NSString *> *_Nullable sortedKeys = nil;
+        NSUInteger keyOffset = 0;
+        while (collectionIndex < collections.count) {
+            NSString *collection = collections[collectionIndex];
+
+            if (!sortedKeys) {
+                __block NSArray<NSString *> *allKeys;
+                [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+                    allKeys = [transaction allKeysInCollection:collection];
+                }];
+                sortedKeys = [allKeys sortedArrayUsingSelector:@selector(compare:)];
+                keyOffset = [self offsetOfKeysAfterKey:lastKey inSortedKeys:sortedKeys];
+            }
+            NSArray<NSString *> *keys = [sortedKeys
+                subarrayWithRange:NSMakeRange(keyOffset, MIN(kMigrationBatchSize, sortedKeys.count - keyOffset))];
+            keyOffset += keys.count;
+
+            if (keys.count > 0) {
+                lastKey = keys.lastObject;
+            }
+            if (keyOffset >= sortedKeys.count) {
+                collectionIndex++;
+                lastKey = nil;
+                sortedKeys = nil;
+            }
+
+            NSMutableDictionary *nextCursor = [NSMutableDictionary new];
+            nextCursor[kMigrationCursorKeyCollectionIndex] = @(collectionIndex);
+            nextCursor[kMigrationCursorKeyKey] = lastKey;
+
+            // The cursor is written in the same transaction as its batch, so that
+            // neither can be committed without the other.
+            __block NSUInteger batchMigratedCount = 0;
+            [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+                for (NSString *key in keys) {
+                    if ([self migrateRowForKey:key inCollection:collection transaction:transaction]) {
+                        batchMigratedCount++;
+                    }
+                }
+                [transaction setObject:nextCursor
+                                forKey:OWSCompactSerializerMigrationCursorKey
+                          inCollection:OWSCompactSerializerCollection];
+            }];
+            scannedCount += keys.count;
+            migratedCount += batchMigratedCount;
+
+            if (fabs([windowStartDate timeIntervalSinceNow]) >= timeBudget) {
+                break;
+            }
+        }
+
+        BOOL isComplete = collectionIndex >= collections.count;
+        DDLogInfo(@"%@ Re-encoded %lu of %lu scanned rows in %.3fs, complete: %d",
+            self.logTag,
+            (unsigned long)migratedCount,
+            (unsigned long)scannedCount,
+            fabs([windowStartDate timeIntervalSinceNow]),
+            isComplete);
+
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion(isComplete);
+            });
+        }
+    });
+}
+
++ (nullable NSDictionary *)migrationCursorWithTransaction:(YapDatabaseReadTransaction *)transaction
+{
+    return [transaction objectForKey:OWSCompactSerializerMigrationCursorKey
+                        inCollection:OWSCompactSerializerCollection];
+}
+
+// Returns YES IFF the row was a keyed archive and has been re-encoded.
++ (BOOL)migrateRowForKey:(NSString *)key
+            inCollection:(NSString *)collection
+             transaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    id _Nullable object = [transaction objectForKey:key inCollection:collection];
+    if (!object || ![self wasDecodedFromLegacyData:object]) {
+        return NO;
+    }
+    NSData *_Nullable data = [self compactDataForObject:object];
+    if (!data) {
+        return NO;
+    }
+
+    // The re-encoded row decodes to an equal object, so we rewrite it beneath
+    // YapDatabase rather than with replaceObject:, which would have the views
+    // (and so the UI) treat every migrated row as modified.
+    sqlite3 *_Nullable db = [self sqliteHandleForTransaction:transaction];
+    if (!db) {
+        // Leaves metadata alone; the serializer clears the flag.
+        [transaction replaceObject:object forKey:key inCollection:collection];
+        return YES;
+    }
+
+    static const char *const kUpdateRowSql
+        = "UPDATE \"database2\" SET \"data\" = ? WHERE \"collection\" = ? AND \"key\" = ?;";
+    sqlite3_stmt *statement = NULL;
+    int status = sqlite3_prepare_v2(db, kUpdateRowSql, -1, &statement, NULL);
+    if (status != SQLITE_OK) {
+        OWSFail(@"%@ Could not prepare row update: %d, %s", self.logTag, status, sqlite3_errmsg(db));
+        return NO;
+    }
+    sqlite3_bind_blob(statement, 1, data.bytes, (int)data.length, SQLITE_STATIC);
+    sqlite3_bind_text(statement, 2, collection.UTF8String, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(statement, 3, key.UTF8String, -1, SQLITE_TRANSIENT);
+    status = sqlite3_step(statement);
+    sqlite3_finalize(statement);
+    if (status != SQLITE_DONE) {
+        OWSFail(@"%@ Could not update row: %d, %s", self.logTag, status, sqlite3_errmsg(db));
+        return NO;
+    }
+    objc_setAssociatedObject(object, &kLegacyDataAssociatedObjectKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    return YES;
+}
+
+// YapDatabase doesn't expose its connections' database handles, so we look the
+// handle up by name.  Returns NULL if that's no longer possible.
++ (nullable sqlite3 *)sqliteHandleForTransaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    YapDatabaseConnection *_Nullable connection = transaction.connection;
+    Ivar _Nullable dbIvar = class_getInstanceVariable([YapDatabaseConnection class], "db");
+    if (!connection || !dbIvar || ivar_getTypeEncoding(dbIvar)[0] != '^') {
+        OWSFail(@"%@ Could not find database handle.", self.logTag);
+        return NULL;
+    }
+    return *(sqlite3 **)((uint8_t *)(__bridge void *)connection + ivar_getOffset(dbIvar));
+}
+
+// Returns the index of the first key in sortedKeys which follows lastKey.
++ (NSUInteger)offsetOfKeysAfterKey:(nullable NSString *)lastKey inSortedKeys:(NSArray<NSString *> *)sortedKeys
+{
+    if (!lastKey) {
+        return 0;
+    }
+    return [sortedKeys indexOfObject:lastKey
+                       inSortedRange:NSMakeRange(0, sortedKeys.count)
+                             options:NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual
+                     usingComparator:^NSComparisonResult(NSString *left, NSString *right) {
+                         return [left compare:right];
+                     }];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
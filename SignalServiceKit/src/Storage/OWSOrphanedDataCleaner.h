@@ -1,9 +1,33 @@
 //
-//  Copyright (c) 2017 Open Whisper Systems. All rights reserved.
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
 //
 
 NS_ASSUME_NONNULL_BEGIN
 
+// Describes the progress of a cleanup pass.  Counts and durations
+// accumulate across all of the windows that make up the pass.
+@interface OWSOrphanedDataCleanerReport : NSObject
+
+// YES once the pass has visited all interactions, attachments and files.
+@property (nonatomic, readonly) BOOL isComplete;
+
+// Time spent scanning, not including the time between windows.
+@property (nonatomic, readonly) NSTimeInterval scanDuration;
+
+@property (nonatomic, readonly) NSUInteger scannedFileCount;
+@property (nonatomic, readonly) long long scannedBytes;
+@property (nonatomic, readonly) long long reclaimedBytes;
+
+@property (nonatomic, readonly) NSUInteger removedInteractionCount;
+@property (nonatomic, readonly) NSUInteger removedAttachmentCount;
+@property (nonatomic, readonly) NSUInteger removedFileCount;
+
+@end
+
+#pragma mark -
+
+typedef void (^OWSOrphanedDataCleanerCompletion)(OWSOrphanedDataCleanerReport *report);
+
 // Notes:
 //
 // * On disk, we only bother cleaning up files, not directories.
@@ -12,15 +36,30 @@ NS_ASSUME_NONNULL_BEGIN
 //   it's attachments might not be cleaned up until the next pass.
 //   If an attachment is cleaned up, it's file on disk might not
 //   be cleaned up until the next pass.
+// * Each phase of a pass snapshots the keys or files it visits once,
+//   then scans them in bounded chunks, persisting its progress after
+//   each chunk, so it can be spread across many short windows,
+//   even across launches.  Anything created after the pass began
+//   is never cleaned up by that pass.
 @interface OWSOrphanedDataCleaner : NSObject
 
 - (instancetype)init NS_UNAVAILABLE;
 
+// Runs a complete pass from scratch, logging but not cleaning up.
 + (void)auditAsync;
 
+// Runs a complete pass from scratch.
+//
 // completion, if present, will be invoked on the main thread.
 + (void)auditAndCleanupAsync:(void (^_Nullable)(void))completion;
 
+// Resumes the current pass (or starts a new one) and works on it for
+// roughly timeBudget seconds.  Cleanup happens as the pass proceeds.
+//
+// completion, if present, will be invoked on the main thread.
++ (void)cleanupIncrementallyWithTimeBudget:(NSTimeInterval)timeBudget
+                                completion:(nullable OWSOrphanedDataCleanerCompletion)completion;
+
 + (NSSet<NSString *> *)filePathsInAttachmentsFolder;
 
 + (long long)fileSizeOfFilePaths:(NSArray<NSString *> *)filePaths;
@@ -4,11 +4,13 @@
 
 #import "OWSOrphanedDataCleaner.h"
 #import "NSDate+OWS.h"
+#import "OWSThumbnailService.h"
 #import "TSAttachmentStream.h"
 #import "TSInteraction.h"
 #import "TSMessage.h"
 #import "TSStorageManager.h"
 #import "TSThread.h"
+#import "YapDatabaseConnection+OWS.h"
 #import <YapDatabase/YapDatabase.h>
 
 NS_ASSUME_NONNULL_BEGIN
@@ -21,192 +23,703 @@ NS_ASSUME_NONNULL_BEGIN
 #define CleanupLogInfo DDLogInfo
 #endif
 
+// We need to avoid cleaning up new attachments and files that are still in the process of
+// being created/written, so we don't clean up anything recent.
+#ifdef SSK_BUILDING_FOR_TESTS
+static const NSTimeInterval kMinimumOrphanAge = 0.f;
+#else
+static const NSTimeInterval kMinimumOrphanAge = 15 * kMinuteInterval;
+#endif
+
+// The maximum number of interactions, attachments or files visited per chunk.
+static const NSUInteger kOrphanScanChunkSize = 500;
+
+static NSString *const OWSOrphanedDataCleanerCollection = @"OWSOrphanedDataCleanerCollection";
+static NSString *const OWSOrphanedDataCleanerStateKey = @"state";
+
+// These collections are filled in as a pass proceeds and purged when it completes.
+static NSString *const OWSOrphanedDataCleanerReferencedAttachmentIdsCollection
+    = @"OWSOrphanedDataCleanerReferencedAttachmentIdsCollection";
+static NSString *const OWSOrphanedDataCleanerReferencedFilesCollection
+    = @"OWSOrphanedDataCleanerReferencedFilesCollection";
+// A sorted snapshot of the keys or files visited by the current phase, in chunks.
+static NSString *const OWSOrphanedDataCleanerSnapshotCollection = @"OWSOrphanedDataCleanerSnapshotCollection";
+
+static NSString *const kOrphanScanStateKeyPhase = @"phase";
+static NSString *const kOrphanScanStateKeyChunkIndex = @"chunkIndex";
+static NSString *const kOrphanScanStateKeyChunkCount = @"chunkCount";
+static NSString *const kOrphanScanStateKeyStartDate = @"startDate";
+static NSString *const kOrphanScanStateKeyScanDuration = @"scanDuration";
+static NSString *const kOrphanScanStateKeyScannedFileCount = @"scannedFileCount";
+static NSString *const kOrphanScanStateKeyScannedBytes = @"scannedBytes";
+static NSString *const kOrphanScanStateKeyReclaimedBytes = @"reclaimedBytes";
+static NSString *const kOrphanScanStateKeyRemovedInteractionCount = @"removedInteractionCount";
+static NSString *const kOrphanScanStateKeyRemovedAttachmentCount = @"removedAttachmentCount";
+static NSString *const kOrphanScanStateKeyRemovedFileCount = @"removedFileCount";
+
+typedef NS_ENUM(NSUInteger, OWSOrphanScanPhase) {
+    OWSOrphanScanPhaseInteractions = 0,
+    OWSOrphanScanPhaseAttachments,
+    OWSOrphanScanPhaseAttachmentFiles,
+    OWSOrphanScanPhaseThumbnailFiles,
+    OWSOrphanScanPhaseComplete,
+};
+
+#pragma mark -
+
+@interface OWSOrphanedDataCleanerReport ()
+
+@property (nonatomic) BOOL isComplete;
+@property (nonatomic) NSTimeInterval scanDuration;
+@property (nonatomic) NSUInteger scannedFileCount;
+@property (nonatomic) long long scannedBytes;
+@property (nonatomic) long long reclaimedBytes;
+@property (nonatomic) NSUInteger removedInteractionCount;
+@property (nonatomic) NSUInteger removedAttachmentCount;
+@property (nonatomic) NSUInteger removedFileCount;
+
+@end
+
+#pragma mark -
+
+@implementation OWSOrphanedDataCleanerReport
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"complete: %d, duration: %f, scanned: %zd files (%lld bytes), reclaimed: %lld "
+                                      @"bytes, removed: %zd interactions, %zd attachments, %zd files",
+                     self.isComplete,
+                     self.scanDuration,
+                     self.scannedFileCount,
+                     self.scannedBytes,
+                     self.reclaimedBytes,
+                     self.removedInteractionCount,
+                     self.removedAttachmentCount,
+                     self.removedFileCount];
+}
+
+@end
+
+#pragma mark -
+
+// The persisted progress of a pass.
+@interface OWSOrphanScanState : NSObject
+
+@property (nonatomic) OWSOrphanScanPhase phase;
+// The phase's snapshot has been taken iff chunkCount is non-nil.
+@property (nonatomic) NSUInteger chunkIndex;
+@property (nonatomic, nullable) NSNumber *chunkCount;
+@property (nonatomic) NSDate *startDate;
+@property (nonatomic) OWSOrphanedDataCleanerReport *report;
+
+@end
+
+#pragma mark -
+
+@implementation OWSOrphanScanState
+
+- (instancetype)init
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _phase = OWSOrphanScanPhaseInteractions;
+    _startDate = [NSDate new];
+    _report = [OWSOrphanedDataCleanerReport new];
+
+    return self;
+}
+
+- (nullable instancetype)initWithDictionary:(NSDictionary *)dictionary
+{
+    self = [self init];
+    if (!self) {
+        return self;
+    }
+
+    NSNumber *_Nullable phase = dictionary[kOrphanScanStateKeyPhase];
+    NSDate *_Nullable startDate = dictionary[kOrphanScanStateKeyStartDate];
+    if (![phase isKindOfClass:[NSNumber class]] || phase.unsignedIntegerValue > OWSOrphanScanPhaseComplete
+        || ![startDate isKindOfClass:[NSDate class]]) {
+        return nil;
+    }
+    _phase = (OWSOrphanScanPhase)phase.unsignedIntegerValue;
+    _startDate = startDate;
+
+    NSNumber *_Nullable chunkCount = dictionary[kOrphanScanStateKeyChunkCount];
+    if ([chunkCount isKindOfClass:[NSNumber class]]) {
+        _chunkCount = chunkCount;
+        _chunkIndex = [dictionary[kOrphanScanStateKeyChunkIndex] unsignedIntegerValue];
+    }
+
+    _report.isComplete = _phase == OWSOrphanScanPhaseComplete;
+    _report.scanDuration = [dictionary[kOrphanScanStateKeyScanDuration] doubleValue];
+    _report.scannedFileCount = [dictionary[kOrphanScanStateKeyScannedFileCount] unsignedIntegerValue];
+    _report.scannedBytes = [dictionary[kOrphanScanStateKeyScannedBytes] longLongValue];
+    _report.reclaimedBytes = [dictionary[kOrphanScanStateKeyReclaimedBytes] longLongValue];
+    _report.removedInteractionCount = [dictionary[kOrphanScanStateKeyRemovedInteractionCount] unsignedIntegerValue];
+    _report.removedAttachmentCount = [dictionary[kOrphanScanStateKeyRemovedAttachmentCount] unsignedIntegerValue];
+    _report.removedFileCount = [dictionary[kOrphanScanStateKeyRemovedFileCount] unsignedIntegerValue];
+
+    return self;
+}
+
+- (NSDictionary *)dictionaryValue
+{
+    NSMutableDictionary *result = [@{
+        kOrphanScanStateKeyPhase : @(self.phase),
+        kOrphanScanStateKeyStartDate : self.startDate,
+        kOrphanScanStateKeyScanDuration : @(self.report.scanDuration),
+        kOrphanScanStateKeyScannedFileCount : @(self.report.scannedFileCount),
+        kOrphanScanStateKeyScannedBytes : @(self.report.scannedBytes),
+        kOrphanScanStateKeyReclaimedBytes : @(self.report.reclaimedBytes),
+        kOrphanScanStateKeyRemovedInteractionCount : @(self.report.removedInteractionCount),
+        kOrphanScanStateKeyRemovedAttachmentCount : @(self.report.removedAttachmentCount),
+        kOrphanScanStateKeyRemovedFileCount : @(self.report.removedFileCount),
+    } mutableCopy];
+    if (self.chunkCount) {
+        result[kOrphanScanStateKeyChunkCount] = self.chunkCount;
+        result[kOrphanScanStateKeyChunkIndex] = @(self.chunkIndex);
+    }
+    return result;
+}
+
+// Returns YES if the phase is done.
+- (BOOL)advanceChunk
+{
+    OWSAssert(self.chunkCount);
+
+    self.chunkIndex++;
+    return self.chunkIndex >= self.chunkCount.unsignedIntegerValue;
+}
+
+- (void)advanceToPhase:(OWSOrphanScanPhase)phase
+{
+    self.phase = phase;
+    self.chunkIndex = 0;
+    self.chunkCount = nil;
+    self.report.isComplete = phase == OWSOrphanScanPhaseComplete;
+}
+
+// Anything created or modified after the pass began (less a safety margin)
+// might be referenced by data the pass has already visited.
+- (BOOL)isOldEnoughToCleanUp:(nullable NSDate *)date
+{
+    if (!date) {
+        return NO;
+    }
+    return [date timeIntervalSinceDate:self.startDate] <= -kMinimumOrphanAge;
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSOrphanScanFile : NSObject
+
+@property (nonatomic, readonly) NSString *filePath;
+@property (nonatomic) BOOL isValid;
+@property (nonatomic) BOOL isDirectory;
+@property (nonatomic) long long fileSize;
+@property (nonatomic, nullable) NSDate *modificationDate;
+
+@end
+
+#pragma mark -
+
+@implementation OWSOrphanScanFile
+
+- (instancetype)initWithFilePath:(NSString *)filePath
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    _filePath = filePath;
+
+    return self;
+}
+
+@end
+
+#pragma mark -
+
 @implementation OWSOrphanedDataCleaner
 
++ (dispatch_queue_t)serialQueue
+{
+    static dispatch_queue_t queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("org.whispersystems.orphanedDataCleaner", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+    });
+    return queue;
+}
+
 + (void)auditAsync
 {
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        [OWSOrphanedDataCleaner auditAndCleanup:NO completion:nil];
+    dispatch_async(self.serialQueue, ^{
+        [OWSOrphanedDataCleaner runPassFromScratchWithCleanup:NO];
     });
 }
 
 + (void)auditAndCleanupAsync:(void (^_Nullable)(void))completion
 {
-    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        [OWSOrphanedDataCleaner auditAndCleanup:YES completion:completion];
+    dispatch_async(self.serialQueue, ^{
+        [OWSOrphanedDataCleaner runPassFromScratchWithCleanup:YES];
+
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion();
+            });
+        }
+    });
+}
+
++ (void)cleanupIncrementallyWithTimeBudget:(NSTimeInterval)timeBudget
+                                completion:(nullable OWSOrphanedDataCleanerCompletion)completion
+{
+    dispatch_async(self.serialQueue, ^{
+        YapDatabaseConnection *dbConnection = [TSStorageManager sharedManager].newDatabaseConnection;
+        OWSOrphanScanState *state = [self loadStateWithDBConnection:dbConnection];
+
+        // Each window makes progress on at least one chunk.
+        NSDate *windowStartDate = [NSDate new];
+        while (state.phase != OWSOrphanScanPhaseComplete) {
+            [self scanChunkWithState:state dbConnection:dbConnection shouldCleanup:YES];
+
+            [dbConnection setObject:state.dictionaryValue
+                             forKey:OWSOrphanedDataCleanerStateKey
+                       inCollection:OWSOrphanedDataCleanerCollection];
+
+            if (fabs([windowStartDate timeIntervalSinceNow]) >= timeBudget) {
+                break;
+            }
+        }
+
+        if (state.phase == OWSOrphanScanPhaseComplete) {
+            [self finishPassWithState:state dbConnection:dbConnection];
+        } else {
+            DDLogInfo(@"%@ Paused orphan cleanup in phase: %zd, %@", self.logTag, state.phase, state.report);
+        }
+
+        OWSOrphanedDataCleanerReport *report = state.report;
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion(report);
+            });
+        }
     });
 }
 
+#pragma mark - Passes
+
++ (OWSOrphanScanState *)loadStateWithDBConnection:(YapDatabaseConnection *)dbConnection
+{
+    NSDictionary *_Nullable dictionary =
+        [dbConnection dictionaryForKey:OWSOrphanedDataCleanerStateKey inCollection:OWSOrphanedDataCleanerCollection];
+    OWSOrphanScanState *_Nullable state = (dictionary ? [[OWSOrphanScanState alloc] initWithDictionary:dictionary] : nil);
+    if (state) {
+        DDLogInfo(@"%@ Resuming orphan cleanup in phase: %zd", self.logTag, state.phase);
+        return state;
+    }
+
+    [self resetWithDBConnection:dbConnection];
+    return [OWSOrphanScanState new];
+}
+
++ (void)resetWithDBConnection:(YapDatabaseConnection *)dbConnection
+{
+    [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        [transaction removeAllObjectsInCollection:OWSOrphanedDataCleanerCollection];
+        [transaction removeAllObjectsInCollection:OWSOrphanedDataCleanerReferencedAttachmentIdsCollection];
+        [transaction removeAllObjectsInCollection:OWSOrphanedDataCleanerReferencedFilesCollection];
+        [transaction removeAllObjectsInCollection:OWSOrphanedDataCleanerSnapshotCollection];
+    }];
+}
+
++ (void)finishPassWithState:(OWSOrphanScanState *)state dbConnection:(YapDatabaseConnection *)dbConnection
+{
+    OWSAssert(state.phase == OWSOrphanScanPhaseComplete);
+
+    [self resetWithDBConnection:dbConnection];
+
+    DDLogInfo(@"%@ Completed orphan cleanup: %@", self.logTag, state.report);
+}
+
 // This method finds and optionally cleans up:
 //
 // * Orphan messages (with no thread).
 // * Orphan attachments (with no message).
 // * Orphan attachment files (with no attachment).
-// * Missing attachment files (cannot be cleaned up).
-//   These are attachments which have no file on disk.  They should be extremely rare -
-//   the only cases I have seen are probably due to debugging.
-//   They can't be cleaned up - we don't want to delete the TSAttachmentStream or
-//   its corresponding message.  Better that the broken message shows up in the
-//   conversation view.
-+ (void)auditAndCleanup:(BOOL)shouldCleanup completion:(void (^_Nullable)(void))completion
+// * Orphan thumbnail files (with no attachment).
+//
+// Any partially completed pass is discarded.
++ (void)runPassFromScratchWithCleanup:(BOOL)shouldCleanup
 {
-    NSSet<NSString *> *diskFilePaths = [self filePathsInAttachmentsFolder];
-    long long totalFileSize = [self fileSizeOfFilePaths:diskFilePaths.allObjects];
-    NSUInteger fileCount = diskFilePaths.count;
-
-    TSStorageManager *storageManager = [TSStorageManager sharedManager];
-    YapDatabaseConnection *databaseConnection = storageManager.newDatabaseConnection;
-
-    __block int attachmentStreamCount = 0;
-    NSMutableSet<NSString *> *attachmentFilePaths = [NSMutableSet new];
-    NSMutableSet<NSString *> *attachmentIds = [NSMutableSet new];
-    [databaseConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
-        [transaction enumerateKeysAndObjectsInCollection:TSAttachmentStream.collection
-                                              usingBlock:^(NSString *key, TSAttachment *attachment, BOOL *stop) {
-                                                  [attachmentIds addObject:attachment.uniqueId];
-                                                  if (![attachment isKindOfClass:[TSAttachmentStream class]]) {
-                                                      return;
-                                                  }
-                                                  TSAttachmentStream *attachmentStream
-                                                      = (TSAttachmentStream *)attachment;
-                                                  attachmentStreamCount++;
-                                                  NSString *_Nullable filePath = [attachmentStream filePath];
-                                                  OWSAssert(filePath);
-                                                  [attachmentFilePaths addObject:filePath];
-                                              }];
-    }];
+    YapDatabaseConnection *dbConnection = [TSStorageManager sharedManager].newDatabaseConnection;
 
-    CleanupLogDebug(@"fileCount: %zd", fileCount);
-    CleanupLogDebug(@"totalFileSize: %lld", totalFileSize);
-    CleanupLogDebug(@"attachmentStreams: %d", attachmentStreamCount);
-    CleanupLogDebug(@"attachmentStreams with file paths: %zd", attachmentFilePaths.count);
+    [self resetWithDBConnection:dbConnection];
 
-    NSMutableSet<NSString *> *orphanDiskFilePaths = [diskFilePaths mutableCopy];
-    [orphanDiskFilePaths minusSet:attachmentFilePaths];
-    NSMutableSet<NSString *> *missingAttachmentFilePaths = [attachmentFilePaths mutableCopy];
-    [missingAttachmentFilePaths minusSet:diskFilePaths];
+    OWSOrphanScanState *state = [OWSOrphanScanState new];
+    while (state.phase != OWSOrphanScanPhaseComplete) {
+        [self scanChunkWithState:state dbConnection:dbConnection shouldCleanup:shouldCleanup];
+    }
 
-    CleanupLogDebug(@"orphan disk file paths: %zd", orphanDiskFilePaths.count);
-    CleanupLogDebug(@"missing attachment file paths: %zd", missingAttachmentFilePaths.count);
+    [self finishPassWithState:state dbConnection:dbConnection];
+}
 
-    [self printPaths:orphanDiskFilePaths.allObjects label:@"orphan disk file paths"];
-    [self printPaths:missingAttachmentFilePaths.allObjects label:@"missing attachment file paths"];
++ (void)scanChunkWithState:(OWSOrphanScanState *)state
+              dbConnection:(YapDatabaseConnection *)dbConnection
+             shouldCleanup:(BOOL)shouldCleanup
+{
+    NSDate *startDate = [NSDate new];
+
+    switch (state.phase) {
+        case OWSOrphanScanPhaseInteractions:
+            [self scanInteractionsChunkWithState:state dbConnection:dbConnection shouldCleanup:shouldCleanup];
+            break;
+        case OWSOrphanScanPhaseAttachments:
+            [self scanAttachmentsChunkWithState:state dbConnection:dbConnection shouldCleanup:shouldCleanup];
+            break;
+        case OWSOrphanScanPhaseAttachmentFiles: {
+            NSString *attachmentsFolder = [TSAttachmentStream attachmentsFolder];
+            [self scanFilesChunkInFolder:attachmentsFolder
+                                   state:state
+                            dbConnection:dbConnection
+                           shouldCleanup:shouldCleanup
+                       isReferencedBlock:^(NSString *relativePath, YapDatabaseReadTransaction *transaction) {
+                           return [transaction hasObjectForKey:relativePath
+                                                  inCollection:OWSOrphanedDataCleanerReferencedFilesCollection];
+                       }
+                               nextPhase:OWSOrphanScanPhaseThumbnailFiles];
+            break;
+        }
+        case OWSOrphanScanPhaseThumbnailFiles: {
+            NSString *thumbnailsFolder = [OWSThumbnailService thumbnailsFolder];
+            [self scanFilesChunkInFolder:thumbnailsFolder
+                                   state:state
+                            dbConnection:dbConnection
+                           shouldCleanup:shouldCleanup
+                       isReferencedBlock:^(NSString *relativePath, YapDatabaseReadTransaction *transaction) {
+                           NSString *_Nullable attachmentId =
+                               [OWSThumbnailService attachmentIdForThumbnailFileName:relativePath.lastPathComponent];
+                           return (BOOL)(attachmentId &&
+                               [transaction hasObjectForKey:attachmentId inCollection:TSAttachment.collection]);
+                       }
+                               nextPhase:OWSOrphanScanPhaseComplete];
+            break;
+        }
+        case OWSOrphanScanPhaseComplete:
+            OWSFail(@"%@ Pass is already complete.", self.logTag);
+            break;
+    }
 
-    __block NSMutableSet *threadIds;
-    [databaseConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
-        threadIds = [[NSMutableSet alloc] initWithArray:[transaction allKeysInCollection:TSThread.collection]];
-    }];
+    state.report.scanDuration += fabs([startDate timeIntervalSinceNow]);
+}
 
-    NSMutableSet<NSString *> *orphanInteractionIds = [NSMutableSet new];
-    NSMutableSet<NSString *> *messageAttachmentIds = [NSMutableSet new];
-    [databaseConnection readWithBlock:^(YapDatabaseReadTransaction *_Nonnull transaction) {
-        [transaction enumerateKeysAndObjectsInCollection:TSMessage.collection
-                                              usingBlock:^(NSString *key, TSInteraction *interaction, BOOL *stop) {
-                                                  if (![threadIds containsObject:interaction.uniqueThreadId]) {
-                                                      [orphanInteractionIds addObject:interaction.uniqueId];
-                                                  }
-
-                                                  if (![interaction isKindOfClass:[TSMessage class]]) {
-                                                      return;
-                                                  }
-                                                  TSMessage *message = (TSMessage *)interaction;
-                                                  if (message.attachmentIds.count > 0) {
-                                                      [messageAttachmentIds addObjectsFromArray:message.attachmentIds];
-                                                  }
-                                              }];
-    }];
+#pragma mark - Phases
 
-    CleanupLogDebug(@"attachmentIds: %zd", attachmentIds.count);
-    CleanupLogDebug(@"messageAttachmentIds: %zd", messageAttachmentIds.count);
+// Returns the current chunk of the phase's items.
+//
+// The items are listed (by snapshotBlock) and sorted once, when the phase
+// begins, and the snapshot is persisted so that each chunk (in this or
+// a later window) only has to load its own items.
++ (NSArray<NSString *> *)currentChunkWithState:(OWSOrphanScanState *)state
+                                  dbConnection:(YapDatabaseConnection *)dbConnection
+                                 snapshotBlock:(NSArray<NSString *> * (^)(void))snapshotBlock
+{
+    if (!state.chunkCount) {
+        NSArray<NSString *> *items = [snapshotBlock() sortedArrayUsingSelector:@selector(compare:)];
+        __block NSUInteger chunkCount = 0;
+        [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            [transaction removeAllObjectsInCollection:OWSOrphanedDataCleanerSnapshotCollection];
+            for (NSUInteger offset = 0; offset < items.count; offset += kOrphanScanChunkSize) {
+                NSRange range = NSMakeRange(offset, MIN(kOrphanScanChunkSize, items.count - offset));
+                [transaction setObject:[items subarrayWithRange:range]
+                                forKey:[self snapshotKeyForChunkIndex:chunkCount]
+                          inCollection:OWSOrphanedDataCleanerSnapshotCollection];
+                chunkCount++;
+            }
+        }];
+        state.chunkCount = @(chunkCount);
+        state.chunkIndex = 0;
+    }
 
-    NSMutableSet<NSString *> *orphanAttachmentIds = [attachmentIds mutableCopy];
-    [orphanAttachmentIds minusSet:messageAttachmentIds];
-    NSMutableSet<NSString *> *missingAttachmentIds = [messageAttachmentIds mutableCopy];
-    [missingAttachmentIds minusSet:attachmentIds];
+    if (state.chunkIndex >= state.chunkCount.unsignedIntegerValue) {
+        return @[];
+    }
+    NSArray<NSString *> *_Nullable chunk =
+        [dbConnection objectForKey:[self snapshotKeyForChunkIndex:state.chunkIndex]
+                      inCollection:OWSOrphanedDataCleanerSnapshotCollection];
+    OWSAssert([chunk isKindOfClass:[NSArray class]]);
+    return ([chunk isKindOfClass:[NSArray class]] ? chunk : @[]);
+}
 
-    CleanupLogDebug(@"orphan attachmentIds: %zd", orphanAttachmentIds.count);
-    CleanupLogDebug(@"missing attachmentIds: %zd", missingAttachmentIds.count);
-    CleanupLogDebug(@"orphan interactions: %zd", orphanInteractionIds.count);
++ (NSString *)snapshotKeyForChunkIndex:(NSUInteger)chunkIndex
+{
+    return [NSString stringWithFormat:@"%lu", (unsigned long)chunkIndex];
+}
 
-    // We need to avoid cleaning up new attachments and files that are still in the process of
-    // being created/written, so we don't clean up anything recent.
-#ifdef SSK_BUILDING_FOR_TESTS
-    const NSTimeInterval kMinimumOrphanAge = 0.f;
-#else
-    const NSTimeInterval kMinimumOrphanAge = 15 * kMinuteInterval;
-#endif
++ (NSArray<NSString *> *)currentChunkOfKeysInCollection:(NSString *)collection
+                                                  state:(OWSOrphanScanState *)state
+                                           dbConnection:(YapDatabaseConnection *)dbConnection
+{
+    return [self currentChunkWithState:state
+                          dbConnection:dbConnection
+                         snapshotBlock:^{
+                             __block NSArray<NSString *> *keys;
+                             [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+                                 keys = [transaction allKeysInCollection:collection];
+                             }];
+                             return keys;
+                         }];
+}
 
-    if (!shouldCleanup) {
-        return;
-    }
++ (void)scanInteractionsChunkWithState:(OWSOrphanScanState *)state
+                          dbConnection:(YapDatabaseConnection *)dbConnection
+                         shouldCleanup:(BOOL)shouldCleanup
+{
+    NSArray<NSString *> *interactionIds =
+        [self currentChunkOfKeysInCollection:TSInteraction.collection state:state dbConnection:dbConnection];
+    NSMutableArray<NSString *> *orphanInteractionIds = [NSMutableArray new];
+    NSMutableSet<NSString *> *messageAttachmentIds = [NSMutableSet new];
+    [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [transaction
+            enumerateObjectsForKeys:interactionIds
+                       inCollection:TSInteraction.collection
+                unorderedUsingBlock:^(NSUInteger keyIndex, id _Nullable object, BOOL *stop) {
+                    if (![object isKindOfClass:[TSInteraction class]]) {
+                        // Removed since we listed the keys.
+                        return;
+                    }
+                    TSInteraction *interaction = (TSInteraction *)object;
+                    if (![transaction hasObjectForKey:interaction.uniqueThreadId inCollection:TSThread.collection]) {
+                        [orphanInteractionIds addObject:interaction.uniqueId];
+                        return;
+                    }
+
+                    if (![interaction isKindOfClass:[TSMessage class]]) {
+                        return;
+                    }
+                    TSMessage *message = (TSMessage *)interaction;
+                    if (message.attachmentIds.count > 0) {
+                        [messageAttachmentIds addObjectsFromArray:message.attachmentIds];
+                    }
+                }];
+    }];
+
+    CleanupLogDebug(@"orphan interactions: %zd / %zd", orphanInteractionIds.count, interactionIds.count);
 
-    [databaseConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *_Nonnull transaction) {
+    [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        for (NSString *attachmentId in messageAttachmentIds) {
+            [transaction setObject:@(YES)
+                            forKey:attachmentId
+                      inCollection:OWSOrphanedDataCleanerReferencedAttachmentIdsCollection];
+        }
+
+        if (!shouldCleanup) {
+            return;
+        }
         for (NSString *interactionId in orphanInteractionIds) {
             TSInteraction *interaction = [TSInteraction fetchObjectWithUniqueID:interactionId transaction:transaction];
             if (!interaction) {
-                // This could just be a race condition, but it should be very unlikely.
-                OWSFail(@"Could not load interaction: %@", interactionId);
+                DDLogWarn(@"%@ Could not load interaction: %@", self.logTag, interactionId);
+                continue;
+            }
+            if ([transaction hasObjectForKey:interaction.uniqueThreadId inCollection:TSThread.collection]) {
                 continue;
             }
             CleanupLogInfo(@"Removing orphan message: %@", interaction.uniqueId);
             [interaction removeWithTransaction:transaction];
+            state.report.removedInteractionCount++;
+        }
+    }];
+
+    if ([state advanceChunk]) {
+        [state advanceToPhase:OWSOrphanScanPhaseAttachments];
+    }
+}
+
++ (void)scanAttachmentsChunkWithState:(OWSOrphanScanState *)state
+                         dbConnection:(YapDatabaseConnection *)dbConnection
+                        shouldCleanup:(BOOL)shouldCleanup
+{
+    // Relative paths must match those listed by the file scan, which don't begin with a separator.
+    NSString *attachmentsFolderPrefix = [[TSAttachmentStream attachmentsFolder] stringByAppendingString:@"/"];
+
+    NSArray<NSString *> *attachmentIds =
+        [self currentChunkOfKeysInCollection:TSAttachment.collection state:state dbConnection:dbConnection];
+    NSMutableArray<NSString *> *orphanAttachmentIds = [NSMutableArray new];
+    NSMutableArray<NSString *> *attachmentFiles = [NSMutableArray new];
+    [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [transaction
+            enumerateObjectsForKeys:attachmentIds
+                       inCollection:TSAttachment.collection
+                unorderedUsingBlock:^(NSUInteger keyIndex, id _Nullable object, BOOL *stop) {
+                    if (![object isKindOfClass:[TSAttachmentStream class]]) {
+                        return;
+                    }
+                    TSAttachmentStream *attachmentStream = (TSAttachmentStream *)object;
+                    BOOL isReferenced =
+                        [transaction hasObjectForKey:attachmentStream.uniqueId
+                                        inCollection:OWSOrphanedDataCleanerReferencedAttachmentIdsCollection];
+                    // Don't delete attachments which were created in the last N minutes.
+                    if (!isReferenced && [state isOldEnoughToCleanUp:attachmentStream.creationTimestamp]) {
+                        [orphanAttachmentIds addObject:attachmentStream.uniqueId];
+                        return;
+                    }
+
+                    NSString *_Nullable filePath = [attachmentStream filePath];
+                    OWSAssert(filePath);
+                    if (![filePath hasPrefix:attachmentsFolderPrefix]) {
+                        OWSFail(@"%@ Attachment file is outside the attachments folder.", self.logTag);
+                        return;
+                    }
+                    // Relative paths survive the app container moving, e.g. during an app update.
+                    [attachmentFiles addObject:[filePath substringFromIndex:attachmentsFolderPrefix.length]];
+                }];
+    }];
+
+    CleanupLogDebug(@"orphan attachments: %zd / %zd", orphanAttachmentIds.count, attachmentIds.count);
+
+    [dbConnection readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        for (NSString *relativePath in attachmentFiles) {
+            [transaction setObject:@(YES)
+                            forKey:relativePath
+                      inCollection:OWSOrphanedDataCleanerReferencedFilesCollection];
+        }
+
+        if (!shouldCleanup) {
+            return;
         }
         for (NSString *attachmentId in orphanAttachmentIds) {
-            TSAttachment *attachment = [TSAttachment fetchObjectWithUniqueID:attachmentId transaction:transaction];
-            if (!attachment) {
+            TSAttachment *_Nullable attachment =
+                [TSAttachment fetchObjectWithUniqueID:attachmentId transaction:transaction];
+            if (![attachment isKindOfClass:[TSAttachmentStream class]]) {
                 // This can happen on launch since we sync contacts/groups, especially if you have a lot of attachments
                 // to churn through, it's likely it's been deleted since starting this job.
                 DDLogWarn(@"%@ Could not load attachment: %@", self.logTag, attachmentId);
                 continue;
             }
-            if (![attachment isKindOfClass:[TSAttachmentStream class]]) {
-                continue;
-            }
             TSAttachmentStream *attachmentStream = (TSAttachmentStream *)attachment;
-            // Don't delete attachments which were created in the last N minutes.
-            if (fabs([attachmentStream.creationTimestamp timeIntervalSinceNow]) < kMinimumOrphanAge) {
-                CleanupLogInfo(@"Skipping orphan attachment due to age: %f",
-                    fabs([attachmentStream.creationTimestamp timeIntervalSinceNow]));
-                continue;
-            }
+            NSString *_Nullable filePath = [attachmentStream filePath];
+            long long fileSize = (filePath ? [self fileSizeOfFilePaths:@[ filePath ]] : 0);
+
             CleanupLogInfo(@"Removing orphan attachment: %@", attachmentStream.uniqueId);
             [attachmentStream removeWithTransaction:transaction];
+            state.report.removedAttachmentCount++;
+            state.report.reclaimedBytes += fileSize;
         }
     }];
 
-    for (NSString *filePath in orphanDiskFilePaths) {
-        NSError *error;
-        NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:&error];
-        if (!attributes || error) {
-            OWSFail(@"Could not get attributes of file at: %@", filePath);
-            continue;
-        }
-        // Don't delete files which were created in the last N minutes.
-        if (fabs([attributes.fileModificationDate timeIntervalSinceNow]) < kMinimumOrphanAge) {
-            CleanupLogInfo(@"Skipping orphan attachment file due to age: %f",
-                fabs([attributes.fileModificationDate timeIntervalSinceNow]));
-            continue;
-        }
+    if ([state advanceChunk]) {
+        [state advanceToPhase:OWSOrphanScanPhaseAttachmentFiles];
+    }
+}
+
++ (void)scanFilesChunkInFolder:(NSString *)folder
+                         state:(OWSOrphanScanState *)state
+                  dbConnection:(YapDatabaseConnection *)dbConnection
+                 shouldCleanup:(BOOL)shouldCleanup
+             isReferencedBlock:(BOOL (^)(NSString *relativePath, YapDatabaseReadTransaction *transaction))isReferencedBlock
+                     nextPhase:(OWSOrphanScanPhase)nextPhase
+{
+    NSArray<NSString *> *relativePaths = [self currentChunkWithState:state
+                                                         dbConnection:dbConnection
+                                                        snapshotBlock:^{
+                                                            return [self relativePathsInFolder:folder];
+                                                        }];
+
+    NSMutableArray<NSString *> *filePaths = [NSMutableArray new];
+    for (NSString *relativePath in relativePaths) {
+        [filePaths addObject:[folder stringByAppendingPathComponent:relativePath]];
+    }
+    NSArray<OWSOrphanScanFile *> *files = [self scanFilesWithPaths:filePaths];
+
+    NSMutableArray<OWSOrphanScanFile *> *orphanFiles = [NSMutableArray new];
+    [dbConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        [relativePaths enumerateObjectsUsingBlock:^(NSString *relativePath, NSUInteger index, BOOL *stop) {
+            OWSOrphanScanFile *file = files[index];
+            if (!file.isValid || file.isDirectory) {
+                return;
+            }
+            state.report.scannedFileCount++;
+            state.report.scannedBytes += file.fileSize;
 
-        CleanupLogInfo(@"Removing orphan attachment file: %@", filePath);
-        [[NSFileManager defaultManager] removeItemAtPath:filePath error:&error];
-        if (error) {
-            OWSFail(@"Could not remove orphan file at: %@", filePath);
+            if (isReferencedBlock(relativePath, transaction)) {
+                return;
+            }
+            // Don't delete files which were created in the last N minutes.
+            if (![state isOldEnoughToCleanUp:file.modificationDate]) {
+                CleanupLogInfo(@"Skipping orphan file due to age: %f", fabs([file.modificationDate timeIntervalSinceNow]));
+                return;
+            }
+            [orphanFiles addObject:file];
+        }];
+    }];
+
+    CleanupLogDebug(@"orphan files: %zd / %zd", orphanFiles.count, files.count);
+
+    if (shouldCleanup) {
+        for (OWSOrphanScanFile *file in orphanFiles) {
+            CleanupLogInfo(@"Removing orphan file: %@", file.filePath);
+            NSError *error;
+            [[NSFileManager defaultManager] removeItemAtPath:file.filePath error:&error];
+            if (error) {
+                OWSFail(@"Could not remove orphan file at: %@", file.filePath);
+                continue;
+            }
+            state.report.removedFileCount++;
+            state.report.reclaimedBytes += file.fileSize;
         }
     }
 
-    if (completion) {
-        dispatch_async(dispatch_get_main_queue(), ^{
-            completion();
-        });
+    if ([state advanceChunk]) {
+        [state advanceToPhase:nextPhase];
+    }
+}
+
+#pragma mark - Files
+
++ (NSArray<NSString *> *)relativePathsInFolder:(NSString *)folder
+{
+    NSMutableArray<NSString *> *relativePaths = [NSMutableArray new];
+    for (NSString *relativePath in [[NSFileManager defaultManager] enumeratorAtPath:folder]) {
+        [relativePaths addObject:relativePath];
     }
+    return relativePaths;
 }
 
-+ (void)printPaths:(NSArray<NSString *> *)paths label:(NSString *)label
+// Reads the attributes of the files concurrently; most of the cost is waiting on the file system.
++ (NSArray<OWSOrphanScanFile *> *)scanFilesWithPaths:(NSArray<NSString *> *)filePaths
 {
-    for (NSString *path in [paths sortedArrayUsingSelector:@selector(compare:)]) {
-        CleanupLogDebug(@"%@: %@", label, path);
+    NSMutableArray<OWSOrphanScanFile *> *files = [NSMutableArray new];
+    for (NSString *filePath in filePaths) {
+        [files addObject:[[OWSOrphanScanFile alloc] initWithFilePath:filePath]];
     }
+
+    dispatch_apply(files.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^(size_t index) {
+        OWSOrphanScanFile *file = files[index];
+        NSError *error;
+        NSDictionary *_Nullable attributes =
+            [[NSFileManager defaultManager] attributesOfItemAtPath:file.filePath error:&error];
+        if (!attributes || error) {
+            // The file may have been removed since we listed it.
+            DDLogWarn(@"%@ Could not get attributes of file at: %@, %@", self.logTag, file.filePath, error);
+            return;
+        }
+        file.isValid = YES;
+        file.isDirectory = [attributes.fileType isEqualToString:NSFileTypeDirectory];
+        file.fileSize = (long long)attributes.fileSize;
+        file.modificationDate = attributes.fileModificationDate;
+    });
+
+    return files;
 }
 
 + (NSSet<NSString *> *)filePathsInAttachmentsFolder
@@ -239,22 +752,13 @@ NS_ASSUME_NONNULL_BEGIN
     return filePaths;
 }
 
-+ (long long)fileSizeOfFilePath:(NSString *)filePath
-{
-    NSError *error;
-    NSNumber *fileSize = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:&error][NSFileSize];
-    if (error) {
-        OWSFail(@"attributesOfItemAtPath: %@ error: %@", filePath, error);
-        return 0;
-    }
-    return fileSize.longLongValue;
-}
-
 + (long long)fileSizeOfFilePaths:(NSArray<NSString *> *)filePaths
 {
     long long result = 0;
-    for (NSString *filePath in filePaths) {
-        result += [self fileSizeOfFilePath:filePath];
+    for (OWSOrphanScanFile *file in [self scanFilesWithPaths:filePaths]) {
+        if (file.isValid && !file.isDirectory) {
+            result += file.fileSize;
+        }
     }
     return result;
 }
@@ -10,9 +10,15 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)runSyncRegistrations;
 - (void)runAsyncRegistrationsWithCompletion:(void (^_Nonnull)(void))completion;
+- (void)runDeferredRegistrationsWithCompletion:(void (^_Nonnull)(void))completion;
 
 - (BOOL)areAsyncRegistrationsComplete;
 - (BOOL)areSyncRegistrationsComplete;
+- (BOOL)areDeferredRegistrationsComplete;
+
+// Invokes completion on the main thread once the extension registrations
+// enqueued so far have completed, after their completion blocks.
+- (void)flushRegistrationsWithCompletion:(void (^_Nonnull)(void))completion;
 
 - (NSString *)databaseFilePath;
 
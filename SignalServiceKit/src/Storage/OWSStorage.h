@@ -7,6 +7,9 @@
 NS_ASSUME_NONNULL_BEGIN
 
 extern NSString *const StorageIsReadyNotification;
+// Posted on the main thread once runDeferredRegistrations has registered
+// all of the deferred extensions.
+extern NSString *const StorageDeferredRegistrationsCompleteNotification;
 
 @class YapDatabaseExtension;
 
@@ -19,6 +22,9 @@ extern NSString *const StorageIsReadyNotification;
 // sync _AND_ async view registrations.
 + (BOOL)isStorageReady;
 
+// Returns YES if _ALL_ storage classes have completed their deferred registrations.
++ (BOOL)areDeferredRegistrationsComplete;
+
 // This object can be used to filter database notifications.
 @property (nonatomic, readonly, nullable) id dbNotificationObject;
 
@@ -32,6 +38,13 @@ extern NSString *const StorageIsReadyNotification;
  */
 + (void)setupWithSafeBlockingMigrations:(void (^_Nonnull)(void))safeBlockingMigrationsBlock;
 
+// Registers the extensions which aren't needed to present the first screen,
+// e.g. the views used by conversations and the linked devices screen.
+//
+// Should be called once storage is ready and the first screen has been presented.
+// Database writes enqueued after this wait for these registrations.
++ (void)runDeferredRegistrations;
+
 + (void)resetAllStorage;
 
 // TODO: Deprecate?
@@ -45,6 +58,11 @@ extern NSString *const StorageIsReadyNotification;
 
 - (unsigned long long)databaseFileSize;
 
+#pragma mark - Metrics
+
+// How long each extension took to register (and, if necessary, to populate), keyed by name.
+- (NSDictionary<NSString *, NSNumber *> *)extensionRegistrationDurations;
+
 #pragma mark - Password
 
 /**
@@ -6,6 +6,7 @@
 #import "AppContext.h"
 #import "NSData+Base64.h"
 #import "NSNotificationCenter+OWS.h"
+#import "OWSCompactSerializer.h"
 #import "OWSFileSystem.h"
 #import "OWSStorage+Subclass.h"
 #import "TSAttachmentStream.h"
@@ -17,6 +18,7 @@
 NS_ASSUME_NONNULL_BEGIN
 
 NSString *const StorageIsReadyNotification = @"StorageIsReadyNotification";
+NSString *const StorageDeferredRegistrationsCompleteNotification = @"StorageDeferredRegistrationsCompleteNotification";
 
 NSString *const OWSStorageExceptionName_DatabasePasswordInaccessibleWhileBackgrounded
     = @"OWSStorageExceptionName_DatabasePasswordInaccessibleWhileBackgrounded";
@@ -239,6 +241,10 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
 
 @property (atomic, nullable) YapDatabase *database;
 
+// The following state should only be accessed while synchronized on self.
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, NSNumber *> *extensionRegistrationDurationMap;
+@property (nonatomic, nullable) NSDate *lastAsyncRegistrationDate;
+
 @end
 
 #pragma mark -
@@ -250,6 +256,8 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
     self = [super init];
 
     if (self) {
+        _extensionRegistrationDurationMap = [NSMutableDictionary new];
+
         if (![self tryToLoadDatabase]) {
             // Failing to load the database is catastrophic.
             //
@@ -307,6 +315,13 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
     return NO;
 }
 
+- (BOOL)areDeferredRegistrationsComplete
+{
+    OWS_ABSTRACT_METHOD();
+
+    return NO;
+}
+
 - (void)runSyncRegistrations
 {
     OWS_ABSTRACT_METHOD();
@@ -317,6 +332,11 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
     OWS_ABSTRACT_METHOD();
 }
 
+- (void)runDeferredRegistrationsWithCompletion:(void (^_Nonnull)(void))completion
+{
+    OWS_ABSTRACT_METHOD();
+}
+
 + (NSArray<OWSStorage *> *)allStorages
 {
     return @[
@@ -347,6 +367,41 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
     }
 }
 
++ (void)runDeferredRegistrations
+{
+    OWSAssertIsOnMainThread();
+    OWSAssert(self.isStorageReady);
+
+    static BOOL hasRunDeferredRegistrations = NO;
+    if (hasRunDeferredRegistrations) {
+        return;
+    }
+    hasRunDeferredRegistrations = YES;
+
+    for (OWSStorage *storage in self.allStorages) {
+        [storage runDeferredRegistrationsWithCompletion:^{
+            [storage logExtensionRegistrationDurations];
+
+            if (self.areDeferredRegistrationsComplete) {
+                [[NSNotificationCenter defaultCenter]
+                    postNotificationNameAsync:StorageDeferredRegistrationsCompleteNotification
+                                       object:nil
+                                     userInfo:nil];
+            }
+        }];
+    }
+}
+
++ (BOOL)areDeferredRegistrationsComplete
+{
+    for (OWSStorage *storage in self.allStorages) {
+        if (!storage.areDeferredRegistrationsComplete) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
 + (void)postRegistrationCompleteNotificationIfPossible
 {
     if (!self.isStorageReady) {
@@ -387,8 +442,10 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
     options.enableMultiProcessSupport = YES;
 
     OWSDatabase *database = [[OWSDatabase alloc] initWithPath:[self databaseFilePath]
-                                                   serializer:nil
-                                                 deserializer:[[self class] logOnFailureDeserializer]
+                                                   serializer:[OWSCompactSerializer serializer]
+                                                 deserializer:[OWSCompactSerializer
+                                                                  deserializerWithLegacyDeserializer:
+                                                                      [[self class] logOnFailureDeserializer]]
                                                       options:options
                                                      delegate:self];
 
@@ -432,14 +489,112 @@ static NSString *keychainDBPassAccount = @"TSDatabasePass";
 
 - (BOOL)registerExtension:(YapDatabaseExtension *)extension withName:(NSString *)extensionName
 {
-    return [self.database registerExtension:extension withName:extensionName];
+    NSDate *startDate = [NSDate new];
+    BOOL result = [self.database registerExtension:extension withName:extensionName];
+    [self didRegisterExtension:extensionName startDate:startDate isAsync:NO];
+    return result;
 }
 
 - (void)asyncRegisterExtension:(YapDatabaseExtension *)extension
                       withName:(NSString *)extensionName
                completionBlock:(nullable void (^)(BOOL ready))completionBlock
 {
-    [self.database asyncRegisterExtension:extension withName:extensionName completionBlock:completionBlock];
+    NSDate *enqueueDate = [NSDate new];
+    [self.database asyncRegisterExtension:extension
+                                 withName:extensionName
+                          completionQueue:self.class.registrationCompletionQueue
+                          completionBlock:^(BOOL ready) {
+                              [self didRegisterExtension:extensionName startDate:enqueueDate isAsync:YES];
+
+                              if (completionBlock) {
+                                  dispatch_async(dispatch_get_main_queue(), ^{
+                                      completionBlock(ready);
+                                  });
+                              }
+                          }];
+}
+
+- (void)flushRegistrationsWithCompletion:(void (^_Nonnull)(void))completion
+{
+    OWSAssert(completion);
+
+    // Registration completion blocks are invoked by way of the registration
+    // queue, so we do the same to ensure that they are invoked first.
+    YapDatabaseConnection *dbConnection = self.newDatabaseConnection;
+    [dbConnection flushTransactionsWithCompletionQueue:self.class.registrationCompletionQueue
+                                       completionBlock:^{
+                                           dispatch_async(dispatch_get_main_queue(), completion);
+                                       }];
+}
+
+#pragma mark - Metrics
+
+// Registrations are timed off the main thread, which may be busy during launch.
++ (dispatch_queue_t)registrationCompletionQueue
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("org.whispersystems.signal.extensionRegistration", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+- (void)didRegisterExtension:(NSString *)extensionName startDate:(NSDate *)startDate isAsync:(BOOL)isAsync
+{
+    NSDate *now = [NSDate new];
+
+    @synchronized(self)
+    {
+        // Async registrations are performed one at a time, so each one starts
+        // when it is enqueued or when the one before it completes.
+        if (isAsync && self.lastAsyncRegistrationDate &&
+            [self.lastAsyncRegistrationDate compare:startDate] == NSOrderedDescending) {
+            startDate = self.lastAsyncRegistrationDate;
+        }
+        if (isAsync) {
+            self.lastAsyncRegistrationDate = now;
+        }
+
+        NSTimeInterval duration = [now timeIntervalSinceDate:startDate];
+        self.extensionRegistrationDurationMap[extensionName] = @(duration);
+
+        DDLogInfo(@"%@ Registered extension: %@ in %.3fs (%lu registered).",
+            self.logTag,
+            extensionName,
+            duration,
+            (unsigned long)self.extensionRegistrationDurationMap.count);
+    }
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)extensionRegistrationDurations
+{
+    @synchronized(self)
+    {
+        return [self.extensionRegistrationDurationMap copy];
+    }
+}
+
+- (void)logExtensionRegistrationDurations
+{
+    NSDictionary<NSString *, NSNumber *> *durations = self.extensionRegistrationDurations;
+    NSArray<NSString *> *extensionNames =
+        [durations keysSortedByValueUsingComparator:^NSComparisonResult(NSNumber *left, NSNumber *right) {
+            return [right compare:left];
+        }];
+
+    NSTimeInterval totalDuration = 0;
+    NSMutableArray<NSString *> *descriptions = [NSMutableArray new];
+    for (NSString *extensionName in extensionNames) {
+        totalDuration += durations[extensionName].doubleValue;
+        [descriptions
+            addObject:[NSString stringWithFormat:@"%@: %.3fs", extensionName, durations[extensionName].doubleValue]];
+    }
+    DDLogInfo(@"%@ Registered %lu extensions in %.3fs, slowest first: %@",
+        self.logTag,
+        (unsigned long)extensionNames.count,
+        totalDuration,
+        [descriptions componentsJoinedByString:@", "]);
 }
 
 - (nullable id)registeredExtension:(NSString *)extensionName
@@ -0,0 +1,59 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class YapDatabaseConnection;
+@class YapDatabaseReadWriteTransaction;
+
+typedef void (^OWSWriteBlock)(YapDatabaseReadWriteTransaction *transaction);
+
+// Groups async write blocks that are enqueued within a short window into a
+// single write transaction, so that a burst of small writes pays for one commit
+// (and one cross-process notification) rather than one per write.
+//
+// * Blocks are performed in the order in which they were enqueued, and each
+//   block sees the writes of the blocks before it.
+// * Blocks share a transaction with unrelated blocks, so they shouldn't
+//   assume that their writes are visible to other connections until their
+//   completion block is invoked.
+@interface OWSWriteCoalescer : NSObject
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (instancetype)initWithDatabaseConnection:(YapDatabaseConnection *)dbConnection
+                          coalescingWindow:(NSTimeInterval)coalescingWindow NS_DESIGNATED_INITIALIZER;
+
+- (void)asyncReadWriteWithBlock:(OWSWriteBlock)block;
+
+// completionBlock, if present, will be invoked on the main thread once
+// the transaction containing block has been committed.
+- (void)asyncReadWriteWithBlock:(OWSWriteBlock)block completionBlock:(nullable dispatch_block_t)completionBlock;
+
+// Commits any pending blocks without waiting for the window to elapse.
+//
+// Use for writes that are latency-critical.
+- (void)flush;
+
+// Commits any pending blocks and blocks until they have been committed.
+//
+// Use when the app may be suspended or terminated.
+- (void)flushAndWait;
+
+// Performs block synchronously, after (and in the same transaction as) any
+// pending blocks.
+- (void)readWriteWithBlock:(OWSWriteBlock)block;
+
+#pragma mark - Metrics
+
+@property (nonatomic, readonly) NSUInteger committedTransactionCount;
+@property (nonatomic, readonly) NSUInteger committedBlockCount;
+
+// Averaged over the lifetime of the coalescer.
+- (double)transactionsPerSecond;
+- (double)averageBlocksPerTransaction;
+
+@end
+
+NS_ASSUME_NONNULL_END
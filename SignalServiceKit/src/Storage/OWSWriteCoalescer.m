@@ -0,0 +1,221 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSWriteCoalescer.h"
+#import <YapDatabase/YapDatabaseConnection.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Bounds the size (and duration) of any one transaction.
+static const NSUInteger kMaxBlocksPerTransaction = 200;
+
+@interface OWSWriteCoalescer ()
+
+@property (nonatomic, readonly) YapDatabaseConnection *dbConnection;
+@property (nonatomic, readonly) NSTimeInterval coalescingWindow;
+@property (nonatomic, readonly) NSDate *creationDate;
+
+// The following state should only be accessed while synchronized on self.
+@property (nonatomic) NSMutableArray<OWSWriteBlock> *pendingBlocks;
+@property (nonatomic) NSMutableArray<dispatch_block_t> *pendingCompletionBlocks;
+@property (nonatomic) BOOL isCommitScheduled;
+@property (nonatomic) NSUInteger committedTransactionCount;
+@property (nonatomic) NSUInteger committedBlockCount;
+
+@end
+
+#pragma mark -
+
+@implementation OWSWriteCoalescer
+
+- (instancetype)initWithDatabaseConnection:(YapDatabaseConnection *)dbConnection
+                          coalescingWindow:(NSTimeInterval)coalescingWindow
+{
+    self = [super init];
+    if (!self) {
+        return self;
+    }
+
+    OWSAssert(dbConnection);
+    OWSAssert(coalescingWindow >= 0);
+
+    _dbConnection = dbConnection;
+    _coalescingWindow = coalescingWindow;
+    _creationDate = [NSDate new];
+    _pendingBlocks = [NSMutableArray new];
+    _pendingCompletionBlocks = [NSMutableArray new];
+
+    return self;
+}
+
+- (void)asyncReadWriteWithBlock:(OWSWriteBlock)block
+{
+    [self asyncReadWriteWithBlock:block completionBlock:nil];
+}
+
+- (void)asyncReadWriteWithBlock:(OWSWriteBlock)block completionBlock:(nullable dispatch_block_t)completionBlock
+{
+    OWSAssert(block);
+
+    @synchronized(self)
+    {
+        [self.pendingBlocks addObject:[block copy]];
+        if (completionBlock) {
+            [self.pendingCompletionBlocks addObject:[completionBlock copy]];
+        }
+
+        if (self.pendingBlocks.count >= kMaxBlocksPerTransaction) {
+            [self commitPendingBlocksWithBlock:nil completionQueue:nil completionBlock:nil];
+        } else if (!self.isCommitScheduled) {
+            self.isCommitScheduled = YES;
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.coalescingWindow * NSEC_PER_SEC)),
+                dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                ^{
+                    [self flush];
+                });
+        }
+    }
+}
+
+- (void)flush
+{
+    @synchronized(self)
+    {
+        [self commitPendingBlocksWithBlock:nil completionQueue:nil completionBlock:nil];
+    }
+}
+
+- (void)flushAndWait
+{
+    [self commitPendingBlocksAndWaitWithBlock:nil];
+}
+
+- (void)readWriteWithBlock:(OWSWriteBlock)block
+{
+    OWSAssert(block);
+
+    [self commitPendingBlocksAndWaitWithBlock:block];
+}
+
+- (void)commitPendingBlocksAndWaitWithBlock:(nullable OWSWriteBlock)block
+{
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    @synchronized(self)
+    {
+        [self commitPendingBlocksWithBlock:block
+                           completionQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0)
+                           completionBlock:^{
+                               dispatch_semaphore_signal(semaphore);
+                           }];
+    }
+    // Wait outside of the lock so that blocks which are being performed can
+    // enqueue further writes.
+    dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+}
+
+// Should only be called while synchronized on self.
+//
+// The transaction is enqueued while synchronized so that transactions are
+// committed in the same order that their blocks were enqueued.
+- (void)commitPendingBlocksWithBlock:(nullable OWSWriteBlock)extraBlock
+                     completionQueue:(nullable dispatch_queue_t)extraCompletionQueue
+                     completionBlock:(nullable dispatch_block_t)extraCompletionBlock
+{
+    self.isCommitScheduled = NO;
+
+    NSArray<OWSWriteBlock> *blocks = [self.pendingBlocks copy];
+    NSArray<dispatch_block_t> *completionBlocks = [self.pendingCompletionBlocks copy];
+    [self.pendingBlocks removeAllObjects];
+    [self.pendingCompletionBlocks removeAllObjects];
+
+    if (extraBlock) {
+        blocks = [blocks arrayByAddingObject:extraBlock];
+    }
+    if (blocks.count < 1) {
+        if (extraCompletionBlock) {
+            dispatch_async(extraCompletionQueue ?: dispatch_get_main_queue(), extraCompletionBlock);
+        }
+        return;
+    }
+
+    [self.dbConnection asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        for (OWSWriteBlock block in blocks) {
+            block(transaction);
+        }
+    }
+        completionQueue:extraCompletionQueue
+        completionBlock:^{
+            [self didCommitBlockCount:blocks.count];
+            if (extraCompletionBlock) {
+                extraCompletionBlock();
+            }
+
+            if (completionBlocks.count > 0) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    for (dispatch_block_t completionBlock in completionBlocks) {
+                        completionBlock();
+                    }
+                });
+            }
+        }];
+}
+
+#pragma mark - Metrics
+
+- (void)didCommitBlockCount:(NSUInteger)blockCount
+{
+    @synchronized(self)
+    {
+        self.committedTransactionCount++;
+        self.committedBlockCount += blockCount;
+
+        if (self.committedTransactionCount % 100 == 0) {
+            DDLogInfo(@"%@ committed %lu transactions, %.1f/sec, %.1f blocks per transaction.",
+                self.logTag,
+                (unsigned long)self.committedTransactionCount,
+                self.transactionsPerSecond,
+                self.averageBlocksPerTransaction);
+        }
+    }
+}
+
+- (NSUInteger)committedTransactionCount
+{
+    @synchronized(self)
+    {
+        return _committedTransactionCount;
+    }
+}
+
+- (NSUInteger)committedBlockCount
+{
+    @synchronized(self)
+    {
+        return _committedBlockCount;
+    }
+}
+
+- (double)transactionsPerSecond
+{
+    NSTimeInterval elapsed = fabs([self.creationDate timeIntervalSinceNow]);
+    if (elapsed <= 0) {
+        return 0;
+    }
+    return self.committedTransactionCount / elapsed;
+}
+
+- (double)averageBlocksPerTransaction
+{
+    @synchronized(self)
+    {
+        if (_committedTransactionCount < 1) {
+            return 0;
+        }
+        return _committedBlockCount / (double)_committedTransactionCount;
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -10,6 +10,8 @@
 
 @interface TSStorageManager (messageIDs)
 
+// Returns a new, unique message id.  Ids are increasing within a process, but
+// aren't necessarily contiguous (e.g. after a relaunch).
 + (NSString *)getAndIncrementMessageIdWithTransaction:(YapDatabaseReadWriteTransaction *)transaction;
 
 @end
@@ -1,33 +1,67 @@
 //
-//  Copyright (c) 2017 Open Whisper Systems. All rights reserved.
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
 //
 
 #import "TSStorageManager+messageIDs.h"
 #import <YapDatabase/YapDatabase.h>
 
+NS_ASSUME_NONNULL_BEGIN
+
 #define TSStorageParametersCollection @"TSStorageParametersCollection"
+// The lowest message id that hasn't been reserved by any process.
 #define TSMessagesLatestId @"TSMessagesLatestId"
 
+// Ids are reserved in blocks so that the high-water mark is written once per
+// block rather than once per message.  A crash wastes at most one block's worth
+// of ids, but never reuses an id.
+static const unsigned long long kMessageIdBlockSize = 100;
+
+// The following state is only accessed within write transactions, which are
+// serialized, so it needs no further synchronization.
+//
+// The next id to allocate, and the end of the reserved block.
+static unsigned long long nextMessageId = 0;
+static unsigned long long reservedMessageIdLimit = 0;
+
 @implementation TSStorageManager (messageIDs)
 
-+ (NSString *)getAndIncrementMessageIdWithTransaction:(YapDatabaseReadWriteTransaction *)transaction {
-    NSString *messageId = [transaction objectForKey:TSMessagesLatestId inCollection:TSStorageParametersCollection];
-    if (!messageId) {
-        messageId = @"0";
++ (unsigned long long)persistedMessageIdHighWaterMarkWithTransaction:(YapDatabaseReadTransaction *)transaction
+{
+    id _Nullable value = [transaction objectForKey:TSMessagesLatestId inCollection:TSStorageParametersCollection];
+    if ([value isKindOfClass:[NSNumber class]]) {
+        return [(NSNumber *)value unsignedLongLongValue];
+    } else if ([value isKindOfClass:[NSString class]]) {
+        // Legacy installs persisted the counter as a string.
+        return strtoull([(NSString *)value UTF8String], NULL, 10);
+    } else {
+        OWSAssert(!value);
+        return 0;
     }
+}
 
-    NSNumberFormatter *numberFormatter = [[NSNumberFormatter alloc] init];
-    numberFormatter.numberStyle        = NSNumberFormatterDecimalStyle;
-    NSNumber *myNumber                 = [numberFormatter numberFromString:messageId];
-
-    unsigned long long nextMessageId = [myNumber unsignedLongLongValue];
-    nextMessageId++;
++ (NSString *)getAndIncrementMessageIdWithTransaction:(YapDatabaseReadWriteTransaction *)transaction
+{
+    OWSAssert(transaction);
 
-    NSString *nextMessageIdString = [[NSNumber numberWithUnsignedLongLong:nextMessageId] stringValue];
+    if (nextMessageId >= reservedMessageIdLimit) {
+        // Other processes (e.g. app extensions) reserve their own blocks, so always
+        // start from the persisted high-water mark.  Never go backwards, even if it
+        // has (e.g. if the database was reset).
+        unsigned long long blockStart
+            = MAX(nextMessageId, [self persistedMessageIdHighWaterMarkWithTransaction:transaction]);
+        reservedMessageIdLimit = blockStart + kMessageIdBlockSize;
+        nextMessageId = blockStart;
 
-    [transaction setObject:nextMessageIdString forKey:TSMessagesLatestId inCollection:TSStorageParametersCollection];
+        [transaction setObject:@(reservedMessageIdLimit)
+                        forKey:TSMessagesLatestId
+                  inCollection:TSStorageParametersCollection];
+    }
 
-    return messageId;
+    unsigned long long messageId = nextMessageId;
+    nextMessageId++;
+    return [NSString stringWithFormat:@"%llu", messageId];
 }
 
 @end
+
+NS_ASSUME_NONNULL_END
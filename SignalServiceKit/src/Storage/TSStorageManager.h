@@ -6,8 +6,11 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+@class OWSWriteCoalescer;
+
 void runSyncRegistrationsForStorage(OWSStorage *storage);
 void runAsyncRegistrationsForStorage(OWSStorage *storage);
+void runDeferredRegistrationsForStorage(OWSStorage *storage);
 
 // TODO: Rename to OWSPrimaryStorage?
 @interface TSStorageManager : OWSStorage
@@ -21,6 +24,10 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage);
 + (YapDatabaseConnection *)dbReadConnection;
 + (YapDatabaseConnection *)dbReadWriteConnection;
 
+// Coalesces bursts of small async writes into fewer transactions.
+- (OWSWriteCoalescer *)dbWriteCoalescer;
++ (OWSWriteCoalescer *)dbWriteCoalescer;
+
 + (void)migrateToSharedData;
 
 + (NSString *)databaseFilePath;
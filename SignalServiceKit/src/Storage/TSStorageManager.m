@@ -13,6 +13,7 @@
 #import "OWSIncomingMessageFinder.h"
 #import "OWSMessageReceiver.h"
 #import "OWSStorage+Subclass.h"
+#import "OWSWriteCoalescer.h"
 #import "TSDatabaseSecondaryIndexes.h"
 #import "TSDatabaseView.h"
 
@@ -23,6 +24,9 @@ NSString *const TSStorageManagerExceptionName_CouldNotMoveDatabaseFile
 NSString *const TSStorageManagerExceptionName_CouldNotCreateDatabaseDirectory
     = @"TSStorageManagerExceptionName_CouldNotCreateDatabaseDirectory";
 
+// Long enough to gather a burst of writes, short enough to be imperceptible.
+static const NSTimeInterval kWriteCoalescingWindow = 0.05f;
+
 void runSyncRegistrationsForStorage(OWSStorage *storage)
 {
     OWSCAssert(storage);
@@ -41,30 +45,41 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage)
 {
     OWSCAssert(storage);
 
-    // Asynchronously register other extensions.
+    // Asynchronously register extensions which are needed by the jobs
+    // and message processing that start once storage is ready.
     //
     // All sync registrations must be done before all async registrations,
     // or the sync registrations will block on the async registrations.
-    [TSDatabaseView asyncRegisterUnseenDatabaseView:storage];
-    [TSDatabaseView asyncRegisterThreadOutgoingMessagesDatabaseView:storage];
-    [TSDatabaseView asyncRegisterThreadSpecialMessagesDatabaseView:storage];
-
-    // Register extensions which aren't essential for rendering threads async.
     [OWSIncomingMessageFinder asyncRegisterExtensionWithStorageManager:storage];
-    [TSDatabaseView asyncRegisterSecondaryDevicesDatabaseView:storage];
     [OWSDisappearingMessagesFinder asyncRegisterDatabaseExtensions:storage];
     [OWSFailedMessagesJob asyncRegisterDatabaseExtensionsWithStorageManager:storage];
     [OWSFailedAttachmentDownloadsJob asyncRegisterDatabaseExtensionsWithStorageManager:storage];
 }
 
+void runDeferredRegistrationsForStorage(OWSStorage *storage)
+{
+    OWSCAssert(storage);
+
+    // Register extensions which aren't needed to render the inbox once it
+    // has been presented.  Conversations read the outgoing and special
+    // messages views from write transactions, which wait on these
+    // registrations; the unseen view falls back to the unread view.
+    [TSDatabaseView asyncRegisterUnseenDatabaseView:storage];
+    [TSDatabaseView asyncRegisterThreadOutgoingMessagesDatabaseView:storage];
+    [TSDatabaseView asyncRegisterThreadSpecialMessagesDatabaseView:storage];
+    [TSDatabaseView asyncRegisterSecondaryDevicesDatabaseView:storage];
+}
+
 #pragma mark -
 @interface TSStorageManager ()
 
 @property (nonatomic, readonly, nullable) YapDatabaseConnection *dbReadConnection;
 @property (nonatomic, readonly, nullable) YapDatabaseConnection *dbReadWriteConnection;
+@property (nonatomic, readonly, nullable) OWSWriteCoalescer *dbWriteCoalescer;
 
 @property (atomic) BOOL areAsyncRegistrationsComplete;
 @property (atomic) BOOL areSyncRegistrationsComplete;
+@property (atomic) BOOL areDeferredRegistrationsComplete;
 
 @end
 
@@ -92,6 +107,8 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage)
     if (self) {
         _dbReadConnection = self.newDatabaseConnection;
         _dbReadWriteConnection = self.newDatabaseConnection;
+        _dbWriteCoalescer = [[OWSWriteCoalescer alloc] initWithDatabaseConnection:self.newDatabaseConnection
+                                                                 coalescingWindow:kWriteCoalescingWindow];
 
         OWSSingletonAssert();
     }
@@ -103,13 +120,16 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage)
 {
     _dbReadConnection = nil;
     _dbReadWriteConnection = nil;
+    _dbWriteCoalescer = nil;
 
     [super resetStorage];
 }
 
 - (void)runSyncRegistrations
 {
+    NSDate *startDate = [NSDate new];
     runSyncRegistrationsForStorage(self);
+    DDLogInfo(@"%@ Completed sync registrations in %.3fs.", self.logTag, fabs([startDate timeIntervalSinceNow]));
 
     // See comments on OWSDatabaseConnection.
     //
@@ -125,18 +145,37 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage)
 {
     OWSAssert(completion);
 
+    NSDate *startDate = [NSDate new];
     runAsyncRegistrationsForStorage(self);
 
     // Block until all async registrations are complete.
-    YapDatabaseConnection *dbConnection = self.newDatabaseConnection;
-    [dbConnection flushTransactionsWithCompletionQueue:dispatch_get_main_queue()
-                                       completionBlock:^{
-                                           OWSAssert(!self.areAsyncRegistrationsComplete);
+    [self flushRegistrationsWithCompletion:^{
+        OWSAssert(!self.areAsyncRegistrationsComplete);
 
-                                           self.areAsyncRegistrationsComplete = YES;
+        DDLogInfo(@"%@ Completed async registrations in %.3fs.", self.logTag, fabs([startDate timeIntervalSinceNow]));
+        self.areAsyncRegistrationsComplete = YES;
 
-                                           completion();
-                                       }];
+        completion();
+    }];
+}
+
+- (void)runDeferredRegistrationsWithCompletion:(void (^_Nonnull)(void))completion
+{
+    OWSAssert(completion);
+    OWSAssert(self.areAsyncRegistrationsComplete);
+
+    NSDate *startDate = [NSDate new];
+    runDeferredRegistrationsForStorage(self);
+
+    [self flushRegistrationsWithCompletion:^{
+        OWSAssert(!self.areDeferredRegistrationsComplete);
+
+        DDLogInfo(
+            @"%@ Completed deferred registrations in %.3fs.", self.logTag, fabs([startDate timeIntervalSinceNow]));
+        self.areDeferredRegistrationsComplete = YES;
+
+        completion();
+    }];
 }
 
 + (void)protectFiles
@@ -247,6 +286,11 @@ void runAsyncRegistrationsForStorage(OWSStorage *storage)
     return TSStorageManager.sharedManager.dbReadWriteConnection;
 }
 
++ (OWSWriteCoalescer *)dbWriteCoalescer
+{
+    return TSStorageManager.sharedManager.dbWriteCoalescer;
+}
+
 @end
 
 NS_ASSUME_NONNULL_END
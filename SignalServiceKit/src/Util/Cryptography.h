@@ -66,6 +66,41 @@ typedef NS_ENUM(NSInteger, TSMACType) {
                            outKey:(NSData *_Nonnull *_Nullable)outKey
                         outDigest:(NSData *_Nonnull *_Nullable)outDigest;
 
+#pragma mark streaming encrypt and decrypt attachment data
+
+// These methods process the attachment in fixed-size chunks, computing the cipher,
+// HMAC and digest incrementally, so memory usage doesn't grow with attachment size.
+//
+// The streams should already be open. The format of the output is identical to
+// that of encryptAttachmentData:outKey:outDigest:.
++ (BOOL)encryptAttachmentStream:(NSInputStream *)inputStream
+                   outputStream:(NSOutputStream *)outputStream
+                         outKey:(NSData *_Nonnull *_Nullable)outKey
+                      outDigest:(NSData *_Nonnull *_Nullable)outDigest
+                          error:(NSError **)error;
+
+// The plaintext is written to the output stream before the HMAC and digest can
+// be verified; if this method returns NO, callers must discard the output.
++ (BOOL)decryptAttachmentStream:(NSInputStream *)inputStream
+                   outputStream:(NSOutputStream *)outputStream
+                        withKey:(NSData *)key
+                         digest:(nullable NSData *)digest
+                   unpaddedSize:(UInt32)unpaddedSize
+                          error:(NSError **)error;
+
+// Any output file is deleted on failure.
++ (BOOL)encryptAttachmentAtPath:(NSString *)plaintextFilePath
+                         toPath:(NSString *)encryptedFilePath
+                         outKey:(NSData *_Nonnull *_Nullable)outKey
+                      outDigest:(NSData *_Nonnull *_Nullable)outDigest
+                          error:(NSError **)error;
++ (BOOL)decryptAttachmentAtPath:(NSString *)encryptedFilePath
+                         toPath:(NSString *)plaintextFilePath
+                        withKey:(NSData *)key
+                         digest:(nullable NSData *)digest
+                   unpaddedSize:(UInt32)unpaddedSize
+                          error:(NSError **)error;
+
 + (nullable NSData *)encryptAESGCMWithData:(NSData *)plaintextData key:(OWSAES256Key *)key;
 + (nullable NSData *)decryptAESGCMWithData:(NSData *)encryptedData key:(OWSAES256Key *)key;
 
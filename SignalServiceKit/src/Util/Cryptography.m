@@ -6,6 +6,7 @@
 #import "NSData+Base64.h"
 #import "NSData+OWSConstantTimeCompare.h"
 #import "OWSError.h"
+#import "OWSFileSystem.h"
 #import <CommonCrypto/CommonCryptor.h>
 #import <CommonCrypto/CommonHMAC.h>
 #import <Curve25519Kit/Randomness.h>
@@ -444,6 +445,385 @@ const NSUInteger kAES256_KeyByteLength = 32;
     return [encryptedPaddedData copy];
 }
 
+#pragma mark streaming encrypt and decrypt attachment data
+
+// The size of the chunks in which attachments are streamed through the cipher.
+static const NSUInteger kAttachmentStreamChunkSize = 64 * 1024;
+
+// Writes all of the bytes to the output stream, returning NO on failure.
+static BOOL OWSWriteAllBytesToStream(NSOutputStream *outputStream, const uint8_t *bytes, NSUInteger length)
+{
+    NSUInteger offset = 0;
+    while (offset < length) {
+        NSInteger bytesWritten = [outputStream write:bytes + offset maxLength:length - offset];
+        if (bytesWritten <= 0) {
+            DDLogError(@"Failed to write to output stream: %@", outputStream.streamError);
+            return NO;
+        }
+        offset += (NSUInteger)bytesWritten;
+    }
+    return YES;
+}
+
++ (BOOL)encryptAttachmentStream:(NSInputStream *)inputStream
+                   outputStream:(NSOutputStream *)outputStream
+                         outKey:(NSData *_Nonnull *_Nullable)outKey
+                      outDigest:(NSData *_Nonnull *_Nullable)outDigest
+                          error:(NSError **)error
+{
+    OWSAssert(inputStream);
+    OWSAssert(outputStream);
+
+    *error = nil;
+
+    NSData *iv = [Cryptography generateRandomBytes:AES_CBC_IV_LENGTH];
+    NSData *encryptionKey = [Cryptography generateRandomBytes:AES_KEY_SIZE];
+    NSData *hmacKey = [Cryptography generateRandomBytes:HMAC256_KEY_LENGTH];
+
+    CCCryptorRef cryptor = NULL;
+    CCCryptorStatus cryptStatus = CCCryptorCreate(kCCEncrypt,
+        kCCAlgorithmAES128,
+        kCCOptionPKCS7Padding,
+        [encryptionKey bytes],
+        [encryptionKey length],
+        [iv bytes],
+        &cryptor);
+    if (cryptStatus != kCCSuccess) {
+        DDLogError(@"%@ %s CCCryptorCreate failed with status: %d", self.logTag, __PRETTY_FUNCTION__, (int32_t)cryptStatus);
+        *error = OWSErrorMakeAssertionError();
+        return NO;
+    }
+
+    __block CCHmacContext hmacContext;
+    CCHmacInit(&hmacContext, kCCHmacAlgSHA256, [hmacKey bytes], [hmacKey length]);
+    __block CC_SHA256_CTX digestContext;
+    CC_SHA256_Init(&digestContext);
+
+    NSMutableData *inputBuffer = [NSMutableData dataWithLength:kAttachmentStreamChunkSize];
+    NSMutableData *outputBuffer = [NSMutableData dataWithLength:kAttachmentStreamChunkSize + kCCBlockSizeAES128];
+
+    // Feeds plaintext through the cipher and writes the resulting ciphertext,
+    // updating the hmac and digest of: iv || encrypted data
+    BOOL (^writeCipherText)(const uint8_t *, size_t) = ^(const uint8_t *bytes, size_t length) {
+        if (length < 1) {
+            return YES;
+        }
+        CC_SHA256_Update(&digestContext, bytes, (CC_LONG)length);
+        CCHmacUpdate(&hmacContext, bytes, length);
+        return OWSWriteAllBytesToStream(outputStream, bytes, length);
+    };
+    BOOL (^encryptChunk)(const void *, size_t) = ^(const void *bytes, size_t length) {
+        size_t bytesEncrypted = 0;
+        CCCryptorStatus status = CCCryptorUpdate(
+            cryptor, bytes, length, outputBuffer.mutableBytes, outputBuffer.length, &bytesEncrypted);
+        if (status != kCCSuccess) {
+            DDLogError(@"%@ CCCryptorUpdate failed with status: %d", self.logTag, (int32_t)status);
+            return NO;
+        }
+        return writeCipherText(outputBuffer.bytes, bytesEncrypted);
+    };
+
+    BOOL success = writeCipherText([iv bytes], [iv length]);
+
+    // Encrypt
+    unsigned long long unpaddedSize = 0;
+    while (success) {
+        NSInteger bytesRead = [inputStream read:inputBuffer.mutableBytes maxLength:inputBuffer.length];
+        if (bytesRead < 0) {
+            DDLogError(@"%@ Failed to read from input stream: %@", self.logTag, inputStream.streamError);
+            success = NO;
+            break;
+        } else if (bytesRead == 0) {
+            break;
+        }
+        unpaddedSize += (unsigned long long)bytesRead;
+        success = encryptChunk(inputBuffer.bytes, (size_t)bytesRead);
+    }
+
+    // Apply any padding
+    if (success) {
+        unsigned long long paddingSize = [self paddedSize:(unsigned long)unpaddedSize] - unpaddedSize;
+        memset(inputBuffer.mutableBytes, 0, inputBuffer.length);
+        while (success && paddingSize > 0) {
+            size_t chunkSize = (size_t)MIN(paddingSize, (unsigned long long)inputBuffer.length);
+            success = encryptChunk(inputBuffer.bytes, chunkSize);
+            paddingSize -= chunkSize;
+        }
+    }
+
+    if (success) {
+        size_t bytesEncrypted = 0;
+        cryptStatus = CCCryptorFinal(cryptor, outputBuffer.mutableBytes, outputBuffer.length, &bytesEncrypted);
+        if (cryptStatus != kCCSuccess) {
+            DDLogError(@"%@ CCCryptorFinal failed with status: %d", self.logTag, (int32_t)cryptStatus);
+            success = NO;
+        } else {
+            success = writeCipherText(outputBuffer.bytes, bytesEncrypted);
+        }
+    }
+    CCCryptorRelease(cryptor);
+
+    if (!success) {
+        *error = OWSErrorMakeWriteAttachmentDataError();
+        return NO;
+    }
+
+    // compute hmac of: iv || encrypted data
+    uint8_t hmac[CC_SHA256_DIGEST_LENGTH];
+    CCHmacFinal(&hmacContext, hmac);
+    if (!OWSWriteAllBytesToStream(outputStream, hmac, HMAC256_OUTPUT_LENGTH)) {
+        *error = OWSErrorMakeWriteAttachmentDataError();
+        return NO;
+    }
+
+    // compute digest of: iv || encrypted data || hmac
+    CC_SHA256_Update(&digestContext, hmac, HMAC256_OUTPUT_LENGTH);
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &digestContext);
+
+    // The concatenated key for storage
+    NSMutableData *attachmentKey = [NSMutableData data];
+    [attachmentKey appendData:encryptionKey];
+    [attachmentKey appendData:hmacKey];
+    *outKey = [attachmentKey copy];
+    *outDigest = [NSData dataWithBytes:digest length:CC_SHA256_DIGEST_LENGTH];
+    DDLogVerbose(@"%@ computed digest: %@", self.logTag, *outDigest);
+
+    return YES;
+}
+
++ (BOOL)decryptAttachmentStream:(NSInputStream *)inputStream
+                   outputStream:(NSOutputStream *)outputStream
+                        withKey:(NSData *)key
+                         digest:(nullable NSData *)digest
+                   unpaddedSize:(UInt32)unpaddedSize
+                          error:(NSError **)error
+{
+    OWSAssert(inputStream);
+    OWSAssert(outputStream);
+
+    *error = nil;
+
+    NSError *invalidMessageError = OWSErrorWithCodeDescription(
+        OWSErrorCodeFailedToDecryptMessage, NSLocalizedString(@"ERROR_MESSAGE_INVALID_MESSAGE", @""));
+
+    if (digest.length <= 0) {
+        // This *could* happen with sufficiently outdated clients.
+        DDLogError(@"%@ Refusing to decrypt attachment without a digest.", self.logTag);
+        *error = OWSErrorWithCodeDescription(OWSErrorCodeFailedToDecryptMessage,
+            NSLocalizedString(@"ERROR_MESSAGE_ATTACHMENT_FROM_OLD_CLIENT",
+                @"Error message when unable to receive an attachment because the sending client is too old."));
+        return NO;
+    }
+
+    if ([key length] < AES_KEY_SIZE + HMAC256_KEY_LENGTH) {
+        DDLogError(@"%@ Attachment key is too short.", self.logTag);
+        *error = invalidMessageError;
+        return NO;
+    }
+
+    // key: 32 byte AES key || 32 byte Hmac-SHA256 key.
+    NSData *encryptionKey = [key subdataWithRange:NSMakeRange(0, AES_KEY_SIZE)];
+    NSData *hmacKey = [key subdataWithRange:NSMakeRange(AES_KEY_SIZE, HMAC256_KEY_LENGTH)];
+
+    CCHmacContext hmacContext;
+    CCHmacInit(&hmacContext, kCCHmacAlgSHA256, [hmacKey bytes], [hmacKey length]);
+    CC_SHA256_CTX digestContext;
+    CC_SHA256_Init(&digestContext);
+
+    __block CCCryptorRef cryptor = NULL;
+    __block unsigned long long plaintextLength = 0;
+    NSMutableData *outputBuffer = [NSMutableData dataWithLength:kAttachmentStreamChunkSize + kCCBlockSizeAES128];
+
+    // Writes decrypted data, discarding any padding beyond unpaddedSize.
+    BOOL (^writePlainText)(const uint8_t *, size_t) = ^(const uint8_t *bytes, size_t length) {
+        unsigned long long writeLength = length;
+        if (unpaddedSize > 0) {
+            // Work around for legacy iOS client's which weren't setting padding size.
+            // Since we know those clients pre-date attachment padding we write the entire data.
+            writeLength = (plaintextLength >= unpaddedSize ? 0 : MIN(length, unpaddedSize - plaintextLength));
+        }
+        plaintextLength += length;
+        if (writeLength < 1) {
+            return YES;
+        }
+        return OWSWriteAllBytesToStream(outputStream, bytes, (NSUInteger)writeLength);
+    };
+
+    // dataToDecrypt: IV || Ciphertext || truncated MAC(IV||Ciphertext)
+    //
+    // We don't know where the ciphertext ends until we reach the end of the input,
+    // so we always hold back the last HMAC256_OUTPUT_LENGTH bytes that we've read.
+    NSMutableData *pendingData = [NSMutableData dataWithCapacity:kAttachmentStreamChunkSize + HMAC256_OUTPUT_LENGTH];
+    NSMutableData *inputBuffer = [NSMutableData dataWithLength:kAttachmentStreamChunkSize];
+    BOOL success = YES;
+    while (success) {
+        NSInteger bytesRead = [inputStream read:inputBuffer.mutableBytes maxLength:inputBuffer.length];
+        if (bytesRead < 0) {
+            DDLogError(@"%@ Failed to read from input stream: %@", self.logTag, inputStream.streamError);
+            success = NO;
+            break;
+        } else if (bytesRead == 0) {
+            break;
+        }
+        [pendingData appendBytes:inputBuffer.bytes length:(NSUInteger)bytesRead];
+
+        if (!cryptor) {
+            if (pendingData.length < AES_CBC_IV_LENGTH) {
+                continue;
+            }
+            CCCryptorStatus cryptStatus = CCCryptorCreate(kCCDecrypt,
+                kCCAlgorithmAES128,
+                kCCOptionPKCS7Padding,
+                [encryptionKey bytes],
+                [encryptionKey length],
+                pendingData.bytes,
+                &cryptor);
+            if (cryptStatus != kCCSuccess) {
+                DDLogError(@"%@ CCCryptorCreate failed with status: %d", self.logTag, (int32_t)cryptStatus);
+                success = NO;
+                break;
+            }
+            CCHmacUpdate(&hmacContext, pendingData.bytes, AES_CBC_IV_LENGTH);
+            CC_SHA256_Update(&digestContext, pendingData.bytes, AES_CBC_IV_LENGTH);
+            [pendingData replaceBytesInRange:NSMakeRange(0, AES_CBC_IV_LENGTH) withBytes:NULL length:0];
+        }
+
+        if (pendingData.length <= HMAC256_OUTPUT_LENGTH) {
+            continue;
+        }
+        size_t cipherTextLength = pendingData.length - HMAC256_OUTPUT_LENGTH;
+        CCHmacUpdate(&hmacContext, pendingData.bytes, cipherTextLength);
+        CC_SHA256_Update(&digestContext, pendingData.bytes, (CC_LONG)cipherTextLength);
+
+        size_t bytesDecrypted = 0;
+        CCCryptorStatus cryptStatus = CCCryptorUpdate(
+            cryptor, pendingData.bytes, cipherTextLength, outputBuffer.mutableBytes, outputBuffer.length, &bytesDecrypted);
+        if (cryptStatus != kCCSuccess) {
+            DDLogError(@"%@ CCCryptorUpdate failed with status: %d", self.logTag, (int32_t)cryptStatus);
+            success = NO;
+            break;
+        }
+        success = writePlainText(outputBuffer.bytes, bytesDecrypted);
+        [pendingData replaceBytesInRange:NSMakeRange(0, cipherTextLength) withBytes:NULL length:0];
+    }
+
+    if (success && (!cryptor || pendingData.length != HMAC256_OUTPUT_LENGTH)) {
+        DDLogError(@"%@ Message shorter than crypto overhead!", self.logTag);
+        success = NO;
+    }
+
+    if (success) {
+        size_t bytesDecrypted = 0;
+        CCCryptorStatus cryptStatus
+            = CCCryptorFinal(cryptor, outputBuffer.mutableBytes, outputBuffer.length, &bytesDecrypted);
+        if (cryptStatus != kCCSuccess) {
+            DDLogError(@"%@ Failed CBC decryption", self.logTag);
+            success = NO;
+        } else {
+            success = writePlainText(outputBuffer.bytes, bytesDecrypted);
+        }
+    }
+    if (cryptor) {
+        CCCryptorRelease(cryptor);
+    }
+    if (!success) {
+        *error = invalidMessageError;
+        return NO;
+    }
+
+    // Verify hmac of: iv || encrypted data
+    uint8_t ourHmacBytes[CC_SHA256_DIGEST_LENGTH];
+    CCHmacFinal(&hmacContext, ourHmacBytes);
+    NSData *ourHmac = [NSData dataWithBytes:ourHmacBytes length:HMAC256_OUTPUT_LENGTH];
+    NSData *theirHmac = [pendingData copy];
+    if (![ourHmac ows_constantTimeIsEqualToData:theirHmac]) {
+        DDLogError(@"%@ %s Bad HMAC on decrypting payload. Their MAC: %@, our MAC: %@",
+            self.logTag,
+            __PRETTY_FUNCTION__,
+            theirHmac,
+            ourHmac);
+        *error = invalidMessageError;
+        return NO;
+    }
+
+    // Verify digest of: iv || encrypted data || hmac
+    CC_SHA256_Update(&digestContext, ourHmacBytes, HMAC256_OUTPUT_LENGTH);
+    uint8_t ourDigestBytes[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(ourDigestBytes, &digestContext);
+    NSData *ourDigest = [NSData dataWithBytes:ourDigestBytes length:CC_SHA256_DIGEST_LENGTH];
+    if (![ourDigest ows_constantTimeIsEqualToData:digest]) {
+        DDLogWarn(@"%@ Bad digest on decrypting payload. Their digest: %@, our digest: %@", self.logTag, digest, ourDigest);
+        *error = invalidMessageError;
+        return NO;
+    }
+
+    if (unpaddedSize > plaintextLength) {
+        *error = invalidMessageError;
+        return NO;
+    }
+
+    DDLogInfo(@"%@ decrypted attachment with unpaddedSize: %u, paddedSize: %llu", self.logTag, unpaddedSize, plaintextLength);
+    return YES;
+}
+
++ (BOOL)encryptAttachmentAtPath:(NSString *)plaintextFilePath
+                         toPath:(NSString *)encryptedFilePath
+                         outKey:(NSData *_Nonnull *_Nullable)outKey
+                      outDigest:(NSData *_Nonnull *_Nullable)outDigest
+                          error:(NSError **)error
+{
+    OWSAssert(plaintextFilePath.length > 0);
+    OWSAssert(encryptedFilePath.length > 0);
+
+    NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:plaintextFilePath];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:encryptedFilePath append:NO];
+    [inputStream open];
+    [outputStream open];
+    BOOL success = [self encryptAttachmentStream:inputStream
+                                    outputStream:outputStream
+                                          outKey:outKey
+                                       outDigest:outDigest
+                                           error:error];
+    [inputStream close];
+    [outputStream close];
+
+    if (!success) {
+        [OWSFileSystem deleteFileIfExists:encryptedFilePath];
+    }
+    return success;
+}
+
++ (BOOL)decryptAttachmentAtPath:(NSString *)encryptedFilePath
+                         toPath:(NSString *)plaintextFilePath
+                        withKey:(NSData *)key
+                         digest:(nullable NSData *)digest
+                   unpaddedSize:(UInt32)unpaddedSize
+                          error:(NSError **)error
+{
+    OWSAssert(encryptedFilePath.length > 0);
+    OWSAssert(plaintextFilePath.length > 0);
+
+    NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:encryptedFilePath];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:plaintextFilePath append:NO];
+    [inputStream open];
+    [outputStream open];
+    BOOL success = [self decryptAttachmentStream:inputStream
+                                    outputStream:outputStream
+                                         withKey:key
+                                          digest:digest
+                                    unpaddedSize:unpaddedSize
+                                           error:error];
+    [inputStream close];
+    [outputStream close];
+
+    if (!success) {
+        // The output may contain unauthenticated plaintext.
+        [OWSFileSystem deleteFileIfExists:plaintextFilePath];
+    }
+    return success;
+}
+
 + (nullable NSData *)encryptAESGCMWithData:(NSData *)plaintext key:(OWSAES256Key *)key
 {
     NSData *initializationVector = [Cryptography generateRandomBytes:kAESGCM256_IVLength];
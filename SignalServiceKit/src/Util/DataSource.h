@@ -14,8 +14,28 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, nullable) NSString *sourceFilename;
 
 // Should not be called unless necessary as it can involve an expensive read.
+//
+// Prefer mappedData, inputStream or dataInRange: which avoid loading the
+// whole file into memory.
 - (NSData *)data;
 
+// Returns the data without reading it all into memory, if possible; file-backed
+// sources are memory-mapped.  The result should not be retained longer than
+// necessary.
+//
+// Will only return nil in the error case.
+- (nullable NSData *)mappedData;
+
+// Returns a new, unopened stream for the data.
+//
+// Will only return nil in the error case.
+- (nullable NSInputStream *)inputStream;
+
+// Reads only the requested bytes.
+//
+// Will only return nil in the error case, including out-of-bounds ranges.
+- (nullable NSData *)dataInRange:(NSRange)range;
+
 // The URL for the data.  Should always be a File URL.
 //
 // Should not be called unless necessary as it can involve an expensive write.
@@ -35,6 +55,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (BOOL)isValidImage;
 
+// The number of times (and total bytes) a file-backed data source has read
+// its entire contents into memory.  Large values indicate callers that should
+// use one of the lighter accessors.
++ (NSUInteger)materializationCount;
++ (unsigned long long)materializedByteCount;
+
 @end
 
 #pragma mark -
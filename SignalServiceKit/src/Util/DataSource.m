@@ -22,10 +22,16 @@ NS_ASSUME_NONNULL_BEGIN
 // ensure the data is on disk and return a URL, barring an error.
 - (nullable NSString *)dataPathIfOnDisk;
 
+// Records that a data source has read its entire contents into memory.
++ (void)recordMaterializationOfLength:(unsigned long long)length;
+
 @end
 
 #pragma mark -
 
+static NSUInteger DataSourceMaterializationCount = 0;
+static unsigned long long DataSourceMaterializedByteCount = 0;
+
 @implementation DataSource
 
 - (NSData *)data
@@ -34,6 +40,24 @@ NS_ASSUME_NONNULL_BEGIN
     return nil;
 }
 
+- (nullable NSData *)mappedData
+{
+    OWSFail(@"%@ Missing required method: mappedData", self.logTag);
+    return nil;
+}
+
+- (nullable NSInputStream *)inputStream
+{
+    OWSFail(@"%@ Missing required method: inputStream", self.logTag);
+    return nil;
+}
+
+- (nullable NSData *)dataInRange:(NSRange)range
+{
+    OWSFail(@"%@ Missing required method: dataInRange:", self.logTag);
+    return nil;
+}
+
 - (nullable NSURL *)dataUrl
 {
     OWSFail(@"%@ Missing required method: dataUrl", self.logTag);
@@ -72,10 +96,35 @@ NS_ASSUME_NONNULL_BEGIN
         // is considerably more performant, so try to do that.
         return [NSData ows_isValidImageAtPath:dataPath];
     }
-    NSData *data = [self data];
+    NSData *_Nullable data = [self mappedData];
     return [data ows_isValidImage];
 }
 
++ (void)recordMaterializationOfLength:(unsigned long long)length
+{
+    @synchronized([DataSource class])
+    {
+        DataSourceMaterializationCount++;
+        DataSourceMaterializedByteCount += length;
+    }
+}
+
++ (NSUInteger)materializationCount
+{
+    @synchronized([DataSource class])
+    {
+        return DataSourceMaterializationCount;
+    }
+}
+
++ (unsigned long long)materializedByteCount
+{
+    @synchronized([DataSource class])
+    {
+        return DataSourceMaterializedByteCount;
+    }
+}
+
 @end
 
 #pragma mark -
@@ -160,6 +209,31 @@ NS_ASSUME_NONNULL_BEGIN
     return self.dataValue;
 }
 
+- (nullable NSData *)mappedData
+{
+    OWSAssert(self.dataValue);
+
+    return self.dataValue;
+}
+
+- (nullable NSInputStream *)inputStream
+{
+    OWSAssert(self.dataValue);
+
+    return [NSInputStream inputStreamWithData:self.dataValue];
+}
+
+- (nullable NSData *)dataInRange:(NSRange)range
+{
+    OWSAssert(self.dataValue);
+
+    if (NSMaxRange(range) > self.dataValue.length) {
+        OWSFail(@"%@ Invalid range: %@, %lu", self.logTag, NSStringFromRange(range), (unsigned long)self.dataValue.length);
+        return nil;
+    }
+    return [self.dataValue subdataWithRange:range];
+}
+
 - (nullable NSURL *)dataUrl
 {
     NSString *_Nullable path = [self dataPath];
@@ -227,6 +301,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 // These properties are lazy-populated.
 @property (nonatomic) NSData *cachedData;
+@property (nonatomic) NSData *cachedMappedData;
 @property (nonatomic) NSNumber *cachedDataLength;
 
 @end
@@ -298,8 +373,11 @@ NS_ASSUME_NONNULL_BEGIN
     @synchronized(self)
     {
         if (!self.cachedData) {
-            DDLogError(@"%@ ---- reading data", self.logTag);
             self.cachedData = [NSData dataWithContentsOfFile:self.filePath];
+            if (self.cachedData) {
+                DDLogWarn(@"%@ Reading entire file into memory: %lu", self.logTag, (unsigned long)self.cachedData.length);
+                [DataSource recordMaterializationOfLength:self.cachedData.length];
+            }
         }
         if (!self.cachedData) {
             OWSFail(@"%@ Could not read data from disk: %@", self.logTag, self.filePath);
@@ -309,6 +387,68 @@ NS_ASSUME_NONNULL_BEGIN
     }
 }
 
+- (nullable NSData *)mappedData
+{
+    OWSAssert(self.filePath);
+
+    @synchronized(self)
+    {
+        if (self.cachedData) {
+            return self.cachedData;
+        }
+        if (!self.cachedMappedData) {
+            NSError *error;
+            self.cachedMappedData =
+                [NSData dataWithContentsOfFile:self.filePath options:NSDataReadingMappedIfSafe error:&error];
+            if (!self.cachedMappedData) {
+                OWSFail(@"%@ Could not map data from disk: %@, %@", self.logTag, self.filePath, error);
+            }
+        }
+        return self.cachedMappedData;
+    }
+}
+
+- (nullable NSInputStream *)inputStream
+{
+    OWSAssert(self.filePath);
+
+    NSInputStream *_Nullable inputStream = [NSInputStream inputStreamWithFileAtPath:self.filePath];
+    if (!inputStream) {
+        OWSFail(@"%@ Could not open stream for file: %@", self.logTag, self.filePath);
+    }
+    return inputStream;
+}
+
+- (nullable NSData *)dataInRange:(NSRange)range
+{
+    OWSAssert(self.filePath);
+
+    if (NSMaxRange(range) > self.dataLength) {
+        OWSFail(@"%@ Invalid range: %@, %lu", self.logTag, NSStringFromRange(range), (unsigned long)self.dataLength);
+        return nil;
+    }
+
+    NSFileHandle *_Nullable fileHandle = [NSFileHandle fileHandleForReadingAtPath:self.filePath];
+    if (!fileHandle) {
+        OWSFail(@"%@ Could not open file: %@", self.logTag, self.filePath);
+        return nil;
+    }
+    NSData *_Nullable data;
+    @try {
+        [fileHandle seekToFileOffset:range.location];
+        data = [fileHandle readDataOfLength:range.length];
+    } @catch (NSException *exception) {
+        OWSFail(@"%@ Could not read file: %@, %@", self.logTag, self.filePath, exception);
+    }
+    [fileHandle closeFile];
+
+    if (data.length != range.length) {
+        OWSFail(@"%@ Short read from file: %@", self.logTag, self.filePath);
+        return nil;
+    }
+    return data;
+}
+
 - (nullable NSURL *)dataUrl
 {
     OWSAssert(self.filePath);
@@ -0,0 +1,169 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "Contact.h"
+#import "ContactsUpdater.h"
+#import "Cryptography.h"
+#import "OWSFakeNetworkManager.h"
+#import "SignalRecipient.h"
+#import <XCTest/XCTest.h>
+
+// Answers contact intersection requests for a fixed set of registered phone numbers.
+@interface ContactsUpdaterStubNetworkManager : OWSFakeNetworkManager
+
+@property (nonatomic) NSSet<NSString *> *registeredPhoneNumbers;
+@property (atomic) NSUInteger requestCount;
+@property (atomic) NSUInteger hashCount;
+
+@end
+
+@implementation ContactsUpdaterStubNetworkManager
+
+- (void)makeRequest:(TSRequest *)request
+            success:(void (^)(NSURLSessionDataTask *task, id responseObject))success
+            failure:(void (^)(NSURLSessionDataTask *task, NSError *error))failure
+{
+    if (![request isKindOfClass:[TSContactsIntersectionRequest class]]) {
+        [super makeRequest:request success:success failure:failure];
+        return;
+    }
+
+    NSMutableSet<NSString *> *registeredHashes = [NSMutableSet new];
+    for (NSString *phoneNumber in self.registeredPhoneNumbers) {
+        [registeredHashes addObject:[Cryptography truncatedSHA1Base64EncodedWithoutPadding:phoneNumber]];
+    }
+
+    NSArray<NSString *> *hashes = request.parameters[@"contacts"];
+    NSMutableArray<NSDictionary *> *contacts = [NSMutableArray new];
+    for (NSString *hash in hashes) {
+        if ([registeredHashes containsObject:hash]) {
+            [contacts addObject:@{ @"token" : hash }];
+        }
+    }
+    @synchronized(self)
+    {
+        self.requestCount++;
+        self.hashCount += hashes.count;
+    }
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        success([NSURLSessionDataTask new], @{ @"contacts" : contacts });
+    });
+}
+
+@end
+
+#pragma mark -
+
+@interface ContactsUpdaterTest : XCTestCase
+
+@property (nonatomic) ContactsUpdaterStubNetworkManager *networkManager;
+@property (nonatomic) ContactsUpdater *contactsUpdater;
+
+@end
+
+@implementation ContactsUpdaterTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [SignalRecipient removeAllObjectsInCollection];
+    self.networkManager = [ContactsUpdaterStubNetworkManager new];
+    self.contactsUpdater = [[ContactsUpdater alloc] initWithNetworkManager:self.networkManager];
+}
+
+- (NSArray<Contact *> *)contactsWithPhoneNumbers:(NSArray<NSString *> *)phoneNumbers
+{
+    NSMutableArray<Contact *> *contacts = [NSMutableArray new];
+    for (NSString *phoneNumber in phoneNumbers) {
+        [contacts addObject:[[Contact alloc] initWithFirstName:phoneNumber
+                                                      lastName:nil
+                                          userTextPhoneNumbers:@[ phoneNumber ]
+                                                     imageData:nil
+                                                     contactID:(ABRecordID)contacts.count]];
+    }
+    return contacts;
+}
+
+- (NSArray<NSString *> *)phoneNumbersWithCount:(NSUInteger)count offset:(NSUInteger)offset
+{
+    NSMutableArray<NSString *> *phoneNumbers = [NSMutableArray new];
+    for (NSUInteger i = 0; i < count; i++) {
+        [phoneNumbers addObject:[NSString stringWithFormat:@"+1323555%04lu", (unsigned long)(offset + i)]];
+    }
+    return phoneNumbers;
+}
+
+- (void)intersectContacts:(NSArray<Contact *> *)contacts forceFullIntersection:(BOOL)forceFullIntersection
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Intersection"];
+    [self.contactsUpdater updateSignalContactIntersectionWithABContacts:contacts
+        forceFullIntersection:forceFullIntersection
+        success:^{
+            [expectation fulfill];
+        }
+        failure:^(NSError *error) {
+            XCTFail(@"Intersection failed with error: %@", error);
+            [expectation fulfill];
+        }];
+    [self waitForExpectationsWithTimeout:10.0
+                                 handler:^(NSError *error) {
+                                     if (error) {
+                                         XCTFail(@"Expectation Failed with error: %@", error);
+                                     }
+                                 }];
+}
+
+- (void)testFullIntersectionIsChunked
+{
+    NSArray<NSString *> *phoneNumbers = [self phoneNumbersWithCount:5000 offset:0];
+    NSArray<NSString *> *registeredPhoneNumbers = [phoneNumbers subarrayWithRange:NSMakeRange(0, 500)];
+    self.networkManager.registeredPhoneNumbers = [NSSet setWithArray:registeredPhoneNumbers];
+
+    [self intersectContacts:[self contactsWithPhoneNumbers:phoneNumbers] forceFullIntersection:YES];
+
+    XCTAssertEqual(3, self.networkManager.requestCount);
+    XCTAssertEqual(5000, self.networkManager.hashCount);
+    XCTAssertEqual(500, [SignalRecipient numberOfKeysInCollection]);
+    XCTAssertNotNil([SignalRecipient recipientWithTextSecureIdentifier:registeredPhoneNumbers.lastObject]);
+    XCTAssertNil([SignalRecipient recipientWithTextSecureIdentifier:phoneNumbers.lastObject]);
+}
+
+- (void)testIncrementalIntersectionOnlySendsNewPhoneNumbers
+{
+    NSArray<NSString *> *phoneNumbers = [self phoneNumbersWithCount:100 offset:0];
+    NSArray<NSString *> *newPhoneNumbers = [self phoneNumbersWithCount:10 offset:100];
+    self.networkManager.registeredPhoneNumbers =
+        [NSSet setWithObjects:phoneNumbers.firstObject, newPhoneNumbers.firstObject, nil];
+
+    [self intersectContacts:[self contactsWithPhoneNumbers:phoneNumbers] forceFullIntersection:YES];
+    XCTAssertEqual(100, self.networkManager.hashCount);
+    XCTAssertEqual(1, [SignalRecipient numberOfKeysInCollection]);
+
+    self.networkManager.hashCount = 0;
+    [self intersectContacts:[self contactsWithPhoneNumbers:[phoneNumbers arrayByAddingObjectsFromArray:newPhoneNumbers]]
+        forceFullIntersection:NO];
+    XCTAssertEqual(10, self.networkManager.hashCount);
+    XCTAssertEqual(2, [SignalRecipient numberOfKeysInCollection]);
+
+    // Nothing new to intersect.
+    self.networkManager.hashCount = 0;
+    [self intersectContacts:[self contactsWithPhoneNumbers:phoneNumbers] forceFullIntersection:NO];
+    XCTAssertEqual(0, self.networkManager.hashCount);
+}
+
+- (void)testFullIntersectionRemovesUnregisteredRecipients
+{
+    NSArray<NSString *> *phoneNumbers = [self phoneNumbersWithCount:10 offset:0];
+    self.networkManager.registeredPhoneNumbers = [NSSet setWithArray:phoneNumbers];
+    [self intersectContacts:[self contactsWithPhoneNumbers:phoneNumbers] forceFullIntersection:YES];
+    XCTAssertEqual(10, [SignalRecipient numberOfKeysInCollection]);
+
+    self.networkManager.registeredPhoneNumbers = [NSSet setWithObject:phoneNumbers.firstObject];
+    [self intersectContacts:[self contactsWithPhoneNumbers:phoneNumbers] forceFullIntersection:YES];
+    XCTAssertEqual(1, [SignalRecipient numberOfKeysInCollection]);
+}
+
+@end
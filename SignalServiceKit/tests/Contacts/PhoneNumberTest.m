@@ -4,6 +4,7 @@
 
 #import <XCTest/XCTest.h>
 #import "PhoneNumber.h"
+#import "PhoneNumberUtil.h"
 
 @interface PhoneNumberTest : XCTestCase
 
@@ -130,4 +131,35 @@
     XCTAssertTrue([parsed containsObject:@"+13235551234"]);
 }
 
+- (void)testTryParsePhoneNumbersFromUserSpecifiedTexts
+{
+    NSArray<NSString *> *texts = @[ @"323 555 1234", @"323-555-1234", @"323 555 1234", @"8341639157", @"" ];
+    NSDictionary<NSString *, NSArray<PhoneNumber *> *> *parsed =
+        [PhoneNumber tryParsePhoneNumbersFromUserSpecifiedTexts:texts clientPhoneNumber:@"+13213214321"];
+    XCTAssertEqual(4, parsed.count);
+    for (NSString *text in texts) {
+        NSArray<PhoneNumber *> *expected =
+            [PhoneNumber tryParsePhoneNumbersFromsUserSpecifiedText:text clientPhoneNumber:@"+13213214321"];
+        XCTAssertEqualObjects([parsed[text] valueForKey:@"e164"], [expected valueForKey:@"e164"]);
+    }
+    XCTAssertEqual(0, parsed[@""].count);
+}
+
+- (void)testParseCachesFailures
+{
+    PhoneNumberUtil *phoneNumberUtil = [PhoneNumberUtil sharedUtil];
+
+    NSError *error;
+    XCTAssertNil([phoneNumberUtil parse:@"not a phone number" defaultRegion:@"US" error:&error]);
+    XCTAssertNotNil(error);
+
+    NSUInteger missCount = phoneNumberUtil.parseCacheMissCount;
+    NSUInteger hitCount = phoneNumberUtil.parseCacheHitCount;
+    error = nil;
+    XCTAssertNil([phoneNumberUtil parse:@"not a phone number" defaultRegion:@"US" error:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertEqual(missCount, phoneNumberUtil.parseCacheMissCount);
+    XCTAssertEqual(hitCount + 1, phoneNumberUtil.parseCacheHitCount);
+}
+
 @end
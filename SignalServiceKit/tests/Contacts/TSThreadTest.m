@@ -3,12 +3,14 @@
 //
 
 #import "OWSDevice.h"
+#import "OWSThreadInboxSummary.h"
 #import "TSAttachmentStream.h"
 #import "TSContactThread.h"
 #import "TSIncomingMessage.h"
 #import "TSOutgoingMessage.h"
 #import "TSStorageManager.h"
 #import <XCTest/XCTest.h>
+#import <YapDatabase/YapDatabaseConnection.h>
 
 @interface TSThreadTest : XCTestCase
 
@@ -113,4 +115,93 @@
     XCTAssertFalse(outgoingFileStillExists);
 }
 
+- (void)testInboxSummaryTracksInteractions
+{
+    TSContactThread *thread = [[TSContactThread alloc] initWithUniqueId:@"fake-test-thread"];
+    [thread save];
+    [TSInteraction removeAllObjectsInCollection];
+
+    TSIncomingMessage *incomingMessage = [[TSIncomingMessage alloc] initWithTimestamp:10000
+                                                                             inThread:thread
+                                                                             authorId:@"fake-author-id"
+                                                                       sourceDeviceId:OWSDevicePrimaryDeviceId
+                                                                          messageBody:@"Incoming message body"];
+    [incomingMessage save];
+
+    OWSThreadInboxSummary *summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqualObjects(@"Incoming message body", summary.snippet);
+    XCTAssertEqual(1, summary.unreadCount);
+    XCTAssertTrue(summary.hasUnreadMessages);
+    XCTAssertEqual(thread.hasUnreadMessages, summary.hasUnreadMessages);
+
+    [[TSStorageManager sharedManager].newDatabaseConnection
+        readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            [incomingMessage markAsReadWithTransaction:transaction sendReadReceipt:NO updateExpiration:NO];
+        }];
+    summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqual(0, summary.unreadCount);
+    XCTAssertFalse(summary.hasUnreadMessages);
+
+    TSOutgoingMessage *outgoingMessage =
+        [[TSOutgoingMessage alloc] initWithTimestamp:20000 inThread:thread messageBody:@"outgoing message body"];
+    [outgoingMessage save];
+    summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqualObjects(@"outgoing message body", summary.snippet);
+    XCTAssertEqualObjects(thread.lastMessageLabel, summary.snippet);
+
+    [outgoingMessage remove];
+    summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqualObjects(@"Incoming message body", summary.snippet);
+
+    [thread remove];
+    XCTAssertNil([OWSThreadInboxSummary fetchObjectWithUniqueID:@"fake-test-thread"]);
+}
+
+- (void)testCoalescedThreadUpdates
+{
+    TSContactThread *thread = [[TSContactThread alloc] initWithUniqueId:@"fake-test-thread"];
+    [thread save];
+    [TSInteraction removeAllObjectsInCollection];
+
+    NSMutableArray<TSIncomingMessage *> *messages = [NSMutableArray new];
+    [[TSStorageManager sharedManager].newDatabaseConnection readWriteWithBlock:^(
+        YapDatabaseReadWriteTransaction *transaction) {
+        [TSThread performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                             block:^{
+                                                                 for (uint64_t i = 1; i <= 32; i++) {
+                                                                     TSIncomingMessage *message = [[TSIncomingMessage
+                                                                         alloc]
+                                                                         initWithTimestamp:i * 1000
+                                                                                  inThread:thread
+                                                                                  authorId:@"fake-author-id"
+                                                                            sourceDeviceId:OWSDevicePrimaryDeviceId
+                                                                               messageBody:@"Incoming message body"];
+                                                                     [message saveWithTransaction:transaction];
+                                                                     [messages addObject:message];
+                                                                 }
+                                                             }];
+    }];
+
+    TSThread *fetchedThread = [TSThread fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqualObjects(messages.lastObject.dateForSorting, fetchedThread.lastMessageDate);
+    XCTAssertTrue(fetchedThread.hasEverHadMessage);
+    OWSThreadInboxSummary *summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqual(32, summary.unreadCount);
+
+    [[TSStorageManager sharedManager].newDatabaseConnection readWriteWithBlock:^(
+        YapDatabaseReadWriteTransaction *transaction) {
+        [TSThread performWithCoalescedThreadUpdatesWithTransaction:transaction
+                                                             block:^{
+                                                                 for (TSIncomingMessage *message in messages) {
+                                                                     [message markAsReadWithTransaction:transaction
+                                                                                        sendReadReceipt:NO
+                                                                                       updateExpiration:NO];
+                                                                 }
+                                                             }];
+    }];
+    summary = [OWSThreadInboxSummary fetchObjectWithUniqueID:thread.uniqueId];
+    XCTAssertEqual(0, summary.unreadCount);
+    XCTAssertFalse(summary.hasUnreadMessages);
+}
+
 @end
@@ -82,6 +82,40 @@ NS_ASSUME_NONNULL_BEGIN
     XCTAssertEqual(2, [TSMessage numberOfKeysInCollection]);
 }
 
+- (void)testRemoveExpiredMessagesSpanningSeveralBatches
+{
+    TSThread *thread = [TSContactThread getOrCreateThreadWithContactId:@"fake-thread-id"];
+    uint64_t now = [NSDate ows_millisecondTimeStamp];
+
+    // More than fit in a single expiration transaction.
+    const NSUInteger kExpiredMessageCount = 600;
+    for (NSUInteger i = 0; i < kExpiredMessageCount; i++) {
+        TSMessage *expiredMessage = [[TSMessage alloc] initWithTimestamp:1
+                                                                inThread:thread
+                                                             messageBody:@"expiredMessage"
+                                                           attachmentIds:@[]
+                                                        expiresInSeconds:1
+                                                         expireStartedAt:now - 20000];
+        [expiredMessage save];
+    }
+
+    TSMessage *notYetExpiredMessage = [[TSMessage alloc] initWithTimestamp:1
+                                                                  inThread:thread
+                                                               messageBody:@"notYetExpiredMessage"
+                                                             attachmentIds:@[]
+                                                          expiresInSeconds:20
+                                                           expireStartedAt:now - 10000];
+    [notYetExpiredMessage save];
+
+    OWSDisappearingMessagesJob *job = [OWSDisappearingMessagesJob sharedJob];
+
+    // Sanity Check.
+    XCTAssertEqual(kExpiredMessageCount + 1, [TSMessage numberOfKeysInCollection]);
+    [job run];
+
+    XCTAssertEqual(1, [TSMessage numberOfKeysInCollection]);
+}
+
 - (void)testBecomeConsistentWithMessageConfiguration
 {
     TSThread *thread = [TSContactThread getOrCreateThreadWithContactId:@"fake-thread-id"];
@@ -8,6 +8,7 @@
 #import "OWSFakeContactsManager.h"
 #import "OWSFakeContactsUpdater.h"
 #import "OWSFakeNetworkManager.h"
+#import "OWSMessageSendScheduler.h"
 #import "OWSMessageSender.h"
 #import "OWSUploadingService.h"
 #import "TSAccountManager.h"
@@ -506,6 +507,40 @@ NS_ASSUME_NONNULL_BEGIN
     XCTAssertEqualObjects(recipient, recipients.firstObject);
 }
 
+- (void)testSendSchedulerPreservesLaneOrder
+{
+    OWSMessageSendScheduler *scheduler = [[OWSMessageSendScheduler alloc] initWithMaxConcurrentOperationCount:4];
+    NSMutableArray<NSNumber *> *completedOperations = [NSMutableArray new];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"All operations completed"];
+
+    NSUInteger operationCount = 10;
+    for (NSUInteger i = 0; i < operationCount; i++) {
+        NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:^{
+            // Give later operations a chance to overtake, were the lane not serial.
+            [NSThread sleepForTimeInterval:0.01];
+            @synchronized(completedOperations)
+            {
+                [completedOperations addObject:@(i)];
+                if (completedOperations.count == operationCount) {
+                    [expectation fulfill];
+                }
+            }
+        }];
+        [scheduler addOperation:operation
+                        laneKey:@"lane"
+                       priority:(i % 2 == 0 ? OWSMessageSendPriorityBackground : OWSMessageSendPriorityInteractive)];
+    }
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    NSMutableArray<NSNumber *> *expectedOperations = [NSMutableArray new];
+    for (NSUInteger i = 0; i < operationCount; i++) {
+        [expectedOperations addObject:@(i)];
+    }
+    XCTAssertEqualObjects(expectedOperations, completedOperations);
+    XCTAssertEqual(0, scheduler.pendingOperationCount);
+}
+
 @end
 
 NS_ASSUME_NONNULL_END
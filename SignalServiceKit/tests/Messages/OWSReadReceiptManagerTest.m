@@ -0,0 +1,170 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSLinkedDeviceReadReceipt.h"
+#import "OWSReadReceiptManager.h"
+#import "TSStorageManager.h"
+#import <XCTest/XCTest.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+extern NSString *const OWSPendingReadReceiptsForSenderCollection;
+extern NSString *const OWSPendingReadReceiptsForLinkedDevicesCollection;
+
+@interface OWSReadReceiptManager (Testing)
+
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, OWSLinkedDeviceReadReceipt *> *toLinkedDevicesReadReceiptMap;
+@property (nonatomic, readonly) NSMutableDictionary<NSString *, NSMutableSet<NSNumber *> *> *toSenderReadReceiptMap;
+@property (nonatomic) BOOL hasLoadedPendingReadReceipts;
+@property (nonatomic) NSUInteger pendingReadReceiptCount;
+@property (nonatomic, nullable) NSDate *firstPendingReadReceiptDate;
+@property (nonatomic, nullable) NSDate *lastPendingReadReceiptDate;
+@property (atomic) NSTimeInterval networkRetryDelaySeconds;
+
++ (NSString *)pendingReadReceiptKeyForSenderId:(NSString *)senderId timestamp:(uint64_t)timestamp;
+
+- (void)loadPendingReadReceiptsIfNecessary;
+- (BOOL)enqueueReadReceiptForSenderId:(NSString *)senderId timestamp:(uint64_t)timestamp;
+- (NSTimeInterval)delayUntilFlush;
+- (void)retryAfterNetworkFailureWithEnqueueBlock:(void (^)(void))enqueueBlock;
+
+@end
+
+#pragma mark -
+
+@interface OWSReadReceiptManagerTest : XCTestCase
+
+@property (nonatomic) OWSReadReceiptManager *readReceiptManager;
+
+@end
+
+#pragma mark -
+
+@implementation OWSReadReceiptManagerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.readReceiptManager = [OWSReadReceiptManager sharedManager];
+    [[TSStorageManager sharedManager] purgeCollection:OWSPendingReadReceiptsForSenderCollection];
+    [[TSStorageManager sharedManager] purgeCollection:OWSPendingReadReceiptsForLinkedDevicesCollection];
+    [self resetPendingReadReceipts];
+}
+
+- (void)tearDown
+{
+    [self resetPendingReadReceipts];
+
+    [super tearDown];
+}
+
+- (void)resetPendingReadReceipts
+{
+    OWSReadReceiptManager *readReceiptManager = self.readReceiptManager;
+    @synchronized(readReceiptManager)
+    {
+        [readReceiptManager.toLinkedDevicesReadReceiptMap removeAllObjects];
+        [readReceiptManager.toSenderReadReceiptMap removeAllObjects];
+        readReceiptManager.pendingReadReceiptCount = 0;
+        readReceiptManager.firstPendingReadReceiptDate = nil;
+        readReceiptManager.lastPendingReadReceiptDate = nil;
+    }
+}
+
+- (void)testLoadsPersistedReceiptsAfterRelaunch
+{
+    [[TSStorageManager sharedManager].dbReadWriteConnection
+        readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            for (uint64_t timestamp = 1; timestamp <= 3; timestamp++) {
+                [transaction setObject:@(timestamp)
+                                forKey:[OWSReadReceiptManager pendingReadReceiptKeyForSenderId:@"+13213214321"
+                                                                                     timestamp:timestamp]
+                          inCollection:OWSPendingReadReceiptsForSenderCollection];
+            }
+            [transaction setObject:[[OWSLinkedDeviceReadReceipt alloc] initWithSenderId:@"+13213214321" timestamp:3]
+                            forKey:@"fake-thread-id"
+                      inCollection:OWSPendingReadReceiptsForLinkedDevicesCollection];
+        }];
+
+    // Simulate a relaunch, with one of the receipts already pending in memory.
+    @synchronized(self.readReceiptManager)
+    {
+        self.readReceiptManager.hasLoadedPendingReadReceipts = NO;
+        [self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:1];
+    }
+    [self.readReceiptManager loadPendingReadReceiptsIfNecessary];
+
+    @synchronized(self.readReceiptManager)
+    {
+        XCTAssertTrue(self.readReceiptManager.hasLoadedPendingReadReceipts);
+        NSSet<NSNumber *> *expectedTimestamps = [NSSet setWithArray:@[ @(1), @(2), @(3) ]];
+        XCTAssertEqualObjects(expectedTimestamps, self.readReceiptManager.toSenderReadReceiptMap[@"+13213214321"]);
+        XCTAssertEqual(3, self.readReceiptManager.toLinkedDevicesReadReceiptMap[@"fake-thread-id"].timestamp);
+        XCTAssertEqual(4, self.readReceiptManager.pendingReadReceiptCount);
+    }
+}
+
+- (void)testFlushWaitsForQuietInterval
+{
+    @synchronized(self.readReceiptManager)
+    {
+        [self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:1];
+        NSTimeInterval delaySeconds = [self.readReceiptManager delayUntilFlush];
+        XCTAssertGreaterThan(delaySeconds, 0);
+        XCTAssertLessThanOrEqual(delaySeconds, 1);
+
+        // Receipts stopped arriving a while ago.
+        self.readReceiptManager.lastPendingReadReceiptDate = [NSDate dateWithTimeIntervalSinceNow:-1];
+        XCTAssertEqual(0, [self.readReceiptManager delayUntilFlush]);
+    }
+}
+
+- (void)testFlushDelayIsBounded
+{
+    @synchronized(self.readReceiptManager)
+    {
+        [self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:1];
+        self.readReceiptManager.firstPendingReadReceiptDate = [NSDate dateWithTimeIntervalSinceNow:-4.5];
+        XCTAssertLessThanOrEqual([self.readReceiptManager delayUntilFlush], 0.5);
+
+        // Receipts are still arriving, but the oldest has waited long enough.
+        self.readReceiptManager.firstPendingReadReceiptDate = [NSDate dateWithTimeIntervalSinceNow:-5];
+        XCTAssertEqual(0, [self.readReceiptManager delayUntilFlush]);
+    }
+}
+
+- (void)testFlushesImmediatelyAtThreshold
+{
+    @synchronized(self.readReceiptManager)
+    {
+        for (uint64_t timestamp = 1; timestamp < 500; timestamp++) {
+            [self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:timestamp];
+        }
+        XCTAssertGreaterThan([self.readReceiptManager delayUntilFlush], 0);
+
+        [self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:500];
+        XCTAssertEqual(0, [self.readReceiptManager delayUntilFlush]);
+    }
+}
+
+- (void)testNetworkRetryReenqueues
+{
+    NSTimeInterval networkRetryDelaySeconds = self.readReceiptManager.networkRetryDelaySeconds;
+    self.readReceiptManager.networkRetryDelaySeconds = 0.1;
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"re-enqueued"];
+    [self.readReceiptManager retryAfterNetworkFailureWithEnqueueBlock:^{
+        XCTAssertTrue([self.readReceiptManager enqueueReadReceiptForSenderId:@"+13213214321" timestamp:1]);
+        XCTAssertEqual(1, self.readReceiptManager.pendingReadReceiptCount);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    self.readReceiptManager.networkRetryDelaySeconds = networkRetryDelaySeconds;
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,132 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSThumbnailService.h"
+#import "TSAttachmentStream.h"
+#import "TSStorageManager.h"
+#import <XCTest/XCTest.h>
+
+@interface OWSThumbnailService (Testing)
+
+- (dispatch_queue_t)serialQueue;
+
+@end
+
+#pragma mark -
+
+@interface OWSThumbnailServiceTest : XCTestCase
+
+@property (nonatomic) TSAttachmentStream *attachment;
+
+@end
+
+#pragma mark -
+
+@implementation OWSThumbnailServiceTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [[TSStorageManager sharedManager] setupDatabaseWithSafeBlockingMigrations:^{
+    }];
+
+    UIGraphicsBeginImageContextWithOptions(CGSizeMake(400, 300), YES, 1.f);
+    [[UIColor redColor] setFill];
+    UIRectFill(CGRectMake(0, 0, 400, 300));
+    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+
+    self.attachment = [[TSAttachmentStream alloc] initWithContentType:@"image/png" sourceFilename:nil];
+    NSError *error;
+    XCTAssertTrue([self.attachment writeData:UIImagePNGRepresentation(image) error:&error]);
+    XCTAssertNil(error);
+}
+
+- (void)tearDown
+{
+    [[OWSThumbnailService sharedService] removeThumbnailsForAttachmentId:self.attachment.uniqueId];
+
+    [super tearDown];
+}
+
+// Returns the thumbnail, or nil if the request failed.
+- (nullable UIImage *)requestThumbnail
+{
+    __block UIImage *_Nullable result;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Thumbnail"];
+    [[OWSThumbnailService sharedService] thumbnailForAttachment:self.attachment
+        thumbnailSize:OWSThumbnailSizeSmall
+        success:^(UIImage *image) {
+            result = image;
+            [expectation fulfill];
+        }
+        failure:^{
+            [expectation fulfill];
+        }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    return result;
+}
+
+- (void)testCacheMissThenHit
+{
+    OWSThumbnailService *service = [OWSThumbnailService sharedService];
+    XCTAssertNil([service cachedThumbnailForAttachment:self.attachment thumbnailSize:OWSThumbnailSizeSmall]);
+
+    UIImage *_Nullable thumbnail = [self requestThumbnail];
+    XCTAssertNotNil(thumbnail);
+    CGFloat maxPixelSize = MAX(thumbnail.size.width, thumbnail.size.height) * thumbnail.scale;
+    XCTAssertLessThanOrEqual(maxPixelSize, (CGFloat)OWSThumbnailSizeSmall);
+
+    UIImage *_Nullable cachedThumbnail =
+        [service cachedThumbnailForAttachment:self.attachment thumbnailSize:OWSThumbnailSizeSmall];
+    XCTAssertEqual(thumbnail, cachedThumbnail);
+    XCTAssertNil([service cachedThumbnailForAttachment:self.attachment thumbnailSize:OWSThumbnailSizeLarge]);
+}
+
+- (void)testRemoval
+{
+    OWSThumbnailService *service = [OWSThumbnailService sharedService];
+    XCTAssertNotNil([self requestThumbnail]);
+
+    [service removeThumbnailsForAttachmentId:self.attachment.uniqueId];
+    XCTAssertNil([service cachedThumbnailForAttachment:self.attachment thumbnailSize:OWSThumbnailSizeSmall]);
+
+    // Wait for the thumbnails to be removed from disk.
+    dispatch_sync(service.serialQueue, ^{
+    });
+    NSArray<NSString *> *fileNames =
+        [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[OWSThumbnailService thumbnailsFolder] error:nil];
+    for (NSString *fileName in fileNames) {
+        XCTAssertNotEqualObjects(
+            self.attachment.uniqueId, [OWSThumbnailService attachmentIdForThumbnailFileName:fileName]);
+    }
+}
+
+- (void)testRemovalDuringGenerationIsNotCached
+{
+    OWSThumbnailService *service = [OWSThumbnailService sharedService];
+
+    // Hold the generation until the attachment has been removed.
+    dispatch_suspend(service.serialQueue);
+    __block BOOL didSucceed = NO;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Thumbnail"];
+    [service thumbnailForAttachment:self.attachment
+        thumbnailSize:OWSThumbnailSizeSmall
+        success:^(UIImage *image) {
+            didSucceed = YES;
+            [expectation fulfill];
+        }
+        failure:^{
+            [expectation fulfill];
+        }];
+    [service removeThumbnailsForAttachmentId:self.attachment.uniqueId];
+    dispatch_resume(service.serialQueue);
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertFalse(didSucceed);
+    XCTAssertNil([service cachedThumbnailForAttachment:self.attachment thumbnailSize:OWSThumbnailSizeSmall]);
+}
+
+@end
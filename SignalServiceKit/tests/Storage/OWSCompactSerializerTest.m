@@ -0,0 +1,246 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSCompactSerializer.h"
+#import "TSAttachmentPointer.h"
+#import "TSContactThread.h"
+#import "TSIncomingMessage.h"
+#import "TSOutgoingMessage.h"
+#import "TSStorageManager.h"
+#import <XCTest/XCTest.h>
+
+static const NSUInteger kBenchmarkMessageCount = 1000;
+
+@interface OWSCompactSerializer (Testing)
+
++ (NSDictionary *)migrationCursorWithTransaction:(YapDatabaseReadTransaction *)transaction;
+
+@end
+
+#pragma mark -
+
+@interface OWSCompactSerializerTest : XCTestCase
+
+@property (nonatomic) TSContactThread *thread;
+
+@end
+
+#pragma mark -
+
+@implementation OWSCompactSerializerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [[TSStorageManager sharedManager].dbReadWriteConnection
+        readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            self.thread = [TSContactThread getOrCreateThreadWithContactId:@"+13213214321" transaction:transaction];
+        }];
+}
+
+- (NSArray<TSMessage *> *)messagesWithCount:(NSUInteger)count
+{
+    NSMutableArray<TSMessage *> *messages = [NSMutableArray new];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *body =
+            [NSString stringWithFormat:@"Message %lu, which is about as long as a typical message.", (unsigned long)i];
+        if (i % 2 == 0) {
+            [messages addObject:[[TSIncomingMessage alloc] initWithTimestamp:1000 + i
+                                                                    inThread:self.thread
+                                                                    authorId:self.thread.contactIdentifier
+                                                              sourceDeviceId:1
+                                                                 messageBody:body]];
+        } else {
+            [messages addObject:[[TSOutgoingMessage alloc] initWithTimestamp:1000 + i
+                                                                    inThread:self.thread
+                                                                 messageBody:body]];
+        }
+    }
+    return messages;
+}
+
+- (void)testRoundTripsMessages
+{
+    YapDatabaseSerializer serializer = [OWSCompactSerializer serializer];
+    for (TSMessage *message in [self messagesWithCount:4]) {
+        NSData *data = serializer([TSInteraction collection], @"key", message);
+        XCTAssertTrue([OWSCompactSerializer isCompactData:data]);
+
+        TSMessage *decoded = [OWSCompactSerializer objectWithCompactData:data];
+        XCTAssertEqualObjects([message class], [decoded class]);
+        XCTAssertEqualObjects(message.body, decoded.body);
+        XCTAssertEqual(message.timestamp, decoded.timestamp);
+        XCTAssertEqualObjects(message.uniqueThreadId, decoded.uniqueThreadId);
+        XCTAssertEqualObjects(message.attachmentIds, decoded.attachmentIds);
+        XCTAssertTrue([decoded.attachmentIds isKindOfClass:[NSMutableArray class]]);
+        if ([decoded isKindOfClass:[TSOutgoingMessage class]]) {
+            XCTAssertTrue(
+                [((TSOutgoingMessage *)decoded).attachmentFilenameMap isKindOfClass:[NSMutableDictionary class]]);
+        }
+    }
+}
+
+- (void)testRoundTripsAttachmentPointers
+{
+    TSAttachmentPointer *pointer = [[TSAttachmentPointer alloc] initWithServerId:UINT64_MAX
+                                                                             key:[NSData dataWithBytes:"key" length:3]
+                                                                          digest:nil
+                                                                       byteCount:12345
+                                                                     contentType:@"image/jpeg"
+                                                                           relay:@""
+                                                                  sourceFilename:@"photo.jpg"
+                                                                  attachmentType:TSAttachmentTypeDefault];
+
+    NSData *data = [OWSCompactSerializer compactDataForObject:pointer];
+    TSAttachmentPointer *decoded = [OWSCompactSerializer objectWithCompactData:data];
+    XCTAssertEqual(pointer.serverId, decoded.serverId);
+    XCTAssertEqualObjects(pointer.encryptionKey, decoded.encryptionKey);
+    XCTAssertNil(decoded.digest);
+    XCTAssertEqual(pointer.byteCount, decoded.byteCount);
+    XCTAssertEqualObjects(pointer.contentType, decoded.contentType);
+    XCTAssertEqualObjects(pointer.sourceFilename, decoded.sourceFilename);
+    XCTAssertEqual(pointer.state, decoded.state);
+}
+
+- (void)testDecodesLegacyRows
+{
+    YapDatabaseDeserializer legacyDeserializer = ^id(NSString *collection, NSString *key, NSData *data) {
+        return [NSKeyedUnarchiver unarchiveObjectWithData:data];
+    };
+    YapDatabaseDeserializer deserializer =
+        [OWSCompactSerializer deserializerWithLegacyDeserializer:legacyDeserializer];
+
+    TSMessage *message = [self messagesWithCount:1].firstObject;
+    NSData *legacyData = [NSKeyedArchiver archivedDataWithRootObject:message];
+    XCTAssertFalse([OWSCompactSerializer isCompactData:legacyData]);
+
+    TSMessage *decoded = deserializer([TSInteraction collection], @"key", legacyData);
+    XCTAssertEqualObjects(message.body, decoded.body);
+}
+
+- (void)testRejectsMalformedData
+{
+    TSMessage *message = [self messagesWithCount:1].firstObject;
+    NSData *data = [OWSCompactSerializer compactDataForObject:message];
+    NSData *truncatedData = [data subdataWithRange:NSMakeRange(0, data.length - 1)];
+    XCTAssertThrows([OWSCompactSerializer objectWithCompactData:truncatedData]);
+}
+
+- (void)testCompactRowsAreSmaller
+{
+    NSUInteger compactSize = 0;
+    NSUInteger keyedSize = 0;
+    for (TSMessage *message in [self messagesWithCount:kBenchmarkMessageCount]) {
+        compactSize += [OWSCompactSerializer compactDataForObject:message].length;
+        keyedSize += [NSKeyedArchiver archivedDataWithRootObject:message].length;
+    }
+    XCTAssertLessThan(compactSize, keyedSize);
+}
+
+- (void)testPerformanceCompactEncode
+{
+    NSArray<TSMessage *> *messages = [self messagesWithCount:kBenchmarkMessageCount];
+    [self measureBlock:^{
+        for (TSMessage *message in messages) {
+            [OWSCompactSerializer compactDataForObject:message];
+        }
+    }];
+}
+
+- (void)testPerformanceKeyedEncode
+{
+    NSArray<TSMessage *> *messages = [self messagesWithCount:kBenchmarkMessageCount];
+    [self measureBlock:^{
+        for (TSMessage *message in messages) {
+            [NSKeyedArchiver archivedDataWithRootObject:message];
+        }
+    }];
+}
+
+- (void)testPerformanceCompactDecode
+{
+    NSMutableArray<NSData *> *rows = [NSMutableArray new];
+    for (TSMessage *message in [self messagesWithCount:kBenchmarkMessageCount]) {
+        [rows addObject:[OWSCompactSerializer compactDataForObject:message]];
+    }
+    [self measureBlock:^{
+        for (NSData *row in rows) {
+            [OWSCompactSerializer objectWithCompactData:row];
+        }
+    }];
+}
+
+- (void)testPerformanceKeyedDecode
+{
+    NSMutableArray<NSData *> *rows = [NSMutableArray new];
+    for (TSMessage *message in [self messagesWithCount:kBenchmarkMessageCount]) {
+        [rows addObject:[NSKeyedArchiver archivedDataWithRootObject:message]];
+    }
+    [self measureBlock:^{
+        for (NSData *row in rows) {
+            [NSKeyedUnarchiver unarchiveObjectWithData:row];
+        }
+    }];
+}
+
+#pragma mark - Migration
+
+// Runs a single batch of the migration, returning whether it is complete.
+- (BOOL)migrateBatch
+{
+    __block BOOL result = NO;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"migrated"];
+    [OWSCompactSerializer migrateLegacyRowsIncrementallyWithTimeBudget:0
+                                                            completion:^(BOOL isComplete) {
+                                                                result = isComplete;
+                                                                [expectation fulfill];
+                                                            }];
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    return result;
+}
+
+- (NSDictionary *)migrationCursor
+{
+    __block NSDictionary *result;
+    [[TSStorageManager sharedManager].newDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        result = [OWSCompactSerializer migrationCursorWithTransaction:transaction];
+    }];
+    return result;
+}
+
+- (void)testMigrationResumesFromCursor
+{
+    [[TSStorageManager sharedManager] purgeCollection:@"OWSCompactSerializerCollection"];
+    [[TSStorageManager sharedManager] purgeCollection:[TSInteraction collection]];
+    [[TSStorageManager sharedManager] purgeCollection:[TSAttachment collection]];
+
+    NSMutableArray<NSString *> *keys = [NSMutableArray new];
+    [[TSStorageManager sharedManager].dbReadWriteConnection
+        readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            for (TSMessage *message in [self messagesWithCount:250]) {
+                [message saveWithTransaction:transaction];
+                [keys addObject:message.uniqueId];
+            }
+        }];
+    [keys sortUsingSelector:@selector(compare:)];
+
+    // Each pass picks up where the previous one left off.
+    XCTAssertFalse([self migrateBatch]);
+    XCTAssertEqualObjects(@(0), [self migrationCursor][@"collectionIndex"]);
+    XCTAssertEqualObjects(keys[99], [self migrationCursor][@"key"]);
+
+    XCTAssertFalse([self migrateBatch]);
+    XCTAssertEqualObjects(keys[199], [self migrationCursor][@"key"]);
+
+    // The last batch of the collection moves on to the next collection.
+    XCTAssertFalse([self migrateBatch]);
+    XCTAssertEqualObjects(@(1), [self migrationCursor][@"collectionIndex"]);
+    XCTAssertNil([self migrationCursor][@"key"]);
+
+    XCTAssertTrue([self migrateBatch]);
+    XCTAssertTrue([self migrateBatch]);
+}
+
+@end
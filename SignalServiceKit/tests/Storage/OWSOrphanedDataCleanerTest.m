@@ -202,4 +202,90 @@
     XCTAssertEqual(0, [self numberOfItemsInAttachmentsFolder]);
 }
 
+- (void)testIncrementalCleanupKeepsFilesInUse
+{
+    TSContactThread *savedThread = [[TSContactThread alloc] initWithUniqueId:@"this-thread-exists"];
+    [savedThread save];
+
+    NSError *error;
+    TSAttachmentStream *attachmentStream =
+        [[TSAttachmentStream alloc] initWithContentType:@"image/jpeg" sourceFilename:nil];
+    [attachmentStream writeData:[@"in use" dataUsingEncoding:NSUTF8StringEncoding] error:&error];
+    [attachmentStream save];
+
+    TSIncomingMessage *incomingMessage = [[TSIncomingMessage alloc] initWithTimestamp:1
+                                                                             inThread:savedThread
+                                                                             authorId:@"fake-author-id"
+                                                                       sourceDeviceId:OWSDevicePrimaryDeviceId
+                                                                          messageBody:@"footch"
+                                                                        attachmentIds:@[ attachmentStream.uniqueId ]
+                                                                     expiresInSeconds:0];
+    [incomingMessage save];
+
+    NSString *attachmentFilePath = [attachmentStream filePath];
+    XCTAssert([[NSFileManager defaultManager] fileExistsAtPath:attachmentFilePath]);
+
+    __block OWSOrphanedDataCleanerReport *report;
+    NSUInteger windowCount = 0;
+    while (!report.isComplete && windowCount < 10) {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Cleanup"];
+        [OWSOrphanedDataCleaner cleanupIncrementallyWithTimeBudget:0
+                                                        completion:^(OWSOrphanedDataCleanerReport *windowReport) {
+                                                            report = windowReport;
+                                                            [expectation fulfill];
+                                                        }];
+        [self waitForExpectationsWithTimeout:5.0
+                                     handler:^(NSError *error) {
+                                         if (error) {
+                                             XCTFail(@"Expectation Failed with error: %@", error);
+                                         }
+                                     }];
+        windowCount++;
+    }
+
+    XCTAssert(report.isComplete);
+    XCTAssert([[NSFileManager defaultManager] fileExistsAtPath:attachmentFilePath]);
+    XCTAssertEqual(1, [self numberOfItemsInAttachmentsFolder]);
+    XCTAssertEqual(0, report.removedFileCount);
+    XCTAssertEqual(0, report.removedAttachmentCount);
+}
+
+- (void)testIncrementalCleanupResumesAcrossWindows
+{
+    NSError *error;
+    TSAttachmentStream *attachmentStream = [[TSAttachmentStream alloc] initWithContentType:@"image/jpeg" sourceFilename:nil];
+    NSData *data = [@"orphan" dataUsingEncoding:NSUTF8StringEncoding];
+    [attachmentStream writeData:data error:&error];
+    // Intentionally not saved, because we want a lingering file.
+
+    NSString *orphanedFilePath = [attachmentStream filePath];
+    XCTAssert([[NSFileManager defaultManager] fileExistsAtPath:orphanedFilePath]);
+
+    // With no time budget, each window only scans a single chunk.
+    __block OWSOrphanedDataCleanerReport *report;
+    NSUInteger windowCount = 0;
+    while (!report.isComplete && windowCount < 10) {
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Cleanup"];
+        [OWSOrphanedDataCleaner cleanupIncrementallyWithTimeBudget:0
+                                                        completion:^(OWSOrphanedDataCleanerReport *windowReport) {
+                                                            report = windowReport;
+                                                            [expectation fulfill];
+                                                        }];
+        [self waitForExpectationsWithTimeout:5.0
+                                     handler:^(NSError *error) {
+                                         if (error) {
+                                             XCTFail(@"Expectation Failed with error: %@", error);
+                                         }
+                                     }];
+        windowCount++;
+    }
+
+    XCTAssert(report.isComplete);
+    XCTAssertGreaterThan(windowCount, 1);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:orphanedFilePath]);
+    XCTAssertEqual(0, [self numberOfItemsInAttachmentsFolder]);
+    XCTAssertEqual(1, report.removedFileCount);
+    XCTAssertEqual((long long)data.length, report.reclaimedBytes);
+}
+
 @end
@@ -0,0 +1,92 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSWriteCoalescer.h"
+#import "TSContactThread.h"
+#import "TSOutgoingMessage.h"
+#import "TSStorageManager.h"
+#import <XCTest/XCTest.h>
+
+@interface OWSWriteCoalescerTest : XCTestCase
+
+@property (nonatomic) TSContactThread *thread;
+@property (nonatomic) OWSWriteCoalescer *coalescer;
+
+@end
+
+#pragma mark -
+
+@implementation OWSWriteCoalescerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [[TSStorageManager sharedManager].dbReadWriteConnection
+        readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            self.thread = [TSContactThread getOrCreateThreadWithContactId:@"+13334445555" transaction:transaction];
+        }];
+    [[TSStorageManager sharedManager] purgeCollection:[TSMessage collection]];
+
+    // A long window so that nothing is committed unless we flush.
+    self.coalescer =
+        [[OWSWriteCoalescer alloc] initWithDatabaseConnection:[TSStorageManager sharedManager].newDatabaseConnection
+                                             coalescingWindow:60];
+}
+
+// Returns the ids of the enqueued messages.
+- (NSArray<NSString *> *)enqueueMessageCount:(NSUInteger)count
+{
+    NSMutableArray<NSString *> *messageIds = [NSMutableArray new];
+    for (uint64_t i = 0; i < count; i++) {
+        TSOutgoingMessage *message =
+            [[TSOutgoingMessage alloc] initWithTimestamp:i inThread:self.thread messageBody:@"Coalesced"];
+        [messageIds addObject:message.uniqueId];
+        [self.coalescer asyncReadWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+            [message saveWithTransaction:transaction];
+        }];
+    }
+    return messageIds;
+}
+
+- (void)testPreservesOrderInFewerTransactions
+{
+    NSArray<NSString *> *messageIds = [self enqueueMessageCount:20];
+
+    // Each block should see the writes of the blocks before it.
+    __block BOOL didSeePriorWrites = NO;
+    [self.coalescer readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+        didSeePriorWrites = YES;
+        for (NSString *messageId in messageIds) {
+            if (![TSOutgoingMessage fetchObjectWithUniqueID:messageId transaction:transaction]) {
+                didSeePriorWrites = NO;
+            }
+        }
+    }];
+
+    XCTAssertTrue(didSeePriorWrites);
+    XCTAssertEqual(1, self.coalescer.committedTransactionCount);
+    XCTAssertEqual(21, self.coalescer.committedBlockCount);
+}
+
+- (void)testFlushAndWaitCommitsPendingBlocks
+{
+    NSArray<NSString *> *messageIds = [self enqueueMessageCount:5];
+
+    [self.coalescer flushAndWait];
+
+    XCTAssertEqual(1, self.coalescer.committedTransactionCount);
+    XCTAssertEqual(5, self.coalescer.committedBlockCount);
+    [[TSStorageManager sharedManager].newDatabaseConnection readWithBlock:^(YapDatabaseReadTransaction *transaction) {
+        for (NSString *messageId in messageIds) {
+            XCTAssertNotNil([TSOutgoingMessage fetchObjectWithUniqueID:messageId transaction:transaction]);
+        }
+    }];
+
+    // Nothing left to commit.
+    [self.coalescer flushAndWait];
+    XCTAssertEqual(1, self.coalescer.committedTransactionCount);
+}
+
+@end
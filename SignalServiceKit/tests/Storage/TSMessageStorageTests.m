@@ -10,6 +10,7 @@
 #import "TSGroupThread.h"
 
 #import "TSStorageManager.h"
+#import "TSStorageManager+messageIDs.h"
 
 #import "TSIncomingMessage.h"
 #import "TSMessage.h"
@@ -45,6 +46,27 @@
     [super tearDown];
 }
 
+- (void)testMessageIdsAreUniqueAcrossBlocks
+{
+    NSMutableSet<NSString *> *messageIds = [NSMutableSet new];
+    for (NSUInteger transactionIndex = 0; transactionIndex < 5; transactionIndex++) {
+        [[TSStorageManager sharedManager].newDatabaseConnection
+            readWriteWithBlock:^(YapDatabaseReadWriteTransaction *transaction) {
+                for (NSUInteger i = 0; i < 77; i++) {
+                    NSString *messageId = [TSStorageManager getAndIncrementMessageIdWithTransaction:transaction];
+                    XCTAssertFalse([messageIds containsObject:messageId]);
+                    [messageIds addObject:messageId];
+
+                    // The persisted high-water mark must always be past any allocated id.
+                    NSNumber *highWaterMark =
+                        [transaction objectForKey:@"TSMessagesLatestId" inCollection:@"TSStorageParametersCollection"];
+                    XCTAssertGreaterThan(highWaterMark.unsignedLongLongValue, messageId.longLongValue);
+                }
+            }];
+    }
+    XCTAssertEqual(5 * 77, messageIds.count);
+}
+
 - (void)testIncrementalMessageNumbers
 {
     __block NSInteger messageInt;
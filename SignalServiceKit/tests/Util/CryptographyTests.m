@@ -104,6 +104,76 @@ NS_ASSUME_NONNULL_BEGIN
     XCTAssertNil(decryptedData);
 }
 
+- (void)testStreamingAttachmentEncryptionInteroperability
+{
+    // Span several chunks, and end mid-chunk.
+    NSData *plainTextData = [Cryptography generateRandomBytes:200 * 1024 + 7];
+
+    NSData *generatedKey;
+    NSData *generatedDigest;
+    NSError *error;
+    NSOutputStream *encryptedStream = [NSOutputStream outputStreamToMemory];
+    [encryptedStream open];
+    BOOL success = [Cryptography encryptAttachmentStream:[self openInputStreamWithData:plainTextData]
+                                            outputStream:encryptedStream
+                                                  outKey:&generatedKey
+                                               outDigest:&generatedDigest
+                                                   error:&error];
+    XCTAssertTrue(success);
+    XCTAssertNil(error);
+    NSData *cipherText = [encryptedStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+
+    // The streamed ciphertext should be readable by the in-memory decryption.
+    NSData *decryptedData = [Cryptography decryptAttachment:cipherText
+                                                    withKey:generatedKey
+                                                     digest:generatedDigest
+                                               unpaddedSize:(UInt32)plainTextData.length
+                                                      error:&error];
+    XCTAssertEqualObjects(plainTextData, decryptedData);
+
+    // ...and by the streaming decryption.
+    NSOutputStream *decryptedStream = [NSOutputStream outputStreamToMemory];
+    [decryptedStream open];
+    success = [Cryptography decryptAttachmentStream:[self openInputStreamWithData:cipherText]
+                                       outputStream:decryptedStream
+                                            withKey:generatedKey
+                                             digest:generatedDigest
+                                       unpaddedSize:(UInt32)plainTextData.length
+                                              error:&error];
+    XCTAssertTrue(success);
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(plainTextData, [decryptedStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey]);
+}
+
+- (void)testStreamingAttachmentDecryptionWithBadDigest
+{
+    NSData *plainTextData = [Cryptography generateRandomBytes:1024];
+
+    NSData *generatedKey;
+    NSData *generatedDigest;
+    NSData *cipherText =
+        [Cryptography encryptAttachmentData:plainTextData outKey:&generatedKey outDigest:&generatedDigest];
+
+    NSError *error;
+    NSOutputStream *decryptedStream = [NSOutputStream outputStreamToMemory];
+    [decryptedStream open];
+    BOOL success = [Cryptography decryptAttachmentStream:[self openInputStreamWithData:cipherText]
+                                            outputStream:decryptedStream
+                                                 withKey:generatedKey
+                                                  digest:[Cryptography generateRandomBytes:32]
+                                            unpaddedSize:(UInt32)plainTextData.length
+                                                   error:&error];
+    XCTAssertFalse(success);
+    XCTAssertNotNil(error);
+}
+
+- (NSInputStream *)openInputStreamWithData:(NSData *)data
+{
+    NSInputStream *inputStream = [NSInputStream inputStreamWithData:data];
+    [inputStream open];
+    return inputStream;
+}
+
 - (void)testComputeSHA256Digest
 {
     NSString *plainText = @"SGF3YWlpIGlzIEF3ZXNvbWUh";
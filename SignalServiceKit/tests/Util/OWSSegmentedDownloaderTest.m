@@ -0,0 +1,380 @@
+//
+//  Copyright (c) 2018 Open Whisper Systems. All rights reserved.
+//
+
+#import "OWSFileSystem.h"
+#import "OWSSegmentedDownloader.h"
+#import <XCTest/XCTest.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+static const unsigned long long kTestSegmentLength = 1024 * 1024;
+
+// Serves stubContent, honoring single range requests if stubSupportsRanges is set.
+@interface OWSStubRangeURLProtocol : NSURLProtocol
+
++ (void)resetWithContent:(NSData *)content supportsRanges:(BOOL)supportsRanges;
+
+// Requests for the range starting at this offset fail with the given status code,
+// or with a network error if the status code is zero.
++ (void)failRangeStart:(unsigned long long)rangeStart statusCode:(NSInteger)statusCode;
+
+// Requests for ranges starting at zero are answered with this Content-Range.
++ (void)setProbeContentRange:(nullable NSString *)contentRange;
+
++ (NSArray<NSString *> *)requestedRanges;
++ (NSUInteger)maxConcurrentRequestCount;
+
+@end
+
+#pragma mark -
+
+@implementation OWSStubRangeURLProtocol
+
+static NSData *stubContent;
+static BOOL stubSupportsRanges;
+static NSNumber *_Nullable stubFailingRangeStart;
+static NSInteger stubFailureStatusCode;
+static NSString *_Nullable stubProbeContentRange;
+static NSMutableArray<NSString *> *stubRequestedRanges;
+static NSUInteger stubConcurrentRequestCount;
+static NSUInteger stubMaxConcurrentRequestCount;
+
++ (void)resetWithContent:(NSData *)content supportsRanges:(BOOL)supportsRanges
+{
+    @synchronized(self)
+    {
+        stubContent = content;
+        stubSupportsRanges = supportsRanges;
+        stubFailingRangeStart = nil;
+        stubFailureStatusCode = 0;
+        stubProbeContentRange = nil;
+        stubRequestedRanges = [NSMutableArray new];
+        stubConcurrentRequestCount = 0;
+        stubMaxConcurrentRequestCount = 0;
+    }
+}
+
++ (void)failRangeStart:(unsigned long long)rangeStart statusCode:(NSInteger)statusCode
+{
+    @synchronized(self)
+    {
+        stubFailingRangeStart = @(rangeStart);
+        stubFailureStatusCode = statusCode;
+    }
+}
+
++ (void)setProbeContentRange:(nullable NSString *)contentRange
+{
+    @synchronized(self)
+    {
+        stubProbeContentRange = contentRange;
+    }
+}
+
++ (NSArray<NSString *> *)requestedRanges
+{
+    @synchronized(self)
+    {
+        return [stubRequestedRanges copy];
+    }
+}
+
++ (NSUInteger)maxConcurrentRequestCount
+{
+    @synchronized(self)
+    {
+        return stubMaxConcurrentRequestCount;
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    NSString *_Nullable rangeHeader = [self.request valueForHTTPHeaderField:@"Range"];
+
+    NSData *content;
+    BOOL supportsRanges;
+    NSNumber *_Nullable failingRangeStart;
+    NSInteger failureStatusCode;
+    NSString *_Nullable probeContentRange;
+    @synchronized([self class])
+    {
+        [stubRequestedRanges addObject:rangeHeader ?: @""];
+        stubConcurrentRequestCount++;
+        stubMaxConcurrentRequestCount = MAX(stubMaxConcurrentRequestCount, stubConcurrentRequestCount);
+        content = stubContent;
+        supportsRanges = stubSupportsRanges;
+        failingRangeStart = stubFailingRangeStart;
+        failureStatusCode = stubFailureStatusCode;
+        probeContentRange = stubProbeContentRange;
+    }
+
+    unsigned long long rangeStart = 0;
+    unsigned long long rangeEnd = (unsigned long long)content.length - 1;
+    BOOL isRangeRequest = NO;
+    if (supportsRanges && rangeHeader) {
+        NSScanner *scanner = [NSScanner scannerWithString:rangeHeader];
+        isRangeRequest = ([scanner scanString:@"bytes=" intoString:NULL] && [scanner scanUnsignedLongLong:&rangeStart]
+            && [scanner scanString:@"-" intoString:NULL] && [scanner scanUnsignedLongLong:&rangeEnd]);
+        rangeEnd = MIN(rangeEnd, (unsigned long long)content.length - 1);
+    }
+
+    if (failingRangeStart && failingRangeStart.unsignedLongLongValue == rangeStart) {
+        if (failureStatusCode == 0) {
+            [self.client URLProtocol:self
+                    didFailWithError:[NSError errorWithDomain:NSURLErrorDomain
+                                                         code:NSURLErrorNetworkConnectionLost
+                                                     userInfo:nil]];
+            return;
+        }
+        [self finishWithStatusCode:failureStatusCode headerFields:@{} data:[NSData new] delay:0];
+        return;
+    }
+
+    NSData *data =
+        [content subdataWithRange:NSMakeRange((NSUInteger)rangeStart, (NSUInteger)(rangeEnd - rangeStart + 1))];
+    NSMutableDictionary<NSString *, NSString *> *headerFields =
+        [@{ @"Content-Length" : [NSString stringWithFormat:@"%lu", (unsigned long)data.length] } mutableCopy];
+    if (!isRangeRequest) {
+        [self finishWithStatusCode:200 headerFields:headerFields data:data delay:0];
+        return;
+    }
+    headerFields[@"Content-Range"] = (rangeStart == 0 && probeContentRange)
+        ? probeContentRange
+        : [NSString stringWithFormat:@"bytes %llu-%llu/%lu", rangeStart, rangeEnd, (unsigned long)content.length];
+    // Hold back the first segment so that we can tell whether the others are
+    // requested while it is in flight.
+    [self finishWithStatusCode:206 headerFields:headerFields data:data delay:(rangeStart == 0 ? 0.5 : 0)];
+}
+
+- (void)finishWithStatusCode:(NSInteger)statusCode
+                headerFields:(NSDictionary<NSString *, NSString *> *)headerFields
+                        data:(NSData *)data
+                       delay:(NSTimeInterval)delay
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL
+                                                              statusCode:statusCode
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:headerFields];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopDefaultMode, ^{
+            [self.client URLProtocol:self didLoadData:data];
+            [self.client URLProtocolDidFinishLoading:self];
+        });
+        CFRunLoopWakeUp(runLoop);
+    });
+}
+
+- (void)stopLoading
+{
+    @synchronized([self class])
+    {
+        stubConcurrentRequestCount--;
+    }
+}
+
+@end
+
+#pragma mark -
+
+@interface OWSSegmentedDownloaderTest : XCTestCase
+
+@property (nonatomic) OWSSegmentedDownloader *downloader;
+@property (nonatomic) NSData *content;
+@property (nonatomic) NSString *filePath;
+
+@end
+
+#pragma mark -
+
+@implementation OWSSegmentedDownloaderTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[ [OWSStubRangeURLProtocol class] ];
+    self.downloader =
+        [[OWSSegmentedDownloader alloc] initWithSessionConfiguration:configuration maxConcurrentRequestsPerHost:4];
+
+    // Two and a half segments.
+    NSMutableData *content = [NSMutableData dataWithLength:(NSUInteger)(kTestSegmentLength * 5 / 2)];
+    uint8_t *bytes = content.mutableBytes;
+    for (NSUInteger i = 0; i < content.length; i++) {
+        bytes[i] = (uint8_t)(i % 251);
+    }
+    self.content = content;
+    [OWSStubRangeURLProtocol resetWithContent:content supportsRanges:YES];
+
+    self.filePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+}
+
+- (void)tearDown
+{
+    [OWSFileSystem deleteFileIfExists:self.filePath];
+    [OWSFileSystem deleteFileIfExists:[self resumeFilePath]];
+
+    [super tearDown];
+}
+
+- (NSString *)resumeFilePath
+{
+    return [self.filePath stringByAppendingPathExtension:@"segments"];
+}
+
+- (NSArray<NSString *> *)allRanges
+{
+    return @[ @"bytes=0-1048575", @"bytes=1048576-2097151", @"bytes=2097152-2621439" ];
+}
+
+// Returns the error, or nil if the download succeeded.
+- (nullable NSError *)downloadWithResumeIdentifier:(nullable NSString *)resumeIdentifier
+{
+    __block NSError *_Nullable result;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Download"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/attachment"]];
+    [self.downloader downloadWithRequest:request
+        toFilePath:self.filePath
+        resumeIdentifier:resumeIdentifier
+        maxContentLength:0
+        priority:OWSDownloadPriorityHigh
+        progress:nil
+        success:^(NSString *filePath) {
+            XCTAssertEqualObjects(self.filePath, filePath);
+            [expectation fulfill];
+        }
+        failure:^(NSError *error) {
+            result = error;
+            [expectation fulfill];
+        }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+    return result;
+}
+
+- (void)testRangeSplitting
+{
+    XCTAssertNil([self downloadWithResumeIdentifier:nil]);
+
+    XCTAssertEqualObjects(self.content, [NSData dataWithContentsOfFile:self.filePath]);
+    XCTAssertEqualObjects([NSSet setWithArray:[self allRanges]],
+        [NSSet setWithArray:[OWSStubRangeURLProtocol requestedRanges]]);
+    XCTAssertEqual(3, [OWSStubRangeURLProtocol requestedRanges].count);
+    // The remaining segments should be requested while the probe segment is in flight.
+    XCTAssertGreaterThan([OWSStubRangeURLProtocol maxConcurrentRequestCount], 1);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self resumeFilePath]]);
+}
+
+- (void)testServerWithoutRangeSupport
+{
+    [OWSStubRangeURLProtocol resetWithContent:self.content supportsRanges:NO];
+
+    XCTAssertNil([self downloadWithResumeIdentifier:nil]);
+
+    XCTAssertEqualObjects(self.content, [NSData dataWithContentsOfFile:self.filePath]);
+    XCTAssertEqual(1, [OWSStubRangeURLProtocol requestedRanges].count);
+}
+
+- (void)testResumeAfterNetworkFailure
+{
+    [OWSStubRangeURLProtocol failRangeStart:2 * kTestSegmentLength statusCode:0];
+
+    NSError *_Nullable error = [self downloadWithResumeIdentifier:@"1234"];
+    XCTAssertEqualObjects(NSURLErrorDomain, error.domain);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:self.filePath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[self resumeFilePath]]);
+
+    [OWSStubRangeURLProtocol resetWithContent:self.content supportsRanges:YES];
+    XCTAssertNil([self downloadWithResumeIdentifier:@"1234"]);
+
+    XCTAssertEqualObjects(self.content, [NSData dataWithContentsOfFile:self.filePath]);
+    // Only the missing segment should be requested.
+    XCTAssertEqualObjects(@[ [self allRanges].lastObject ], [OWSStubRangeURLProtocol requestedRanges]);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self resumeFilePath]]);
+}
+
+- (void)testResumeWithDifferentIdentifierStartsOver
+{
+    [OWSStubRangeURLProtocol failRangeStart:2 * kTestSegmentLength statusCode:0];
+    XCTAssertNotNil([self downloadWithResumeIdentifier:@"1234"]);
+
+    [OWSStubRangeURLProtocol resetWithContent:self.content supportsRanges:YES];
+    XCTAssertNil([self downloadWithResumeIdentifier:@"5678"]);
+
+    XCTAssertEqualObjects(self.content, [NSData dataWithContentsOfFile:self.filePath]);
+    XCTAssertEqual(3, [OWSStubRangeURLProtocol requestedRanges].count);
+}
+
+- (void)testInvalidStatusCodeDiscardsPartialDownload
+{
+    [OWSStubRangeURLProtocol failRangeStart:2 * kTestSegmentLength statusCode:404];
+
+    NSError *_Nullable error = [self downloadWithResumeIdentifier:@"1234"];
+    XCTAssertNotNil(error);
+    XCTAssertNotEqualObjects(NSURLErrorDomain, error.domain);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.filePath]);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self resumeFilePath]]);
+}
+
+- (void)testInvalidContentRangeDiscardsPartialDownload
+{
+    [OWSStubRangeURLProtocol setProbeContentRange:@"bytes 0-1048575/*"];
+
+    XCTAssertNotNil([self downloadWithResumeIdentifier:@"1234"]);
+    XCTAssertEqual(1, [OWSStubRangeURLProtocol requestedRanges].count);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.filePath]);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self resumeFilePath]]);
+}
+
+- (void)testConcurrentDownloadOfSameFileIsRejected
+{
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://example.com/attachment"]];
+    XCTestExpectation *firstExpectation = [self expectationWithDescription:@"First download"];
+    XCTestExpectation *secondExpectation = [self expectationWithDescription:@"Second download"];
+    [self.downloader downloadWithRequest:request
+        toFilePath:self.filePath
+        resumeIdentifier:@"1234"
+        maxContentLength:0
+        priority:OWSDownloadPriorityHigh
+        progress:nil
+        success:^(NSString *filePath) {
+            [firstExpectation fulfill];
+        }
+        failure:^(NSError *error) {
+            XCTFail(@"Unexpected failure: %@", error);
+            [firstExpectation fulfill];
+        }];
+    [self.downloader downloadWithRequest:request
+        toFilePath:self.filePath
+        resumeIdentifier:@"1234"
+        maxContentLength:0
+        priority:OWSDownloadPriorityHigh
+        progress:nil
+        success:^(NSString *filePath) {
+            XCTFail(@"Unexpected success.");
+            [secondExpectation fulfill];
+        }
+        failure:^(NSError *error) {
+            [secondExpectation fulfill];
+        }];
+    [self waitForExpectationsWithTimeout:10.0 handler:nil];
+
+    XCTAssertEqualObjects(self.content, [NSData dataWithContentsOfFile:self.filePath]);
+    XCTAssertEqual(3, [OWSStubRangeURLProtocol requestedRanges].count);
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -253,6 +253,11 @@ public class ShareViewController: UINavigationController, ShareViewDelegate, SAE
         }
 
         // We don't use the AppUpdateNag in the SAE.
+
+        // Wait for the first screen to render.
+        DispatchQueue.main.async {
+            OWSStorage.runDeferredRegistrations()
+        }
     }
 
     func startupLogging() {